@@ -45,14 +45,14 @@ App::App(const std::vector<std::string>& args) : mPresentQueue(nullptr) {
 	CreateSwapchain();
 }
 App::~App() {
-	(*mDevice)->waitIdle();
+	mDevice->WaitIdle();
 	Gui::Destroy();
 }
 
 bool App::CreateSwapchain() {
 	ProfilerScope p("App::CreateSwapchain");
 
-	(*mDevice)->waitIdle();
+	mDevice->WaitIdle();
 	if (!mSwapchain->Create())
 		return false;
 
@@ -108,7 +108,7 @@ void App::Update() {
 			ImGui::Unindent();
 		}
 		if (ImGui::SliderFloat("Render Scale", &mRenderScale, 0.125f, 1.5f))
-			(*mDevice)->waitIdle();
+			mDevice->WaitIdle();
 	}
 	ImGui::End();
 
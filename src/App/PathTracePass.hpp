@@ -1,12 +1,14 @@
 #pragma once
 
 #include "VisibilityPass.hpp"
+#include "HashGrid.hpp"
 
 namespace ptvk {
 
 class PathTracePass {
 private:
 	ComputePipelineCache mSampleCameraPathsPipeline;
+	ComputePipelineCache mBuildLightGridPipeline;
 
 	bool mAlphaTest = true;
 	bool mShadingNormals = true;
@@ -18,6 +20,13 @@ private:
 	uint32_t mMaxBounces = 4;
 	uint32_t mAccumulationStart = 0;
 
+	// per-cell light reservoirs for next event estimation, resampled each frame from primary vertices.
+	// Only the path tracer has it: BPTPass and ReSTIRPTPass need exact light pdfs for their MIS weights and shift mappings
+	bool mUseLightGrid = false;
+	uint32_t mLightGridCandidates = 16;
+	uint32_t mLightGridStride = 4; // one reservoir per stride^2 pixels
+	HashGrid mLightGrid;
+
 public:
 	inline PathTracePass(Device& device) {
 		auto staticSampler = std::make_shared<vk::raii::Sampler>(*device, vk::SamplerCreateInfo({},
@@ -41,6 +50,11 @@ public:
 
 		const std::string shaderFile = *device.mInstance.GetOption("shader-kernel-path") + "/Kernels/PathTracer.slang";
 		mSampleCameraPathsPipeline = ComputePipelineCache(shaderFile, "SampleCameraPaths", "sm_6_7", args, md);
+		mBuildLightGridPipeline    = ComputePipelineCache(shaderFile, "BuildLightGrid"   , "sm_6_7", args, md);
+
+		mLightGrid = HashGrid(device.mInstance);
+		mLightGrid.mElementSize = 32; // sizeof(LightGridReservoir) in PathTracer.slang, a multiple of 16 like the std430 struct stride
+		mLightGrid.mCellPixelRadius = 16;
 	}
 
 	inline void OnInspectorGui() {
@@ -52,6 +66,18 @@ public:
 		ImGui::Checkbox("Force lambertian", &mForceLambertian);
 		ImGui::Checkbox("Sample lights", &mSampleLights);
 		Gui::ScalarField<uint32_t>("Max bounces", &mMaxBounces, 0, 32);
+		if (mSampleLights) {
+			ImGui::Checkbox("Light grid", &mUseLightGrid);
+			if (mUseLightGrid) {
+				ImGui::Indent();
+				Gui::ScalarField<uint32_t>("Candidates", &mLightGridCandidates, 1, 256);
+				Gui::ScalarField<uint32_t>("Pixel stride", &mLightGridStride, 1, 64);
+				Gui::ScalarField<uint32_t>("Cell count", &mLightGrid.mCellCount, 1000, 0xFFFFFF);
+				Gui::ScalarField<float>("Cell size", &mLightGrid.mCellSize, 0.001f, 100, 0.01f);
+				Gui::ScalarField<float>("Cell pixel radius", &mLightGrid.mCellPixelRadius, 0, 100, 0.05f);
+				ImGui::Unindent();
+			}
+		}
 
 		ImGui::PopID();
 	}
@@ -66,6 +92,7 @@ public:
 		if (mShadingNormals)    defs.emplace("gShadingNormals", "true");
 		if (mNormalMaps)        defs.emplace("gNormalMaps", "true");
 		if (mSampleLights)      defs.emplace("SAMPLE_LIGHTS", "true");
+		if (mSampleLights && mUseLightGrid) defs.emplace("LIGHT_GRID", "true");
 		if (mForceLambertian)   defs.emplace("FORCE_LAMBERTIAN", "true");
 		if (!mRussianRoullette) defs.emplace("DISABLE_STOCHASTIC_TERMINATION", "true");
 		if (visibility.HeatmapCounterType() != DebugCounterType::eNumDebugCounters)
@@ -81,6 +108,18 @@ public:
 		params.SetConstant("gOutputSize", extent);
 		params.SetConstant("gRandomSeed", mAccumulationStart++);
 		params.SetConstant("gMaxBounces", mMaxBounces);
+		params.SetConstant("gLightGridCandidates", mLightGridCandidates);
+		params.SetConstant("gLightGridStride", mLightGridStride);
+
+		if (mSampleLights && mUseLightGrid) {
+			ProfilerScope p("Build light grid", &commandBuffer);
+			const uint2 gridExtent = (extent + mLightGridStride - 1u) / mLightGridStride;
+			mLightGrid.mSize = std::max(1u, gridExtent.x * gridExtent.y);
+			mLightGrid.Prepare(commandBuffer, visibility.GetCameraPosition(), visibility.GetVerticalFov(), extent);
+			params.SetParameters("gLightGrid", mLightGrid.mParameters);
+			mBuildLightGridPipeline.Dispatch(commandBuffer, vk::Extent3D{gridExtent.x, gridExtent.y, 1}, params, defs);
+			mLightGrid.Build(commandBuffer);
+		}
 
 		{
 			ProfilerScope p("Sample Paths", &commandBuffer);
@@ -123,7 +123,7 @@ public:
 				Gui::EnumDropdown("Type", mCurrentRenderer, RendererStrings);
 				if (mCurrentRenderer != type) {
 					if (!CallRendererFn([](const auto& r) -> bool { return (bool)r; })) {
-						mDevice->waitIdle();
+						mDevice.WaitIdle();
 						CreateRenderer();
 					}
 				}
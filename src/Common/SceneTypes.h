@@ -4,6 +4,7 @@
 
 #define INVALID_INSTANCE 0xFFFF
 #define INVALID_PRIMITIVE 0xFFFF
+#define INVALID_TABLE_OFFSET 0xFFFFFFFF
 
 #define BVH_FLAG_NONE 0
 #define BVH_FLAG_TRIANGLES BIT(0)
@@ -82,10 +83,40 @@ struct VolumeInfo {
 	uint pad;
 };
 
+// Alias table entry: bin i is chosen with probability mThreshold, and mAlias otherwise (see SampleAliasTable)
+struct AliasTableEntry {
+	float mThreshold;
+	uint mAlias;
+	float mPdf;      // probability of i
+	float mAliasPdf; // probability of mAlias
+};
+
+#define LIGHT_BVH_LEAF BIT(31)
+
+// Light BVH node (see Scene/LightBvh.hpp). Nodes are stored depth first, so an interior node's first child follows it
+struct LightBvhNode {
+	float3 mMin;
+	uint mChild; // interior nodes: index of the second child. leaves: LIGHT_BVH_LEAF | light BVH primitive index
+	float3 mMax;
+	uint mParent;
+	float3 mAxis; // normal cone axis. cones are two-sided, emission faces the shading normal which is unknown on the host
+	float mCosThetaO; // cone half angle, -1 for all directions
+	float mPower;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+};
+
+// Storage format of a mesh vertex attribute
+enum class VertexAttributeFormat {
+	eFloat,     // float3 positions and normals, float2 texcoords
+	eQuantized  // R16G16B16A16_SNORM positions (dequantized by the instance transform), octahedral R16G16_SNORM normals, R16G16_SFLOAT texcoords
+};
+
 struct MeshVertexInfo {
 	uint2 mPackedBufferIndices;
 	uint mPackedStrides;
-	uint pad;
+	uint mPackedFormats;
 	uint4 mPackedOffsets;
 
 	inline uint GetIndexBuffer()    CPP_CONST { return BF_GET(mPackedBufferIndices[0],  0, 16); }
@@ -104,11 +135,20 @@ struct MeshVertexInfo {
 	inline uint GetTexcoordOffset() CPP_CONST { return mPackedOffsets[3]; };
 	inline uint GetTexcoordStride() CPP_CONST { return BF_GET(mPackedStrides, 24, 8); }
 
+	inline VertexAttributeFormat GetPositionFormat() CPP_CONST { return (VertexAttributeFormat)BF_GET(mPackedFormats, 0, 4); }
+	inline VertexAttributeFormat GetNormalFormat()   CPP_CONST { return (VertexAttributeFormat)BF_GET(mPackedFormats, 4, 4); }
+	inline VertexAttributeFormat GetTexcoordFormat() CPP_CONST { return (VertexAttributeFormat)BF_GET(mPackedFormats, 8, 4); }
+
 	SLANG_CTOR(MeshVertexInfo)(
 		const uint indexBuffer   , const uint indexOffset   , const uint indexStride,
-		const uint positionBuffer, const uint positionOffset, const uint positionStride,
-		const uint normalBuffer  , const uint normalOffset  , const uint normalStride,
-		const uint texcoordBuffer, const uint texcoordOffset, const uint texcoordStride) {
+		const uint positionBuffer, const uint positionOffset, const uint positionStride, const VertexAttributeFormat positionFormat,
+		const uint normalBuffer  , const uint normalOffset  , const uint normalStride  , const VertexAttributeFormat normalFormat,
+		const uint texcoordBuffer, const uint texcoordOffset, const uint texcoordStride, const VertexAttributeFormat texcoordFormat) {
+		mPackedFormats = 0;
+		BF_SET(mPackedFormats, (uint)positionFormat, 0, 4);
+		BF_SET(mPackedFormats, (uint)normalFormat,   4, 4);
+		BF_SET(mPackedFormats, (uint)texcoordFormat, 8, 4);
+
 		BF_SET(mPackedBufferIndices[0], indexBuffer, 0, 16);
 		mPackedOffsets[0] = indexOffset;
 		BF_SET(mPackedStrides, indexStride, 0, 8);
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <mutex>
+#include <span>
+
+#include "Image.hpp"
+#include "Hash.hpp"
+
+namespace ptvk {
+
+class Mesh;
+
+// Device-wide table of uploaded buffers, images and meshes keyed by a hash of their contents, so that assets shared between files
+// (or a file loaded twice) occupy GPU memory, BLASs and descriptor slots once.
+// Meshes are shared individually, so a prop which appears in several files is reused even when the rest of each file differs.
+// Entries are weak: a resource leaves the registry once nothing references it.
+// Resources are published only once the upload writing them has been submitted, along with the UploadQueue value it signals,
+// so that a load which reuses them can wait for that value rather than for a resource another thread is still recording.
+class AssetRegistry {
+public:
+	struct Stats {
+		size_t mBufferHits = 0;
+		size_t mImageHits = 0;
+		size_t mMeshHits = 0;
+		size_t mBytesSaved = 0; // bytes that would have been uploaded again without the registry
+	};
+
+	// Resources a command buffer uploaded and resources it reused, collected while recording (see CommandBuffer::UploadShared)
+	struct Pending {
+		std::vector<std::tuple<size_t, std::shared_ptr<Buffer>, size_t /* bytes */>> mBuffers;
+		std::vector<std::tuple<size_t, std::shared_ptr<Image>,  size_t /* bytes */>> mImages;
+		std::vector<std::tuple<size_t, std::shared_ptr<Mesh>,   size_t /* bytes */>> mMeshes;
+		uint64_t mDependency = 0; // largest upload value of the reused resources
+		size_t mHits = 0;
+		size_t mBytesSaved = 0;
+	};
+
+	inline static size_t HashContents(const std::span<const std::byte> data) {
+		return std::hash<std::string_view>()(std::string_view(reinterpret_cast<const char*>(data.data()), data.size()));
+	}
+
+	inline std::shared_ptr<Buffer> FindBuffer(const size_t key, Pending& pending) { return Find(mBuffers, key, pending); }
+	inline std::shared_ptr<Image>  FindImage (const size_t key, Pending& pending) { return Find(mImages,  key, pending); }
+	inline std::shared_ptr<Mesh>   FindMesh  (const size_t key, Pending& pending) { return Find(mMeshes,  key, pending); }
+
+	// Makes the resources in pending visible to other loads. uploadValue is the UploadQueue value which completes their uploads, or 0 if they are already complete
+	inline void Publish(const Pending& pending, const uint64_t uploadValue) {
+		std::scoped_lock lock(mMutex);
+		for (const auto&[key, buffer, bytes] : pending.mBuffers)
+			mBuffers[key] = Entry<Buffer>{ buffer, uploadValue, bytes };
+		for (const auto&[key, image, bytes] : pending.mImages)
+			mImages[key] = Entry<Image>{ image, uploadValue, bytes };
+		for (const auto&[key, mesh, bytes] : pending.mMeshes)
+			mMeshes[key] = Entry<Mesh>{ mesh, uploadValue, bytes };
+	}
+
+	inline Stats GetStats() {
+		std::scoped_lock lock(mMutex);
+		return mStats;
+	}
+
+	// Number of registered resources which are still alive, and their total size
+	inline std::tuple<size_t, size_t, size_t, size_t> GetResidentCounts() {
+		std::scoped_lock lock(mMutex);
+		size_t buffers = 0, bufferBytes = 0, images = 0, imageBytes = 0;
+		for (const auto&[key, e] : mBuffers) if (!e.mResource.expired()) { buffers++; bufferBytes += e.mBytes; }
+		for (const auto&[key, e] : mImages)  if (!e.mResource.expired()) { images++;  imageBytes  += e.mBytes; }
+		return { buffers, bufferBytes, images, imageBytes };
+	}
+
+private:
+	template<typename T>
+	struct Entry {
+		std::weak_ptr<T> mResource;
+		uint64_t mUploadValue = 0;
+		size_t mBytes = 0;
+	};
+
+	std::mutex mMutex;
+	std::unordered_map<size_t, Entry<Buffer>> mBuffers;
+	std::unordered_map<size_t, Entry<Image>> mImages;
+	std::unordered_map<size_t, Entry<Mesh>> mMeshes;
+	Stats mStats;
+
+	template<typename T>
+	inline std::shared_ptr<T> Find(std::unordered_map<size_t, Entry<T>>& entries, const size_t key, Pending& pending) {
+		std::scoped_lock lock(mMutex);
+		auto it = entries.find(key);
+		if (it == entries.end()) return nullptr;
+		std::shared_ptr<T> resource = it->second.mResource.lock();
+		if (!resource) {
+			entries.erase(it);
+			return nullptr;
+		}
+		pending.mDependency = std::max(pending.mDependency, it->second.mUploadValue);
+		pending.mHits++;
+		pending.mBytesSaved += it->second.mBytes;
+		if constexpr (std::is_same_v<T, Buffer>)
+			mStats.mBufferHits++;
+		else if constexpr (std::is_same_v<T, Image>)
+			mStats.mImageHits++;
+		else
+			mStats.mMeshHits++;
+		mStats.mBytesSaved += it->second.mBytes;
+		return resource;
+	}
+};
+
+}
@@ -0,0 +1,271 @@
+#include "BlockCompression.hpp"
+
+#include <Common/Common.h>
+#include <glm/gtc/packing.hpp>
+
+namespace ptvk {
+
+vk::Format GetBlockCompressedFormat(const vk::Format format, const bool normalMap) {
+	switch (format) {
+		default: return vk::Format::eUndefined;
+		case vk::Format::eR8Unorm:       return vk::Format::eBc4UnormBlock;
+		case vk::Format::eR8G8Unorm:     return vk::Format::eBc5UnormBlock;
+		case vk::Format::eR8G8B8Unorm:
+		case vk::Format::eR8G8B8A8Unorm: return normalMap ? vk::Format::eBc5UnormBlock : vk::Format::eBc7UnormBlock;
+		case vk::Format::eR8G8B8Srgb:
+		case vk::Format::eR8G8B8A8Srgb:  return vk::Format::eBc7SrgbBlock;
+		case vk::Format::eR32G32B32Sfloat:
+		case vk::Format::eR32G32B32A32Sfloat: return vk::Format::eBc6HUfloatBlock;
+	}
+}
+
+// Writes bits LSB first, the way BC blocks are laid out
+class BlockWriter {
+public:
+	inline void Write(const uint32_t value, const uint32_t bitCount) {
+		for (uint32_t i = 0; i < bitCount; i++, mBit++)
+			if (value & (1u << i))
+				mBlock[mBit / 64] |= 1ull << (mBit % 64);
+	}
+	inline const std::array<uint64_t, 2>& Get() const { return mBlock; }
+private:
+	std::array<uint64_t, 2> mBlock = { 0, 0 };
+	uint32_t mBit = 0;
+};
+
+// 4 bit index weights shared by BC6H and BC7
+static constexpr std::array<uint32_t, 16> gWeights4 = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Principal axis of the block, found by power iteration on the covariance matrix.
+// Returns the endpoints of the block's extent along it.
+template<typename V>
+inline std::pair<V, V> FitEndpoints(const std::array<V, 16>& px) {
+	V mean(0), mn(std::numeric_limits<float>::infinity()), mx(-std::numeric_limits<float>::infinity());
+	for (const V& p : px) {
+		mean += p;
+		mn = min(mn, p);
+		mx = max(mx, p);
+	}
+	mean /= 16.f;
+
+	V axis = mx - mn;
+	for (uint32_t it = 0; it < 8; it++) {
+		V next(0);
+		for (const V& p : px)
+			next += (p - mean) * dot(p - mean, axis);
+		const float l = glm::length(next);
+		if (l < 1e-6f) break;
+		axis = next / l;
+	}
+	if (dot(axis, axis) < 1e-12f)
+		return { mean, mean };
+
+	float tmin = std::numeric_limits<float>::infinity(), tmax = -std::numeric_limits<float>::infinity();
+	for (const V& p : px) {
+		const float t = dot(p - mean, axis);
+		tmin = std::min(tmin, t);
+		tmax = std::max(tmax, t);
+	}
+	return { mean + axis*tmin, mean + axis*tmax };
+}
+
+// Picks the 4 bit index whose interpolated value is closest to each texel. Returns the total squared error.
+template<typename V>
+inline float FitIndices4(const std::array<V, 16>& px, const V& e0, const V& e1, std::array<uint32_t, 16>& indices) {
+	const V d = e1 - e0;
+	const float dd = dot(d, d);
+	float error = 0;
+	for (uint32_t i = 0; i < 16; i++) {
+		const int guess = dd > 0 ? (int)std::round(dot(px[i] - e0, d) / dd * 15) : 0;
+		float best = std::numeric_limits<float>::infinity();
+		for (int k = std::max(guess - 1, 0); k <= std::min(guess + 1, 15); k++) {
+			const V v = (e0*(float)(64 - gWeights4[k]) + e1*(float)gWeights4[k]) / 64.f;
+			const float err = dot(px[i] - v, px[i] - v);
+			if (err < best) {
+				best = err;
+				indices[i] = k;
+			}
+		}
+		error += best;
+	}
+	return error;
+}
+
+// values in [0,255]
+inline uint64_t EncodeBC4(const std::array<float, 16>& values) {
+	float mn = values[0], mx = values[0];
+	for (const float v : values) {
+		mn = std::min(mn, v);
+		mx = std::max(mx, v);
+	}
+	const uint32_t e0 = (uint32_t)std::round(mx);
+	const uint32_t e1 = (uint32_t)std::round(mn);
+
+	uint64_t block = e0 | (e1 << 8);
+	if (e0 == e1) return block;
+
+	// with e0 > e1, index 0 is e0, 1 is e1 and 2..7 step from e0 towards e1
+	for (uint32_t i = 0; i < 16; i++) {
+		const uint32_t k = (uint32_t)std::clamp(std::round((e0 - values[i]) / (float)(e0 - e1) * 7), 0.f, 7.f);
+		const uint64_t index = k == 0 ? 0 : k == 7 ? 1 : k + 1;
+		block |= index << (16 + 3*i);
+	}
+	return block;
+}
+
+// BC7 mode 6: one subset, 7 bit RGBA endpoints with a unique p-bit each, 4 bit indices. values in [0,255]
+inline std::array<uint64_t, 2> EncodeBC7(const std::array<float4, 16>& px) {
+	const auto[f0, f1] = FitEndpoints(px);
+
+	uint4 bestEndpoints[2];
+	uint32_t bestP[2] = { 0, 0 };
+	std::array<uint32_t, 16> bestIndices;
+	float bestError = std::numeric_limits<float>::infinity();
+	for (uint32_t p = 0; p < 4; p++) {
+		const uint32_t p0 = p & 1, p1 = p >> 1;
+		const uint4 q0 = uint4(clamp(glm::round((f0 - (float)p0) / 2.f), float4(0), float4(127)));
+		const uint4 q1 = uint4(clamp(glm::round((f1 - (float)p1) / 2.f), float4(0), float4(127)));
+
+		std::array<uint32_t, 16> indices;
+		const float error = FitIndices4(px, float4(q0*2u + p0), float4(q1*2u + p1), indices);
+		if (error < bestError) {
+			bestError = error;
+			bestEndpoints[0] = q0;
+			bestEndpoints[1] = q1;
+			bestP[0] = p0;
+			bestP[1] = p1;
+			bestIndices = indices;
+		}
+	}
+
+	// the anchor index only has 3 bits, the weights are symmetric so swapping the endpoints is lossless
+	if (bestIndices[0] >= 8) {
+		std::swap(bestEndpoints[0], bestEndpoints[1]);
+		std::swap(bestP[0], bestP[1]);
+		for (uint32_t& i : bestIndices) i = 15 - i;
+	}
+
+	BlockWriter w;
+	w.Write(1 << 6, 7);
+	for (uint32_t c = 0; c < 4; c++) {
+		w.Write(bestEndpoints[0][c], 7);
+		w.Write(bestEndpoints[1][c], 7);
+	}
+	w.Write(bestP[0], 1);
+	w.Write(bestP[1], 1);
+	for (uint32_t i = 0; i < 16; i++)
+		w.Write(bestIndices[i], i == 0 ? 3 : 4);
+	return w.Get();
+}
+
+// BC6H mode 11: one region, untransformed 10 bit endpoints, 4 bit indices.
+// Fitting happens on half bits scaled by 64/31, where the decoder's interpolation is linear.
+inline std::array<uint64_t, 2> EncodeBC6H(const std::array<float3, 16>& rgb) {
+	std::array<float3, 16> px;
+	for (uint32_t i = 0; i < 16; i++)
+		for (uint32_t c = 0; c < 3; c++) {
+			const float v = std::isnan(rgb[i][c]) ? 0.f : std::clamp(rgb[i][c], 0.f, 65504.f);
+			px[i][c] = glm::packHalf1x16(v) * 64.f / 31.f;
+		}
+
+	const auto[f0, f1] = FitEndpoints(px);
+	const auto Quantize   = [](const float3 u) { return uint3(clamp(glm::round((u - 32.f) / 64.f), float3(0), float3(1023))); };
+	const auto Unquantize = [](const uint3 e) {
+		float3 u;
+		for (uint32_t c = 0; c < 3; c++)
+			u[c] = e[c] == 0 ? 0.f : e[c] == 1023 ? 65535.f : (float)((e[c] << 6) + 32);
+		return u;
+	};
+
+	uint3 e0 = Quantize(f0);
+	uint3 e1 = Quantize(f1);
+	std::array<uint32_t, 16> indices;
+	FitIndices4(px, Unquantize(e0), Unquantize(e1), indices);
+
+	if (indices[0] >= 8) {
+		std::swap(e0, e1);
+		for (uint32_t& i : indices) i = 15 - i;
+	}
+
+	BlockWriter w;
+	w.Write(3, 5);
+	for (uint32_t c = 0; c < 3; c++) w.Write(e0[c], 10);
+	for (uint32_t c = 0; c < 3; c++) w.Write(e1[c], 10);
+	for (uint32_t i = 0; i < 16; i++)
+		w.Write(indices[i], i == 0 ? 3 : 4);
+	return w.Get();
+}
+
+std::vector<std::vector<std::byte>> EncodeBlockCompressed(const std::vector<std::vector<std::byte>>& levels, const vk::Format srcFormat, const vk::Extent3D& extent, const vk::Format dstFormat) {
+	if (dstFormat == vk::Format::eUndefined || extent.depth != 1)
+		throw std::runtime_error("Cannot block compress " + vk::to_string(srcFormat) + " to " + vk::to_string(dstFormat));
+
+	const bool isFloat = srcFormat == vk::Format::eR32G32B32Sfloat || srcFormat == vk::Format::eR32G32B32A32Sfloat;
+	const uint32_t channels = GetChannelCount(srcFormat);
+	const uint32_t texelSize = GetTexelSize(srcFormat);
+	const uint32_t blockSize = dstFormat == vk::Format::eBc4UnormBlock ? 8 : 16;
+
+	std::vector<std::vector<std::byte>> result(levels.size());
+	for (uint32_t level = 0; level < levels.size(); level++) {
+		const uint32_t w = std::max(extent.width  >> level, 1u);
+		const uint32_t h = std::max(extent.height >> level, 1u);
+		const uint32_t bw = (w + 3) / 4;
+		const uint32_t bh = (h + 3) / 4;
+		const std::byte* src = levels[level].data();
+		if (levels[level].size() < (size_t)w*h*texelSize)
+			throw std::runtime_error("Mip level " + std::to_string(level) + " is too small");
+
+		result[level].resize((size_t)bw*bh*blockSize);
+		std::byte* dst = result[level].data();
+
+		// 8 bit components are kept in [0,255], missing channels are opaque
+		const auto Load = [&](uint32_t x, uint32_t y) {
+			x = std::min(x, w - 1);
+			y = std::min(y, h - 1);
+			const std::byte* t = src + ((size_t)y*w + x)*texelSize;
+			float4 v(0, 0, 0, isFloat ? 1 : 255);
+			for (uint32_t c = 0; c < channels; c++)
+				v[c] = isFloat ? reinterpret_cast<const float*>(t)[c] : (float)reinterpret_cast<const uint8_t*>(t)[c];
+			return v;
+		};
+
+		for (uint32_t by = 0; by < bh; by++)
+			for (uint32_t bx = 0; bx < bw; bx++) {
+				std::array<float4, 16> px;
+				for (uint32_t i = 0; i < 16; i++)
+					px[i] = Load(4*bx + i%4, 4*by + i/4);
+
+				std::byte* block = dst + ((size_t)by*bw + bx)*blockSize;
+				switch (dstFormat) {
+					default:
+						throw std::runtime_error("No encoder for " + vk::to_string(dstFormat));
+					case vk::Format::eBc4UnormBlock:
+					case vk::Format::eBc5UnormBlock: {
+						for (uint32_t c = 0; c < blockSize/8; c++) {
+							std::array<float, 16> values;
+							for (uint32_t i = 0; i < 16; i++) values[i] = px[i][c];
+							const uint64_t b = EncodeBC4(values);
+							std::memcpy(block + 8*c, &b, sizeof(b));
+						}
+						break;
+					}
+					case vk::Format::eBc7UnormBlock:
+					case vk::Format::eBc7SrgbBlock: {
+						const auto b = EncodeBC7(px);
+						std::memcpy(block, b.data(), sizeof(b));
+						break;
+					}
+					case vk::Format::eBc6HUfloatBlock: {
+						std::array<float3, 16> rgb;
+						for (uint32_t i = 0; i < 16; i++) rgb[i] = float3(px[i]);
+						const auto b = EncodeBC6H(rgb);
+						std::memcpy(block, b.data(), sizeof(b));
+						break;
+					}
+				}
+			}
+	}
+	return result;
+}
+
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "Utils.hpp"
+
+namespace ptvk {
+
+// Bump whenever encoder output changes, so that cached textures are re-encoded
+static constexpr uint32_t gBlockCompressionVersion = 1;
+
+// Returns the block compressed format pixels of format are encoded to, or vk::Format::eUndefined if there is no encoder for it.
+// 8 bit color uses BC7, one and two channel images BC4/BC5, and float images BC6H.
+// Normal maps are stored as BC5 (the two channel bump map path), the z component is reconstructed when shading.
+vk::Format GetBlockCompressedFormat(const vk::Format format, const bool normalMap = false);
+
+// Encodes each level of a mip chain (as returned by GenerateMipChain) to dstFormat, which must come from GetBlockCompressedFormat(srcFormat).
+// Edge blocks of levels which are not a multiple of 4 texels replicate the last row/column.
+std::vector<std::vector<std::byte>> EncodeBlockCompressed(const std::vector<std::vector<std::byte>>& levels, const vk::Format srcFormat, const vk::Extent3D& extent, const vk::Format dstFormat);
+
+}
@@ -156,6 +156,11 @@ public:
 	inline void* data() const { return mAllocationInfo.pMappedData; }
 	inline vk::DeviceSize size() const { return mSize; }
 
+	// Makes host writes to mapped memory available, a no-op for host-coherent memory
+	inline void Flush(const vk::DeviceSize offset = 0, const vk::DeviceSize size = VK_WHOLE_SIZE) {
+		vmaFlushAllocation(mDevice.GetAllocator(), mAllocation, offset, size);
+	}
+
 private:
 	vk::Buffer mBuffer;
 	std::string mName;
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <functional>
+#include <map>
+#include <numeric>
 #include <variant>
 
+#include "AssetRegistry.hpp"
 #include "Image.hpp"
 #include "Pipeline.hpp"
+#include "StagingRing.hpp"
 
 namespace ptvk {
 
@@ -17,6 +22,9 @@ public:
 		mCommandBuffer = std::move(commandBuffers[0]);
 		device.SetDebugName(*mCommandBuffer, name);
 	}
+	inline ~CommandBuffer() {
+		ReleaseStaging();
+	}
 
 	inline       vk::raii::CommandBuffer& operator*()        { return mCommandBuffer; }
 	inline const vk::raii::CommandBuffer& operator*() const  { return mCommandBuffer; }
@@ -25,29 +33,77 @@ public:
 
 	inline const std::shared_ptr<vk::raii::Fence>& GetCompletionFence() const { return mFence; }
 	inline uint32_t GetQueueFamily() const { return mQueueFamily; }
+	// Blits (e.g. GenerateMipMaps) require a graphics queue
+	inline bool SupportsBlit() const { return (bool)(mDevice.GetQueueFamilyFlags(mQueueFamily) & vk::QueueFlagBits::eGraphics); }
 
 	inline void Reset() {
+		ReleaseStaging();
 		mHeldResources.clear();
 		mCommandBuffer.reset();
 		mCommandBuffer.begin(vk::CommandBufferBeginInfo());
 	}
 
+	// Makes the next submission wait for a timeline semaphore to reach value
+	inline void WaitSemaphore(const vk::Semaphore semaphore, const uint64_t value, const vk::PipelineStageFlags stage) {
+		mTimelineWaits.emplace_back(semaphore, value, stage);
+	}
+
 	inline void Submit(
 		const vk::Queue queue,
 		const vk::ArrayProxy<const vk::Semaphore>& waitSemaphores = {},
 		const vk::ArrayProxy<const vk::PipelineStageFlags>& waitStages = {},
 		const vk::ArrayProxy<const vk::Semaphore>& signalSemaphores = {}) {
 
-		FlushBarriers();
-
-		mCommandBuffer.end();
+		End();
 
-		if (!mFence)
+		if (!mFence || mSharedFence)
 			mFence = std::make_shared<vk::raii::Fence>(*mDevice, vk::FenceCreateInfo());
 		else
 			mDevice->resetFences(**mFence);
+		mSharedFence = false;
+
+		std::scoped_lock l(mDevice.GetQueueMutex(queue));
+		if (mTimelineWaits.empty())
+			queue.submit(vk::SubmitInfo(waitSemaphores, waitStages, *mCommandBuffer, signalSemaphores), **mFence);
+		else {
+			// binary semaphores ignore their values, but every semaphore needs one once a timeline semaphore is waited on
+			std::vector<vk::Semaphore> semaphores(waitSemaphores.begin(), waitSemaphores.end());
+			std::vector<vk::PipelineStageFlags> stages(waitStages.begin(), waitStages.end());
+			std::vector<uint64_t> values(semaphores.size(), 0);
+			for (const auto&[semaphore, value, stage] : mTimelineWaits) {
+				semaphores.emplace_back(semaphore);
+				stages.emplace_back(stage);
+				values.emplace_back(value);
+			}
+			const std::vector<uint64_t> signalValues(signalSemaphores.size(), 0);
+			vk::TimelineSemaphoreSubmitInfo timelineInfo(values, signalValues);
+			queue.submit(vk::SubmitInfo(semaphores, stages, *mCommandBuffer, signalSemaphores, &timelineInfo), **mFence);
+			mTimelineWaits.clear();
+		}
+
+		if (!mStagingAllocations.empty())
+			mDevice.GetStagingRing().SetFence(mStagingAllocations, mFence);
+	}
+
+	// Ends recording, for command buffers which are submitted in a batch rather than by Submit.
+	// The batch's fence must then be passed to SetCompletionFence.
+	inline void End() {
+		FlushBarriers();
+		mCommandBuffer.end();
+	}
+	inline void SetCompletionFence(const std::shared_ptr<vk::raii::Fence>& fence) {
+		mFence = fence;
+		mSharedFence = true;
+		if (!mStagingAllocations.empty())
+			mDevice.GetStagingRing().SetFence(mStagingAllocations, mFence);
+	}
 
-		queue.submit(vk::SubmitInfo(waitSemaphores, waitStages, *mCommandBuffer, signalSemaphores), **mFence);
+	// Submits, waits for the commands to finish and begins recording again
+	inline void SubmitAndWait(const vk::Queue queue) {
+		Submit(queue);
+		if (mDevice->waitForFences(**mFence, true, std::numeric_limits<uint64_t>::max()) != vk::Result::eSuccess)
+			throw std::runtime_error("waitForFences failed");
+		Reset();
 	}
 
 	template<typename T>
@@ -76,6 +132,8 @@ public:
 
 	inline void Barrier(const vk::ArrayProxy<const Buffer::View<std::byte>>& buffers, const vk::PipelineStageFlags dstStage, const vk::AccessFlags dstAccess, const uint32_t dstQueue = VK_QUEUE_FAMILY_IGNORED) {
 		for (auto& b : buffers) {
+			if (mTrackOwnership)
+				mTrackedBuffers.emplace(std::make_tuple(b.GetBuffer().get(), b.Offset(), b.SizeBytes()), b);
 			const auto& [ srcStage, srcAccess, srcQueue ] = b.GetState();
 			if (srcAccess != vk::AccessFlagBits::eNone && dstAccess != vk::AccessFlagBits::eNone && ((srcAccess & gWriteAccesses) || (dstAccess & gWriteAccesses)))
 				mBarrierQueue[std::make_pair(srcStage, dstStage)].first.emplace_back(
@@ -90,6 +148,8 @@ public:
 		const auto& [ newLayout, newStage, dstAccessMask, dstQueueFamilyIndex ] = newState;
 
 		for (const auto& img : imgs) {
+			if (mTrackOwnership)
+				mTrackedImages.emplace(img.get(), img);
 			const uint32_t maxLayer = std::min(img->GetLayers(), subresource.baseArrayLayer + subresource.layerCount);
 			const uint32_t maxLevel = std::min(img->GetLevels(), subresource.baseMipLevel   + subresource.levelCount);
 			for (uint32_t arrayLayer = subresource.baseArrayLayer; arrayLayer < maxLayer; arrayLayer++) {
@@ -137,6 +197,93 @@ public:
 
 	#pragma endregion
 
+	#pragma region Queue family ownership
+
+	// Barriers which hand the resources written on one queue family to another. See ReleaseOwnership
+	struct OwnershipTransfer {
+		uint32_t mSrcFamily = VK_QUEUE_FAMILY_IGNORED;
+		uint32_t mDstFamily = VK_QUEUE_FAMILY_IGNORED;
+		std::vector<std::pair<std::shared_ptr<Buffer>, vk::BufferMemoryBarrier>> mBuffers;
+		std::vector<std::pair<std::shared_ptr<Image>, vk::ImageMemoryBarrier>> mImages;
+
+		inline bool empty() const { return mBuffers.empty() && mImages.empty(); }
+	};
+
+	// Remembers every resource passed to Barrier from now on (including across Reset), so that ReleaseOwnership can transfer them
+	inline void TrackOwnership() { mTrackOwnership = true; }
+
+	// Records release barriers to dstFamily for every tracked resource with defined contents, and stops tracking.
+	// The returned acquire barriers must be recorded with AcquireOwnership on dstFamily, after this command buffer completes.
+	// Resource states are left as they will be after the acquire.
+	inline OwnershipTransfer ReleaseOwnership(const uint32_t dstFamily) {
+		OwnershipTransfer transfer;
+		transfer.mSrcFamily = mQueueFamily;
+		transfer.mDstFamily = dstFamily;
+
+		// the acquire makes the writes visible to everything. subsequent barriers on dstFamily treat it as a write
+		const vk::AccessFlags acquireAccess = vk::AccessFlagBits::eMemoryRead|vk::AccessFlagBits::eMemoryWrite;
+
+		if (dstFamily != mQueueFamily) {
+			std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+			std::vector<vk::ImageMemoryBarrier> imageBarriers;
+
+			for (const auto&[key, b] : mTrackedBuffers) {
+				const auto&[stage, access, queue] = b.GetState();
+				if (access == vk::AccessFlagBits::eNone) continue;
+				const vk::BufferMemoryBarrier barrier(access & gWriteAccesses, vk::AccessFlagBits::eNone, mQueueFamily, dstFamily, **b.GetBuffer(), b.Offset(), b.SizeBytes());
+				bufferBarriers.emplace_back(barrier);
+				transfer.mBuffers.emplace_back(b.GetBuffer(), vk::BufferMemoryBarrier(vk::AccessFlagBits::eNone, acquireAccess, mQueueFamily, dstFamily, **b.GetBuffer(), b.Offset(), b.SizeBytes()));
+				b.SetState(vk::PipelineStageFlagBits::eAllCommands, acquireAccess);
+			}
+
+			for (const auto&[ptr, img] : mTrackedImages) {
+				for (uint32_t layer = 0; layer < img->GetLayers(); layer++) {
+					for (uint32_t level = 0; level < img->GetLevels(); level++) {
+						const auto[layout, stage, access, queue] = img->GetSubresourceState(layer, level);
+						// undefined contents need not be preserved
+						if (layout == vk::ImageLayout::eUndefined) continue;
+						const vk::ImageSubresourceRange range(IsDepthStencil(img->GetFormat()) ? vk::ImageAspectFlagBits::eDepth : vk::ImageAspectFlagBits::eColor, level, 1, layer, 1);
+						imageBarriers.emplace_back(access & gWriteAccesses, vk::AccessFlagBits::eNone, layout, layout, mQueueFamily, dstFamily, **img, range);
+						transfer.mImages.emplace_back(img, vk::ImageMemoryBarrier(vk::AccessFlagBits::eNone, acquireAccess, layout, layout, mQueueFamily, dstFamily, **img, range));
+						img->SetSubresourceState(range, { layout, vk::PipelineStageFlagBits::eAllCommands, acquireAccess, VK_QUEUE_FAMILY_IGNORED });
+					}
+				}
+			}
+
+			if (!bufferBarriers.empty() || !imageBarriers.empty()) {
+				FlushBarriers();
+				mCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, bufferBarriers, imageBarriers);
+			}
+		}
+
+		mTrackOwnership = false;
+		mTrackedBuffers.clear();
+		mTrackedImages.clear();
+		return transfer;
+	}
+
+	// Records the acquire half of an ownership transfer. The command buffer which released the resources must complete first
+	inline void AcquireOwnership(const OwnershipTransfer& transfer) {
+		if (transfer.empty()) return;
+		if (transfer.mDstFamily != mQueueFamily)
+			throw std::runtime_error("Ownership acquired on the wrong queue family");
+
+		std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+		std::vector<vk::ImageMemoryBarrier> imageBarriers;
+		for (const auto&[buffer, barrier] : transfer.mBuffers) {
+			bufferBarriers.emplace_back(barrier);
+			HoldResource(buffer);
+		}
+		for (const auto&[img, barrier] : transfer.mImages) {
+			imageBarriers.emplace_back(barrier);
+			HoldResource(img);
+		}
+		FlushBarriers();
+		mCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eAllCommands, {}, {}, bufferBarriers, imageBarriers);
+	}
+
+	#pragma endregion
+
 	#pragma region Buffer manipulation
 
 	inline void Fill(const Buffer::View<std::byte>& buffer, const uint32_t data, const vk::DeviceSize offset = 0, const vk::DeviceSize size = VK_WHOLE_SIZE) {
@@ -162,7 +309,12 @@ public:
 	}
 	inline void Copy(const Buffer::View<std::byte>& src, const std::shared_ptr<Image>& dst, const vk::ArrayProxy<const vk::BufferImageCopy>& copies) {
 		Barrier(src, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead);
-		Barrier(dst, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1), vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
+		uint32_t minLevel = dst->GetLevels(), maxLevel = 0;
+		for (const vk::BufferImageCopy& c : copies) {
+			minLevel = std::min(minLevel, c.imageSubresource.mipLevel);
+			maxLevel = std::max(maxLevel, c.imageSubresource.mipLevel);
+		}
+		Barrier(dst, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, minLevel, maxLevel + 1 - minLevel, 0, 1), vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
 		FlushBarriers();
 		mCommandBuffer.copyBufferToImage(**src.GetBuffer(), **dst, vk::ImageLayout::eTransferDstOptimal, copies);
 	}
@@ -173,6 +325,72 @@ public:
 		mCommandBuffer.copyImageToBuffer(**src, vk::ImageLayout::eTransferSrcOptimal, **dst.GetBuffer(), copies);
 	}
 
+	// Host-visible memory which lives until this command buffer is reset. Sub-allocated from the device's staging ring when possible
+	inline Buffer::View<std::byte> AllocateStaging(const vk::DeviceSize size, const std::string& name, const vk::DeviceSize alignment = 16) {
+		uint64_t id;
+		if (Buffer::View<std::byte> view = mDevice.GetStagingRing().Allocate(size, alignment, id)) {
+			// ids are increasing, so the list stays sorted
+			mStagingAllocations.emplace_back(id);
+			return view;
+		}
+		auto tmp = std::make_shared<Buffer>(
+			mDevice,
+			name + "/Staging",
+			size,
+			vk::BufferUsageFlagBits::eTransferSrc,
+			vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent,
+			VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+		HoldResource(tmp);
+		return tmp;
+	}
+
+	// Copies out of memory from AllocateStaging. Host writes are made visible by the submission, so src needs no barrier.
+	// The staging ring is shared between threads, so its state is never tracked.
+	inline void CopyFromStaging(const Buffer::View<std::byte>& src, const Buffer::View<std::byte>& dst) {
+		if (dst.SizeBytes() < src.SizeBytes())
+			throw std::runtime_error("dst buffer smaller than src buffer");
+		Barrier(dst, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
+		FlushBarriers();
+		mCommandBuffer.copyBuffer(**src.GetBuffer(), **dst.GetBuffer(), vk::BufferCopy(src.Offset(), dst.Offset(), src.SizeBytes()));
+	}
+
+	// Uploads a full mip chain (one tightly packed vector per level, as from GenerateMipChain) with a single copy
+	inline void Upload(const std::vector<std::vector<std::byte>>& levels, const std::shared_ptr<Image>& dst) {
+		// buffer offsets must be a multiple of the texel block size, and of 4
+		const vk::DeviceSize alignment = std::lcm<vk::DeviceSize>(4, GetTexelBlockSize(dst->GetFormat()));
+		std::vector<vk::BufferImageCopy> copies(levels.size());
+		vk::DeviceSize totalSize = 0;
+		for (uint32_t level = 0; level < levels.size(); level++) {
+			totalSize = (totalSize + alignment - 1) / alignment * alignment;
+			copies[level] = vk::BufferImageCopy(totalSize, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1), { 0, 0, 0 }, dst->GetExtent(level));
+			totalSize += levels[level].size();
+		}
+
+		const Buffer::View<std::byte> tmp = AllocateStaging(totalSize, dst->GetName(), alignment);
+		for (uint32_t level = 0; level < levels.size(); level++) {
+			std::ranges::copy(levels[level], tmp.begin() + copies[level].bufferOffset);
+			copies[level].bufferOffset += tmp.Offset();
+		}
+
+		Barrier(dst, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, (uint32_t)levels.size(), 0, 1), vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
+		FlushBarriers();
+		mCommandBuffer.copyBufferToImage(**tmp.GetBuffer(), **dst, vk::ImageLayout::eTransferDstOptimal, copies);
+	}
+
+	// Device-local buffer which the host can write into directly, when the device has such memory and size is within Device::GetMaxDirectUploadSize.
+	// Returns null otherwise, or when that heap is out of budget.
+	inline std::shared_ptr<Buffer> CreateDirectUploadBuffer(const vk::DeviceSize size, const std::string& name, const vk::BufferUsageFlags usage, const VmaAllocationCreateFlags flags = 0) {
+		// decided up front, so that callers falling back to staging never pay for a second allocation
+		if (size == 0 || size > mDevice.GetMaxDirectUploadSize() || !mDevice.HasDirectUploadBudget(size)) return nullptr;
+		try {
+			return std::make_shared<Buffer>(mDevice, name, size, usage|vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal|vk::MemoryPropertyFlagBits::eHostVisible,
+				flags | VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+		} catch (vk::OutOfDeviceMemoryError&) {
+			// the budget is an estimate without VK_EXT_memory_budget
+			return nullptr;
+		}
+	}
+
 	template<typename T>
 	inline std::shared_ptr<Buffer> Upload(const vk::ArrayProxy<const T>& data, const std::string name, vk::BufferUsageFlags usage, const bool fastAllocate = false) {
 		VmaAllocationCreateFlags flag = 0;
@@ -184,28 +402,123 @@ public:
 			return dst;
 		}
 
-		auto tmp = std::make_shared<Buffer>(
-			mDevice,
-			name + "/Staging",
-			data.size()*sizeof(T) ,
-			vk::BufferUsageFlagBits::eTransferSrc,
-			vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent,
-			VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | flag);
+		const auto t0 = std::chrono::high_resolution_clock::now();
+		const vk::DeviceSize size = data.size()*sizeof(T);
+
+		// written in place, host writes are made visible by the submission so no barrier is needed
+		if (std::shared_ptr<Buffer> dst = CreateDirectUploadBuffer(size, name, usage, flag)) {
+			memcpy(dst->data(), data.data(), size);
+			dst->Flush();
+			HoldResource(dst);
+			mDevice.RecordUpload(true, size, std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(std::chrono::high_resolution_clock::now() - t0).count());
+			return dst;
+		}
+
+		const Buffer::View<std::byte> tmp = AllocateStaging(size, name);
 		auto dst = std::make_shared<Buffer>(
 			mDevice,
 			name,
-			data.size()*sizeof(T),
+			size,
 			usage|vk::BufferUsageFlagBits::eTransferDst,
 			vk::MemoryPropertyFlagBits::eDeviceLocal,
 			flag);
 
-		memcpy(tmp->data(), data.data(), data.size()*sizeof(T));
-		Copy(tmp, dst);
-		HoldResource(tmp);
+		memcpy(tmp.data(), data.data(), size);
+		CopyFromStaging(tmp, dst);
 		HoldResource(dst);
+		mDevice.RecordUpload(false, size, std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(std::chrono::high_resolution_clock::now() - t0).count());
 		return dst;
 	}
 
+	#pragma region Shared uploads
+	// Resources are looked up by contents in the device's AssetRegistry. Resources this command buffer creates are published
+	// by whoever submits it (see LoadQueue), which also waits for GetSharedAssets().mDependency before using the results.
+
+	inline std::shared_ptr<Buffer> FindSharedBuffer(const size_t key) { return mDevice.GetAssetRegistry().FindBuffer(key, mSharedAssets); }
+	inline std::shared_ptr<Image>  FindSharedImage (const size_t key) { return mDevice.GetAssetRegistry().FindImage (key, mSharedAssets); }
+	inline std::shared_ptr<Mesh>   FindSharedMesh  (const size_t key) { return mDevice.GetAssetRegistry().FindMesh  (key, mSharedAssets); }
+	inline void ShareBuffer(const size_t key, const std::shared_ptr<Buffer>& buffer, const size_t bytes) { mSharedAssets.mBuffers.emplace_back(key, buffer, bytes); }
+	inline void ShareImage (const size_t key, const std::shared_ptr<Image>&  image,  const size_t bytes) { mSharedAssets.mImages.emplace_back(key, image, bytes); }
+	inline void ShareMesh  (const size_t key, const std::shared_ptr<Mesh>&   mesh,   const size_t bytes) { mSharedAssets.mMeshes.emplace_back(key, mesh, bytes); }
+	inline AssetRegistry::Pending TakeSharedAssets() { return std::exchange(mSharedAssets, {}); }
+
+	inline static size_t GetBufferKey(const std::span<const std::byte> data, const vk::BufferUsageFlags usage) {
+		return HashArgs(AssetRegistry::HashContents(data), (VkBufferUsageFlags)usage);
+	}
+	inline static size_t GetImageKey(const std::span<const std::span<const std::byte>> levels, const ImageInfo& info) {
+		size_t key = HashArgs(info.mFormat, info.mExtent.width, info.mExtent.height, info.mExtent.depth, info.mLevels, info.mLayers, (VkImageUsageFlags)info.mUsage);
+		for (const std::span<const std::byte> level : levels)
+			key = HashCombine(key, AssetRegistry::HashContents(level));
+		return key;
+	}
+	inline static size_t GetImageKey(const std::vector<std::vector<std::byte>>& levels, const ImageInfo& info) {
+		const std::vector<std::span<const std::byte>> spans(levels.begin(), levels.end());
+		return GetImageKey(spans, info);
+	}
+
+	// Upload, reusing an identical buffer from any load on this device
+	template<typename T>
+	inline std::shared_ptr<Buffer> UploadShared(const vk::ArrayProxy<const T>& data, const std::string name, vk::BufferUsageFlags usage) {
+		const std::span<const std::byte> bytes(reinterpret_cast<const std::byte*>(data.data()), data.size()*sizeof(T));
+		const size_t key = GetBufferKey(bytes, usage);
+		if (std::shared_ptr<Buffer> buffer = FindSharedBuffer(key))
+			return buffer;
+		std::shared_ptr<Buffer> buffer = Upload<T>(data, name, usage);
+		ShareBuffer(key, buffer, bytes.size());
+		return buffer;
+	}
+
+	// Creates an image from a full mip chain, or reuses an identical image from any load on this device
+	inline std::shared_ptr<Image> UploadShared(const std::vector<std::vector<std::byte>>& levels, const ImageInfo& info, const std::string& name) {
+		const size_t key = GetImageKey(levels, info);
+		if (std::shared_ptr<Image> image = FindSharedImage(key))
+			return image;
+		const std::shared_ptr<Image> image = std::make_shared<Image>(mDevice, name, info);
+		Upload(levels, image);
+		HoldResource(image);
+		size_t bytes = 0;
+		for (const auto& level : levels) bytes += level.size();
+		ShareImage(key, image, bytes);
+		return image;
+	}
+
+	#pragma endregion
+
+	// Uploads data of any size in batches of at most a quarter of the staging ring.
+	// Whenever the ring is full of this command buffer's uploads, flush is called to submit the recorded commands, wait on them and begin recording again
+	// (e.g. CommandBuffer::SubmitAndWait, or UploadQueue::SubmitAndWait), so the staging memory in flight stays bounded by the ring size rather than by the data size.
+	// onBatch is called with each range of data once it has been copied to staging memory.
+	inline void UploadBatched(const std::span<const std::byte> data, const Buffer::View<std::byte>& dst, const std::function<void()>& flush, const std::function<void(const std::span<const std::byte>)>& onBatch = {}) {
+		if (dst.SizeBytes() < data.size())
+			throw std::runtime_error("dst buffer smaller than data");
+		StagingRing& ring = mDevice.GetStagingRing();
+		const vk::DeviceSize capacity = ring.GetStats().mCapacity;
+		const size_t batchSize = capacity > 0 ? capacity/4 : (64 << 20);
+
+		for (size_t offset = 0; offset < data.size(); offset += batchSize) {
+			const std::span<const std::byte> batch = data.subspan(offset, std::min(batchSize, data.size() - offset));
+
+			uint64_t id;
+			Buffer::View<std::byte> tmp = ring.Allocate(batch.size(), 16, id);
+			if (!tmp && !mStagingAllocations.empty()) {
+				flush();
+				tmp = ring.Allocate(batch.size(), 16, id);
+			}
+			// the ring is disabled, or full of other command buffers' uploads: use a dedicated buffer, and release it right away
+			const bool dedicated = !tmp;
+			if (dedicated)
+				tmp = AllocateStaging(batch.size(), dst.GetBuffer()->GetName());
+			else
+				mStagingAllocations.emplace_back(id);
+
+			std::memcpy(tmp.data(), batch.data(), batch.size());
+			CopyFromStaging(tmp, Buffer::View<std::byte>(dst, offset, batch.size()));
+			if (onBatch) onBatch(batch);
+			if (dedicated)
+				flush();
+		}
+	}
+
 	#pragma endregion
 
 	#pragma region Image manipulation
@@ -243,6 +556,8 @@ public:
 	}
 
 	inline void GenerateMipMaps(const std::shared_ptr<Image>& img, const vk::Filter filter = vk::Filter::eLinear, const vk::ImageAspectFlags aspect = vk::ImageAspectFlagBits::eColor) {
+		if (!SupportsBlit())
+			throw std::runtime_error("GenerateMipMaps requires a graphics queue");
 		Barrier(img,
 			vk::ImageSubresourceRange(aspect, 1, img->GetLevels()-1, 0, img->GetLayers()),
 			vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
@@ -299,8 +614,17 @@ public:
 private:
 	vk::raii::CommandBuffer mCommandBuffer;
 	std::shared_ptr<vk::raii::Fence> mFence;
+	bool mSharedFence = false; // set by SetCompletionFence, Submit must not reset it
 	uint32_t mQueueFamily;
 
+	std::vector<std::tuple<vk::Semaphore, uint64_t, vk::PipelineStageFlags>> mTimelineWaits;
+
+	AssetRegistry::Pending mSharedAssets;
+
+	bool mTrackOwnership = false;
+	std::map<std::tuple<Buffer*, vk::DeviceSize, vk::DeviceSize>, Buffer::View<std::byte>> mTrackedBuffers;
+	std::unordered_map<Image*, std::shared_ptr<Image>> mTrackedImages;
+
 	std::unordered_map<
 		std::pair<vk::PipelineStageFlags, vk::PipelineStageFlags>,
 		std::pair< std::vector<vk::BufferMemoryBarrier>, std::vector<vk::ImageMemoryBarrier> >,
@@ -314,6 +638,14 @@ private:
 		std::shared_ptr<vk::raii::AccelerationStructureKHR>,
 		std::shared_ptr<vk::raii::DescriptorSet> >;
 	std::unordered_map<void*, ResourcePointer> mHeldResources;
+
+	std::vector<uint64_t> mStagingAllocations; // staging ring allocations made since the last reset
+
+	inline void ReleaseStaging() {
+		if (mStagingAllocations.empty()) return;
+		mDevice.GetStagingRing().Release(mStagingAllocations);
+		mStagingAllocations.clear();
+	}
 };
 
 }
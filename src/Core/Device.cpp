@@ -1,6 +1,9 @@
 #define VMA_IMPLEMENTATION
 #include "Device.hpp"
 #include "CommandBuffer.hpp"
+#include "StagingRing.hpp"
+#include "UploadQueue.hpp"
+#include "AssetRegistry.hpp"
 #include "Profiler.hpp"
 
 #include <imgui/imgui.h>
@@ -37,6 +40,7 @@ Device::Device(Instance& instance, vk::raii::PhysicalDevice physicalDevice) :
 		mFeatures.shaderStorageBufferArrayDynamicIndexing = true;
 		mFeatures.shaderSampledImageArrayDynamicIndexing = true;
 		mFeatures.shaderStorageImageArrayDynamicIndexing = true;
+		mFeatures.textureCompressionBC = mPhysicalDevice.getFeatures().textureCompressionBC; // for --compress-textures, see SupportsBlockCompressedFormat
 
 		vk::PhysicalDeviceVulkan12Features& vk12features = std::get<vk::PhysicalDeviceVulkan12Features>(mFeatureChain);
 		vk12features.shaderStorageBufferArrayNonUniformIndexing = true;
@@ -46,6 +50,7 @@ Device::Device(Instance& instance, vk::raii::PhysicalDevice physicalDevice) :
 		vk12features.shaderInt8 = true;
 		vk12features.storageBuffer8BitAccess = true;
 		vk12features.shaderFloat16 = true;
+		vk12features.timelineSemaphore = true;
 		vk12features.bufferDeviceAddress = mExtensions.contains(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME);
 
 		vk::PhysicalDeviceVulkan13Features& vk13features = std::get<vk::PhysicalDeviceVulkan13Features>(mFeatureChain);
@@ -66,12 +71,30 @@ Device::Device(Instance& instance, vk::raii::PhysicalDevice physicalDevice) :
 
 	#pragma region Queue create infos
 
-	std::vector<vk::QueueFamilyProperties> queueFamilyProperties = mPhysicalDevice.getQueueFamilyProperties();
+	mQueueFamilyProperties = mPhysicalDevice.getQueueFamilyProperties();
+
+	// uploads go to an async compute family when there is one, so that they run alongside rendering.
+	// transfer-only families cannot run the material conversion kernels loaders dispatch.
+	// otherwise they use a second queue in the graphics family, or share the graphics queue on devices with only one (see Device::GetQueueMutex)
+	uint32_t uploadFamily = -1;
+	uint32_t uploadQueueIndex = 0;
+	for (uint32_t i = 0; i < mQueueFamilyProperties.size(); i++) {
+		const vk::QueueFlags flags = mQueueFamilyProperties[i].queueFlags;
+		if ((flags & vk::QueueFlagBits::eCompute) && !(flags & vk::QueueFlagBits::eGraphics)) {
+			uploadFamily = i;
+			break;
+		}
+	}
+	if (uploadFamily == -1) {
+		uploadFamily = FindQueueFamily(vk::QueueFlagBits::eGraphics|vk::QueueFlagBits::eCompute);
+		uploadQueueIndex = std::min(mQueueFamilyProperties[uploadFamily].queueCount, 2u) - 1;
+	}
+
 	std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
-	float queuePriority = 1.0f;
-	for (uint32_t i = 0; i < queueFamilyProperties.size(); i++) {
-		if (queueFamilyProperties[i].queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eTransfer)) {
-			queueCreateInfos.emplace_back(vk::DeviceQueueCreateInfo({}, i, 1, &queuePriority));
+	const std::array<float,2> queuePriorities = { 1.0f, 0.5f };
+	for (uint32_t i = 0; i < mQueueFamilyProperties.size(); i++) {
+		if (mQueueFamilyProperties[i].queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eTransfer)) {
+			queueCreateInfos.emplace_back(vk::DeviceQueueCreateInfo({}, i, i == uploadFamily ? uploadQueueIndex + 1 : 1, queuePriorities.data()));
 		}
 	}
 
@@ -95,6 +118,8 @@ Device::Device(Instance& instance, vk::raii::PhysicalDevice physicalDevice) :
 
 	const vk::PhysicalDeviceProperties properties = mPhysicalDevice.getProperties();
 	mLimits = properties.limits;
+	if (mExtensions.contains(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME))
+		mAccelerationStructureProperties = mPhysicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceAccelerationStructurePropertiesKHR>().get<vk::PhysicalDeviceAccelerationStructurePropertiesKHR>();
 	SetDebugName(*mDevice, "[" + std::to_string(properties.deviceID) + "]: " + properties.deviceName.data());
 
 	#pragma endregion
@@ -135,6 +160,36 @@ Device::Device(Instance& instance, vk::raii::PhysicalDevice physicalDevice) :
 	vmaCreateAllocator(&allocatorInfo, &mAllocator);
 
 	#pragma endregion
+
+	#pragma region Find host-visible device-local memory
+
+	const vk::PhysicalDeviceMemoryProperties memoryProperties = mPhysicalDevice.getMemoryProperties();
+	const vk::MemoryPropertyFlags directFlags = vk::MemoryPropertyFlagBits::eDeviceLocal|vk::MemoryPropertyFlagBits::eHostVisible;
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		const vk::MemoryType& type = memoryProperties.memoryTypes[i];
+		if ((type.propertyFlags & directFlags) == directFlags && memoryProperties.memoryHeaps[type.heapIndex].size > mHostVisibleDeviceLocalHeapSize) {
+			mHostVisibleDeviceLocalHeapSize = memoryProperties.memoryHeaps[type.heapIndex].size;
+			mHostVisibleDeviceLocalHeap = type.heapIndex;
+		}
+	}
+	if (mHostVisibleDeviceLocalHeapSize > 0) {
+		// opt-in until the update latency of direct writes has been measured against staging copies (see the Uploads inspector)
+		if (auto arg = mInstance.GetOption("direct-upload-size"))
+			mMaxDirectUploadSize = std::stoull(*arg)*1024;
+
+		const auto[heapSize, heapUnit] = FormatBytes(mHostVisibleDeviceLocalHeapSize);
+		std::cout << "Host-visible device-local heap: " << heapSize << " " << heapUnit << (mMaxDirectUploadSize > 0 ? "" : " (direct uploads disabled)") << std::endl;
+	}
+
+	#pragma endregion
+
+	vk::DeviceSize stagingRingSize = 64;
+	if (auto arg = mInstance.GetOption("staging-ring-size"))
+		stagingRingSize = std::stoull(*arg);
+	mStagingRing = std::make_unique<StagingRing>(*this, stagingRingSize*1024*1024);
+
+	mUploadQueue = std::make_unique<UploadQueue>(*this, uploadFamily, uploadQueueIndex);
+	mAssetRegistry = std::make_unique<AssetRegistry>();
 }
 Device::~Device() {
 	if (!mInstance.GetOption("no-pipeline-cache")) {
@@ -146,9 +201,26 @@ Device::~Device() {
 			std::cerr << "Warning: Failed to write pipeline cache: " << e.what() << std::endl;
 		}
 	}
+	mAssetRegistry.reset();
+	mUploadQueue.reset();
+	mStagingRing.reset();
 	vmaDestroyAllocator(mAllocator);
 }
 
+bool Device::SupportsBlockCompressedFormat(const vk::Format format) const {
+	if (!mFeatures.textureCompressionBC) return false;
+	const vk::FormatFeatureFlags required = vk::FormatFeatureFlagBits::eSampledImage | vk::FormatFeatureFlagBits::eSampledImageFilterLinear | vk::FormatFeatureFlagBits::eTransferSrc | vk::FormatFeatureFlagBits::eTransferDst;
+	return (mPhysicalDevice.getFormatProperties(format).optimalTilingFeatures & required) == required;
+}
+
+void Device::WaitIdle() {
+	std::scoped_lock l(mQueueMutexesMutex);
+	std::vector<std::unique_lock<std::mutex>> locks;
+	for (auto&[queue, mutex] : mQueueMutexes)
+		locks.emplace_back(mutex);
+	mDevice.waitIdle();
+}
+
 vk::raii::CommandPool& Device::GetCommandPool(const uint32_t queueFamily) {
 	std::unique_lock l(mCommandPoolMutex);
 	auto& pools = mCommandPools[std::this_thread::get_id()];
@@ -226,6 +298,53 @@ void Device::OnInspectorGui() {
 			ImGui::Unindent();
 		}
 	}
+
+	if (ImGui::CollapsingHeader("Staging ring")) {
+		const StagingRing::Stats stats = mStagingRing->GetStats();
+		const auto[used, usedUnit]         = FormatBytes(stats.mUsed);
+		const auto[peak, peakUnit]         = FormatBytes(stats.mPeakUsed);
+		const auto[capacity, capacityUnit] = FormatBytes(stats.mCapacity);
+		ImGui::Text("%llu %s / %llu %s used (peak %llu %s)", used, usedUnit, capacity, capacityUnit, peak, peakUnit);
+		if (stats.mCapacity > 0)
+			ImGui::ProgressBar(stats.mUsed / (float)stats.mCapacity);
+		ImGui::Text("%llu live allocations", (uint64_t)stats.mLiveAllocations);
+		ImGui::Text("%llu allocations, %llu dedicated", (uint64_t)stats.mAllocations, (uint64_t)stats.mDedicatedAllocations);
+		ImGui::Text("%llu stalls (%.2f ms)", (uint64_t)stats.mStalls, stats.mStallTime);
+	}
+
+	if (ImGui::CollapsingHeader("Uploads")) {
+		if (mMaxDirectUploadSize > 0) {
+			const auto[heapSize, heapUnit] = FormatBytes(mHostVisibleDeviceLocalHeapSize);
+			const auto[maxSize, maxUnit] = FormatBytes(mMaxDirectUploadSize);
+			ImGui::Text("Direct writes up to %llu %s (host-visible device-local heap: %llu %s)", maxSize, maxUnit, heapSize, heapUnit);
+		} else
+			ImGui::TextUnformatted("Direct writes disabled");
+
+		std::scoped_lock l(mUploadStatsMutex);
+		for (const auto&[label, s] : { std::make_pair("Direct", mDirectUploadStats), std::make_pair("Staged", mStagedUploadStats) }) {
+			const auto[bytes, unit] = FormatBytes(s.mBytes);
+			ImGui::Text("%s: %llu uploads, %llu %s, %.3f ms (%.2f us per upload)", label, (uint64_t)s.mCount, bytes, unit, s.mTime, s.mCount > 0 ? 1000*s.mTime/s.mCount : 0.f);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Upload queue")) {
+		const UploadQueue::Stats stats = mUploadQueue->GetStats();
+		ImGui::Text("Queue family %u, queue %u", mUploadQueue->GetQueueFamily(), mUploadQueue->GetQueueIndex());
+		ImGui::Text("%llu / %llu command buffers complete", mUploadQueue->GetCompletedValue(), mUploadQueue->GetSubmittedValue());
+		ImGui::Text("%llu batches (largest %llu)", (uint64_t)stats.mBatches, (uint64_t)stats.mLargestBatch);
+		ImGui::Text("%llu flushes", (uint64_t)stats.mFlushes);
+	}
+
+	if (ImGui::CollapsingHeader("Shared assets")) {
+		const AssetRegistry::Stats stats = mAssetRegistry->GetStats();
+		const auto[buffers, bufferBytes, images, imageBytes] = mAssetRegistry->GetResidentCounts();
+		const auto[bufferSize, bufferUnit] = FormatBytes(bufferBytes);
+		const auto[imageSize, imageUnit] = FormatBytes(imageBytes);
+		const auto[savedSize, savedUnit] = FormatBytes(stats.mBytesSaved);
+		ImGui::Text("%llu buffers (%llu %s), %llu images (%llu %s)", (uint64_t)buffers, bufferSize, bufferUnit, (uint64_t)images, imageSize, imageUnit);
+		ImGui::Text("Reused %llu buffers, %llu images, %llu meshes", (uint64_t)stats.mBufferHits, (uint64_t)stats.mImageHits, (uint64_t)stats.mMeshHits);
+		ImGui::Text("Saved %llu %s", savedSize, savedUnit);
+	}
 }
 
 }
\ No newline at end of file
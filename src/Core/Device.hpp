@@ -1,6 +1,7 @@
 #pragma once
 
 #include <thread>
+#include <mutex>
 #include <shared_mutex>
 
 #include <vk_mem_alloc.h>
@@ -9,10 +10,14 @@
 
 namespace ptvk {
 
+class StagingRing;
+class UploadQueue;
+class AssetRegistry;
+
 inline uint32_t FindQueueFamily(vk::raii::PhysicalDevice& physicalDevice, const vk::QueueFlags flags = vk::QueueFlagBits::eGraphics|vk::QueueFlagBits::eCompute|vk::QueueFlagBits::eTransfer) {
 	const auto queueFamilyProperties = physicalDevice.getQueueFamilyProperties();
 	for (uint32_t i = 0; i < queueFamilyProperties.size(); i++) {
-		if (queueFamilyProperties[i].queueFlags | flags)
+		if ((queueFamilyProperties[i].queueFlags & flags) == flags)
 			return i;
 	}
 	return -1;
@@ -38,11 +43,14 @@ public:
 
 	inline const vk::PhysicalDeviceLimits& GetLimits() const { return mLimits; }
 	inline const vk::PhysicalDeviceFeatures& GetFeatures() const { return mFeatures; }
+	// Whether textureCompressionBC is enabled and format can be uploaded to and sampled with linear filtering. Loaders keep the uncompressed mip chain otherwise
+	bool SupportsBlockCompressedFormat(const vk::Format format) const;
 	inline const vk::PhysicalDeviceVulkan12Features&                 GetVulkan12Features() const              { return std::get<vk::PhysicalDeviceVulkan12Features>(mFeatureChain); }
 	inline const vk::PhysicalDeviceVulkan13Features&                 GetVulkan13Features() const              { return std::get<vk::PhysicalDeviceVulkan13Features>(mFeatureChain); }
 	inline const vk::PhysicalDeviceAccelerationStructureFeaturesKHR& GetAccelerationStructureFeatures() const { return std::get<vk::PhysicalDeviceAccelerationStructureFeaturesKHR>(mFeatureChain); }
 	inline const vk::PhysicalDeviceRayTracingPipelineFeaturesKHR&    GetRayTracingPipelineFeatures() const    { return std::get<vk::PhysicalDeviceRayTracingPipelineFeaturesKHR>(mFeatureChain); }
 	inline const vk::PhysicalDeviceRayQueryFeaturesKHR&              GetRayQueryFeatures() const              { return std::get<vk::PhysicalDeviceRayQueryFeaturesKHR>(mFeatureChain); }
+	inline const vk::PhysicalDeviceAccelerationStructurePropertiesKHR& GetAccelerationStructureProperties() const { return mAccelerationStructureProperties; }
 
 	template<typename T> requires(std::convertible_to<decltype(T::objectType), vk::ObjectType>)
 	inline void SetDebugName(const T& object, const std::string& name) {
@@ -58,9 +66,49 @@ public:
 	const std::shared_ptr<vk::raii::DescriptorPool>& AllocateDescriptorPool();
 	const std::shared_ptr<vk::raii::DescriptorPool>& GetDescriptorPool();
 
+	inline StagingRing& GetStagingRing() { return *mStagingRing; }
+
+	// Uploads of up to this many bytes are written straight into host-visible device-local memory (resizable BAR, integrated GPUs, software implementations)
+	// instead of being copied from staging memory. 0 when the device has no such memory, or direct uploads are not enabled with --direct-upload-size.
+	inline vk::DeviceSize GetMaxDirectUploadSize() const { return mMaxDirectUploadSize; }
+	// Whether size more bytes fit in the host-visible device-local heap's budget
+	inline bool HasDirectUploadBudget(const vk::DeviceSize size) const {
+		VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+		vmaGetHeapBudgets(mAllocator, budgets);
+		const VmaBudget& budget = budgets[mHostVisibleDeviceLocalHeap];
+		return budget.usage + size <= budget.budget;
+	}
+
+	// CPU time spent in CommandBuffer::Upload, per path, to compare direct writes with staging copies
+	struct UploadStats {
+		size_t mCount = 0;
+		vk::DeviceSize mBytes = 0;
+		float mTime = 0; // ms
+	};
+	inline void RecordUpload(const bool direct, const vk::DeviceSize bytes, const float ms) {
+		std::scoped_lock l(mUploadStatsMutex);
+		UploadStats& s = direct ? mDirectUploadStats : mStagedUploadStats;
+		s.mCount++;
+		s.mBytes += bytes;
+		s.mTime += ms;
+	}
+	inline UploadQueue& GetUploadQueue() { return *mUploadQueue; }
+	// Queues are externally synchronized, and the UploadQueue submits from its own thread, to the graphics queue on devices with only one.
+	// Every vkQueueSubmit and vkQueuePresentKHR holds the queue's mutex
+	inline std::mutex& GetQueueMutex(const vk::Queue queue) {
+		std::scoped_lock l(mQueueMutexesMutex);
+		return mQueueMutexes[(VkQueue)queue];
+	}
+	// vkDeviceWaitIdle, with every queue's mutex held
+	void WaitIdle();
+	inline AssetRegistry& GetAssetRegistry() { return *mAssetRegistry; }
+
 	inline uint32_t FindQueueFamily(const vk::QueueFlags flags = vk::QueueFlagBits::eGraphics|vk::QueueFlagBits::eCompute|vk::QueueFlagBits::eTransfer) {
 		return ptvk::FindQueueFamily(mPhysicalDevice, flags);
 	}
+	inline vk::QueueFlags GetQueueFamilyFlags(const uint32_t queueFamily) const {
+		return queueFamily < mQueueFamilyProperties.size() ? mQueueFamilyProperties[queueFamily].queueFlags : vk::QueueFlags{};
+	}
 
 	inline size_t GetFrameIndex() const { return mFrameIndex; }
 	inline void IncrementFrameIndex() { mFrameIndex++; }
@@ -83,6 +131,21 @@ private:
 
 	VmaAllocator mAllocator;
 
+	std::vector<vk::QueueFamilyProperties> mQueueFamilyProperties;
+	std::mutex mQueueMutexesMutex;
+	std::unordered_map<VkQueue, std::mutex> mQueueMutexes;
+
+	vk::DeviceSize mHostVisibleDeviceLocalHeapSize = 0;
+	uint32_t mHostVisibleDeviceLocalHeap = 0;
+	vk::DeviceSize mMaxDirectUploadSize = 0;
+	std::mutex mUploadStatsMutex;
+	UploadStats mDirectUploadStats;
+	UploadStats mStagedUploadStats;
+
+	std::unique_ptr<StagingRing> mStagingRing;
+	std::unique_ptr<UploadQueue> mUploadQueue;
+	std::unique_ptr<AssetRegistry> mAssetRegistry;
+
 	size_t mFrameIndex;
 	size_t mFramesInFlight; // assigned by Swapchain
 	friend class Swapchain;
@@ -98,6 +161,7 @@ private:
 		vk::PhysicalDeviceRayQueryFeaturesKHR
 	> mFeatureChain;
 	vk::PhysicalDeviceLimits mLimits;
+	vk::PhysicalDeviceAccelerationStructurePropertiesKHR mAccelerationStructureProperties;
 };
 
 }
\ No newline at end of file
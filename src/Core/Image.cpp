@@ -1,6 +1,9 @@
 #include "Image.hpp"
 #include "Buffer.hpp"
 
+#include <numbers>
+#include <optional>
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image.h>
@@ -91,23 +94,27 @@ PixelData LoadImageFile(Device& device, const std::filesystem::path& filename, c
 		memcpy(buf->data(), img->m_mem, buf->size());
 		return PixelData{buf, dxgiToVulkan(dds.GetFormat(), desiredChannels == 4), vk::Extent3D(dds.GetWidth(), dds.GetHeight(), dds.GetDepth())};
 	} else {
+		// read the file once, instead of letting each stb query reopen it
+		const std::vector<stbi_uc> file = ReadFile<std::vector<stbi_uc>>(filename);
+		if (file.empty()) throw std::invalid_argument("Could not read " + filename.string());
+
 		int x,y,channels;
-		stbi_info(filename.string().c_str(), &x, &y, &channels);
+		stbi_info_from_memory(file.data(), (int)file.size(), &x, &y, &channels);
 
 		if (channels == 3) desiredChannels = 4;
 
 		std::byte* pixels = nullptr;
 		vk::Format format = vk::Format::eUndefined;
-		if (stbi_is_hdr(filename.string().c_str())) {
-			pixels = (std::byte*)stbi_loadf(filename.string().c_str(), &x, &y, &channels, desiredChannels);
+		if (stbi_is_hdr_from_memory(file.data(), (int)file.size())) {
+			pixels = (std::byte*)stbi_loadf_from_memory(file.data(), (int)file.size(), &x, &y, &channels, desiredChannels);
 			switch(desiredChannels ? desiredChannels : channels) {
 				case 1: format = vk::Format::eR32Sfloat; break;
 				case 2: format = vk::Format::eR32G32Sfloat; break;
 				case 3: format = vk::Format::eR32G32B32Sfloat; break;
 				case 4: format = vk::Format::eR32G32B32A32Sfloat; break;
 			}
-		} else if (stbi_is_16_bit(filename.string().c_str())) {
-			pixels = (std::byte*)stbi_load_16(filename.string().c_str(), &x, &y, &channels, desiredChannels);
+		} else if (stbi_is_16_bit_from_memory(file.data(), (int)file.size())) {
+			pixels = (std::byte*)stbi_load_16_from_memory(file.data(), (int)file.size(), &x, &y, &channels, desiredChannels);
 			switch(desiredChannels ? desiredChannels : channels) {
 				case 1: format = vk::Format::eR16Unorm; break;
 				case 2: format = vk::Format::eR16G16Unorm; break;
@@ -115,7 +122,7 @@ PixelData LoadImageFile(Device& device, const std::filesystem::path& filename, c
 				case 4: format = vk::Format::eR16G16B16A16Unorm; break;
 			}
 		} else {
-			pixels = (std::byte*)stbi_load(filename.string().c_str(), &x, &y, &channels, desiredChannels);
+			pixels = (std::byte*)stbi_load_from_memory(file.data(), (int)file.size(), &x, &y, &channels, desiredChannels);
 			switch (desiredChannels ? desiredChannels : channels) {
 				case 1: format = srgb ? vk::Format::eR8Srgb : vk::Format::eR8Unorm; break;
 				case 2: format = srgb ? vk::Format::eR8G8Srgb : vk::Format::eR8G8Unorm; break;
@@ -124,7 +131,8 @@ PixelData LoadImageFile(Device& device, const std::filesystem::path& filename, c
 			}
 		}
 		if (!pixels) throw std::invalid_argument("Could not load " + filename.string());
-		std::cout << "Loaded " << filename << " (" << x << "x" << y << ")" << std::endl;
+		// single write, since images may be decoded on several threads at once
+		std::cout << ("Loaded " + filename.string() + " (" + std::to_string(x) + "x" + std::to_string(y) + ")\n") << std::flush;
 		if (desiredChannels) channels = desiredChannels;
 
 		auto buf = std::make_shared<Buffer>(device, filename.stem().string() + "/Staging", x*y*GetTexelSize(format), vk::BufferUsageFlagBits::eTransferSrc,
@@ -136,6 +144,245 @@ PixelData LoadImageFile(Device& device, const std::filesystem::path& filename, c
 	}
 }
 
+// Kaiser windowed sinc for 2x downsampling, sampled at source texel centers.
+// Tap k sits (k - 5.5)/2 destination texels from the destination texel's center, taps cover [2x-5, 2x+6].
+static const std::array<float, 12> gKaiserWeights = []() {
+	const auto BesselI0 = [](const float x) {
+		float sum = 1, term = 1;
+		for (uint32_t k = 1; k < 16; k++) {
+			term *= (x / (2*k)) * (x / (2*k));
+			sum += term;
+		}
+		return sum;
+	};
+	const float width = 3;
+	const float alpha = 4;
+	std::array<float, 12> w;
+	float total = 0;
+	for (uint32_t k = 0; k < 12; k++) {
+		const float d = ((float)k - 5.5f) / 2;
+		const float sinc = std::sin(std::numbers::pi_v<float> * d) / (std::numbers::pi_v<float> * d);
+		const float t = d / width;
+		w[k] = sinc * BesselI0(alpha * std::sqrt(std::max(1 - t*t, 0.f))) / BesselI0(alpha);
+		total += w[k];
+	}
+	for (float& v : w) v /= total;
+	return w;
+}();
+
+// Component types GenerateMipChain and ComputeLuminance can decode
+enum class ComponentType { eUnorm8, eSrgb8, eUnorm16, eFloat32 };
+static std::optional<ComponentType> GetComponentType(const vk::Format format) {
+	switch (format) {
+		default: return std::nullopt;
+		case vk::Format::eR8Unorm:
+		case vk::Format::eR8G8Unorm:
+		case vk::Format::eR8G8B8Unorm:
+		case vk::Format::eR8G8B8A8Unorm:
+			return ComponentType::eUnorm8;
+		case vk::Format::eR8Srgb:
+		case vk::Format::eR8G8Srgb:
+		case vk::Format::eR8G8B8Srgb:
+		case vk::Format::eR8G8B8A8Srgb:
+			return ComponentType::eSrgb8;
+		case vk::Format::eR16Unorm:
+		case vk::Format::eR16G16Unorm:
+		case vk::Format::eR16G16B16Unorm:
+		case vk::Format::eR16G16B16A16Unorm:
+			return ComponentType::eUnorm16;
+		case vk::Format::eR32Sfloat:
+		case vk::Format::eR32G32Sfloat:
+		case vk::Format::eR32G32B32Sfloat:
+		case vk::Format::eR32G32B32A32Sfloat:
+			return ComponentType::eFloat32;
+	}
+}
+// Decodes component c of a texel to linear space. alpha is never srgb-encoded
+static float DecodeComponent(const ComponentType type, const std::byte* src, const uint32_t c) {
+	switch (type) {
+		default:
+		case ComponentType::eUnorm8:  return (float)*reinterpret_cast<const uint8_t*>(src) / 255.f;
+		case ComponentType::eSrgb8: {
+			const float v = (float)*reinterpret_cast<const uint8_t*>(src) / 255.f;
+			if (c == 3) return v;
+			return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+		}
+		case ComponentType::eUnorm16: return (float)*reinterpret_cast<const uint16_t*>(src) / 65535.f;
+		case ComponentType::eFloat32: return *reinterpret_cast<const float*>(src);
+	}
+}
+
+std::vector<float> ComputeLuminance(const std::span<const std::byte> pixels, const vk::Format format, const vk::Extent3D& extent) {
+	const std::optional<ComponentType> type = GetComponentType(format);
+	if (!type) return {};
+
+	const uint32_t channels = GetChannelCount(format);
+	const uint32_t texelSize = GetTexelSize(format);
+	const uint32_t componentSize = texelSize / channels;
+	const size_t texelCount = (size_t)extent.width*extent.height*extent.depth;
+	if (pixels.size() < texelCount*texelSize) return {};
+
+	std::vector<float> luminance(texelCount);
+	for (size_t i = 0; i < texelCount; i++) {
+		const std::byte* texel = pixels.data() + i*texelSize;
+		if (channels < 3)
+			luminance[i] = DecodeComponent(*type, texel, 0);
+		else
+			luminance[i] =
+				0.2126f * DecodeComponent(*type, texel, 0) +
+				0.7152f * DecodeComponent(*type, texel + componentSize, 1) +
+				0.0722f * DecodeComponent(*type, texel + 2*componentSize, 2);
+	}
+	return luminance;
+}
+
+std::vector<std::vector<std::byte>> GenerateMipChain(const std::span<const std::byte> pixels, const vk::Format format, const vk::Extent3D& extent, const MipChainOptions& options) {
+	const std::optional<ComponentType> componentType = GetComponentType(format);
+	if (!componentType) return {};
+	const ComponentType type = *componentType;
+	if (extent.depth != 1) return {};
+
+	const uint32_t channels = GetChannelCount(format);
+	const uint32_t texelSize = GetTexelSize(format);
+	if (pixels.size() < (size_t)extent.width*extent.height*texelSize) return {};
+
+	// the negative lobes ring around bright HDR texels, so float images always use the box filter
+	const MipFilter filter = type == ComponentType::eFloat32 ? MipFilter::eBox : options.mFilter;
+	const bool normalMap = options.mNormalMap && channels >= 3 && type != ComponentType::eFloat32;
+	const bool alphaCoverage = options.mAlphaCutoff > 0 && channels == 4;
+
+	// filter in linear space
+	const auto Decode = [&](const std::byte* src, const uint32_t c) -> float { return DecodeComponent(type, src, c); };
+	const auto Encode = [&](std::byte* dst, const uint32_t c, float v) {
+		switch (type) {
+			case ComponentType::eSrgb8:
+				v = std::clamp(v, 0.f, 1.f);
+				if (c != 3) v = v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1/2.4f) - 0.055f;
+				[[fallthrough]];
+			case ComponentType::eUnorm8:
+				*reinterpret_cast<uint8_t*>(dst) = (uint8_t)std::clamp(v * 255.f + 0.5f, 0.f, 255.f);
+				break;
+			case ComponentType::eUnorm16:
+				*reinterpret_cast<uint16_t*>(dst) = (uint16_t)std::clamp(v * 65535.f + 0.5f, 0.f, 65535.f);
+				break;
+			case ComponentType::eFloat32:
+				*reinterpret_cast<float*>(dst) = v;
+				break;
+		}
+	};
+
+	const uint32_t componentSize = texelSize / channels;
+	const uint32_t levelCount = GetMaxMipLevels(extent);
+
+	std::vector<std::vector<std::byte>> levels(levelCount);
+	levels[0].assign(pixels.begin(), pixels.begin() + (size_t)extent.width*extent.height*texelSize);
+
+	std::vector<float> src((size_t)extent.width*extent.height*channels);
+	for (size_t i = 0; i < src.size(); i++)
+		src[i] = Decode(levels[0].data() + i*componentSize, (uint32_t)(i % channels));
+
+	// fraction of texels which pass the alpha test, which each level should match
+	const auto Coverage = [&](const std::vector<float>& data, const float cutoff, const float scale) {
+		size_t count = 0;
+		for (size_t i = 3; i < data.size(); i += 4)
+			if (data[i] * scale >= cutoff)
+				count++;
+		return (float)count / (float)(data.size() / 4);
+	};
+	const float targetCoverage = alphaCoverage ? Coverage(src, options.mAlphaCutoff, 1) : 0;
+
+	// Downsamples one axis by 2. Rows are contiguous runs of floats, so the inner loops vectorize.
+	// stride is the distance between neighboring texels along the axis, count the number of texels along it.
+	const auto Kaiser = [](const float* in, float* out, const uint32_t count, const uint32_t outCount, const size_t stride, const size_t outStride, const size_t span) {
+		for (uint32_t x = 0; x < outCount; x++) {
+			float* o = out + x*outStride;
+			std::fill_n(o, span, 0.f);
+			for (uint32_t k = 0; k < 12; k++) {
+				const float* i = in + (size_t)std::clamp<int>((int)(2*x + k) - 5, 0, (int)count - 1)*stride;
+				const float w = gKaiserWeights[k];
+				for (size_t j = 0; j < span; j++)
+					o[j] += w * i[j];
+			}
+		}
+	};
+
+	uint32_t w = extent.width;
+	uint32_t h = extent.height;
+	std::vector<float> dst, tmp;
+	for (uint32_t level = 1; level < levelCount; level++) {
+		const uint32_t dw = std::max(w/2, 1u);
+		const uint32_t dh = std::max(h/2, 1u);
+		dst.resize((size_t)dw*dh*channels);
+
+		if (filter == MipFilter::eKaiser) {
+			// horizontal, then vertical. a 1 texel wide axis is copied through
+			tmp.resize((size_t)dw*h*channels);
+			if (w > 1) {
+				for (uint32_t y = 0; y < h; y++)
+					Kaiser(src.data() + (size_t)y*w*channels, tmp.data() + (size_t)y*dw*channels, w, dw, channels, channels, channels);
+			} else
+				tmp = src;
+			if (h > 1)
+				Kaiser(tmp.data(), dst.data(), h, dh, (size_t)dw*channels, (size_t)dw*channels, (size_t)dw*channels);
+			else
+				dst = tmp;
+			// only unorm data gets here. clamp the overshoot so that it does not build up down the chain
+			for (float& v : dst) v = std::clamp(v, 0.f, 1.f);
+		} else {
+			for (uint32_t y = 0; y < dh; y++) {
+				const uint32_t y0 = std::min(2*y, h-1), y1 = std::min(2*y+1, h-1);
+				for (uint32_t x = 0; x < dw; x++) {
+					const uint32_t x0 = std::min(2*x, w-1), x1 = std::min(2*x+1, w-1);
+					for (uint32_t c = 0; c < channels; c++)
+						dst[((size_t)y*dw + x)*channels + c] = 0.25f * (
+							src[((size_t)y0*w + x0)*channels + c] +
+							src[((size_t)y0*w + x1)*channels + c] +
+							src[((size_t)y1*w + x0)*channels + c] +
+							src[((size_t)y1*w + x1)*channels + c]);
+				}
+			}
+		}
+
+		// averaged normals shorten, renormalize so that bumps do not flatten out at a distance
+		if (normalMap) {
+			for (size_t i = 0; i < dst.size(); i += channels) {
+				float n[3];
+				for (uint32_t c = 0; c < 3; c++) n[c] = dst[i+c] * 2 - 1;
+				const float len = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+				if (len > 1e-6f)
+					for (uint32_t c = 0; c < 3; c++) dst[i+c] = n[c] / len * 0.5f + 0.5f;
+			}
+		}
+
+		// alpha tested surfaces thin out as alpha is averaged. scale alpha so that the same fraction of texels passes the test.
+		// the scale is only applied to the stored level, the next level is filtered from unscaled alpha
+		float alphaScale = 1;
+		if (alphaCoverage) {
+			float lo = 0, hi = 4;
+			for (uint32_t it = 0; it < 16; it++) {
+				const float mid = (lo + hi) / 2;
+				if (Coverage(dst, options.mAlphaCutoff, mid) < targetCoverage)
+					lo = mid;
+				else
+					hi = mid;
+			}
+			// only ever raise alpha, images which are opaque or already keep their coverage are left alone
+			alphaScale = std::max(hi, 1.f);
+		}
+
+		levels[level].resize((size_t)dw*dh*texelSize);
+		for (size_t i = 0; i < dst.size(); i++) {
+			const uint32_t c = (uint32_t)(i % channels);
+			Encode(levels[level].data() + i*componentSize, c, c == 3 ? dst[i] * alphaScale : dst[i]);
+		}
+
+		std::swap(src, dst);
+		w = dw;
+		h = dh;
+	}
+	return levels;
+}
+
 
 Image::Image(Device& device, const std::string& name, const ImageInfo& info, const vk::MemoryPropertyFlags memoryFlags, const VmaAllocationCreateFlags allocationFlags) : mDevice(device), mImage(nullptr), mName(name), mInfo(info) {
 	VmaAllocationCreateInfo allocationCreateInfo;
@@ -21,6 +21,27 @@ struct ImageInfo {
 using PixelData = std::tuple<std::shared_ptr<Buffer>, vk::Format, vk::Extent3D>;
 PixelData LoadImageFile(Device& device, const std::filesystem::path& filename, const bool srgb = true, int desiredChannels = 0);
 
+enum class MipFilter {
+	eBox,
+	eKaiser
+};
+struct MipChainOptions {
+	MipFilter mFilter = MipFilter::eKaiser;
+	// renormalizes the xyz of tangent space normal maps after filtering
+	bool mNormalMap = false;
+	// when > 0, scales alpha so that every level passes an alpha test at this cutoff over as much area as level 0
+	float mAlphaCutoff = 0;
+};
+
+// Generates a full 2D mip chain on the CPU. Level 0 is a copy of pixels, the rest are filtered in linear space.
+// Supports 8 bit unorm/srgb, 16 bit unorm and 32 bit float formats. Returns an empty vector for unsupported formats.
+// Float images always use the box filter.
+std::vector<std::vector<std::byte>> GenerateMipChain(const std::span<const std::byte> pixels, const vk::Format format, const vk::Extent3D& extent, const MipChainOptions& options = {});
+
+// Linear-space luminance of each texel (the first channel of one and two channel formats).
+// Supports the formats GenerateMipChain supports. Returns an empty vector for other formats.
+std::vector<float> ComputeLuminance(const std::span<const std::byte> pixels, const vk::Format format, const vk::Extent3D& extent);
+
 class Image {
 public:
 	using SubresourceLayoutState = std::tuple<vk::ImageLayout, vk::PipelineStageFlags, vk::AccessFlags, uint32_t /*queueFamily*/>;
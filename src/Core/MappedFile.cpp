@@ -0,0 +1,90 @@
+#include "MappedFile.hpp"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ptvk {
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::filesystem::path& filename) {
+	mFile = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE) {
+		mFile = nullptr;
+		throw std::runtime_error("Failed to open " + filename.string());
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mFile, &size)) {
+		CloseHandle(mFile);
+		throw std::runtime_error("Failed to get the size of " + filename.string());
+	}
+	mSize = (size_t)size.QuadPart;
+	if (mSize == 0) return;
+
+	mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping)
+		mData = reinterpret_cast<const std::byte*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	if (!mData) {
+		if (mMapping) CloseHandle(mMapping);
+		CloseHandle(mFile);
+		throw std::runtime_error("Failed to map " + filename.string());
+	}
+}
+MappedFile::~MappedFile() {
+	if (mData) UnmapViewOfFile(mData);
+	if (mMapping) CloseHandle(mMapping);
+	if (mFile) CloseHandle(mFile);
+}
+
+// pages of a read-only view are trimmed from the working set by the OS as needed
+void MappedFile::Discard(const std::span<const std::byte> range) const {}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path& filename) {
+	const int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) throw std::runtime_error("Failed to open " + filename.string());
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw std::runtime_error("Failed to get the size of " + filename.string());
+	}
+	mSize = (size_t)st.st_size;
+	if (mSize > 0) {
+		void* data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Failed to map " + filename.string());
+		}
+		mData = reinterpret_cast<const std::byte*>(data);
+		madvise(data, mSize, MADV_SEQUENTIAL);
+	}
+	// the mapping keeps the file alive
+	close(fd);
+}
+MappedFile::~MappedFile() {
+	if (mData) munmap(const_cast<std::byte*>(mData), mSize);
+}
+
+void MappedFile::Discard(const std::span<const std::byte> range) const {
+	// only whole pages inside the range can be dropped
+	const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t begin = ((size_t)(range.data() - mData) + pageSize - 1) / pageSize * pageSize;
+	const size_t end = (size_t)(range.data() + range.size() - mData) / pageSize * pageSize;
+	if (end > begin)
+		madvise(const_cast<std::byte*>(mData) + begin, end - begin, MADV_DONTNEED);
+}
+
+#endif
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <filesystem>
+#include <span>
+
+namespace ptvk {
+
+// Read-only memory mapping of a whole file.
+// Pages are read on first access and are backed by the file itself, so they can be dropped again without writing anything back.
+class MappedFile {
+public:
+	MappedFile(const std::filesystem::path& filename);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	inline std::span<const std::byte> Data() const { return { mData, mSize }; }
+	inline size_t size() const { return mSize; }
+
+	// Hints that a range will not be read again soon, so that its pages stop counting towards the process' resident memory.
+	// The range stays readable, it is simply read from the file again.
+	void Discard(const std::span<const std::byte> range) const;
+
+private:
+	const std::byte* mData = nullptr;
+	size_t mSize = 0;
+#ifdef _WIN32
+	void* mFile = nullptr;
+	void* mMapping = nullptr;
+#endif
+};
+
+}
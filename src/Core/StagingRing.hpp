@@ -0,0 +1,154 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+
+#include "Buffer.hpp"
+
+namespace ptvk {
+
+// Persistently mapped upload buffer shared by every command buffer on a device.
+// Sub-allocations are made in FIFO order, and retired when the command buffer that recorded them is reset, or when its fence signals.
+class StagingRing {
+public:
+	struct Stats {
+		vk::DeviceSize mCapacity = 0;
+		vk::DeviceSize mUsed = 0;
+		vk::DeviceSize mPeakUsed = 0;
+		size_t mLiveAllocations = 0;
+		size_t mAllocations = 0;
+		size_t mDedicatedAllocations = 0; // uploads which were too large for the ring, or found it full
+		size_t mStalls = 0; // allocations which had to wait on a fence
+		float mStallTime = 0; // ms
+	};
+
+	inline StagingRing(Device& device, const vk::DeviceSize capacity) : mDevice(device) {
+		mStats.mCapacity = capacity;
+		if (capacity > 0)
+			mBuffer = std::make_shared<Buffer>(device, "StagingRing", capacity, vk::BufferUsageFlagBits::eTransferSrc,
+				vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent,
+				VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+	}
+
+	inline const std::shared_ptr<Buffer>& GetBuffer() const { return mBuffer; }
+
+	// Returns an empty view if the allocation does not fit, in which case the caller should use a dedicated staging buffer
+	inline Buffer::View<std::byte> Allocate(const vk::DeviceSize size, const vk::DeviceSize alignment, uint64_t& id) {
+		std::unique_lock l(mMutex);
+		// oversized payloads would evict everything else in the ring
+		if (!mBuffer || size == 0 || size > mStats.mCapacity/2) {
+			mStats.mDedicatedAllocations++;
+			return {};
+		}
+
+		while (true) {
+			RetireCompleted();
+
+			if (const auto offset = TryAllocate(size, alignment)) {
+				id = mNextId++;
+				mEntries.emplace_back(id, *offset, *offset + size, nullptr, false);
+				mTail = *offset + size;
+				mStats.mAllocations++;
+				mStats.mUsed = GetUsed();
+				mStats.mPeakUsed = std::max(mStats.mPeakUsed, mStats.mUsed);
+				return Buffer::View<std::byte>(mBuffer, *offset, size);
+			}
+
+			// the oldest allocation belongs to a command buffer which is still being recorded, waiting on it could deadlock
+			Entry& oldest = mEntries.front();
+			if (!oldest.mFence) {
+				mStats.mDedicatedAllocations++;
+				return {};
+			}
+
+			// wait without holding the lock, so other threads can keep allocating and releasing. the entry is retired by RetireCompleted once its fence signals
+			const std::shared_ptr<vk::raii::Fence> fence = oldest.mFence;
+			l.unlock();
+			const auto t0 = std::chrono::high_resolution_clock::now();
+			if (mDevice->waitForFences(**fence, true, ~0ull) != vk::Result::eSuccess)
+				throw std::runtime_error("waitForFences failed");
+			const float stallTime = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(std::chrono::high_resolution_clock::now() - t0).count();
+			l.lock();
+			mStats.mStalls++;
+			mStats.mStallTime += stallTime;
+		}
+	}
+
+	// Called when the command buffer which owns the allocations is submitted
+	inline void SetFence(const std::vector<uint64_t>& ids, const std::shared_ptr<vk::raii::Fence>& fence) {
+		std::scoped_lock l(mMutex);
+		for (Entry& e : mEntries)
+			if (std::ranges::binary_search(ids, e.mId))
+				e.mFence = fence;
+	}
+
+	// Called when the command buffer which owns the allocations is reset or destroyed
+	inline void Release(const std::vector<uint64_t>& ids) {
+		std::scoped_lock l(mMutex);
+		for (Entry& e : mEntries)
+			if (std::ranges::binary_search(ids, e.mId))
+				e.mReleased = true;
+		RetireCompleted();
+	}
+
+	inline Stats GetStats() const {
+		std::scoped_lock l(mMutex);
+		Stats s = mStats;
+		s.mLiveAllocations = mEntries.size();
+		return s;
+	}
+
+private:
+	struct Entry {
+		uint64_t mId;
+		vk::DeviceSize mBegin;
+		vk::DeviceSize mEnd;
+		std::shared_ptr<vk::raii::Fence> mFence;
+		bool mReleased;
+	};
+
+	Device& mDevice;
+	std::shared_ptr<Buffer> mBuffer;
+
+	mutable std::mutex mMutex;
+	std::deque<Entry> mEntries; // in allocation order
+	vk::DeviceSize mTail = 0; // end of the most recent allocation
+	uint64_t mNextId = 1;
+	Stats mStats;
+
+	inline vk::DeviceSize GetUsed() const {
+		if (mEntries.empty()) return 0;
+		const vk::DeviceSize head = mEntries.front().mBegin;
+		return mTail > head ? mTail - head : mStats.mCapacity - head + mTail;
+	}
+
+	// Pops released allocations off the front of the ring
+	inline void RetireCompleted() {
+		for (Entry& e : mEntries)
+			if (!e.mReleased && e.mFence && e.mFence->getStatus() == vk::Result::eSuccess)
+				e.mReleased = true;
+		while (!mEntries.empty() && mEntries.front().mReleased)
+			mEntries.pop_front();
+		if (mEntries.empty())
+			mTail = 0;
+		mStats.mUsed = GetUsed();
+	}
+
+	// Free space is [mTail, capacity) + [0, head) when the ring has not wrapped, and [mTail, head) when it has.
+	// Allocations never end exactly at head, so that mTail == head only when the ring is empty.
+	inline std::optional<vk::DeviceSize> TryAllocate(const vk::DeviceSize size, const vk::DeviceSize alignment) const {
+		const vk::DeviceSize aligned = (mTail + alignment - 1) / alignment * alignment;
+		if (mEntries.empty())
+			return 0;
+		const vk::DeviceSize head = mEntries.front().mBegin;
+		if (mTail > head) {
+			if (aligned + size <= mStats.mCapacity) return aligned;
+			if (size < head) return 0;
+		} else if (aligned + size < head)
+			return aligned;
+		return std::nullopt;
+	}
+};
+
+}
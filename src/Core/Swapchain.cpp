@@ -103,6 +103,7 @@ bool Swapchain::AcquireImage(const std::chrono::nanoseconds& timeout) {
 void Swapchain::Present(const vk::raii::Queue queue, const vk::ArrayProxy<const vk::Semaphore>& waitSemaphores) {
 	ProfilerScope ps("Swapchain::present");
 
+	std::scoped_lock l(mDevice.GetQueueMutex(*queue));
 	const vk::Result result = queue.presentKHR(vk::PresentInfoKHR(waitSemaphores, *mSwapchain, mImageIndex));
 	if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eErrorSurfaceLostKHR)
 		mDirty = true;
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <queue>
+#include <functional>
+
+namespace ptvk {
+
+// Fixed number of worker threads consuming a FIFO queue of tasks
+class ThreadPool {
+public:
+	inline ThreadPool(const uint32_t threadCount = std::thread::hardware_concurrency()) {
+		mThreads.resize(std::max(threadCount, 1u));
+		for (std::thread& t : mThreads)
+			t = std::thread([this]() { WorkerLoop(); });
+	}
+	inline ~ThreadPool() {
+		{
+			std::scoped_lock lock(mMutex);
+			mStop = true;
+		}
+		mCondition.notify_all();
+		for (std::thread& t : mThreads)
+			t.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	inline uint32_t ThreadCount() const { return (uint32_t)mThreads.size(); }
+
+	template<std::invocable F>
+	inline std::future<std::invoke_result_t<F>> Enqueue(F&& fn) {
+		auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(fn));
+		std::future<std::invoke_result_t<F>> result = task->get_future();
+		{
+			std::scoped_lock lock(mMutex);
+			mQueue.emplace([task]() { (*task)(); });
+		}
+		mCondition.notify_one();
+		return result;
+	}
+
+private:
+	std::vector<std::thread> mThreads;
+	std::queue<std::function<void()>> mQueue;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool mStop = false;
+
+	inline void WorkerLoop() {
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock lock(mMutex);
+				mCondition.wait(lock, [&]() { return mStop || !mQueue.empty(); });
+				if (mQueue.empty()) return;
+				task = std::move(mQueue.front());
+				mQueue.pop();
+			}
+			task();
+		}
+	}
+};
+
+}
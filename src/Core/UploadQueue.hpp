@@ -0,0 +1,144 @@
+#pragma once
+
+#include <thread>
+#include <condition_variable>
+
+#include "CommandBuffer.hpp"
+
+namespace ptvk {
+
+// Dedicated queue which streams assets in alongside rendering.
+// Loader threads record into command buffers from CreateCommandBuffer and hand them to Submit. A worker thread gathers every command buffer
+// submitted since its last batch into a single vkQueueSubmit, which signals a timeline semaphore with the batch's last value.
+// Command buffers are freed by the threads that created them (command pools are per thread), so callers keep them alive until their value completes,
+// and the worker releases its references before submitting.
+class UploadQueue {
+public:
+	struct Stats {
+		size_t mBatches = 0;
+		size_t mCommandBuffers = 0;
+		size_t mLargestBatch = 0;
+		size_t mFlushes = 0; // SubmitAndWait calls
+	};
+
+	inline UploadQueue(Device& device, const uint32_t queueFamily, const uint32_t queueIndex)
+		: mDevice(device), mQueueFamily(queueFamily), mQueueIndex(queueIndex), mTimeline(nullptr) {
+		mQueue = *device->getQueue(queueFamily, queueIndex);
+		vk::SemaphoreTypeCreateInfo typeInfo(vk::SemaphoreType::eTimeline, 0);
+		mTimeline = vk::raii::Semaphore(*device, vk::SemaphoreCreateInfo({}, &typeInfo));
+		device.SetDebugName(*mTimeline, "UploadQueue/Timeline");
+		mThread = std::thread([this]() { WorkerLoop(); });
+	}
+	inline ~UploadQueue() {
+		{
+			std::scoped_lock lock(mMutex);
+			mStop = true;
+		}
+		mCondition.notify_all();
+		mThread.join();
+		Wait(mNextValue - 1);
+	}
+
+	UploadQueue(const UploadQueue&) = delete;
+	UploadQueue& operator=(const UploadQueue&) = delete;
+
+	inline uint32_t GetQueueFamily() const { return mQueueFamily; }
+	inline uint32_t GetQueueIndex() const { return mQueueIndex; }
+	inline vk::Semaphore GetTimeline() const { return *mTimeline; }
+
+	// A command buffer in the recording state, which tracks the resources it accesses so that they can be released to another queue family
+	inline std::shared_ptr<CommandBuffer> CreateCommandBuffer(const std::string& name) {
+		auto commandBuffer = std::make_shared<CommandBuffer>(mDevice, name, mQueueFamily);
+		commandBuffer->Reset();
+		commandBuffer->TrackOwnership();
+		return commandBuffer;
+	}
+
+	// Ends commandBuffer and queues it for the next batch. Returns the timeline value which is signalled once it completes
+	inline uint64_t Submit(const std::shared_ptr<CommandBuffer>& commandBuffer) {
+		commandBuffer->End();
+		uint64_t value;
+		{
+			std::scoped_lock lock(mMutex);
+			value = mNextValue++;
+			mPending.emplace_back(commandBuffer);
+		}
+		mCondition.notify_one();
+		return value;
+	}
+
+	// Submits commandBuffer on its own, waits for it and begins recording again. For loaders which need to bound the staging memory they hold
+	inline void SubmitAndWait(CommandBuffer& commandBuffer) {
+		commandBuffer.Submit(mQueue);
+		if (mDevice->waitForFences(**commandBuffer.GetCompletionFence(), true, std::numeric_limits<uint64_t>::max()) != vk::Result::eSuccess)
+			throw std::runtime_error("waitForFences failed");
+		commandBuffer.Reset();
+		std::scoped_lock lock(mMutex);
+		mStats.mFlushes++;
+	}
+
+	inline uint64_t GetCompletedValue() const { return mTimeline.getCounterValue(); }
+	inline uint64_t GetSubmittedValue() {
+		std::scoped_lock lock(mMutex);
+		return mNextValue - 1;
+	}
+	inline void Wait(const uint64_t value) const {
+		if (value == 0) return;
+		if (mDevice->waitSemaphores(vk::SemaphoreWaitInfo({}, *mTimeline, value), std::numeric_limits<uint64_t>::max()) != vk::Result::eSuccess)
+			throw std::runtime_error("waitSemaphores failed");
+	}
+
+	inline Stats GetStats() {
+		std::scoped_lock lock(mMutex);
+		return mStats;
+	}
+
+private:
+	Device& mDevice;
+	uint32_t mQueueFamily;
+	uint32_t mQueueIndex;
+	vk::Queue mQueue;
+	vk::raii::Semaphore mTimeline;
+
+	std::thread mThread;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool mStop = false;
+	std::vector<std::shared_ptr<CommandBuffer>> mPending; // in value order
+	uint64_t mNextValue = 1;
+	Stats mStats;
+
+	inline void WorkerLoop() {
+		while (true) {
+			std::vector<std::shared_ptr<CommandBuffer>> batch;
+			uint64_t value;
+			{
+				std::unique_lock lock(mMutex);
+				mCondition.wait(lock, [&]() { return mStop || !mPending.empty(); });
+				if (mPending.empty()) return;
+				batch.swap(mPending);
+				value = mNextValue - 1;
+				mStats.mBatches++;
+				mStats.mCommandBuffers += batch.size();
+				mStats.mLargestBatch = std::max(mStats.mLargestBatch, batch.size());
+			}
+
+			// the fence is set before submitting, and the batch's references dropped, so that the last reference to each command buffer
+			// is always held by the thread which created it: the submitter keeps it until the value completes, which cannot happen before the submit below
+			auto fence = std::make_shared<vk::raii::Fence>(*mDevice, vk::FenceCreateInfo());
+			std::vector<vk::CommandBuffer> commandBuffers;
+			for (const auto& cb : batch) {
+				cb->SetCompletionFence(fence);
+				commandBuffers.emplace_back(***cb);
+			}
+			batch.clear();
+
+			const vk::TimelineSemaphoreSubmitInfo timelineInfo({}, value);
+			const vk::Semaphore signal = *mTimeline;
+			std::scoped_lock lock(mDevice.GetQueueMutex(mQueue));
+			mQueue.submit(vk::SubmitInfo({}, {}, commandBuffers, signal, &timelineInfo), **fence);
+		}
+	}
+};
+
+}
@@ -9,6 +9,7 @@
 #include <unordered_set>
 #include <unordered_map>
 #include <ranges>
+#include <span>
 #include <utility>
 
 #include <vulkan/vulkan_raii.hpp>
@@ -241,6 +242,32 @@ inline constexpr T GetTexelSize(vk::Format format) {
 	return 0;
 }
 
+// Size of a compressed block of format, or of a texel for uncompressed formats, in bytes
+inline uint32_t GetTexelBlockSize(const vk::Format format) {
+	switch (format) {
+	case vk::Format::eBc1RgbUnormBlock:
+	case vk::Format::eBc1RgbSrgbBlock:
+	case vk::Format::eBc1RgbaUnormBlock:
+	case vk::Format::eBc1RgbaSrgbBlock:
+	case vk::Format::eBc4UnormBlock:
+	case vk::Format::eBc4SnormBlock:
+		return 8;
+	case vk::Format::eBc2UnormBlock:
+	case vk::Format::eBc2SrgbBlock:
+	case vk::Format::eBc3UnormBlock:
+	case vk::Format::eBc3SrgbBlock:
+	case vk::Format::eBc5UnormBlock:
+	case vk::Format::eBc5SnormBlock:
+	case vk::Format::eBc6HUfloatBlock:
+	case vk::Format::eBc6HSfloatBlock:
+	case vk::Format::eBc7UnormBlock:
+	case vk::Format::eBc7SrgbBlock:
+		return 16;
+	default:
+		return GetTexelSize(format);
+	}
+}
+
 template<typename T = uint32_t> requires(std::is_arithmetic_v<T>)
 inline constexpr T GetChannelCount(const vk::Format format) {
 	switch (format) {
@@ -336,6 +363,8 @@ inline constexpr T GetChannelCount(const vk::Format format) {
 	case vk::Format::eBc1RgbSrgbBlock:
 	case vk::Format::eBc3UnormBlock:
 	case vk::Format::eBc3SrgbBlock:
+	case vk::Format::eBc6HUfloatBlock:
+	case vk::Format::eBc6HSfloatBlock:
 		return 3;
 	case vk::Format::eR5G5B5A1UnormPack16:
 	case vk::Format::eB5G5R5A1UnormPack16:
@@ -391,6 +420,8 @@ inline constexpr T GetChannelCount(const vk::Format format) {
 	case vk::Format::eBc1RgbaSrgbBlock:
 	case vk::Format::eBc2UnormBlock:
 	case vk::Format::eBc2SrgbBlock:
+	case vk::Format::eBc7UnormBlock:
+	case vk::Format::eBc7SrgbBlock:
 		return 4;
 	}
 }
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cmath>
+#include <span>
+#include <vector>
+
+#include <Common/Math.h>
+#include <Common/SceneTypes.h>
+
+namespace ptvk {
+
+// Fills table with an alias table (Vose's method) for sampling index i with probability weights[i] / sum(weights) in constant time.
+// Negative weights are treated as zero, and a table with no positive weights samples uniformly. Returns the sum of the weights.
+inline double BuildAliasTable(const std::span<const float> weights, const std::span<AliasTableEntry> table) {
+	const size_t n = std::min(weights.size(), table.size());
+	if (n == 0) return 0;
+
+	double sum = 0;
+	for (size_t i = 0; i < n; i++)
+		sum += std::max(weights[i], 0.f);
+
+	std::vector<double> scaled(n);
+	std::vector<uint32_t> small, large;
+	for (size_t i = 0; i < n; i++) {
+		const double p = sum > 0 ? std::max(weights[i], 0.f) / sum : 1.0 / n;
+		table[i].mPdf = (float)p;
+		scaled[i] = p * n;
+		(scaled[i] < 1 ? small : large).emplace_back((uint32_t)i);
+	}
+
+	while (!small.empty() && !large.empty()) {
+		const uint32_t s = small.back();
+		const uint32_t l = large.back();
+		small.pop_back();
+		table[s].mThreshold = (float)scaled[s];
+		table[s].mAlias = l;
+		scaled[l] = (scaled[l] + scaled[s]) - 1;
+		if (scaled[l] < 1) {
+			large.pop_back();
+			small.emplace_back(l);
+		}
+	}
+	// what remains is 1 up to rounding error
+	for (const uint32_t i : large) { table[i].mThreshold = 1; table[i].mAlias = i; }
+	for (const uint32_t i : small) { table[i].mThreshold = 1; table[i].mAlias = i; }
+
+	for (size_t i = 0; i < n; i++)
+		table[i].mAliasPdf = table[table[i].mAlias].mPdf;
+
+	return sum;
+}
+
+// Marginal/conditional alias table over the texels of an equirectangular luminance image, weighted by luminance times solid angle.
+// The table is box-filtered down to at most maxWidth texels wide, since it is 16 bytes per entry. Table texels cover equal uv ranges,
+// as SampleBackgroundUV (Scene.slang) assumes, so image texels that straddle two table texels are split between them by overlap.
+// Layout matches SampleBackgroundUV: one entry per row, then one row of entries per row, holding joint probabilities.
+inline constexpr uint32_t gEnvironmentAliasTableMaxWidth = 2048;
+inline std::vector<AliasTableEntry> BuildEnvironmentAliasTable(const std::span<const float> luminance, const uint2 extent, uint2& tableExtent, const uint32_t maxWidth = gEnvironmentAliasTableMaxWidth) {
+	if (extent.x == 0 || extent.y == 0 || luminance.size() < (size_t)extent.x*extent.y) return {};
+
+	const uint32_t factor = (extent.x + maxWidth - 1) / maxWidth;
+	tableExtent = uint2((extent.x + factor - 1) / factor, (extent.y + factor - 1) / factor);
+
+	// image texel i covers [i*tableSize, (i+1)*tableSize) and table texel j covers [j*imageSize, (j+1)*imageSize) in the same units,
+	// so a texel overlaps at most two table texels. Returns the first one, and the fraction of the texel inside it
+	const auto Overlap = [](const uint32_t i, const uint32_t imageSize, const uint32_t tableSize) {
+		const uint64_t begin = (uint64_t)i*tableSize;
+		const uint32_t j = (uint32_t)(begin / imageSize);
+		const uint64_t boundary = (uint64_t)(j + 1)*imageSize;
+		return std::pair(j, begin + tableSize <= boundary ? 1.f : (float)(boundary - begin) / tableSize);
+	};
+	std::vector<std::pair<uint32_t, float>> columns(extent.x);
+	for (uint32_t x = 0; x < extent.x; x++)
+		columns[x] = Overlap(x, extent.x, tableExtent.x);
+
+	std::vector<float> weights((size_t)tableExtent.x*tableExtent.y, 0.f);
+	for (uint32_t y = 0; y < extent.y; y++) {
+		// solid angle of a texel is proportional to sin(theta) at its center
+		const float sinTheta = (float)std::sin(M_PI * (y + 0.5) / extent.y);
+		const auto[row, rowFraction] = Overlap(y, extent.y, tableExtent.y);
+		for (uint32_t x = 0; x < extent.x; x++) {
+			const float l = luminance[(size_t)y*extent.x + x];
+			if (!std::isfinite(l) || l <= 0) continue;
+			const auto[column, columnFraction] = columns[x];
+			const float w = l * sinTheta;
+			const auto Add = [&](const uint32_t tx, const uint32_t ty, const float fraction) {
+				if (fraction > 0 && tx < tableExtent.x && ty < tableExtent.y)
+					weights[(size_t)ty*tableExtent.x + tx] += w * fraction;
+			};
+			Add(column,     row,     columnFraction       * rowFraction);
+			Add(column + 1, row,     (1 - columnFraction) * rowFraction);
+			Add(column,     row + 1, columnFraction       * (1 - rowFraction));
+			Add(column + 1, row + 1, (1 - columnFraction) * (1 - rowFraction));
+		}
+	}
+
+	std::vector<AliasTableEntry> table(tableExtent.y + (size_t)tableExtent.x*tableExtent.y);
+	std::vector<float> rowWeights(tableExtent.y);
+	for (uint32_t y = 0; y < tableExtent.y; y++) {
+		const std::span<AliasTableEntry> row = std::span(table).subspan(tableExtent.y + (size_t)y*tableExtent.x, tableExtent.x);
+		rowWeights[y] = (float)BuildAliasTable(std::span(weights).subspan((size_t)y*tableExtent.x, tableExtent.x), row);
+	}
+	BuildAliasTable(rowWeights, std::span(table).subspan(0, tableExtent.y));
+
+	// conditional probabilities -> joint probabilities
+	for (uint32_t y = 0; y < tableExtent.y; y++) {
+		for (AliasTableEntry& e : std::span(table).subspan(tableExtent.y + (size_t)y*tableExtent.x, tableExtent.x)) {
+			e.mPdf      *= table[y].mPdf;
+			e.mAliasPdf *= table[y].mPdf;
+		}
+	}
+	return table;
+}
+
+}
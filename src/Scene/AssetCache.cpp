@@ -0,0 +1,721 @@
+#include "Scene.hpp"
+#include "MeshProcessing.hpp"
+#include <Core/BlockCompression.hpp>
+
+#include <chrono>
+#include <format>
+
+#include <json.hpp>
+
+namespace ptvk {
+
+static constexpr uint32_t gAssetCacheMagic = 0x43565450; // 'PTVC'
+static constexpr uint32_t gTextureCacheMagic = 0x54565450; // 'PTVT'
+
+class BinaryWriter {
+public:
+	std::ofstream mStream;
+
+	inline BinaryWriter(const std::filesystem::path& path) : mStream(path, std::ios::binary) {}
+
+	template<typename T> requires(std::is_trivially_copyable_v<T>)
+	inline void Write(const T& v) { mStream.write(reinterpret_cast<const char*>(&v), sizeof(T)); }
+	inline void Write(const std::string& s) {
+		Write((uint32_t)s.size());
+		mStream.write(s.data(), s.size());
+	}
+	inline void Write(const std::span<const std::byte> data) {
+		Write((uint64_t)data.size());
+		mStream.write(reinterpret_cast<const char*>(data.data()), data.size());
+	}
+};
+
+class BinaryReader {
+public:
+	std::ifstream mStream;
+
+	inline BinaryReader(const std::filesystem::path& path) : mStream(path, std::ios::binary) {}
+
+	template<typename T> requires(std::is_trivially_copyable_v<T>)
+	inline T Read() {
+		T v;
+		Read(&v, sizeof(T));
+		return v;
+	}
+	inline std::string ReadString() {
+		std::string s;
+		s.resize(Read<uint32_t>());
+		Read(s.data(), s.size());
+		return s;
+	}
+	inline void Read(void* dst, const size_t size) {
+		mStream.read(reinterpret_cast<char*>(dst), size);
+		if (!mStream) throw std::runtime_error("Unexpected end of file");
+	}
+};
+
+AssetCache::AssetCache(const Instance& instance) {
+	if (instance.GetOption("no-asset-cache")) return;
+	if (auto arg = instance.GetOption("asset-cache-path"); arg && !arg->empty())
+		mDirectory = *arg;
+	else
+		mDirectory = std::filesystem::temp_directory_path() / "ptvk_asset_cache";
+}
+
+// glTF uris are percent-encoded
+static std::string DecodeUri(const std::string& uri) {
+	std::string s;
+	for (size_t i = 0; i < uri.size(); i++) {
+		if (uri[i] == '%' && i + 2 < uri.size() && std::isxdigit((unsigned char)uri[i+1]) && std::isxdigit((unsigned char)uri[i+2])) {
+			s += (char)std::stoi(uri.substr(i + 1, 2), nullptr, 16);
+			i += 2;
+		} else
+			s += uri[i];
+	}
+	return s;
+}
+
+static size_t StatFile(const std::filesystem::path& path) {
+	std::error_code ec;
+	const auto size = std::filesystem::file_size(path, ec);
+	if (ec) return 0;
+	return HashArgs(size, std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+}
+
+AssetCache::Key AssetCache::ComputeKey(const std::filesystem::path& filename, const size_t optionsHash) const {
+	Key key;
+	key.mSlot = HashArgs(gVersion, optionsHash, std::filesystem::absolute(filename).string());
+
+	std::error_code ec;
+	key.mSourceSize = std::filesystem::file_size(filename, ec);
+	if (ec) key.mSourceSize = 0;
+	std::ifstream file(filename, std::ios::binary);
+	std::string header(64 * 1024, '\0');
+	file.read(header.data(), header.size());
+	header.resize((size_t)file.gcount());
+	key.mStamp = HashArgs(StatFile(filename), std::hash<std::string>()(header));
+
+	// .gltf files reference external buffers and images, usually next to the file. .glb files embed them
+	if (filename.extension() != ".glb") {
+		std::ifstream json(filename);
+		const nlohmann::json gltf = nlohmann::json::parse(json, nullptr, false);
+		if (gltf.is_discarded()) return key;
+		for (const char* array : { "buffers", "images" }) {
+			if (!gltf.contains(array) || !gltf[array].is_array()) continue;
+			for (const auto& entry : gltf[array]) {
+				if (!entry.contains("uri") || !entry["uri"].is_string()) continue;
+				const std::string uri = entry["uri"].get<std::string>();
+				if (uri.starts_with("data:")) continue; // embedded in the source file
+				key.mExternalStamp = HashArgs(key.mExternalStamp, uri, StatFile(filename.parent_path() / DecodeUri(uri)));
+			}
+		}
+	}
+
+	return key;
+}
+
+size_t AssetCache::ComputeContentHash(const std::filesystem::path& filename) {
+	size_t hash = 0;
+	std::ifstream file(filename, std::ios::binary);
+	std::string chunk(1 << 24, '\0');
+	while (file) {
+		file.read(chunk.data(), chunk.size());
+		hash = HashCombine(hash, std::hash<std::string_view>()(std::string_view(chunk.data(), (size_t)file.gcount())));
+	}
+	return hash;
+}
+
+std::filesystem::path AssetCache::GetPath(const std::filesystem::path& filename, const Key& key) const {
+	return mDirectory / std::format("{}_{:016x}.ptvkcache", filename.stem().string(), key.mSlot);
+}
+
+#pragma region Writing
+
+bool AssetCache::Writer::Write(const AssetCache& cache, const std::filesystem::path& filename, const Key& key, SceneNode& root) const {
+	const auto t0 = std::chrono::high_resolution_clock::now();
+
+	// assign indices to every resource reachable from root
+
+	std::vector<const Buffer*> buffers;
+	std::vector<const Image*> images;
+	std::vector<const Material*> materials;
+	std::vector<const Mesh*> meshes;
+	std::unordered_map<const void*, int32_t> indices;
+	const auto GetIndex = [&]<typename T>(std::vector<const T*>& v, const T* ptr) -> int32_t {
+		if (!ptr) return -1;
+		auto it = indices.find(ptr);
+		if (it == indices.end()) {
+			it = indices.emplace(ptr, (int32_t)v.size()).first;
+			v.emplace_back(ptr);
+		}
+		return it->second;
+	};
+	const auto AddMaterial = [&](const std::shared_ptr<Material>& m) {
+		if (!m) return;
+		for (const Image::View& v : { m->mBaseColor, m->mPackedParams, m->mEmission, m->mBumpMap })
+			GetIndex(images, v.GetImage().get());
+		GetIndex(materials, m.get());
+	};
+
+	struct NodeRecord {
+		SceneNode* mNode;
+		int32_t mParent;
+	};
+	std::vector<NodeRecord> nodes;
+	{
+		std::stack<NodeRecord> todo;
+		todo.push({ &root, -1 });
+		while (!todo.empty()) {
+			const NodeRecord n = todo.top();
+			todo.pop();
+			const int32_t index = (int32_t)nodes.size();
+			nodes.emplace_back(n);
+			const auto AddMesh = [&](const std::shared_ptr<Material>& material, const std::shared_ptr<Mesh>& mesh) {
+				AddMaterial(material);
+				GetIndex(meshes, mesh.get());
+				GetIndex(buffers, mesh->GetIndices().GetBuffer().get());
+				for (const auto& attribs : mesh->GetVertices() | std::views::values)
+					for (const auto&[view, desc] : attribs)
+						GetIndex(buffers, view.GetBuffer().get());
+			};
+			if (const auto r = n.mNode->GetComponent<MeshRenderer>(); r && r->mMesh)
+				AddMesh(r->mMaterial, r->mMesh);
+			if (const auto r = n.mNode->GetComponent<InstancedMeshRenderer>(); r && r->mMesh)
+				AddMesh(r->mMaterial, r->mMesh);
+			if (const auto r = n.mNode->GetComponent<SphereRenderer>())
+				AddMaterial(r->mMaterial);
+			for (const std::shared_ptr<SceneNode>& c : n.mNode->GetChildren())
+				todo.push({ c.get(), index });
+		}
+	}
+
+	// each buffer is stored as its ranges with host copies, merged and packed together.
+	// A buffer uploaded by this load is a single range, stored as is
+	struct StoredRange {
+		size_t mOffset;
+		size_t mSize;
+		size_t mStoredOffset;
+	};
+	std::vector<std::vector<StoredRange>> storedRanges(buffers.size());
+	std::vector<std::vector<std::byte>> packedBuffers(buffers.size());
+	std::vector<std::span<const std::byte>> storedBuffers(buffers.size());
+	for (size_t b = 0; b < buffers.size(); b++) {
+		std::vector<HostBufferRange> ranges;
+		const auto[begin, end] = mBuffers.equal_range(buffers[b]);
+		for (auto it = begin; it != end; ++it)
+			ranges.emplace_back(it->second);
+		if (ranges.size() == 1 && ranges[0].mOffset == 0) {
+			storedRanges[b].emplace_back(StoredRange{ 0, ranges[0].mData.size(), 0 });
+			storedBuffers[b] = ranges[0].mData;
+			continue;
+		}
+
+		std::ranges::sort(ranges, {}, &HostBufferRange::mOffset);
+		size_t storedSize = 0;
+		for (const HostBufferRange& r : ranges) {
+			if (!storedRanges[b].empty() && r.mOffset <= storedRanges[b].back().mOffset + storedRanges[b].back().mSize) {
+				StoredRange& last = storedRanges[b].back();
+				last.mSize = std::max(last.mSize, r.mOffset + r.mData.size() - last.mOffset);
+			} else
+				storedRanges[b].emplace_back(StoredRange{ r.mOffset, r.mData.size(), (storedSize + 15) & ~size_t(15) });
+			storedSize = storedRanges[b].back().mStoredOffset + storedRanges[b].back().mSize;
+		}
+		packedBuffers[b].resize(storedSize);
+		for (const HostBufferRange& r : ranges) {
+			const StoredRange& dst = *std::ranges::find_if(storedRanges[b], [&](const StoredRange& s) { return r.mOffset >= s.mOffset && r.mOffset + r.mData.size() <= s.mOffset + s.mSize; });
+			std::memcpy(packedBuffers[b].data() + dst.mStoredOffset + (r.mOffset - dst.mOffset), r.mData.data(), r.mData.size());
+		}
+		storedBuffers[b] = packedBuffers[b];
+	}
+
+	// offset of a view in its stored buffer, or nullopt if no range holds it.
+	// Views may extend past the end of their data by less than a stride (interleaved glTF attributes), so only their start is checked
+	const auto GetStoredOffset = [&](const Buffer* buffer, const size_t offset) -> std::optional<uint64_t> {
+		if (!buffer) return std::nullopt;
+		for (const StoredRange& r : storedRanges[GetIndex(buffers, buffer)])
+			if (offset >= r.mOffset && offset <= r.mOffset + r.mSize)
+				return r.mStoredOffset + (offset - r.mOffset);
+		return std::nullopt;
+	};
+	for (const Mesh* m : meshes) {
+		const Buffer* missing = GetStoredOffset(m->GetIndices().GetBuffer().get(), m->GetIndices().Offset()) ? nullptr : m->GetIndices().GetBuffer().get();
+		bool found = !missing && m->GetIndices().GetBuffer();
+		for (const auto& attribs : m->GetVertices() | std::views::values)
+			for (const auto&[view, desc] : attribs)
+				if (found && !GetStoredOffset(view.GetBuffer().get(), view.Offset())) {
+					missing = view.GetBuffer().get();
+					found = false;
+				}
+		if (!found) {
+			std::cerr << "Not caching " << filename << ": missing data for buffer " << (missing ? missing->GetName() : "(null)") << std::endl;
+			return false;
+		}
+	}
+	for (const Image* i : images)
+		if (!mImages.contains(i)) {
+			std::cerr << "Not caching " << filename << ": missing data for image " << i->GetName() << std::endl;
+			return false;
+		}
+
+	const std::filesystem::path path = cache.GetPath(filename, key);
+	std::filesystem::create_directories(path.parent_path());
+
+	// write to a temporary file, so that a partially written cache is never read
+	const std::filesystem::path tmpPath = std::filesystem::path(path).concat(".tmp");
+	{
+		BinaryWriter w(tmpPath);
+		w.Write(gAssetCacheMagic);
+		w.Write(gVersion);
+		w.Write((uint64_t)key.mSlot);
+		w.Write((uint64_t)key.mStamp);
+		w.Write((uint64_t)key.mExternalStamp);
+		w.Write(key.mSourceSize);
+		w.Write((uint64_t)ComputeContentHash(filename));
+
+		w.Write((uint32_t)buffers.size());
+		for (size_t b = 0; b < buffers.size(); b++) {
+			w.Write(buffers[b]->GetName());
+			w.Write(storedBuffers[b]);
+		}
+
+		w.Write((uint32_t)images.size());
+		for (const Image* i : images) {
+			const auto& levels = mImages.at(i);
+			w.Write(i->GetName());
+			w.Write(i->GetFormat());
+			w.Write(i->GetExtent());
+			// all levels are stored in one blob, so they can be uploaded with a single copy
+			w.Write((uint32_t)levels.size());
+			uint64_t total = 0;
+			for (const auto& level : levels) {
+				w.Write((uint64_t)level.size());
+				total += level.size();
+			}
+			w.Write(total);
+			for (const auto& level : levels)
+				w.mStream.write(reinterpret_cast<const char*>(level.data()), level.size());
+		}
+
+		w.Write((uint32_t)materials.size());
+		for (const Material* m : materials) {
+			w.Write(m->mMaterial);
+			for (const Image::View& v : { m->mBaseColor, m->mPackedParams, m->mEmission, m->mBumpMap })
+				w.Write(GetIndex(images, v.GetImage().get()));
+			// the finest level of the emission luminance map. images may be block compressed, so it is not recomputed on load
+			const bool hasLuminance = m->mEmissionLuminance && !m->mEmissionLuminance->mLevels.empty();
+			w.Write(hasLuminance ? m->mEmissionLuminance->mExtents[0] : uint2(0));
+			if (hasLuminance)
+				w.Write(std::as_bytes(std::span(m->mEmissionLuminance->mLevels[0])));
+		}
+
+		w.Write((uint32_t)meshes.size());
+		for (const Mesh* m : meshes) {
+			w.Write(m->GetTopology());
+			w.Write((uint64_t)m->GetContentHash());
+			w.Write(m->GetVertices().mAabb);
+			w.Write(m->GetVertices().mPositionTransform);
+			const Buffer::StrideView& idx = m->GetIndices();
+			w.Write(GetIndex(buffers, idx.GetBuffer().get()));
+			w.Write(*GetStoredOffset(idx.GetBuffer().get(), idx.Offset()));
+			w.Write((uint64_t)idx.SizeBytes());
+			w.Write((uint64_t)idx.Stride());
+			w.Write((uint32_t)m->GetVertices().size());
+			for (const auto&[type, attribs] : m->GetVertices()) {
+				w.Write(type);
+				w.Write((uint32_t)attribs.size());
+				for (const auto&[view, desc] : attribs) {
+					w.Write(GetIndex(buffers, view.GetBuffer().get()));
+					w.Write(*GetStoredOffset(view.GetBuffer().get(), view.Offset()));
+					w.Write((uint64_t)view.SizeBytes());
+					w.Write(desc);
+				}
+			}
+		}
+
+		w.Write((uint32_t)nodes.size());
+		for (const auto&[node, parent] : nodes) {
+			w.Write(node->GetName());
+			w.Write(parent);
+			w.Write(node->Enabled());
+			const auto transform = node->GetComponent<float4x4>();
+			const auto meshRenderer = node->GetComponent<MeshRenderer>();
+			const auto instancedRenderer = node->GetComponent<InstancedMeshRenderer>();
+			const auto sphereRenderer = node->GetComponent<SphereRenderer>();
+			w.Write(transform != nullptr);
+			if (transform) w.Write(*transform);
+			w.Write(meshRenderer && meshRenderer->mMesh);
+			if (meshRenderer && meshRenderer->mMesh) {
+				w.Write(GetIndex(materials, meshRenderer->mMaterial.get()));
+				w.Write(GetIndex(meshes, meshRenderer->mMesh.get()));
+			}
+			w.Write(instancedRenderer && instancedRenderer->mMesh);
+			if (instancedRenderer && instancedRenderer->mMesh) {
+				w.Write(GetIndex(materials, instancedRenderer->mMaterial.get()));
+				w.Write(GetIndex(meshes, instancedRenderer->mMesh.get()));
+				w.Write(std::as_bytes(std::span(instancedRenderer->mTransforms)));
+			}
+			w.Write(sphereRenderer != nullptr);
+			if (sphereRenderer) {
+				w.Write(GetIndex(materials, sphereRenderer->mMaterial.get()));
+				w.Write(sphereRenderer->mRadius);
+			}
+		}
+
+		if (!w.mStream) {
+			std::cerr << "Failed to write " << tmpPath << std::endl;
+			w.mStream.close();
+			std::filesystem::remove(tmpPath);
+			return false;
+		}
+	}
+	std::filesystem::rename(tmpPath, path);
+
+	const auto[size, unit] = FormatBytes(std::filesystem::file_size(path));
+	std::cout << "Wrote " << path << " (" << size << " " << unit << ") in "
+		<< std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(std::chrono::high_resolution_clock::now() - t0).count() << "ms" << std::endl;
+	return true;
+}
+
+#pragma endregion
+
+#pragma region Reading
+
+std::shared_ptr<SceneNode> AssetCache::Read(CommandBuffer& commandBuffer, const std::filesystem::path& filename, const Key& key, const vk::BufferUsageFlags bufferUsage) const {
+	const std::filesystem::path path = GetPath(filename, key);
+	if (!std::filesystem::exists(path)) return nullptr;
+
+	BinaryReader r(path);
+	if (r.Read<uint32_t>() != gAssetCacheMagic || r.Read<uint32_t>() != gVersion || r.Read<uint64_t>() != key.mSlot) {
+		std::cerr << "Ignoring stale asset cache " << path << std::endl;
+		return nullptr;
+	}
+	const uint64_t stamp = r.Read<uint64_t>();
+	const uint64_t externalStamp = r.Read<uint64_t>();
+	const uint64_t sourceSize = r.Read<uint64_t>();
+	const uint64_t contentHash = r.Read<uint64_t>();
+	// a source which was touched or copied without changing size is only hashed in full here
+	if (externalStamp != key.mExternalStamp || (stamp != key.mStamp && (sourceSize != key.mSourceSize || contentHash != ComputeContentHash(filename)))) {
+		std::cerr << "Ignoring stale asset cache " << path << std::endl;
+		return nullptr;
+	}
+	if (stamp != key.mStamp) {
+		// same contents, so later loads can skip the hash
+		std::fstream f(path, std::ios::binary | std::ios::in | std::ios::out);
+		f.seekp(sizeof(uint32_t)*2 + sizeof(uint64_t));
+		const uint64_t newStamp = key.mStamp;
+		f.write(reinterpret_cast<const char*>(&newStamp), sizeof(newStamp));
+	}
+
+	Device& device = commandBuffer.mDevice;
+
+	using clock = std::chrono::high_resolution_clock;
+	auto t0 = clock::now();
+	const auto Lap = [&]() {
+		const auto t1 = clock::now();
+		const float ms = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(t1 - t0).count();
+		t0 = t1;
+		return ms;
+	};
+
+	size_t bytesRead = 0;
+
+	// pixel/vertex data is read straight into mapped staging memory
+	const auto ReadStaging = [&](const std::string& name) {
+		const uint64_t size = r.Read<uint64_t>();
+		if (size > std::filesystem::file_size(path)) throw std::runtime_error("Invalid blob size in " + path.string());
+		Buffer::View<std::byte> staging = std::make_shared<Buffer>(device, name + "/Staging", std::max<uint64_t>(size, 1), vk::BufferUsageFlagBits::eTransferSrc,
+			vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent,
+			VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+		r.Read(staging.data(), size);
+		commandBuffer.HoldResource(staging);
+		bytesRead += size;
+		return Buffer::View<std::byte>(staging, 0, size);
+	};
+
+	// buffers are copied to the device once the meshes are read, as those reused from other loads need none
+	std::vector<std::pair<std::string, Buffer::View<std::byte>>> stagedBuffers(r.Read<uint32_t>());
+	for (auto&[name, staging] : stagedBuffers) {
+		name = r.ReadString();
+		staging = ReadStaging(name);
+	}
+	const float bufferTime = Lap();
+
+	std::vector<std::shared_ptr<Image>> images(r.Read<uint32_t>());
+	for (std::shared_ptr<Image>& image : images) {
+		const std::string name = r.ReadString();
+		ImageInfo md = {};
+		md.mFormat = r.Read<vk::Format>();
+		md.mExtent = r.Read<vk::Extent3D>();
+		md.mLevels = GetMaxMipLevels(md.mExtent);
+		const uint32_t levelCount = std::min(r.Read<uint32_t>(), md.mLevels);
+		// missing levels are regenerated with blits, which need a graphics queue
+		if (levelCount < md.mLevels && !commandBuffer.SupportsBlit())
+			md.mLevels = levelCount;
+		image = std::make_shared<Image>(device, name, md);
+		std::vector<vk::BufferImageCopy> copies(levelCount);
+		vk::DeviceSize offset = 0;
+		for (uint32_t level = 0; level < levelCount; level++) {
+			copies[level] = vk::BufferImageCopy(offset, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1), { 0, 0, 0 }, image->GetExtent(level));
+			offset += r.Read<uint64_t>();
+		}
+		const Buffer::View<std::byte> staging = ReadStaging(name);
+		if (offset > staging.SizeBytes()) throw std::runtime_error("Invalid image size in " + path.string());
+
+		// only complete mip chains have the same key as images uploaded by the loaders
+		size_t key = 0;
+		if (levelCount == md.mLevels) {
+			std::vector<std::span<const std::byte>> levels(levelCount);
+			for (uint32_t level = 0; level < levelCount; level++)
+				levels[level] = std::span(staging.data() + copies[level].bufferOffset, (level + 1 < levelCount ? copies[level + 1].bufferOffset : offset) - copies[level].bufferOffset);
+			key = CommandBuffer::GetImageKey(levels, md);
+			if (const std::shared_ptr<Image> shared = commandBuffer.FindSharedImage(key)) {
+				image = shared;
+				continue;
+			}
+		}
+
+		image = std::make_shared<Image>(device, name, md);
+		commandBuffer.Copy(staging, image, copies);
+		if (levelCount < md.mLevels)
+			commandBuffer.GenerateMipMaps(image);
+		commandBuffer.HoldResource(image);
+		if (key != 0)
+			commandBuffer.ShareImage(key, image, offset);
+	}
+	const float imageTime = Lap();
+
+	const auto GetImage = [&](const int32_t index) -> Image::View {
+		if (index < 0 || index >= images.size()) return {};
+		return images[index];
+	};
+
+	std::vector<std::shared_ptr<Material>> materials(r.Read<uint32_t>());
+	for (std::shared_ptr<Material>& material : materials) {
+		material = std::make_shared<Material>();
+		material->mMaterial     = r.Read<PackedMaterialParameters>();
+		material->mBaseColor    = GetImage(r.Read<int32_t>());
+		material->mPackedParams = GetImage(r.Read<int32_t>());
+		material->mEmission     = GetImage(r.Read<int32_t>());
+		material->mBumpMap      = GetImage(r.Read<int32_t>());
+		if (const uint2 luminanceExtent = r.Read<uint2>(); luminanceExtent.x > 0 && luminanceExtent.y > 0) {
+			std::vector<float> luminance(r.Read<uint64_t>() / sizeof(float));
+			r.Read(luminance.data(), luminance.size()*sizeof(float));
+			material->mEmissionLuminance = LuminanceMap::Create(luminance, luminanceExtent);
+		}
+	}
+
+	struct ViewRecord {
+		int32_t mBuffer;
+		uint64_t mOffset;
+		uint64_t mSize;
+	};
+	struct MeshRecord {
+		vk::PrimitiveTopology mTopology;
+		size_t mContentHash;
+		vk::AabbPositionsKHR mAabb;
+		float4x4 mPositionTransform;
+		ViewRecord mIndices;
+		uint64_t mIndexStride;
+		std::vector<std::tuple<Mesh::VertexAttributeType, uint32_t /* type index */, ViewRecord, Mesh::VertexAttributeDescription>> mAttributes;
+	};
+	const auto ReadView = [&]() {
+		ViewRecord v;
+		v.mBuffer = r.Read<int32_t>();
+		if (v.mBuffer < 0 || v.mBuffer >= stagedBuffers.size()) throw std::runtime_error("Invalid buffer index in " + path.string());
+		v.mOffset = r.Read<uint64_t>();
+		v.mSize   = r.Read<uint64_t>();
+		return v;
+	};
+	std::vector<MeshRecord> meshRecords(r.Read<uint32_t>());
+	for (MeshRecord& m : meshRecords) {
+		m.mTopology = r.Read<vk::PrimitiveTopology>();
+		m.mContentHash = r.Read<uint64_t>();
+		m.mAabb = r.Read<vk::AabbPositionsKHR>();
+		m.mPositionTransform = r.Read<float4x4>();
+		m.mIndices = ReadView();
+		m.mIndexStride = r.Read<uint64_t>();
+		const uint32_t attributeTypeCount = r.Read<uint32_t>();
+		for (uint32_t i = 0; i < attributeTypeCount; i++) {
+			const Mesh::VertexAttributeType type = r.Read<Mesh::VertexAttributeType>();
+			const uint32_t count = r.Read<uint32_t>();
+			for (uint32_t typeIndex = 0; typeIndex < count; typeIndex++) {
+				const ViewRecord view = ReadView();
+				m.mAttributes.emplace_back(type, typeIndex, view, r.Read<Mesh::VertexAttributeDescription>());
+			}
+		}
+	}
+
+	// meshes another load already uploaded are reused, and only buffers which the other meshes view are copied to the device
+	HostBufferData hostBuffers; // staging memory stays mapped until the command buffer completes
+	const auto GetStagedData = [&](const ViewRecord& v) -> std::span<const std::byte> {
+		const Buffer::View<std::byte>& staging = stagedBuffers[v.mBuffer].second;
+		const size_t offset = std::min<size_t>(v.mOffset, staging.size());
+		return std::span(staging.data() + offset, std::min<size_t>(v.mSize, staging.size() - offset));
+	};
+	std::vector<std::shared_ptr<Mesh>> meshes(meshRecords.size());
+	std::unordered_set<const Mesh*> sharedMeshes;
+	std::vector<bool> bufferViewed(stagedBuffers.size(), false);
+	for (size_t k = 0; k < meshRecords.size(); k++) {
+		const MeshRecord& m = meshRecords[k];
+		if (m.mContentHash != 0)
+			meshes[k] = commandBuffer.FindSharedMesh(m.mContentHash);
+		if (!meshes[k]) {
+			bufferViewed[m.mIndices.mBuffer] = true;
+			for (const auto&[type, typeIndex, view, desc] : m.mAttributes)
+				bufferViewed[view.mBuffer] = true;
+			continue;
+		}
+		const Mesh& shared = *meshes[k];
+		sharedMeshes.emplace(&shared);
+		hostBuffers.emplace(shared.GetIndices().GetBuffer().get(), HostBufferRange{ shared.GetIndices().Offset(), GetStagedData(m.mIndices) });
+		for (const auto&[type, typeIndex, view, desc] : m.mAttributes)
+			if (const auto attrib = shared.GetVertices().find(type, typeIndex))
+				hostBuffers.emplace(attrib->first.GetBuffer().get(), HostBufferRange{ attrib->first.Offset(), GetStagedData(view) });
+	}
+
+	std::vector<std::shared_ptr<Buffer>> buffers(stagedBuffers.size());
+	for (size_t b = 0; b < stagedBuffers.size(); b++) {
+		if (!bufferViewed[b]) continue;
+		const auto&[name, staging] = stagedBuffers[b];
+		std::shared_ptr<Buffer>& buffer = buffers[b];
+		const size_t key = CommandBuffer::GetBufferKey(std::span(staging.data(), staging.size()), bufferUsage);
+		if (const std::shared_ptr<Buffer> shared = commandBuffer.FindSharedBuffer(key))
+			buffer = shared;
+		else {
+			buffer = std::make_shared<Buffer>(device, name, staging.SizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eTransferDst);
+			commandBuffer.Copy(staging, buffer);
+			commandBuffer.HoldResource(buffer);
+			commandBuffer.ShareBuffer(key, buffer, staging.SizeBytes());
+		}
+		hostBuffers.emplace(buffer.get(), HostBufferRange{ 0, std::span(staging.data(), staging.size()) });
+	}
+
+	for (size_t k = 0; k < meshRecords.size(); k++) {
+		if (meshes[k]) continue;
+		const MeshRecord& m = meshRecords[k];
+		Mesh::Vertices vertices;
+		vertices.mAabb = m.mAabb;
+		vertices.mPositionTransform = m.mPositionTransform;
+		size_t meshBytes = m.mIndices.mSize;
+		for (const auto&[type, typeIndex, view, desc] : m.mAttributes) {
+			auto& attribs = vertices[type];
+			if (attribs.size() <= typeIndex) attribs.resize(typeIndex+1);
+			attribs[typeIndex] = { Buffer::View<std::byte>(buffers[view.mBuffer], view.mOffset, view.mSize), desc };
+			meshBytes += view.mSize;
+		}
+		meshes[k] = std::make_shared<Mesh>(std::move(vertices), Buffer::StrideView(buffers[m.mIndices.mBuffer], m.mIndexStride, m.mIndices.mOffset, m.mIndices.mSize), m.mTopology);
+		if (m.mContentHash != 0) {
+			meshes[k]->SetContentHash(m.mContentHash);
+			commandBuffer.ShareMesh(m.mContentHash, meshes[k], meshBytes);
+		}
+	}
+
+	const auto GetMaterial = [&](const int32_t index) -> std::shared_ptr<Material> {
+		if (index < 0 || index >= materials.size()) return nullptr;
+		return materials[index];
+	};
+
+	std::vector<std::shared_ptr<SceneNode>> nodes(r.Read<uint32_t>());
+	for (std::shared_ptr<SceneNode>& node : nodes) {
+		node = SceneNode::Create(r.ReadString());
+		const int32_t parent = r.Read<int32_t>();
+		node->Enabled(r.Read<bool>());
+		if (parent >= 0 && parent < (&node - nodes.data()))
+			nodes[parent]->AddChild(node);
+		if (r.Read<bool>())
+			node->MakeComponent<float4x4>(r.Read<float4x4>());
+		if (r.Read<bool>()) {
+			const auto material = GetMaterial(r.Read<int32_t>());
+			const int32_t mesh = r.Read<int32_t>();
+			if (mesh < 0 || mesh >= meshes.size()) throw std::runtime_error("Invalid mesh index in " + path.string());
+			node->MakeComponent<MeshRenderer>(material, meshes[mesh]);
+		}
+		if (r.Read<bool>()) {
+			const auto material = GetMaterial(r.Read<int32_t>());
+			const int32_t mesh = r.Read<int32_t>();
+			if (mesh < 0 || mesh >= meshes.size()) throw std::runtime_error("Invalid mesh index in " + path.string());
+			const uint64_t transformsSize = r.Read<uint64_t>();
+			if (transformsSize > std::filesystem::file_size(path) || transformsSize % sizeof(float4x4) != 0) throw std::runtime_error("Invalid instance count in " + path.string());
+			std::vector<float4x4> transforms(transformsSize / sizeof(float4x4));
+			r.Read(transforms.data(), transformsSize);
+			node->MakeComponent<InstancedMeshRenderer>(material, meshes[mesh], std::move(transforms));
+		}
+		if (r.Read<bool>()) {
+			const auto sphere = node->MakeComponent<SphereRenderer>();
+			sphere->mMaterial = GetMaterial(r.Read<int32_t>());
+			sphere->mRadius = r.Read<float>();
+		}
+	}
+	const float sceneTime = Lap();
+
+	if (nodes.empty()) return nullptr;
+
+	ReadEmissiveTriangles(*nodes[0], hostBuffers, sharedMeshes);
+
+	const auto[size, unit] = FormatBytes(bytesRead);
+	std::cout << "Loaded " << filename << " from " << path << " (" << size << " " << unit << ")" << std::endl;
+	std::cout << "\tBuffers: " << bufferTime << "ms, images: " << imageTime << "ms, scene: " << sceneTime << "ms" << std::endl;
+
+	return nodes[0];
+}
+
+#pragma endregion
+
+#pragma region Textures
+
+size_t AssetCache::ComputeTextureKey(const std::span<const std::byte> pixels, const vk::Format srcFormat, const vk::Extent3D& extent, const vk::Format dstFormat) {
+	return HashArgs(gBlockCompressionVersion, srcFormat, extent.width, extent.height, dstFormat,
+		std::hash<std::string_view>()(std::string_view(reinterpret_cast<const char*>(pixels.data()), pixels.size())));
+}
+
+std::vector<std::vector<std::byte>> AssetCache::ReadTexture(const size_t key) const {
+	if (!Enabled()) return {};
+	const std::filesystem::path path = mDirectory / "textures" / std::format("{:016x}.bc", key);
+	if (!std::filesystem::exists(path)) return {};
+
+	try {
+		BinaryReader r(path);
+		if (r.Read<uint32_t>() != gTextureCacheMagic || r.Read<uint32_t>() != gBlockCompressionVersion || r.Read<uint64_t>() != key)
+			return {};
+		std::vector<std::vector<std::byte>> levels(r.Read<uint32_t>());
+		for (auto& level : levels) {
+			level.resize(r.Read<uint64_t>());
+			r.Read(level.data(), level.size());
+		}
+		return levels;
+	} catch (std::exception& e) {
+		std::cerr << "Failed to read " << path << ": " << e.what() << std::endl;
+		return {};
+	}
+}
+
+void AssetCache::WriteTexture(const size_t key, const std::vector<std::vector<std::byte>>& levels) const {
+	if (!Enabled()) return;
+	const std::filesystem::path path = mDirectory / "textures" / std::format("{:016x}.bc", key);
+	std::filesystem::create_directories(path.parent_path());
+
+	// textures are written from worker threads, and identical textures may be encoded concurrently
+	const std::filesystem::path tmpPath = std::filesystem::path(path).concat(std::format(".{:x}.tmp", std::hash<std::thread::id>()(std::this_thread::get_id())));
+	{
+		BinaryWriter w(tmpPath);
+		w.Write(gTextureCacheMagic);
+		w.Write(gBlockCompressionVersion);
+		w.Write((uint64_t)key);
+		w.Write((uint32_t)levels.size());
+		for (const auto& level : levels)
+			w.Write(std::span<const std::byte>(level));
+		if (!w.mStream) {
+			std::cerr << "Failed to write " << tmpPath << std::endl;
+			w.mStream.close();
+			std::filesystem::remove(tmpPath);
+			return;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, path, ec);
+	if (ec) std::filesystem::remove(tmpPath, ec);
+}
+
+#pragma endregion
+
+}
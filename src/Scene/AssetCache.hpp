@@ -0,0 +1,63 @@
+#pragma once
+
+#include "MeshProcessing.hpp"
+
+namespace ptvk {
+
+// Versioned on-disk cache of loaded scenes.
+// Stores ready-to-upload buffer data, full image mip chains, mesh layouts, materials and the node hierarchy,
+// so that warm loads are a straight read into staging buffers and a copy.
+class AssetCache {
+public:
+	// bump whenever the file layout, or the data a loader produces, changes
+	static constexpr uint32_t gVersion = 6;
+
+	AssetCache() = default;
+	AssetCache(const Instance& instance);
+
+	inline bool Enabled() const { return !mDirectory.empty(); }
+
+	// mSlot selects the cache file (source path and loader options which affect the cached data), the stamps validate its contents
+	struct Key {
+		size_t mSlot = 0;
+		size_t mStamp = 0; // size, write time and leading bytes of the source file
+		size_t mExternalStamp = 0; // size and write time of the buffers and images a .gltf references
+		uint64_t mSourceSize = 0;
+	};
+
+	// Only stats files and reads the start of filename, so that warm loads do not read the source at all
+	Key ComputeKey(const std::filesystem::path& filename, const size_t optionsHash) const;
+	// Hashes all of filename. Computed when writing an entry, and when reading one whose source was touched without changing size
+	static size_t ComputeContentHash(const std::filesystem::path& filename);
+	std::filesystem::path GetPath(const std::filesystem::path& filename, const Key& key) const;
+
+	// Returns nullptr if there is no valid cache entry for key
+	std::shared_ptr<SceneNode> Read(CommandBuffer& commandBuffer, const std::filesystem::path& filename, const Key& key, const vk::BufferUsageFlags bufferUsage) const;
+
+	// Holds CPU copies of the resources a loader created, so the resulting scene can be serialized without reading back from the GPU
+	class Writer {
+	public:
+		// Host copies of the buffers the scene's meshes view. Buffers only partly covered (e.g. meshes reused from another load) are stored compacted
+		inline void AddBuffers(const HostBufferData& data) { mBuffers.insert(data.begin(), data.end()); }
+		inline void AddImage (const std::shared_ptr<Image>& image, std::vector<std::vector<std::byte>>&& levels) { mImages.emplace(image.get(), std::move(levels)); }
+
+		// Returns false if the scene references a resource which was not added to the writer
+		bool Write(const AssetCache& cache, const std::filesystem::path& filename, const Key& key, SceneNode& root) const;
+
+	private:
+		HostBufferData mBuffers;
+		std::unordered_map<const Image*, std::vector<std::vector<std::byte>>> mImages;
+	};
+
+	// Block compressed textures are cached on their own, keyed by source pixels rather than by scene,
+	// so that encoding runs once per texture even when the scene file changes or the scene cache is cold
+	static size_t ComputeTextureKey(const std::span<const std::byte> pixels, const vk::Format srcFormat, const vk::Extent3D& extent, const vk::Format dstFormat);
+	// Returns an empty vector if there is no valid cache entry for key
+	std::vector<std::vector<std::byte>> ReadTexture(const size_t key) const;
+	void WriteTexture(const size_t key, const std::vector<std::vector<std::byte>>& levels) const;
+
+private:
+	std::filesystem::path mDirectory;
+};
+
+}
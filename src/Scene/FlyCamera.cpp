@@ -27,7 +27,7 @@ void FlyCamera::Update(const float deltaTime) {
 	if (!mNode.HasComponent<float4x4>())
 		mNode.MakeComponent<float4x4>(glm::identity<float4x4>());
 
-	float4x4& transform = *mNode.GetComponent<float4x4>();
+	const float4x4& transform = *mNode.GetComponent<float4x4>();
 
 	const ImGuiIO& io = ImGui::GetIO();
 
@@ -66,7 +66,7 @@ void FlyCamera::Update(const float deltaTime) {
 		}
 	}
 	if (update)
-		transform = glm::translate(pos) * (glm::rotate(mRotation.y, float3(0, 1, 0)) * glm::rotate(mRotation.x, float3(1, 0, 0)));
+		mNode.SetTransform(glm::translate(pos) * (glm::rotate(mRotation.y, float3(0, 1, 0)) * glm::rotate(mRotation.x, float3(1, 0, 0))));
 }
 
 }
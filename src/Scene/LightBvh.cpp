@@ -0,0 +1,211 @@
+#include "LightBvh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <numbers>
+
+namespace ptvk {
+
+static constexpr float gPi = std::numbers::pi_v<float>;
+
+// Power, bounds and two-sided normal cone of a set of primitives
+struct LightBounds {
+	float3 mMin = float3(std::numeric_limits<float>::infinity());
+	float3 mMax = float3(-std::numeric_limits<float>::infinity());
+	float3 mAxis = float3(0, 0, 1);
+	float mThetaO = -1; // < 0 when empty, pi for all directions
+	float mPower = 0;
+
+	inline bool Empty() const { return mThetaO < 0; }
+
+	inline void Add(const LightBounds& b) {
+		if (b.Empty()) return;
+		mMin = min(mMin, b.mMin);
+		mMax = max(mMax, b.mMax);
+		mPower += b.mPower;
+		if (Empty()) {
+			mAxis = b.mAxis;
+			mThetaO = b.mThetaO;
+			return;
+		}
+		if (mThetaO >= gPi) return;
+		if (b.mThetaO >= gPi) {
+			mThetaO = gPi;
+			return;
+		}
+
+		// cones are two-sided, so either direction of b's axis may be merged
+		const float3 axis = dot(mAxis, b.mAxis) < 0 ? -b.mAxis : b.mAxis;
+		const float thetaD = std::acos(std::clamp(dot(mAxis, axis), -1.f, 1.f));
+		if (std::min(thetaD + b.mThetaO, gPi) <= mThetaO) return;
+		if (thetaD + mThetaO <= b.mThetaO) {
+			mAxis = axis;
+			mThetaO = b.mThetaO;
+			return;
+		}
+
+		// a two-sided cone with a half angle of pi/2 covers every direction
+		const float thetaO = (mThetaO + thetaD + b.mThetaO) / 2;
+		if (thetaO >= gPi/2) {
+			mThetaO = gPi;
+			return;
+		}
+		// rotate the axis towards b's by thetaO - mThetaO
+		const float3 ortho = axis - mAxis * dot(mAxis, axis);
+		const float orthoLength = length(ortho);
+		if (orthoLength > 1e-6f) {
+			const float thetaR = thetaO - mThetaO;
+			mAxis = normalize(mAxis * std::cos(thetaR) + (ortho / orthoLength) * std::sin(thetaR));
+		}
+		mThetaO = thetaO;
+	}
+
+	inline float SurfaceArea() const {
+		if (Empty()) return 0;
+		const float3 e = max(mMax - mMin, float3(0));
+		return 2 * (e.x*e.y + e.y*e.z + e.z*e.x);
+	}
+
+	// Orientation measure of the cone, with an emission angle of pi/2
+	inline float OrientationMeasure() const {
+		if (Empty()) return 0;
+		const float thetaW = std::min(mThetaO + gPi/2, gPi);
+		const float sinThetaO = std::sin(mThetaO);
+		const float cosThetaO = std::cos(mThetaO);
+		return 2*gPi*(1 - cosThetaO) + gPi/2 * (2*thetaW*sinThetaO - std::cos(mThetaO - 2*thetaW) - 2*mThetaO*sinThetaO + cosThetaO);
+	}
+};
+
+static LightBounds GetBounds(const LightBvhPrimitive& p) {
+	LightBounds b;
+	b.mMin = p.mMin;
+	b.mMax = p.mMax;
+	b.mAxis = p.mAxis;
+	b.mThetaO = p.mCosThetaO <= -1 ? gPi : std::acos(std::clamp(p.mCosThetaO, -1.f, 1.f));
+	b.mPower = std::max(p.mPower, 0.f);
+	return b;
+}
+
+void BuildLightBvh(const std::span<const LightBvhPrimitive> primitives, std::vector<LightBvhNode>& nodes, std::vector<uint32_t>& leaves) {
+	nodes.clear();
+	leaves.assign(primitives.size(), 0);
+	if (primitives.empty()) return;
+	nodes.reserve(2*primitives.size() - 1);
+
+	std::vector<LightBounds> bounds(primitives.size());
+	std::vector<float3> centroids(primitives.size());
+	for (size_t i = 0; i < primitives.size(); i++) {
+		bounds[i] = GetBounds(primitives[i]);
+		centroids[i] = (primitives[i].mMin + primitives[i].mMax) / 2.f;
+	}
+
+	std::vector<uint32_t> order(primitives.size());
+	std::iota(order.begin(), order.end(), 0);
+
+	static constexpr uint32_t gBinCount = 12;
+	const auto GetBin = [&](const uint32_t primitive, const uint32_t axis, const float3& centroidMin, const float3& extent) {
+		return std::min((uint32_t)((centroids[primitive][axis] - centroidMin[axis]) / extent[axis] * gBinCount), gBinCount - 1);
+	};
+
+	// ranges of order to build nodes from. the second child is pushed first, so that nodes are written depth first
+	struct Task {
+		uint32_t mBegin, mEnd;
+		uint32_t mParent;
+		bool mSecondChild;
+	};
+	std::vector<Task> stack = { Task{ 0, (uint32_t)primitives.size(), INVALID_TABLE_OFFSET, false } };
+	while (!stack.empty()) {
+		const auto[begin, end, parent, secondChild] = stack.back();
+		stack.pop_back();
+
+		const uint32_t nodeIndex = (uint32_t)nodes.size();
+		nodes.emplace_back();
+		if (secondChild)
+			nodes[parent].mChild = nodeIndex;
+
+		LightBounds nodeBounds;
+		float3 centroidMin = float3(std::numeric_limits<float>::infinity());
+		float3 centroidMax = float3(-std::numeric_limits<float>::infinity());
+		for (uint32_t i = begin; i < end; i++) {
+			nodeBounds.Add(bounds[order[i]]);
+			centroidMin = min(centroidMin, centroids[order[i]]);
+			centroidMax = max(centroidMax, centroids[order[i]]);
+		}
+
+		LightBvhNode& node = nodes[nodeIndex];
+		node.mMin = nodeBounds.mMin;
+		node.mMax = nodeBounds.mMax;
+		node.mAxis = nodeBounds.mAxis;
+		node.mCosThetaO = nodeBounds.mThetaO >= gPi ? -1 : std::cos(nodeBounds.mThetaO);
+		node.mPower = nodeBounds.mPower;
+		node.mParent = parent;
+
+		if (end - begin == 1) {
+			node.mChild = LIGHT_BVH_LEAF | order[begin];
+			leaves[order[begin]] = nodeIndex;
+			continue;
+		}
+
+		// binned surface area orientation heuristic: the cost of a side is power * area * orientation measure.
+		// costs along thin axes are scaled up, so that they do not win by having small bins
+		const float3 extent = centroidMax - centroidMin;
+		const float maxExtent = std::max({ extent.x, extent.y, extent.z });
+		float bestCost = std::numeric_limits<float>::infinity();
+		uint32_t bestAxis = 0, bestBin = 0;
+		for (uint32_t axis = 0; axis < 3 && maxExtent > 0; axis++) {
+			if (extent[axis] <= 0) continue;
+			std::array<LightBounds, gBinCount> bins;
+			std::array<uint32_t, gBinCount> counts = {};
+			for (uint32_t i = begin; i < end; i++) {
+				const uint32_t bin = GetBin(order[i], axis, centroidMin, extent);
+				bins[bin].Add(bounds[order[i]]);
+				counts[bin]++;
+			}
+
+			std::array<float, gBinCount> aboveCost;
+			std::array<uint32_t, gBinCount> aboveCount;
+			LightBounds above;
+			uint32_t count = 0;
+			for (uint32_t b = gBinCount - 1; b > 0; b--) {
+				above.Add(bins[b]);
+				count += counts[b];
+				aboveCost[b] = above.mPower * above.SurfaceArea() * above.OrientationMeasure();
+				aboveCount[b] = count;
+			}
+			LightBounds below;
+			count = 0;
+			const float axisScale = maxExtent / extent[axis];
+			for (uint32_t b = 0; b + 1 < gBinCount; b++) {
+				below.Add(bins[b]);
+				count += counts[b];
+				if (count == 0 || aboveCount[b+1] == 0) continue;
+				const float cost = axisScale * (below.mPower * below.SurfaceArea() * below.OrientationMeasure() + aboveCost[b+1]);
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+
+		uint32_t mid = begin;
+		if (std::isfinite(bestCost))
+			mid = (uint32_t)(std::partition(order.begin() + begin, order.begin() + end, [&](const uint32_t i) {
+				return GetBin(i, bestAxis, centroidMin, extent) <= bestBin;
+			}) - order.begin());
+		if (mid == begin || mid == end) {
+			// coincident centroids: split in the middle along the widest axis
+			const uint32_t axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+			mid = begin + (end - begin) / 2;
+			std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](const uint32_t a, const uint32_t b) {
+				return centroids[a][axis] < centroids[b][axis];
+			});
+		}
+
+		stack.emplace_back(Task{ mid, end, nodeIndex, true });
+		stack.emplace_back(Task{ begin, mid, nodeIndex, false });
+	}
+}
+
+}
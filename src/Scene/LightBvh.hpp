@@ -0,0 +1,26 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include <Common/SceneTypes.h>
+
+namespace ptvk {
+
+// An emissive triangle, or a whole light instance when its triangles are not known on the host (spheres, meshes loaded without triangles)
+struct LightBvhPrimitive {
+	float3 mMin;
+	float3 mMax;
+	float3 mAxis = float3(0, 0, 1);
+	float mCosThetaO = -1; // 1 for triangles, -1 for primitives which emit in all directions
+	float mPower = 0;
+	uint32_t mLightIndex = 0;
+	uint32_t mPrimitiveIndex = INVALID_PRIMITIVE; // INVALID_PRIMITIVE samples a primitive from the whole light instance
+};
+
+// Builds a light BVH (Conty Estevez and Kulla, "Importance Sampling of Many Lights with Adaptive Tree Splitting", 2018)
+// with one primitive per leaf, splitting by the surface area orientation heuristic over binned centroids.
+// Nodes are written depth first (see LightBvhNode). leaves[i] is the index of the leaf holding primitives[i].
+void BuildLightBvh(const std::span<const LightBvhPrimitive> primitives, std::vector<LightBvhNode>& nodes, std::vector<uint32_t>& leaves);
+
+}
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <Core/UploadQueue.hpp>
+#include "SceneNode.hpp"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace ptvk {
+
+// Thrown from ReportLoadProgress once the job being loaded on the calling thread has been cancelled
+class LoadCancelled : public std::exception {
+public:
+	inline const char* what() const noexcept override { return "Load cancelled"; }
+};
+
+// A file being loaded by a LoadQueue. Written by the worker loading it, read by the main thread.
+struct LoadJob {
+	enum class Stage : uint32_t {
+		eQueued,
+		eParse,
+		eDecode,
+		eUpload,
+		eAccelerationStructures, // uploaded, waiting for the scene to build its BLASs
+		eDone,
+		eCancelled,
+		eFailed
+	};
+
+	std::filesystem::path mFilename;
+	std::atomic<int> mPriority = 0;
+	uint64_t mSequence = 0;
+
+	std::atomic<Stage> mStage = Stage::eQueued;
+	std::atomic<float> mProgress = 0; // within the current stage
+	std::atomic<bool> mCancelRequested = false;
+
+	// written by the worker before mStage is set to eFailed, or before mUploadValue is set
+	std::string mError;
+	std::shared_ptr<SceneNode> mNode;
+	CommandBuffer::OwnershipTransfer mOwnershipTransfer; // acquired by the scene once the upload completes
+	std::atomic<uint64_t> mUploadValue = 0; // UploadQueue timeline value of the job's uploads and of the shared assets it reuses, 0 until submitted
+
+	inline void Cancel() { mCancelRequested = true; }
+	inline bool Finished() const {
+		const Stage s = mStage;
+		return s == Stage::eDone || s == Stage::eCancelled || s == Stage::eFailed;
+	}
+};
+
+// Job loaded by the calling thread, null outside of LoadQueue workers (e.g. on decode pool threads)
+inline thread_local LoadJob* gCurrentLoadJob = nullptr;
+
+// Called by loaders between units of work. Throws LoadCancelled if the current job was cancelled, so loaders need no cleanup paths of their own.
+inline void ReportLoadProgress(const LoadJob::Stage stage, const float progress = 0) {
+	if (!gCurrentLoadJob) return;
+	if (gCurrentLoadJob->mCancelRequested)
+		throw LoadCancelled();
+	gCurrentLoadJob->mStage = stage;
+	gCurrentLoadJob->mProgress = progress;
+}
+
+// Loads files on a fixed number of worker threads, highest priority first (FIFO within a priority).
+// Each job records into its own command buffer, which is handed to the device's UploadQueue without waiting on it, so workers move on to the next file
+// while the upload runs. Resources written by a job are released to dstQueueFamily, the family which renders the scene.
+class LoadQueue {
+public:
+	using LoadFunction = std::function<std::shared_ptr<SceneNode>(CommandBuffer&, const std::filesystem::path&)>;
+
+	inline LoadQueue(Device& device, const uint32_t dstQueueFamily, const uint32_t threadCount, LoadFunction load) : mDevice(device), mDstQueueFamily(dstQueueFamily), mLoad(load) {
+		mThreads.resize(std::max(threadCount, 1u));
+		for (std::thread& t : mThreads)
+			t = std::thread([this]() { WorkerLoop(); });
+	}
+	inline ~LoadQueue() {
+		{
+			std::scoped_lock lock(mMutex);
+			mStop = true;
+			for (const auto& job : mJobs)
+				job->Cancel();
+		}
+		mCondition.notify_all();
+		for (std::thread& t : mThreads)
+			t.join();
+	}
+
+	LoadQueue(const LoadQueue&) = delete;
+	LoadQueue& operator=(const LoadQueue&) = delete;
+
+	inline std::shared_ptr<LoadJob> Enqueue(const std::filesystem::path& filename, const int priority = 0) {
+		auto job = std::make_shared<LoadJob>();
+		job->mFilename = filename;
+		job->mPriority = priority;
+		{
+			std::scoped_lock lock(mMutex);
+			job->mSequence = mNextSequence++;
+			mJobs.emplace_back(job);
+			mPending.emplace_back(job);
+		}
+		mCondition.notify_one();
+		return job;
+	}
+
+	// Jobs whose uploads completed since the last call, in submission order.
+	// Their mOwnershipTransfer must be acquired on the destination queue family before the nodes are used.
+	inline std::vector<std::shared_ptr<LoadJob>> TakeLoaded() {
+		const uint64_t completed = mDevice.GetUploadQueue().GetCompletedValue();
+		std::vector<std::shared_ptr<LoadJob>> loaded;
+		std::scoped_lock lock(mMutex);
+		std::erase_if(mUploading, [&](const auto& job) {
+			if (job->mUploadValue > completed) return false;
+			job->mStage = LoadJob::Stage::eAccelerationStructures;
+			loaded.emplace_back(job);
+			return true;
+		});
+		return loaded;
+	}
+
+	// Snapshot of every job that has not been cleared
+	inline std::vector<std::shared_ptr<LoadJob>> GetJobs() {
+		std::scoped_lock lock(mMutex);
+		return mJobs;
+	}
+
+	// Forgets finished jobs
+	inline void ClearFinished() {
+		std::scoped_lock lock(mMutex);
+		std::erase_if(mJobs, [](const auto& job) { return job->Finished(); });
+	}
+
+	inline void CancelAll() {
+		std::scoped_lock lock(mMutex);
+		for (const auto& job : mJobs)
+			job->Cancel();
+	}
+
+	inline uint32_t ThreadCount() const { return (uint32_t)mThreads.size(); }
+
+private:
+	Device& mDevice;
+	uint32_t mDstQueueFamily;
+	LoadFunction mLoad;
+
+	std::vector<std::thread> mThreads;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool mStop = false;
+
+	uint64_t mNextSequence = 0;
+	std::vector<std::shared_ptr<LoadJob>> mJobs;
+	std::vector<std::shared_ptr<LoadJob>> mPending;
+	std::vector<std::shared_ptr<LoadJob>> mUploading; // in submission order
+
+	// command buffers submitted by a worker, freed by it once their uploads complete
+	using RetiringCommandBuffers = std::vector<std::pair<std::shared_ptr<CommandBuffer>, uint64_t>>;
+	inline void RetireCompleted(RetiringCommandBuffers& retiring) {
+		if (retiring.empty()) return;
+		const uint64_t completed = mDevice.GetUploadQueue().GetCompletedValue();
+		std::erase_if(retiring, [&](const auto& r) { return r.second <= completed; });
+	}
+
+	// priorities may change while queued, so the next job is picked at dequeue time
+	inline std::shared_ptr<LoadJob> PopPending() {
+		auto it = std::ranges::max_element(mPending, [](const auto& a, const auto& b) {
+			const int pa = a->mPriority, pb = b->mPriority;
+			return pa != pb ? pa < pb : a->mSequence > b->mSequence;
+		});
+		std::shared_ptr<LoadJob> job = *it;
+		mPending.erase(it);
+		return job;
+	}
+
+	inline void Load(const std::shared_ptr<LoadJob>& jobPtr, RetiringCommandBuffers& retiring) {
+		LoadJob& job = *jobPtr;
+		gCurrentLoadJob = &job;
+		try {
+			ReportLoadProgress(LoadJob::Stage::eParse);
+			UploadQueue& uploadQueue = mDevice.GetUploadQueue();
+			const std::shared_ptr<CommandBuffer> cb = uploadQueue.CreateCommandBuffer("Scene load");
+			std::shared_ptr<SceneNode> node = mLoad(*cb, job.mFilename);
+			if (!node)
+				throw std::runtime_error("Failed to load " + job.mFilename.string());
+
+			// last chance to cancel
+			ReportLoadProgress(LoadJob::Stage::eUpload, 1);
+
+			job.mNode = node;
+			job.mOwnershipTransfer = cb->ReleaseOwnership(mDstQueueFamily);
+			const AssetRegistry::Pending shared = cb->TakeSharedAssets();
+			const uint64_t value = uploadQueue.Submit(cb);
+			retiring.emplace_back(cb, value);
+
+			// reused resources may belong to a load that was submitted after this one started
+			mDevice.GetAssetRegistry().Publish(shared, value);
+			if (shared.mHits > 0) {
+				const auto[size, unit] = FormatBytes(shared.mBytesSaved);
+				std::cout << "Reused " << shared.mHits << " buffers/images/meshes (" << size << " " << unit << ") for " << job.mFilename << std::endl;
+			}
+
+			std::scoped_lock lock(mMutex);
+			job.mUploadValue = std::max(value, shared.mDependency);
+			mUploading.emplace_back(jobPtr);
+		} catch (const LoadCancelled&) {
+			job.mStage = LoadJob::Stage::eCancelled;
+			std::cout << "Cancelled loading " << job.mFilename << std::endl;
+		} catch (const std::exception& e) {
+			job.mError = e.what();
+			job.mStage = LoadJob::Stage::eFailed;
+			std::cerr << "Failed to load " << job.mFilename << ": " << e.what() << std::endl;
+		}
+		gCurrentLoadJob = nullptr;
+	}
+
+	inline void WorkerLoop() {
+		RetiringCommandBuffers retiring;
+		while (true) {
+			std::shared_ptr<LoadJob> job;
+			{
+				std::unique_lock lock(mMutex);
+				while (!mStop && mPending.empty()) {
+					RetireCompleted(retiring);
+					// poll while uploads are in flight, so that their command buffers and staging memory are freed promptly
+					if (retiring.empty())
+						mCondition.wait(lock);
+					else
+						mCondition.wait_for(lock, std::chrono::milliseconds(10));
+				}
+				if (mStop) break;
+				job = PopPending();
+			}
+			RetireCompleted(retiring);
+			if (job->mCancelRequested)
+				job->mStage = LoadJob::Stage::eCancelled;
+			else
+				Load(job, retiring);
+		}
+
+		for (const auto&[cb, value] : retiring)
+			mDevice.GetUploadQueue().Wait(value);
+	}
+};
+
+}
+
+namespace std {
+inline std::string to_string(const ptvk::LoadJob::Stage& stage) {
+	switch (stage) {
+		default:
+		case ptvk::LoadJob::Stage::eQueued:                 return "Queued";
+		case ptvk::LoadJob::Stage::eParse:                  return "Parsing";
+		case ptvk::LoadJob::Stage::eDecode:                 return "Decoding";
+		case ptvk::LoadJob::Stage::eUpload:                 return "Uploading";
+		case ptvk::LoadJob::Stage::eAccelerationStructures: return "Building acceleration structures";
+		case ptvk::LoadJob::Stage::eDone:                   return "Done";
+		case ptvk::LoadJob::Stage::eCancelled:              return "Cancelled";
+		case ptvk::LoadJob::Stage::eFailed:                 return "Failed";
+	}
+}
+}
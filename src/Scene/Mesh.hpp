@@ -51,6 +51,8 @@ public:
 		void Bind(CommandBuffer& commandBuffer) const;
 
 		vk::AabbPositionsKHR mAabb;
+		// maps stored positions into mesh space, for quantized positions
+		float4x4 mPositionTransform = float4x4(1);
 	};
 
 	Mesh() = default;
@@ -72,6 +74,20 @@ public:
 
 	VertexLayoutDescription GetVertexLayout(const Shader& vertexShader) const;
 
+	// Host copy of a triangle list, three vertices per triangle, in mesh space (mPositionTransform applied).
+	// Loaders keep one for meshes with emissive materials, so that lights can be weighted by area (see ReadEmissiveTriangles)
+	struct Triangles {
+		std::vector<float3> mPositions;
+		std::vector<float2> mTexcoords; // empty if the mesh has no texcoords
+	};
+	inline const std::shared_ptr<const Triangles>& GetTriangles() const { return mTriangles; }
+	inline void SetTriangles(const std::shared_ptr<const Triangles>& triangles) { mTriangles = triangles; }
+
+	// Hash of the index and vertex data and their layout (see HashMesh), set by loaders. Identifies the mesh in the AssetRegistry and keys its BLAS.
+	// 0 if unknown, in which case BLASs are keyed on the buffer ranges instead
+	inline size_t GetContentHash() const { return mContentHash; }
+	inline void SetContentHash(const size_t hash) { mContentHash = hash; }
+
 	inline void Bind(CommandBuffer& commandBuffer) const{
 		mVertices.Bind(commandBuffer);
 		commandBuffer->bindIndexBuffer(**mIndices.GetBuffer(), mIndices.Offset(), GetIndexType());
@@ -81,6 +97,8 @@ private:
 	Vertices mVertices;
 	Buffer::StrideView mIndices;
 	vk::PrimitiveTopology mTopology = vk::PrimitiveTopology::eTriangleList;
+	std::shared_ptr<const Triangles> mTriangles;
+	size_t mContentHash = 0;
 };
 
 }
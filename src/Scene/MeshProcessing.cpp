@@ -0,0 +1,380 @@
+#include "MeshProcessing.hpp"
+#include "Scene.hpp"
+
+#include <numeric>
+
+#include <glm/gtc/packing.hpp>
+
+namespace ptvk {
+
+void WeldVertices(MeshData& mesh) {
+	const size_t vertexSize = mesh.VertexSize();
+	if (mesh.mVertexCount == 0 || vertexSize == 0) return;
+
+	// gather each vertex's attributes into one contiguous key
+	std::vector<std::byte> keys(mesh.mVertexCount * vertexSize);
+	for (uint32_t v = 0; v < mesh.mVertexCount; v++) {
+		std::byte* dst = keys.data() + v*vertexSize;
+		for (const MeshData::Attribute& a : mesh.mAttributes) {
+			std::memcpy(dst, a.mData.data() + v*a.mElementSize, a.mElementSize);
+			dst += a.mElementSize;
+		}
+	}
+
+	const auto GetKey = [&](const uint32_t v) { return std::string_view(reinterpret_cast<const char*>(keys.data() + v*vertexSize), vertexSize); };
+
+	std::unordered_map<std::string_view, uint32_t> unique;
+	unique.reserve(mesh.mVertexCount);
+	std::vector<uint32_t> remap(mesh.mVertexCount);
+	uint32_t uniqueCount = 0;
+	for (uint32_t v = 0; v < mesh.mVertexCount; v++) {
+		const auto[it, inserted] = unique.emplace(GetKey(v), uniqueCount);
+		if (inserted) {
+			// compact in place, the destination is never ahead of the source
+			if (uniqueCount != v)
+				for (MeshData::Attribute& a : mesh.mAttributes)
+					std::memcpy(a.mData.data() + uniqueCount*a.mElementSize, a.mData.data() + v*a.mElementSize, a.mElementSize);
+			uniqueCount++;
+		}
+		remap[v] = it->second;
+	}
+	if (uniqueCount == mesh.mVertexCount) return;
+
+	for (uint32_t& i : mesh.mIndices)
+		i = remap[i];
+	for (MeshData::Attribute& a : mesh.mAttributes)
+		a.mData.resize(uniqueCount*a.mElementSize);
+	mesh.mVertexCount = uniqueCount;
+}
+
+inline uint32_t ExpandBits(uint32_t v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+inline uint32_t MortonCode(const float3 p) {
+	const uint3 q = uint3(clamp(p * 1024.f, float3(0), float3(1023)));
+	return (ExpandBits(q.x) << 2) | (ExpandBits(q.y) << 1) | ExpandBits(q.z);
+}
+
+void OptimizeLocality(MeshData& mesh) {
+	const MeshData::Attribute* positions = mesh.Find(Mesh::VertexAttributeType::ePosition);
+	if (!positions || positions->mFormat != vk::Format::eR32G32B32Sfloat)
+		throw std::runtime_error("OptimizeLocality requires R32G32B32Sfloat positions");
+	const float3* p = reinterpret_cast<const float3*>(positions->mData.data());
+
+	const uint32_t triangleCount = (uint32_t)(mesh.mIndices.size() / 3);
+	if (triangleCount == 0) return;
+
+	float3 mn = float3( std::numeric_limits<float>::infinity());
+	float3 mx = float3(-std::numeric_limits<float>::infinity());
+	for (uint32_t v = 0; v < mesh.mVertexCount; v++) {
+		mn = min(mn, p[v]);
+		mx = max(mx, p[v]);
+	}
+	const float3 extent = max(mx - mn, float3(1e-20f));
+
+	// sort triangles by centroid
+	std::vector<std::pair<uint32_t, uint32_t>> order(triangleCount);
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		const float3 centroid = (p[mesh.mIndices[3*t]] + p[mesh.mIndices[3*t+1]] + p[mesh.mIndices[3*t+2]]) / 3.f;
+		order[t] = { MortonCode((centroid - mn) / extent), t };
+	}
+	std::ranges::sort(order);
+
+	std::vector<uint32_t> indices(mesh.mIndices.size());
+	for (uint32_t t = 0; t < triangleCount; t++)
+		std::copy_n(mesh.mIndices.begin() + 3*order[t].second, 3, indices.begin() + 3*t);
+
+	// renumber vertices in order of first use, unreferenced vertices are dropped
+	std::vector<uint32_t> remap(mesh.mVertexCount, ~0u);
+	uint32_t vertexCount = 0;
+	for (uint32_t& i : indices) {
+		if (remap[i] == ~0u)
+			remap[i] = vertexCount++;
+		i = remap[i];
+	}
+
+	for (MeshData::Attribute& a : mesh.mAttributes) {
+		std::vector<std::byte> data(vertexCount * a.mElementSize);
+		for (uint32_t v = 0; v < mesh.mVertexCount; v++)
+			if (remap[v] != ~0u)
+				std::memcpy(data.data() + remap[v]*a.mElementSize, a.mData.data() + v*a.mElementSize, a.mElementSize);
+		a.mData = std::move(data);
+	}
+	mesh.mIndices = std::move(indices);
+	mesh.mVertexCount = vertexCount;
+}
+
+inline int16_t ToSnorm16(const float v) {
+	return (int16_t)std::round(std::clamp(v, -1.f, 1.f) * 32767);
+}
+
+void QuantizeVertices(MeshData& mesh) {
+	if (mesh.mVertexCount == 0) return;
+
+	if (MeshData::Attribute* a = mesh.Find(Mesh::VertexAttributeType::ePosition); a && a->mFormat == vk::Format::eR32G32B32Sfloat) {
+		const float3* p = reinterpret_cast<const float3*>(a->mData.data());
+		float3 mn = p[0], mx = p[0];
+		for (uint32_t v = 1; v < mesh.mVertexCount; v++) {
+			mn = min(mn, p[v]);
+			mx = max(mx, p[v]);
+		}
+		// uniform scale, so that normals are not skewed by the dequantization transform
+		const float3 center = (mn + mx) / 2.f;
+		const float3 halfExtent = (mx - mn) / 2.f;
+		const float scale = std::max(std::max(halfExtent.x, std::max(halfExtent.y, halfExtent.z)), 1e-20f);
+
+		std::vector<std::byte> data(mesh.mVertexCount * 4*sizeof(int16_t));
+		int16_t* q = reinterpret_cast<int16_t*>(data.data());
+		for (uint32_t v = 0; v < mesh.mVertexCount; v++) {
+			const float3 n = (p[v] - center) / scale;
+			q[4*v + 0] = ToSnorm16(n.x);
+			q[4*v + 1] = ToSnorm16(n.y);
+			q[4*v + 2] = ToSnorm16(n.z);
+			q[4*v + 3] = 0;
+		}
+		a->mFormat = vk::Format::eR16G16B16A16Snorm;
+		a->mElementSize = 4*sizeof(int16_t);
+		a->mData = std::move(data);
+		mesh.mPositionTransform = glm::translate(center) * glm::scale(float3(scale));
+	}
+
+	if (MeshData::Attribute* a = mesh.Find(Mesh::VertexAttributeType::eNormal); a && a->mFormat == vk::Format::eR32G32B32Sfloat) {
+		const float3* n = reinterpret_cast<const float3*>(a->mData.data());
+		std::vector<std::byte> data(mesh.mVertexCount * 2*sizeof(int16_t));
+		int16_t* q = reinterpret_cast<int16_t*>(data.data());
+		for (uint32_t v = 0; v < mesh.mVertexCount; v++) {
+			// octahedral mapping, same as PackNormalF32 in PackedTypes.h
+			const float3 d = n[v] / std::max(std::abs(n[v].x) + std::abs(n[v].y) + std::abs(n[v].z), 1e-20f);
+			float2 o = float2(d.x, d.y);
+			if (d.z <= 0)
+				o = (1.f - abs(float2(o.y, o.x))) * float2(o.x >= 0 ? 1.f : -1.f, o.y >= 0 ? 1.f : -1.f);
+			q[2*v + 0] = ToSnorm16(o.x);
+			q[2*v + 1] = ToSnorm16(o.y);
+		}
+		a->mFormat = vk::Format::eR16G16Snorm;
+		a->mElementSize = 2*sizeof(int16_t);
+		a->mData = std::move(data);
+	}
+
+	for (MeshData::Attribute& a : mesh.mAttributes) {
+		if (a.mType != Mesh::VertexAttributeType::eTexcoord || a.mFormat != vk::Format::eR32G32Sfloat) continue;
+		const float2* t = reinterpret_cast<const float2*>(a.mData.data());
+		std::vector<std::byte> data(mesh.mVertexCount * sizeof(uint32_t));
+		uint32_t* q = reinterpret_cast<uint32_t*>(data.data());
+		for (uint32_t v = 0; v < mesh.mVertexCount; v++)
+			q[v] = glm::packHalf2x16(t[v]);
+		a.mFormat = vk::Format::eR16G16Sfloat;
+		a.mElementSize = sizeof(uint32_t);
+		a.mData = std::move(data);
+	}
+}
+
+size_t HashMesh(const MeshData& mesh) {
+	size_t hash = HashArgs(mesh.mVertexCount, mesh.IndexSize(), AssetRegistry::HashContents(std::as_bytes(std::span(mesh.mIndices))));
+	for (const MeshData::Attribute& a : mesh.mAttributes)
+		hash = HashCombine(hash, HashArgs(a.mType, a.mTypeIndex, a.mFormat, a.mElementSize, AssetRegistry::HashContents(a.mData)));
+	return HashCombine(hash, AssetRegistry::HashContents(std::as_bytes(std::span(&mesh.mPositionTransform, 1))));
+}
+
+std::vector<std::shared_ptr<Mesh>> UploadMeshes(
+	CommandBuffer& commandBuffer,
+	const std::span<const MeshData> meshes,
+	const std::span<const vk::AabbPositionsKHR> aabbs,
+	const std::string& name,
+	const vk::BufferUsageFlags usage,
+	std::vector<std::byte>& packedData,
+	HostBufferData& hostData,
+	std::unordered_set<const Mesh*>& sharedMeshes) {
+	std::vector<std::shared_ptr<Mesh>> result(meshes.size());
+
+	// look up each mesh once, duplicates within this load use the first copy
+	std::vector<size_t> keys(meshes.size());
+	std::vector<size_t> first(meshes.size());
+	std::unordered_map<size_t, size_t> firstIndex;
+	for (size_t k = 0; k < meshes.size(); k++) {
+		keys[k] = HashMesh(meshes[k]);
+		first[k] = firstIndex.emplace(keys[k], k).first->second;
+		if (first[k] == k)
+			result[k] = commandBuffer.FindSharedMesh(keys[k]);
+	}
+
+	struct PackedMesh {
+		size_t mIndexOffset = 0;
+		std::vector<size_t> mAttributeOffsets;
+	};
+	std::vector<PackedMesh> packed(meshes.size());
+	packedData.clear();
+	const auto Append = [&](const void* data, const size_t size) {
+		const size_t offset = (packedData.size() + 15) & ~size_t(15);
+		packedData.resize(offset + size);
+		std::memcpy(packedData.data() + offset, data, size);
+		return offset;
+	};
+	const auto Pack = [&](const size_t k) {
+		const MeshData& mesh = meshes[k];
+		if (mesh.IndexType() == vk::IndexType::eUint16) {
+			std::vector<uint16_t> indices(mesh.mIndices.begin(), mesh.mIndices.end());
+			packed[k].mIndexOffset = Append(indices.data(), indices.size()*sizeof(uint16_t));
+		} else
+			packed[k].mIndexOffset = Append(mesh.mIndices.data(), mesh.mIndices.size()*sizeof(uint32_t));
+		for (const MeshData::Attribute& a : mesh.mAttributes)
+			packed[k].mAttributeOffsets.emplace_back(Append(a.mData.data(), a.mData.size()));
+	};
+
+	// streams of new meshes come first and are uploaded. Those of reused meshes follow, and only back hostData
+	for (size_t k = 0; k < meshes.size(); k++)
+		if (first[k] == k && !result[k]) Pack(k);
+	const size_t uploadSize = packedData.size();
+	for (size_t k = 0; k < meshes.size(); k++)
+		if (first[k] == k && result[k]) Pack(k);
+
+	std::shared_ptr<Buffer> buffer;
+	if (uploadSize > 0) {
+		buffer = commandBuffer.Upload<std::byte>(vk::ArrayProxy<const std::byte>((uint32_t)uploadSize, packedData.data()), name, usage);
+		hostData.emplace(buffer.get(), HostBufferRange{ 0, std::span(packedData).first(uploadSize) });
+	}
+
+	for (size_t k = 0; k < meshes.size(); k++) {
+		const MeshData& mesh = meshes[k];
+		if (first[k] != k) {
+			result[k] = result[first[k]];
+			continue;
+		}
+
+		if (result[k]) {
+			// the reused mesh's views hold the same bytes as this mesh's streams
+			const Mesh& shared = *result[k];
+			sharedMeshes.emplace(&shared);
+			hostData.emplace(shared.GetIndices().GetBuffer().get(), HostBufferRange{ shared.GetIndices().Offset(), std::span(packedData).subspan(packed[k].mIndexOffset, mesh.mIndices.size() * mesh.IndexSize()) });
+			for (size_t a = 0; a < mesh.mAttributes.size(); a++)
+				if (const auto attrib = shared.GetVertices().find(mesh.mAttributes[a].mType, mesh.mAttributes[a].mTypeIndex))
+					hostData.emplace(attrib->first.GetBuffer().get(), HostBufferRange{ attrib->first.Offset(), std::span(packedData).subspan(packed[k].mAttributeOffsets[a], mesh.mAttributes[a].mData.size()) });
+			continue;
+		}
+
+		Mesh::Vertices vertexData;
+		for (size_t a = 0; a < mesh.mAttributes.size(); a++) {
+			const MeshData::Attribute& attrib = mesh.mAttributes[a];
+			auto& attribs = vertexData[attrib.mType];
+			if (attribs.size() <= attrib.mTypeIndex) attribs.resize(attrib.mTypeIndex+1);
+			attribs[attrib.mTypeIndex] = {
+				Buffer::View<std::byte>(buffer, packed[k].mAttributeOffsets[a], attrib.mData.size()),
+				Mesh::VertexAttributeDescription(attrib.mElementSize, attrib.mFormat, 0, vk::VertexInputRate::eVertex) };
+		}
+		vertexData.mAabb = aabbs[k];
+		vertexData.mPositionTransform = mesh.mPositionTransform;
+
+		const Buffer::StrideView indexBuffer(buffer, mesh.IndexSize(), packed[k].mIndexOffset, mesh.mIndices.size() * mesh.IndexSize());
+		result[k] = std::make_shared<Mesh>(std::move(vertexData), indexBuffer, vk::PrimitiveTopology::eTriangleList);
+		result[k]->SetContentHash(keys[k]);
+		commandBuffer.ShareMesh(keys[k], result[k], mesh.SizeBytes());
+	}
+
+	return result;
+}
+
+std::shared_ptr<const Mesh::Triangles> ReadTriangles(const Mesh& mesh, const HostBufferData& data) {
+	if (mesh.GetTopology() != vk::PrimitiveTopology::eTriangleList) return nullptr;
+
+	const auto GetData = [&](const Buffer::View<std::byte>& view) -> std::span<const std::byte> {
+		const auto[begin, end] = data.equal_range(view.GetBuffer().get());
+		for (auto it = begin; it != end; ++it) {
+			const HostBufferRange& range = it->second;
+			if (view.Offset() >= range.mOffset && view.Offset() + view.SizeBytes() <= range.mOffset + range.mData.size())
+				return range.mData.subspan(view.Offset() - range.mOffset, view.SizeBytes());
+		}
+		return {};
+	};
+
+	const Buffer::StrideView& indexView = mesh.GetIndices();
+	const std::span<const std::byte> indices = GetData(indexView);
+	if (indices.empty() || (indexView.Stride() != sizeof(uint16_t) && indexView.Stride() != sizeof(uint32_t))) return nullptr;
+	const size_t indexCount = indices.size() / indexView.Stride() / 3 * 3;
+	const auto Index = [&](const size_t i) -> uint32_t {
+		return indexView.Stride() == sizeof(uint16_t) ? reinterpret_cast<const uint16_t*>(indices.data())[i] : reinterpret_cast<const uint32_t*>(indices.data())[i];
+	};
+
+	const auto positionAttrib = mesh.GetVertices().find(Mesh::VertexAttributeType::ePosition);
+	if (!positionAttrib) return nullptr;
+	const auto&[positionView, positionDesc] = *positionAttrib;
+	const std::span<const std::byte> positions = GetData(positionView);
+	if (positions.empty()) return nullptr;
+	if (positionDesc.mFormat != vk::Format::eR32G32B32Sfloat && positionDesc.mFormat != vk::Format::eR16G16B16A16Snorm) return nullptr;
+	const size_t vertexCount = (positions.size() - std::min<size_t>(positionDesc.mOffset, positions.size())) / positionDesc.mStride;
+
+	std::span<const std::byte> texcoords;
+	Mesh::VertexAttributeDescription texcoordDesc = {};
+	if (const auto texcoordAttrib = mesh.GetVertices().find(Mesh::VertexAttributeType::eTexcoord)) {
+		texcoordDesc = texcoordAttrib->second;
+		if (texcoordDesc.mFormat == vk::Format::eR32G32Sfloat || texcoordDesc.mFormat == vk::Format::eR16G16Sfloat)
+			texcoords = GetData(texcoordAttrib->first);
+	}
+
+	auto triangles = std::make_shared<Mesh::Triangles>();
+	triangles->mPositions.resize(indexCount);
+	if (!texcoords.empty())
+		triangles->mTexcoords.resize(indexCount);
+
+	const float4x4& positionTransform = mesh.GetVertices().mPositionTransform;
+	for (size_t i = 0; i < indexCount; i++) {
+		const uint32_t index = Index(i);
+		if (index >= vertexCount) return nullptr;
+
+		const std::byte* p = positions.data() + positionDesc.mOffset + (size_t)index * positionDesc.mStride;
+		if (positionDesc.mFormat == vk::Format::eR32G32B32Sfloat)
+			triangles->mPositions[i] = *reinterpret_cast<const float3*>(p);
+		else {
+			const int16_t* q = reinterpret_cast<const int16_t*>(p);
+			triangles->mPositions[i] = TransformPoint(positionTransform, float3(
+				std::max(q[0] / 32767.f, -1.f),
+				std::max(q[1] / 32767.f, -1.f),
+				std::max(q[2] / 32767.f, -1.f)));
+		}
+
+		if (!texcoords.empty()) {
+			const size_t offset = texcoordDesc.mOffset + (size_t)index * texcoordDesc.mStride;
+			if (offset + GetTexelSize(texcoordDesc.mFormat) > texcoords.size()) {
+				triangles->mTexcoords.clear();
+				texcoords = {};
+				continue;
+			}
+			if (texcoordDesc.mFormat == vk::Format::eR32G32Sfloat)
+				triangles->mTexcoords[i] = *reinterpret_cast<const float2*>(texcoords.data() + offset);
+			else
+				triangles->mTexcoords[i] = glm::unpackHalf2x16(*reinterpret_cast<const uint32_t*>(texcoords.data() + offset));
+		}
+	}
+	return triangles;
+}
+
+void ReadEmissiveTriangles(SceneNode& root, const HostBufferData& data, const std::unordered_set<const Mesh*>& sharedMeshes) {
+	std::unordered_map<const Mesh*, std::shared_ptr<Mesh>> copies;
+	const auto Read = [&](std::shared_ptr<Mesh>& mesh, const std::shared_ptr<Material>& material) {
+		if (!mesh || !material || mesh->GetTriangles()) return;
+		const float3 emission = material->mMaterial.Emission();
+		if (!(emission.r > 0 || emission.g > 0 || emission.b > 0)) return;
+		if (!sharedMeshes.contains(mesh.get())) {
+			mesh->SetTriangles(ReadTriangles(*mesh, data));
+			return;
+		}
+		auto it = copies.find(mesh.get());
+		if (it == copies.end()) {
+			const std::shared_ptr<Mesh> copy = std::make_shared<Mesh>(*mesh);
+			copy->SetTriangles(ReadTriangles(*mesh, data));
+			it = copies.emplace(mesh.get(), copy).first;
+		}
+		mesh = it->second;
+	};
+	root.ForEachDescendant<MeshRenderer>([&](SceneNode& node, const std::shared_ptr<MeshRenderer>& renderer) {
+		Read(renderer->mMesh, renderer->mMaterial);
+	});
+	root.ForEachDescendant<InstancedMeshRenderer>([&](SceneNode& node, const std::shared_ptr<InstancedMeshRenderer>& renderer) {
+		Read(renderer->mMesh, renderer->mMaterial);
+	});
+}
+
+}
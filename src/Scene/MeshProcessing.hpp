@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Mesh.hpp"
+#include "SceneNode.hpp"
+
+#include <unordered_set>
+
+namespace ptvk {
+
+// CPU copy of an indexed triangle list, with each vertex attribute in its own tightly packed stream.
+// Used by loaders to process meshes before they are uploaded.
+struct MeshData {
+	struct Attribute {
+		Mesh::VertexAttributeType mType;
+		uint32_t mTypeIndex;
+		vk::Format mFormat;
+		uint32_t mElementSize;
+		std::vector<std::byte> mData;
+	};
+	std::vector<Attribute> mAttributes;
+	std::vector<uint32_t> mIndices;
+	uint32_t mVertexCount = 0;
+	float4x4 mPositionTransform = float4x4(1); // see Mesh::Vertices::mPositionTransform
+
+	inline Attribute* Find(const Mesh::VertexAttributeType type, const uint32_t typeIndex = 0) {
+		for (Attribute& a : mAttributes)
+			if (a.mType == type && a.mTypeIndex == typeIndex)
+				return &a;
+		return nullptr;
+	}
+
+	inline size_t VertexSize() const {
+		size_t s = 0;
+		for (const Attribute& a : mAttributes) s += a.mElementSize;
+		return s;
+	}
+	inline vk::IndexType IndexType() const { return mVertexCount <= 0xFFFF ? vk::IndexType::eUint16 : vk::IndexType::eUint32; }
+	inline size_t IndexSize() const { return IndexType() == vk::IndexType::eUint16 ? sizeof(uint16_t) : sizeof(uint32_t); }
+	inline size_t SizeBytes() const { return mVertexCount * VertexSize() + mIndices.size() * IndexSize(); }
+};
+
+// Merges vertices whose attributes are bitwise identical
+void WeldVertices(MeshData& mesh);
+
+// Sorts triangles along a Morton curve through their centroids, then renumbers vertices in order of first use.
+// Neighboring triangles end up close together in memory, which helps BLAS builds and hit shading alike.
+// Requires an R32G32B32Sfloat position attribute.
+void OptimizeLocality(MeshData& mesh);
+
+// Converts float attributes to the formats of VertexAttributeFormat::eQuantized:
+// positions to R16G16B16A16Snorm inside their bounding cube (mPositionTransform maps them back),
+// normals to octahedral R16G16Snorm, and texcoords to R16G16Sfloat.
+// Should run last, as the other passes expect float positions.
+void QuantizeVertices(MeshData& mesh);
+
+// Host copies of uploaded buffers, keyed by the buffer they were uploaded to. A buffer may have several ranges,
+// e.g. when a load reuses meshes from another load's buffer and only holds copies of their own streams
+struct HostBufferRange {
+	size_t mOffset = 0;
+	std::span<const std::byte> mData;
+};
+using HostBufferData = std::unordered_multimap<const Buffer*, HostBufferRange>;
+
+// Content key of a mesh once packed by UploadMeshes (see Mesh::GetContentHash): covers the index and vertex streams and their formats
+size_t HashMesh(const MeshData& mesh);
+
+// Packs the index and vertex streams of meshes into one buffer, with each stream 16-byte aligned for ByteAddressBuffer loads.
+// Meshes already uploaded by another load (see CommandBuffer::FindSharedMesh) are reused and added to sharedMeshes, the rest are uploaded and shared.
+// packedData receives host copies of every mesh's streams, and hostData the ranges of it which back each returned mesh.
+std::vector<std::shared_ptr<Mesh>> UploadMeshes(
+	CommandBuffer& commandBuffer,
+	const std::span<const MeshData> meshes,
+	const std::span<const vk::AabbPositionsKHR> aabbs,
+	const std::string& name,
+	const vk::BufferUsageFlags usage,
+	std::vector<std::byte>& packedData,
+	HostBufferData& hostData,
+	std::unordered_set<const Mesh*>& sharedMeshes);
+
+// Reads a triangle list mesh back from host copies of its buffers.
+// Supports float and quantized positions, and float or half texcoords. Returns null if a buffer is missing or a format is unsupported.
+std::shared_ptr<const Mesh::Triangles> ReadTriangles(const Mesh& mesh, const HostBufferData& data);
+
+// Keeps the triangles of every MeshRenderer and InstancedMeshRenderer under root whose material is emissive.
+// Meshes in sharedMeshes belong to other loads as well and may be in use on other threads, so renderers get a copy holding the triangles instead
+void ReadEmissiveTriangles(SceneNode& root, const HostBufferData& data, const std::unordered_set<const Mesh*>& sharedMeshes = {});
+
+}
@@ -1,8 +1,11 @@
 #include "Scene.hpp"
 #include "FlyCamera.hpp"
+#include "AliasTable.hpp"
+#include "LightBvh.hpp"
 #include <App/App.hpp>
 #include <Core/Gui.hpp>
 #include <Core/Window.hpp>
+#include <Core/BlockCompression.hpp>
 
 #include <future>
 #include <portable-file-dialogs.h>
@@ -11,8 +14,9 @@
 
 namespace ptvk {
 
-std::tuple<std::shared_ptr<vk::raii::AccelerationStructureKHR>, Buffer::View<std::byte>> BuildAccelerationStructure(CommandBuffer& commandBuffer, const std::string& name, const vk::AccelerationStructureTypeKHR type, const vk::ArrayProxy<const vk::AccelerationStructureGeometryKHR>& geometries, const vk::ArrayProxy<const vk::AccelerationStructureBuildRangeInfoKHR>& buildRanges) {
-	vk::AccelerationStructureBuildGeometryInfoKHR buildGeometry(type, vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace, vk::BuildAccelerationStructureModeKHR::eBuild);
+// Creates an acceleration structure and its buffer, sized for geometries, without building it. Also returns the scratch size needed to build it
+std::tuple<std::shared_ptr<vk::raii::AccelerationStructureKHR>, Buffer::View<std::byte>, vk::DeviceSize> CreateAccelerationStructure(CommandBuffer& commandBuffer, const std::string& name, const vk::AccelerationStructureTypeKHR type, const vk::ArrayProxy<const vk::AccelerationStructureGeometryKHR>& geometries, const vk::ArrayProxy<const vk::AccelerationStructureBuildRangeInfoKHR>& buildRanges, const vk::BuildAccelerationStructureFlagsKHR flags) {
+	vk::AccelerationStructureBuildGeometryInfoKHR buildGeometry(type, flags, vk::BuildAccelerationStructureModeKHR::eBuild);
 	buildGeometry.setGeometries(geometries);
 
 	vk::AccelerationStructureBuildSizesInfoKHR buildSizes;
@@ -30,27 +34,67 @@ std::tuple<std::shared_ptr<vk::raii::AccelerationStructureKHR>, Buffer::View<std
 		buildSizes.accelerationStructureSize,
 		vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress);
 
+	std::shared_ptr<vk::raii::AccelerationStructureKHR> accelerationStructure = std::make_shared<vk::raii::AccelerationStructureKHR>(*commandBuffer.mDevice, vk::AccelerationStructureCreateInfoKHR({}, **buffer.GetBuffer(), buffer.Offset(), buffer.SizeBytes(), type));
+	commandBuffer.mDevice.SetDebugName(**accelerationStructure, name);
+
+	commandBuffer.HoldResource(buffer);
+	commandBuffer.HoldResource(accelerationStructure);
+
+	buffer.SetState(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+
+	return std::make_tuple(accelerationStructure, buffer, buildSizes.buildScratchSize);
+}
+
+std::tuple<std::shared_ptr<vk::raii::AccelerationStructureKHR>, Buffer::View<std::byte>> BuildAccelerationStructure(CommandBuffer& commandBuffer, const std::string& name, const vk::AccelerationStructureTypeKHR type, const vk::ArrayProxy<const vk::AccelerationStructureGeometryKHR>& geometries, const vk::ArrayProxy<const vk::AccelerationStructureBuildRangeInfoKHR>& buildRanges, const vk::BuildAccelerationStructureFlagsKHR flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace) {
+	const auto[accelerationStructure, buffer, scratchSize] = CreateAccelerationStructure(commandBuffer, name, type, geometries, buildRanges, flags);
+
 	Buffer::View<std::byte> scratchData = std::make_shared<Buffer>(
 		commandBuffer.mDevice,
 		name + "/scratchData",
-		buildSizes.buildScratchSize,
+		scratchSize,
 		vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eStorageBuffer);
 
-	std::shared_ptr<vk::raii::AccelerationStructureKHR> accelerationStructure = std::make_shared<vk::raii::AccelerationStructureKHR>(*commandBuffer.mDevice, vk::AccelerationStructureCreateInfoKHR({}, **buffer.GetBuffer(), buffer.Offset(), buffer.SizeBytes(), type));
-	commandBuffer.mDevice.SetDebugName(**accelerationStructure, name);
-
+	vk::AccelerationStructureBuildGeometryInfoKHR buildGeometry(type, flags, vk::BuildAccelerationStructureModeKHR::eBuild);
+	buildGeometry.setGeometries(geometries);
 	buildGeometry.dstAccelerationStructure = **accelerationStructure;
 	buildGeometry.scratchData = scratchData.GetDeviceAddress();
 
 	commandBuffer->buildAccelerationStructuresKHR(buildGeometry, buildRanges.data());
 
-	commandBuffer.HoldResource(buffer);
 	commandBuffer.HoldResource(scratchData);
-	commandBuffer.HoldResource(accelerationStructure);
 
-	buffer.SetState(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+	return std::make_tuple(accelerationStructure, buffer);
+}
+
+// Refits an acceleration structure built with eAllowUpdate in place. geometries must have the same primitive counts as the build.
+// scratch is reallocated if it is too small
+void RefitAccelerationStructure(CommandBuffer& commandBuffer, const vk::raii::AccelerationStructureKHR& accelerationStructure, const Buffer::View<std::byte>& buffer, Buffer::View<std::byte>& scratch, const vk::AccelerationStructureTypeKHR type, const vk::ArrayProxy<const vk::AccelerationStructureGeometryKHR>& geometries, const vk::ArrayProxy<const vk::AccelerationStructureBuildRangeInfoKHR>& buildRanges, const vk::BuildAccelerationStructureFlagsKHR flags) {
+	vk::AccelerationStructureBuildGeometryInfoKHR buildGeometry(type, flags, vk::BuildAccelerationStructureModeKHR::eUpdate, *accelerationStructure, *accelerationStructure);
+	buildGeometry.setGeometries(geometries);
+
+	std::vector<uint32_t> counts((uint32_t)geometries.size());
+	for (uint32_t i = 0; i < geometries.size(); i++)
+		counts[i] = (buildRanges.data() + i)->primitiveCount;
+	const vk::AccelerationStructureBuildSizesInfoKHR buildSizes = commandBuffer.mDevice->getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, buildGeometry, counts);
+	if (!scratch || scratch.SizeBytes() < buildSizes.updateScratchSize)
+		scratch = std::make_shared<Buffer>(
+			commandBuffer.mDevice,
+			"TLAS/updateScratchData",
+			std::max<vk::DeviceSize>(buildSizes.updateScratchSize, 4),
+			vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eStorageBuffer);
+	buildGeometry.scratchData = scratch.GetDeviceAddress();
+
+	// the structure and scratch may still be in use by previous frames' traces and refits
+	commandBuffer.FlushBarriers();
+	commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+		vk::MemoryBarrier(vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eAccelerationStructureWriteKHR | vk::AccessFlagBits::eShaderRead,
+			vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eAccelerationStructureWriteKHR), {}, {});
+
+	commandBuffer->buildAccelerationStructuresKHR(buildGeometry, buildRanges.data());
 
-	return std::tie(accelerationStructure, buffer);
+	commandBuffer.HoldResource(buffer);
+	commandBuffer.HoldResource(scratch);
+	buffer.SetState(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::AccessFlagBits::eAccelerationStructureWriteKHR);
 }
 
 Scene::Scene(Instance& instance) {
@@ -61,34 +105,165 @@ Scene::Scene(Instance& instance) {
 	mRootNode = SceneNode::Create("Root");
 	mInspectedNode = nullptr;
 
+	mAssetCache = AssetCache(instance);
+	mOptimizeMeshes = instance.GetOption("optimize-meshes").has_value();
+	mQuantizeVertices = instance.GetOption("quantize-vertices").has_value();
+	mCompressTextures = instance.GetOption("compress-textures").has_value();
+	mPowerLightSelection = !instance.GetOption("uniform-light-selection").has_value();
+	mUseLightBvh = !instance.GetOption("no-light-bvh").has_value();
+	mSolidAngleLightSampling = !instance.GetOption("area-light-sampling").has_value();
+	mIncrementalUpdates = !instance.GetOption("no-incremental-scene-updates").has_value();
+	mRefitTlas = !instance.GetOption("no-tlas-refit").has_value();
+	mCompactBlas = !instance.GetOption("no-blas-compaction").has_value();
+	if (auto arg = instance.GetOption("max-tlas-refits"))
+		mMaxTlasRefits = std::stoi(*arg);
+	if (auto arg = instance.GetOption("max-blas-batch-scratch"))
+		mMaxBlasBatchScratch = (vk::DeviceSize)std::max(std::stoi(*arg), 1) << 20;
+
+	if (auto arg = instance.GetOption("load-threads"))
+		mLoadThreads = std::max(std::stoi(*arg), 1);
+
 	for (const std::string arg : instance.GetOptions("scene"))
-		mToLoad.emplace_back(arg);
+		mToLoad.emplace_back(arg, 0);
 	mUpdateOnce = true;
 }
 
-std::shared_ptr<SceneNode> Scene::LoadEnvironmentMap(CommandBuffer& commandBuffer, const std::filesystem::path& filepath) {
-	std::filesystem::path path = filepath;
-	if (path.is_relative()) {
-		std::filesystem::path cur = std::filesystem::current_path();
-		std::filesystem::current_path(path.parent_path());
-		path = std::filesystem::absolute(path);
-		std::filesystem::current_path(cur);
+std::shared_ptr<const LuminanceMap> LuminanceMap::Create(const std::span<const float> luminance, const uint2 extent) {
+	if (luminance.empty() || extent.x == 0 || extent.y == 0 || luminance.size() < (size_t)extent.x*extent.y) return nullptr;
+
+	auto map = std::make_shared<LuminanceMap>();
+
+	// box filter down to gMaxExtent first, triangle weights only need the coarse distribution
+	const uint32_t factor = (std::max(extent.x, extent.y) + gMaxExtent - 1) / gMaxExtent;
+	uint2 e = uint2((extent.x + factor - 1) / factor, (extent.y + factor - 1) / factor);
+	std::vector<float> level((size_t)e.x*e.y, 0.f);
+	std::vector<uint32_t> counts(level.size(), 0);
+	for (uint32_t y = 0; y < extent.y; y++)
+		for (uint32_t x = 0; x < extent.x; x++) {
+			const float v = luminance[(size_t)y*extent.x + x];
+			const size_t i = (size_t)(y/factor)*e.x + x/factor;
+			level[i] += std::isfinite(v) ? std::max(v, 0.f) : 0.f;
+			counts[i]++;
+		}
+	for (size_t i = 0; i < level.size(); i++) {
+		map->mMean += level[i];
+		level[i] /= std::max(counts[i], 1u);
+	}
+	map->mMean /= (float)extent.x*extent.y;
+
+	map->mLevels.emplace_back(std::move(level));
+	map->mExtents.emplace_back(e);
+	while (e.x > 1 || e.y > 1) {
+		const uint2 n = uint2(std::max(e.x/2, 1u), std::max(e.y/2, 1u));
+		const std::vector<float>& src = map->mLevels.back();
+		std::vector<float> dst((size_t)n.x*n.y);
+		for (uint32_t y = 0; y < n.y; y++)
+			for (uint32_t x = 0; x < n.x; x++) {
+				// odd extents fold their last row/column into the last texel
+				const uint32_t x0 = x*e.x/n.x, x1 = (x+1)*e.x/n.x;
+				const uint32_t y0 = y*e.y/n.y, y1 = (y+1)*e.y/n.y;
+				float sum = 0;
+				for (uint32_t sy = y0; sy < y1; sy++)
+					for (uint32_t sx = x0; sx < x1; sx++)
+						sum += src[(size_t)sy*e.x + sx];
+				dst[(size_t)y*n.x + x] = sum / ((x1 - x0)*(y1 - y0));
+			}
+		map->mLevels.emplace_back(std::move(dst));
+		map->mExtents.emplace_back(n);
+		e = n;
 	}
+	return map;
+}
+
+float LuminanceMap::Average(const float2 uv0, const float2 uv1, const float2 uv2) const {
+	if (mLevels.empty()) return 0;
+
+	// pick the level where the triangle covers a few texels, then average a few bilinear samples
+	const float2 e0 = float2(mExtents[0]);
+	const float texelArea = std::abs((uv1.x - uv0.x)*(uv2.y - uv0.y) - (uv2.x - uv0.x)*(uv1.y - uv0.y)) / 2 * e0.x * e0.y;
+	if (texelArea >= e0.x * e0.y) return mMean;
+	const uint32_t level = (uint32_t)std::clamp(std::floor(std::log2(std::max(texelArea / 4, 1.f)) / 2), 0.f, (float)mLevels.size() - 1);
+	const std::vector<float>& texels = mLevels[level];
+	const uint2 extent = mExtents[level];
+
+	const auto Texel = [&](int32_t x, int32_t y) {
+		x %= (int32_t)extent.x; if (x < 0) x += extent.x;
+		y %= (int32_t)extent.y; if (y < 0) y += extent.y;
+		return texels[(size_t)y*extent.x + x];
+	};
+	const auto Sample = [&](const float2 uv) {
+		if (!std::isfinite(uv.x) || !std::isfinite(uv.y)) return 0.f;
+		const float2 p = uv * float2(extent) - 0.5f;
+		const float2 f = floor(p);
+		const float2 t = p - f;
+		const int32_t x = (int32_t)f.x, y = (int32_t)f.y;
+		return glm::mix(
+			glm::mix(Texel(x, y  ), Texel(x+1, y  ), t.x),
+			glm::mix(Texel(x, y+1), Texel(x+1, y+1), t.x), t.y);
+	};
+
+	const float2 center = (uv0 + uv1 + uv2) / 3.f;
+	return (Sample(center) + Sample((center + uv0)/2.f) + Sample((center + uv1)/2.f) + Sample((center + uv2)/2.f)) / 4;
+}
+
+std::shared_ptr<SceneNode> Scene::LoadEnvironmentMap(CommandBuffer& commandBuffer, const std::filesystem::path& filepath) {
+	ReportLoadProgress(LoadJob::Stage::eDecode);
 
 	ImageInfo md = {};
 	std::shared_ptr<Buffer> pixels;
 	std::tie(pixels, md.mFormat, md.mExtent) = LoadImageFile(commandBuffer.mDevice, filepath, false);
+	const vk::Format srcFormat = md.mFormat;
 	md.mUsage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
 	md.mLevels = GetMaxMipLevels(md.mExtent);
-	const std::shared_ptr<Image> img = std::make_shared<Image>(commandBuffer.mDevice, filepath.filename().string(), md);
-
-	commandBuffer.Copy(pixels, img);
-	commandBuffer.GenerateMipMaps(img);
 
-	commandBuffer.HoldResource(pixels);
+	// HDR environment maps are stored as BC6H, an eighth of the size of RGBA32F
+	std::shared_ptr<Image> img;
+	vk::Format compressedFormat = mCompressTextures ? GetBlockCompressedFormat(md.mFormat) : vk::Format::eUndefined;
+	if (compressedFormat != vk::Format::eUndefined && !commandBuffer.mDevice.SupportsBlockCompressedFormat(compressedFormat)) {
+		std::cout << vk::to_string(compressedFormat) << " is not supported by the device, not compressing " << filepath.filename() << std::endl;
+		compressedFormat = vk::Format::eUndefined;
+	}
+	if (compressedFormat != vk::Format::eUndefined) {
+		const std::span<const std::byte> src(reinterpret_cast<const std::byte*>(pixels->data()), pixels->size());
+		const size_t textureKey = AssetCache::ComputeTextureKey(src, srcFormat, md.mExtent, compressedFormat);
+		std::vector<std::vector<std::byte>> levels = mAssetCache.ReadTexture(textureKey);
+		if (levels.size() != md.mLevels) {
+			levels = EncodeBlockCompressed(GenerateMipChain(src, srcFormat, md.mExtent), srcFormat, md.mExtent, compressedFormat);
+			mAssetCache.WriteTexture(textureKey, levels);
+		}
+		md.mFormat = compressedFormat;
+		img = commandBuffer.UploadShared(levels, md, filepath.filename().string());
+
+		const auto[srcSize, srcUnit] = FormatBytes(pixels->size());
+		const auto[dstSize, dstUnit] = FormatBytes(levels[0].size());
+		std::cout << "Compressed " << filepath.filename() << " to " << vk::to_string(compressedFormat) << " (" << srcSize << " " << srcUnit << " -> " << dstSize << " " << dstUnit << ")" << std::endl;
+	} else {
+		const std::vector<std::vector<std::byte>> levels = GenerateMipChain(std::span(reinterpret_cast<const std::byte*>(pixels->data()), pixels->size()), md.mFormat, md.mExtent);
+		// formats GenerateMipChain does not support are mipmapped with blits, which need a graphics queue
+		if (levels.empty() && !commandBuffer.SupportsBlit())
+			md.mLevels = 1;
+		if (!levels.empty())
+			img = commandBuffer.UploadShared(levels, md, filepath.filename().string());
+		else {
+			img = std::make_shared<Image>(commandBuffer.mDevice, filepath.filename().string(), md);
+			commandBuffer.Copy(pixels, img);
+			if (md.mLevels > 1)
+				commandBuffer.GenerateMipMaps(img);
+			commandBuffer.HoldResource(pixels);
+		}
+	}
 
 	const std::shared_ptr<SceneNode> node = SceneNode::Create(filepath.stem().string());
-	node->MakeComponent<EnvironmentMap>(float3(1), img);
+	const std::shared_ptr<EnvironmentMap> environment = node->MakeComponent<EnvironmentMap>(float3(1), img);
+
+	uint2 tableExtent;
+	const std::vector<AliasTableEntry> table = BuildEnvironmentAliasTable(ComputeLuminance(std::span(reinterpret_cast<const std::byte*>(pixels->data()), pixels->size()), srcFormat, md.mExtent), uint2(md.mExtent.width, md.mExtent.height), tableExtent);
+	if (!table.empty()) {
+		environment->mAliasTable = commandBuffer.UploadShared<AliasTableEntry>(table, filepath.filename().string() + "/AliasTable", vk::BufferUsageFlagBits::eStorageBuffer);
+		environment->mAliasTableExtent = tableExtent;
+	} else
+		std::cout << "Unsupported format for environment importance sampling: " << vk::to_string(srcFormat) << std::endl;
+
 	return node;
 }
 
@@ -109,8 +284,9 @@ bool OnInspectorGui(SceneNode& node, float4x4& v) {
 	if (ImGui::InputFloat3("S", matrixScale)) changed = true;
 	if (changed) {
 		ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, &v[0][0]);
+		node.MarkTransformDirty();
 	}
-	return true;
+	return changed;
 }
 
 bool OnInspectorGui(SceneNode& node, Camera& v) {
@@ -211,6 +387,21 @@ bool OnInspectorGui(SceneNode& node, MeshRenderer& v) {
 	}
 	return changed;
 }
+bool OnInspectorGui(SceneNode& node, InstancedMeshRenderer& v) {
+	bool changed = false;
+	ImGui::Text("%zu instances", v.mTransforms.size());
+	if (v.mMaterial) {
+		if (ImGui::CollapsingHeader("Mesh")) {
+			if (OnInspectorGui(node, *v.mMesh))
+				changed = true;
+		}
+		if (ImGui::CollapsingHeader("Material")) {
+			if (OnInspectorGui(node, *v.mMaterial))
+				changed = true;
+		}
+	}
+	return changed;
+}
 bool OnInspectorGui(SceneNode& node, SphereRenderer& v) {
 	bool changed = false;
 	if (ImGui::DragFloat("Radius", &v.mRadius, .01f))
@@ -245,9 +436,47 @@ bool OnInspectorGui(SceneNode& node, EnvironmentMap& v) {
 }
 
 
+// load queue inspector
+
+bool Scene::DrawLoadQueueGui() {
+	if (!mLoadQueue) return false;
+	const std::vector<std::shared_ptr<LoadJob>> jobs = mLoadQueue->GetJobs();
+	if (jobs.empty()) return false;
+	if (!ImGui::CollapsingHeader("Loading", ImGuiTreeNodeFlags_DefaultOpen)) return false;
+
+	for (const auto& job : jobs) {
+		ImGui::PushID(job.get());
+		const LoadJob::Stage stage = job->mStage;
+		ImGui::Text("%s: %s", job->mFilename.filename().string().c_str(), std::to_string(stage).c_str());
+		if (stage == LoadJob::Stage::eFailed && ImGui::IsItemHovered())
+			ImGui::SetTooltip("%s", job->mError.c_str());
+		if (!job->Finished()) {
+			ImGui::ProgressBar(job->mProgress);
+			if (stage == LoadJob::Stage::eQueued) {
+				int priority = job->mPriority;
+				ImGui::SetNextItemWidth(ImGui::GetFontSize()*6);
+				if (ImGui::InputInt("Priority", &priority))
+					job->mPriority = priority;
+				ImGui::SameLine();
+			}
+			// jobs can no longer be cancelled once their uploads are submitted
+			if (job->mUploadValue == 0 && ImGui::Button("Cancel"))
+				job->Cancel();
+		}
+		ImGui::PopID();
+	}
+
+	if (ImGui::Button("Cancel all"))
+		mLoadQueue->CancelAll();
+	ImGui::SameLine();
+	if (ImGui::Button("Clear finished"))
+		mLoadQueue->ClearFinished();
+	return true;
+}
+
 // scene graph node inspector
 
-bool Scene::DrawNodeGui(SceneNode& n, bool& changed) {
+bool Scene::DrawNodeGui(SceneNode& n, bool& changed, bool& instancesChanged) {
 	ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_OpenOnDoubleClick | ImGuiTreeNodeFlags_OpenOnArrow;
 	if (mInspectedNode && &n == mInspectedNode) flags |= ImGuiTreeNodeFlags_Selected;
 	if (n.GetChildren().empty()) flags |= ImGuiTreeNodeFlags_Leaf;
@@ -293,7 +522,7 @@ bool Scene::DrawNodeGui(SceneNode& n, bool& changed) {
 	if (ImGui::BeginPopupContextItem()) {
 		if (ImGui::Selectable(n.Enabled() ? "Disable" : "Enable")) {
 			n.Enabled(!n.Enabled());
-			changed = true;
+			instancesChanged = true;
 		}
 		if (ImGui::Selectable("Add component", false, ImGuiSelectableFlags_DontClosePopups)) {
 			ImGui::OpenPopup("Add component");
@@ -341,7 +570,7 @@ bool Scene::DrawNodeGui(SceneNode& n, bool& changed) {
 
 		// draw children
 		for (const std::shared_ptr<SceneNode>& c : n.GetChildren())
-			if (DrawNodeGui(*c, changed))
+			if (DrawNodeGui(*c, changed, instancesChanged))
 				toErase.emplace(c.get());
 
 		for (SceneNode* c : toErase) {
@@ -350,7 +579,7 @@ bool Scene::DrawNodeGui(SceneNode& n, bool& changed) {
 					mInspectedNode = nullptr;
 			}
 			c->RemoveParent();
-			changed = true;
+			instancesChanged = true;
 		}
 
 		ImGui::TreePop();
@@ -442,6 +671,9 @@ void Scene::Update(CommandBuffer& commandBuffer) {
 	sGizmoData.Update();
 
 	bool changed = false;
+	bool transformsChanged = false;
+	bool materialsChanged = false;
+	bool instancesChanged = false;
 
 	// draw gui
 	if (ImGui::Begin("Scene Inspector")) {
@@ -455,10 +687,67 @@ void Scene::Update(CommandBuffer& commandBuffer) {
 		if (ImGui::Button("Update"))
 			changed = true;
 
+		DrawLoadQueueGui();
+
+		if (ImGui::CollapsingHeader("Updates")) {
+			ImGui::Checkbox("Incremental updates", &mIncrementalUpdates);
+			ImGui::Text("Last update: %s, %.2fms", mUpdateStats.mType, mUpdateStats.mTime);
+			if (mUpdateStats.mType != std::string_view("full")) {
+				const auto[size, unit] = FormatBytes(mUpdateStats.mUploadBytes);
+				ImGui::Text("%u instances, %u materials patched (%zu %s)", mUpdateStats.mPatchedInstances, mUpdateStats.mPatchedMaterials, size, unit);
+				if (mUpdateStats.mAddedInstances > 0 || mUpdateStats.mRemovedInstances > 0)
+					ImGui::Text("%u instances added, %u removed", mUpdateStats.mAddedInstances, mUpdateStats.mRemovedInstances);
+			}
+			if (ImGui::Checkbox("Refit TLAS", &mRefitTlas))
+				mTlas.mAccelerationStructure.reset(); // the next build sets or clears eAllowUpdate
+			if (mRefitTlas) {
+				ImGui::PushItemWidth(80);
+				Gui::ScalarField<uint32_t>("Max refits", &mMaxTlasRefits, 0, 1024);
+				ImGui::DragFloat("Max bounds growth", &mMaxTlasBoundsGrowth, .01f, 1, 16);
+				ImGui::PopItemWidth();
+				if (*mTlas.mRebuildReason)
+					ImGui::Text("TLAS built (%s)", mTlas.mRebuildReason);
+				else
+					ImGui::Text("TLAS refit %u times since build", mTlas.mRefitCount);
+			}
+			ImGui::Text("TLAS build %.3fms, refit %.3fms", mTlas.mBuildTime, mTlas.mRefitTime);
+			ImGui::Checkbox("Compact BLASs", &mCompactBlas);
+			if (mCompactionStats.mCount > 0) {
+				const auto[reclaimed, unit] = FormatBytes(mCompactionStats.mOriginalBytes - mCompactionStats.mCompactedBytes);
+				ImGui::Text("%u BLASs compacted, %zu %s reclaimed", mCompactionStats.mCount, reclaimed, unit);
+			}
+			if (mBlasBuildStats.mCount > 0) {
+				ImGui::Text("%u BLASs built in %u batches (%zu triangles)", mBlasBuildStats.mCount, mBlasBuildStats.mBatchCount, mBlasBuildStats.mTriangleCount);
+				if (mBlasBuildStats.mTime > 0)
+					ImGui::Text("BLAS build %.3fms, %.2f Mtri/s", mBlasBuildStats.mTime, mBlasBuildStats.mTimedTriangleCount / (mBlasBuildStats.mTime * 1e3f));
+				const auto[scratch, unit] = FormatBytes(mBlasScratch.SizeBytes());
+				ImGui::Text("BLAS scratch: %zu %s", scratch, unit);
+				if (!mBlasBuildStats.mMeshTimes.empty() && ImGui::TreeNode("BLAS build time per mesh")) {
+					for (const auto&[name, time] : mBlasBuildStats.mMeshTimes)
+						ImGui::Text("%s: %.4fms", name.c_str(), time);
+					ImGui::TreePop();
+				}
+			}
+		}
+
+		if (ImGui::CollapsingHeader("Lights")) {
+			if (ImGui::Checkbox("Sample by emitted power", &mPowerLightSelection))
+				changed = true;
+			if (ImGui::Checkbox("Light BVH", &mUseLightBvh))
+				changed = true;
+			if (ImGui::Checkbox("Sample solid angle", &mSolidAngleLightSampling))
+				changed = true;
+			if (mUseLightBvh) {
+				const auto[size, unit] = FormatBytes(mLightBvhStats.mBytes);
+				ImGui::Text("%u primitives, %u nodes (%zu %s)", mLightBvhStats.mPrimitiveCount, mLightBvhStats.mNodeCount, size, unit);
+				ImGui::Text("Built in %.2fms", mLightBvhStats.mBuildTime);
+			}
+		}
+
 		if (ImGui::CollapsingHeader("Scene graph")) {
 			const float s = ImGui::GetStyle().IndentSpacing;
 			ImGui::GetStyle().IndentSpacing = s/2;
-			if (DrawNodeGui(*mRootNode, changed))
+			if (DrawNodeGui(*mRootNode, changed, instancesChanged))
 				changed = true;
 			ImGui::GetStyle().IndentSpacing = s;
 		}
@@ -473,17 +762,18 @@ void Scene::Update(CommandBuffer& commandBuffer) {
 			bool e = mInspectedNode->Enabled();
 			if (ImGui::Checkbox("Enabled", &e)) {
 				mInspectedNode->Enabled(e);
-				changed = true;
+				instancesChanged = true;
 			}
 			for (const std::type_index compType : mInspectedNode->GetComponents()) {
 				if (ImGui::CollapsingHeader(compType.name())) {
-					if      (compType == typeid(float4x4))       { if (OnInspectorGui(*mInspectedNode, *mInspectedNode->GetComponent<float4x4>())) changed = true; }
+					if      (compType == typeid(float4x4))       { if (OnInspectorGui(*mInspectedNode, *mInspectedNode->GetComponent<float4x4>())) transformsChanged = true; }
 					else if (compType == typeid(Camera))         { if (OnInspectorGui(*mInspectedNode, *mInspectedNode->GetComponent<Camera>())) changed = true; }
 					else if (compType == typeid(Mesh))           { if (OnInspectorGui(*mInspectedNode, *mInspectedNode->GetComponent<Mesh>())) changed = true; }
-					else if (compType == typeid(MeshRenderer))   { if (OnInspectorGui(*mInspectedNode, *mInspectedNode->GetComponent<MeshRenderer>())) changed = true; }
+					else if (compType == typeid(MeshRenderer))   { if (OnInspectorGui(*mInspectedNode, *mInspectedNode->GetComponent<MeshRenderer>())) materialsChanged = true; }
+					else if (compType == typeid(InstancedMeshRenderer)) { if (OnInspectorGui(*mInspectedNode, *mInspectedNode->GetComponent<InstancedMeshRenderer>())) materialsChanged = true; }
 					else if (compType == typeid(SphereRenderer)) { if (OnInspectorGui(*mInspectedNode, *mInspectedNode->GetComponent<SphereRenderer>())) changed = true; }
 					else if (compType == typeid(EnvironmentMap)) { if (OnInspectorGui(*mInspectedNode, *mInspectedNode->GetComponent<EnvironmentMap>())) changed = true; }
-					else if (compType == typeid(Material))       { if (OnInspectorGui(*mInspectedNode, *mInspectedNode->GetComponent<Material>())) changed = true; }
+					else if (compType == typeid(Material))       { if (OnInspectorGui(*mInspectedNode, *mInspectedNode->GetComponent<Material>())) materialsChanged = true; }
 					else if (compType == typeid(VolumeRenderer)) { if (OnInspectorGui(*mInspectedNode, *mInspectedNode->GetComponent<VolumeRenderer>())) changed = true; }
 					else if (compType == typeid(FlyCamera))      { if (mInspectedNode->GetComponent<FlyCamera>()->OnInspectorGui()) changed = true; }
 					ImGui::Separator();
@@ -505,65 +795,608 @@ void Scene::Update(CommandBuffer& commandBuffer) {
 			if (auto v = mInspectedNode->GetComponent<float4x4>())
 				m = *v;
 
-			float4x4 view = inverse(NodeToWorld(*cameraNode));
+			float4x4 view = cameraNode->GetWorldInverse();
 			float4x4 proj = camera->GetProjection();
 			if (sGizmoData.OnGizmoGui(&view[0][0], &proj[0][0], parentTransform, m)) {
-				changed = true;
-				if (auto v = mInspectedNode->GetComponent<float4x4>())
-					*v = m;
-				else
-					mInspectedNode->MakeComponent<float4x4>(m);
+				transformsChanged = true;
+				mInspectedNode->SetTransform(m);
 			}
 		}
 	}
 
-	if (changed) mUpdateOnce = true;
+	if (changed) mDirty.mStructure = true;
+	if (transformsChanged) mDirty.mTransforms = true;
+	if (materialsChanged) mDirty.mMaterials = true;
+	if (instancesChanged) mDirty.mInstances = true;
 
 	// load input files
 
-	bool loaded = false;
-	for (auto it = mLoading.begin(); it != mLoading.end();) {
-		if (it->wait_for(std::chrono::milliseconds(0)) != std::future_status::ready) {
-		 	it++;
+	if (!mLoadQueue)
+		mLoadQueue = std::make_unique<LoadQueue>(commandBuffer.mDevice, commandBuffer.GetQueueFamily(), mLoadThreads, [this](CommandBuffer& cb, const std::filesystem::path& filename) { return Load(cb, filename); });
+	for (const auto&[file, priority] : mToLoad)
+		mLoadQueue->Enqueue(file, priority);
+	mToLoad.clear();
+
+	const std::vector<std::shared_ptr<LoadJob>> loadedJobs = mLoadQueue->TakeLoaded();
+	for (const auto& job : loadedJobs) {
+		// the upload already completed, the wait only orders the release before the acquire
+		commandBuffer.WaitSemaphore(commandBuffer.mDevice.GetUploadQueue().GetTimeline(), job->mUploadValue, vk::PipelineStageFlagBits::eAllCommands);
+		commandBuffer.AcquireOwnership(job->mOwnershipTransfer);
+		job->mOwnershipTransfer = {};
+		mRootNode->AddChild(job->mNode);
+		job->mNode.reset();
+	}
+	const bool loaded = !loadedJobs.empty();
+	if (loaded) mDirty.mInstances = true;
+
+	if (!mCompactionBatches.empty())
+		CompactAccelerationStructures(commandBuffer);
+	if (mBlasBuildStats.mTimestampsPending)
+		ReadBlasBuildTime(commandBuffer.mDevice);
+
+	if (!mUpdateOnce && !mDirty.mStructure && !mDirty.mTransforms && !mDirty.mMaterials && !mDirty.mInstances) {
+		if (commandBuffer.mDevice.GetAccelerationStructureFeatures().accelerationStructure)
+			commandBuffer.HoldResource(mRenderData.mShaderParameters.GetBuffer<std::byte>("mAccelerationStructureBuffer"));
+		return;
+	}
+
+	// Update scene data based on node graph.
+	// Transform, material and instance add/remove changes are patched into the existing buffers,
+	// an update with no changes (mUpdateOnce) just resets motion transforms and the instance index map
+
+	const auto t0 = std::chrono::high_resolution_clock::now();
+	if (mIncrementalUpdates && !mDirty.mStructure && PatchRenderData(commandBuffer, mDirty.mTransforms || !mDirty.mMaterials, mDirty.mMaterials, mDirty.mInstances)) {
+		mUpdateStats.mType = mDirty.mInstances ? "instances" : mDirty.mTransforms ? (mDirty.mMaterials ? "transforms, materials" : "transforms") : mDirty.mMaterials ? "materials" : "motion";
+	} else {
+		UpdateRenderData(commandBuffer);
+		mUpdateStats = {};
+		mUpdateStats.mType = "full";
+	}
+	mUpdateStats.mTime = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(std::chrono::high_resolution_clock::now() - t0).count();
+	mDirty = {};
+
+	// always update once after load so that motion transforms are valid.
+	// patches are cheap, so with incremental updates also update once after anything moves
+	mUpdateOnce = loaded || (mIncrementalUpdates && (!mRenderData.mMovingInstances.empty() || !mRenderData.mIdentityInstanceIndexMap));
+
+	// BLASs for loaded nodes are recorded above
+	for (const auto& job : loadedJobs)
+		job->mStage = LoadJob::Stage::eDone;
+}
+
+// Meshes that can be drawn: indexed triangle lists with positions
+static bool IsSupportedMesh(const Mesh& mesh) {
+	return mesh.GetTopology() == vk::PrimitiveTopology::eTriangleList &&
+		(mesh.GetIndexType() == vk::IndexType::eUint32 || mesh.GetIndexType() == vk::IndexType::eUint16) &&
+		mesh.GetVertices().find(Mesh::VertexAttributeType::ePosition);
+}
+
+// World transform and world-space bounds of an instance whose node has transform nodeToWorld
+static std::tuple<float4x4, float3, float3> InstanceToWorld(const Scene::RenderData::InstanceRecord& r, const float4x4& nodeToWorld) {
+	float4x4 instanceToWorld = nodeToWorld * r.mLocalTransform;
+	if (r.mTranslationOnly)
+		instanceToWorld = glm::translate(TransformPoint(instanceToWorld, float3(0)));
+	float3 mn = float3( std::numeric_limits<float>::infinity());
+	float3 mx = float3(-std::numeric_limits<float>::infinity());
+	for (uint32_t c = 0; c < 8; c++) {
+		const float3 corner = TransformPoint(instanceToWorld, float3(
+			(c & 1) ? r.mMax.x : r.mMin.x,
+			(c & 2) ? r.mMax.y : r.mMin.y,
+			(c & 4) ? r.mMax.z : r.mMin.z));
+		mn = min(mn, corner);
+		mx = max(mx, corner);
+	}
+	return { instanceToWorld * r.mPositionTransform, mn, mx };
+}
+
+template<typename F2, typename F4>
+static GpuMaterial MakeGpuMaterial(const Material& material, F2&& image2, F4&& image4) {
+	GpuMaterial m;
+	m.mParameters = material.mMaterial;
+	m.SetBaseColorImage(image4(material.mBaseColor));
+	m.SetEmissionImage(image4(material.mEmission));
+	m.SetPackedParamsImage(image4(material.mPackedParams));
+	if (material.mBumpMap) {
+		if (GetChannelCount(material.mBumpMap.GetImage()->GetFormat()) == 2) {
+			m.SetBumpImage(image2(material.mBumpMap));
+			m.SetIsBumpTwoChannel(true);
+		} else {
+			m.SetBumpImage(image4(material.mBumpMap));
+			m.SetIsBumpTwoChannel(false);
+		}
+	} else
+		m.SetBumpImage(~(uint32_t)0);
+	return m;
+}
+
+// Copies the elements of data in each [begin, end) range into the same elements of dst
+template<typename T>
+static size_t PatchBuffer(CommandBuffer& commandBuffer, const Buffer::View<T>& dst, const std::vector<T>& data, const std::vector<uint2>& ranges) {
+	size_t bytes = 0;
+	for (const uint2 r : ranges) {
+		const Buffer::View<std::byte> tmp = commandBuffer.AllocateStaging((r.y - r.x) * sizeof(T), dst.GetBuffer()->GetName());
+		memcpy(tmp.data(), data.data() + r.x, tmp.SizeBytes());
+		commandBuffer.CopyFromStaging(tmp, Buffer::View<T>(dst, r.x, r.y - r.x));
+		bytes += tmp.SizeBytes();
+	}
+	return bytes;
+}
+
+// Copies the ranges of data into the shader parameter's buffer, or uploads all of data to a new buffer with room to grow if it is too small
+template<typename T>
+static size_t PatchOrGrowBuffer(CommandBuffer& commandBuffer, ShaderParameterBlock& parameters, const std::string& name, const std::vector<T>& data, const std::vector<uint2>& ranges) {
+	if (const Buffer::View<T> dst = parameters.GetBuffer<T>(name); dst.size() >= data.size())
+		return PatchBuffer(commandBuffer, dst, data, ranges);
+	std::vector<T> padded(data.size() + data.size()/2);
+	std::ranges::copy(data, padded.begin());
+	parameters.SetBuffer(name, commandBuffer.Upload<T>(padded, name, vk::BufferUsageFlagBits::eStorageBuffer));
+	return padded.size() * sizeof(T);
+}
+
+// Merges indices into [begin, end) ranges. Indices closer than maxGap share a range, so that scattered changes don't become many tiny copies
+static std::vector<uint2> ToRanges(std::vector<uint32_t> indices, const uint32_t maxGap = 8) {
+	std::ranges::sort(indices);
+	std::vector<uint2> ranges;
+	for (const uint32_t i : indices) {
+		if (!ranges.empty() && i < ranges.back().y + maxGap)
+			ranges.back().y = std::max(ranges.back().y, i + 1);
+		else
+			ranges.emplace_back(i, i + 1);
+	}
+	return ranges;
+}
+
+void Scene::BuildTlas(CommandBuffer& commandBuffer) {
+	const std::vector<vk::AccelerationStructureInstanceKHR>& instancesAS = mRenderData.mAccelerationStructureInstances;
+	const std::vector<std::pair<float3, float3>>& bounds = mRenderData.mInstanceBounds;
+
+	// refit when only transforms changed, until the refit count or bounds growth says the tree has degraded too far
+	mTlas.mRebuildReason = "";
+	if (!mRefitTlas || !mTlas.mAccelerationStructure)
+		mTlas.mRebuildReason = mRefitTlas ? "first build" : "refit disabled";
+	else if (instancesAS.size() != mTlas.mBlasReferences.size() || instancesAS.empty())
+		mTlas.mRebuildReason = "instance count changed";
+	else if (!std::ranges::equal(instancesAS, mTlas.mBlasReferences, {}, &vk::AccelerationStructureInstanceKHR::accelerationStructureReference))
+		mTlas.mRebuildReason = "BLAS changed";
+	else if (mTlas.mRefitCount >= mMaxTlasRefits)
+		mTlas.mRebuildReason = "refit limit";
+	else {
+		auto Area = [](const float3 mn, const float3 mx) {
+			const float3 e = max(mx - mn, float3(0));
+			return e.x*e.y + e.y*e.z + e.z*e.x;
+		};
+		double buildArea = 0, sweptArea = 0;
+		for (size_t i = 0; i < bounds.size(); i++) {
+			const auto&[mn0, mx0] = mTlas.mBounds[i];
+			const auto&[mn1, mx1] = bounds[i];
+			buildArea += Area(mn0, mx0);
+			sweptArea += Area(min(mn0, mn1), max(mx0, mx1));
+		}
+		if (sweptArea > mMaxTlasBoundsGrowth * buildArea)
+			mTlas.mRebuildReason = "bounds growth";
+	}
+	const bool refit = *mTlas.mRebuildReason == '\0';
+	if (!refit && mTlas.mRefitCount > 0)
+		std::cout << "Rebuilding TLAS after " << mTlas.mRefitCount << " refits (" << mTlas.mRebuildReason << "). Last build: " << mTlas.mBuildTime << "ms, last refit: " << mTlas.mRefitTime << "ms" << std::endl;
+
+	ProfilerScope s(refit ? "Refit TLAS" : "Build TLAS", &commandBuffer);
+
+	vk::AccelerationStructureGeometryKHR geom{ vk::GeometryTypeKHR::eInstances, vk::AccelerationStructureGeometryInstancesDataKHR() };
+	vk::AccelerationStructureBuildRangeInfoKHR range{ (uint32_t)instancesAS.size() };
+	if (!instancesAS.empty()) {
+		const vk::DeviceSize instancesSize = sizeof(vk::AccelerationStructureInstanceKHR) * instancesAS.size();
+		const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eShaderDeviceAddress;
+
+		// extra 16 bytes for alignment
+		std::shared_ptr<Buffer> buf = commandBuffer.CreateDirectUploadBuffer(instancesSize + 16, "TLAS instance buffer", usage);
+		const bool direct = (bool)buf;
+		if (!direct)
+			buf = std::make_shared<Buffer>(commandBuffer.mDevice, "TLAS instance buffer", instancesSize + 16, usage);
+
+		const size_t address = (size_t)buf->GetDeviceAddress();
+		const size_t offset = (-address & 15); // aligned = unaligned + (-unaligned & (alignment - 1))
+
+		geom.geometry.instances.data = address + offset;
+		if (direct) {
+			memcpy(reinterpret_cast<std::byte*>(buf->data()) + offset, instancesAS.data(), instancesSize);
+			buf->Flush();
+		} else {
+			std::shared_ptr<Buffer> tmp = std::make_shared<Buffer>(commandBuffer.mDevice, "TLAS instance buffer",
+				instancesSize,
+				vk::BufferUsageFlagBits::eTransferSrc,
+				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+				VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+			memcpy(tmp->data(), instancesAS.data(), instancesSize);
+			commandBuffer.Copy(tmp, Buffer::View<std::byte>(buf, offset, tmp->size()));
+			commandBuffer.HoldResource(tmp);
+		}
+		commandBuffer.HoldResource(buf);
+	}
+
+	// read back the previous timestamps. new ones are only written once those have been read, so the pool is never reset while in use
+	const bool timestamps = commandBuffer.mDevice.GetLimits().timestampComputeAndGraphics;
+	if (timestamps && !mTlas.mTimestamps)
+		mTlas.mTimestamps = std::make_shared<vk::raii::QueryPool>(*commandBuffer.mDevice, vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp, 2));
+	if (mTlas.mTimestampsPending) {
+		const auto[result, values] = mTlas.mTimestamps->getResults<uint64_t>(0, 2, 2*sizeof(uint64_t), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+		if (result == vk::Result::eSuccess) {
+			(mTlas.mTimestampsRefit ? mTlas.mRefitTime : mTlas.mBuildTime) = (values[1] - values[0]) * commandBuffer.mDevice.GetLimits().timestampPeriod / 1e6f;
+			mTlas.mTimestampsPending = false;
+		}
+	}
+	const bool writeTimestamps = timestamps && !mTlas.mTimestampsPending;
+	if (writeTimestamps) {
+		commandBuffer.FlushBarriers();
+		commandBuffer->resetQueryPool(**mTlas.mTimestamps, 0, 2);
+		commandBuffer->writeTimestamp(vk::PipelineStageFlagBits::eAllCommands, **mTlas.mTimestamps, 0);
+	}
+
+	const vk::BuildAccelerationStructureFlagsKHR flags = mRefitTlas ?
+		vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate :
+		vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+	if (refit) {
+		RefitAccelerationStructure(commandBuffer, *mTlas.mAccelerationStructure, mTlas.mBuffer, mTlas.mUpdateScratch, vk::AccelerationStructureTypeKHR::eTopLevel, geom, range, flags);
+		mTlas.mRefitCount++;
+	} else {
+		std::tie(mTlas.mAccelerationStructure, mTlas.mBuffer) = BuildAccelerationStructure(commandBuffer, "TLAS", vk::AccelerationStructureTypeKHR::eTopLevel, geom, range, flags);
+		mTlas.mBlasReferences.resize(instancesAS.size());
+		std::ranges::transform(instancesAS, mTlas.mBlasReferences.begin(), &vk::AccelerationStructureInstanceKHR::accelerationStructureReference);
+		mTlas.mBounds = bounds;
+		mTlas.mRefitCount = 0;
+		mTlas.mUpdateScratch = {};
+	}
+
+	if (writeTimestamps) {
+		commandBuffer->writeTimestamp(vk::PipelineStageFlagBits::eAllCommands, **mTlas.mTimestamps, 1);
+		mTlas.mTimestampsPending = true;
+		mTlas.mTimestampsRefit = refit;
+	}
+
+	mRenderData.mShaderParameters.SetAccelerationStructure("mAccelerationStructure", mTlas.mAccelerationStructure);
+	mRenderData.mShaderParameters.SetBuffer("mAccelerationStructureBuffer", mTlas.mBuffer);
+}
+
+void Scene::CompactAccelerationStructures(CommandBuffer& commandBuffer) {
+	std::unordered_map<vk::DeviceAddress, vk::DeviceAddress> addressMap; // original -> compacted BLAS
+	for (auto batch = mCompactionBatches.begin(); batch != mCompactionBatches.end();) {
+		const uint32_t count = (uint32_t)batch->mKeys.size();
+		const auto[result, sizes] = batch->mQueryPool->getResults<vk::DeviceSize>(0, count, count*sizeof(vk::DeviceSize), sizeof(vk::DeviceSize), vk::QueryResultFlagBits::e64);
+		if (result != vk::Result::eSuccess) {
+			batch++;
 			continue;
 		}
-		const auto[node, cb] = it->get();
-		mRootNode->AddChild(node);
 
-		it = mLoading.erase(it);
+		ProfilerScope ps("Compact BLASs", &commandBuffer);
+		for (uint32_t i = 0; i < count; i++) {
+			const auto&[isAabb, key] = batch->mKeys[i];
+			auto& cache = isAabb ? mAABBs : mMeshAccelerationStructures;
+			auto it = cache.find(key);
+			// skip structures which were replaced since
+			if (it == cache.end() || it->second.first != batch->mAccelerationStructures[i]) continue;
+
+			const auto&[src, srcBuffer] = it->second;
+			if (sizes[i] == 0 || sizes[i] >= srcBuffer.SizeBytes()) continue;
+
+			Buffer::View<std::byte> buffer = std::make_shared<Buffer>(
+				commandBuffer.mDevice,
+				srcBuffer.GetBuffer()->GetName(),
+				sizes[i],
+				vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress);
+			auto dst = std::make_shared<vk::raii::AccelerationStructureKHR>(*commandBuffer.mDevice, vk::AccelerationStructureCreateInfoKHR({}, **buffer.GetBuffer(), buffer.Offset(), buffer.SizeBytes(), vk::AccelerationStructureTypeKHR::eBottomLevel));
+			commandBuffer.mDevice.SetDebugName(**dst, srcBuffer.GetBuffer()->GetName() + "/Compacted");
+
+			commandBuffer->copyAccelerationStructureKHR(vk::CopyAccelerationStructureInfoKHR(**src, **dst, vk::CopyAccelerationStructureModeKHR::eCompact));
+			buffer.SetState(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+
+			addressMap.emplace(
+				commandBuffer.mDevice->getAccelerationStructureAddressKHR(**src),
+				commandBuffer.mDevice->getAccelerationStructureAddressKHR(**dst));
+
+			mCompactionStats.mCount++;
+			mCompactionStats.mOriginalBytes += srcBuffer.SizeBytes();
+			mCompactionStats.mCompactedBytes += buffer.SizeBytes();
+
+			// the originals are released once this command buffer completes
+			commandBuffer.HoldResource(src);
+			commandBuffer.HoldResource(srcBuffer);
+			commandBuffer.HoldResource(dst);
+			commandBuffer.HoldResource(buffer);
+			it->second = std::make_pair(dst, buffer);
+		}
+		batch = mCompactionBatches.erase(batch);
+	}
+
+	if (addressMap.empty()) return;
+
+	const auto[original, originalUnit] = FormatBytes(mCompactionStats.mOriginalBytes);
+	const auto[compacted, compactedUnit] = FormatBytes(mCompactionStats.mCompactedBytes);
+	std::cout << "Compacted " << addressMap.size() << " BLASs (" << mCompactionStats.mCount << " total, " << original << " " << originalUnit << " -> " << compacted << " " << compactedUnit << ")" << std::endl;
+
+	// point the TLAS at the copies
+	commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+		vk::MemoryBarrier(vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR), {}, {});
+	for (vk::AccelerationStructureInstanceKHR& instance : mRenderData.mAccelerationStructureInstances)
+		if (auto it = addressMap.find(instance.accelerationStructureReference); it != addressMap.end())
+			instance.accelerationStructureReference = it->second;
+	if (!mRenderData.mAccelerationStructureInstances.empty())
+		BuildTlas(commandBuffer);
+}
 
-		loaded = true;
-		mUpdateOnce = true;
+void Scene::BuildBlases(CommandBuffer& commandBuffer, const std::vector<PendingBlasBuild>& builds, const vk::BuildAccelerationStructureFlagsKHR flags) {
+	ProfilerScope ps("Build BLASs", &commandBuffer);
+
+	const vk::DeviceSize alignment = std::max<vk::DeviceSize>(commandBuffer.mDevice.GetAccelerationStructureProperties().minAccelerationStructureScratchOffsetAlignment, 1);
+	auto AlignUp = [=](const vk::DeviceSize x) { return (x + alignment - 1) / alignment * alignment; };
+
+	// split into batches whose scratch fits in mMaxBlasBatchScratch. builds larger than that get a batch of their own
+	std::vector<std::pair<size_t, size_t>> batches; // [begin, end) into builds
+	vk::DeviceSize scratchSize = 0;
+	vk::DeviceSize batchScratch = 0;
+	for (size_t i = 0; i < builds.size(); i++) {
+		const vk::DeviceSize size = AlignUp(builds[i].mScratchSize);
+		if (batches.empty() || (batchScratch > 0 && batchScratch + size > mMaxBlasBatchScratch)) {
+			batches.emplace_back(i, i);
+			batchScratch = 0;
+		}
+		batches.back().second = i + 1;
+		batchScratch += size;
+		scratchSize = std::max(scratchSize, batchScratch);
 	}
 
-	for (const std::string& file : mToLoad) {
-		const std::filesystem::path filepath = file;
-		Device& device = commandBuffer.mDevice;
-		const uint32_t family = device.FindQueueFamily(vk::QueueFlagBits::eTransfer|vk::QueueFlagBits::eCompute);
-		mLoading.emplace_back( std::move(std::async(std::launch::async, [&,filepath,family]() {
-			std::shared_ptr<CommandBuffer> cb = std::make_shared<CommandBuffer>(device, "Scene load", family);
-			cb->Reset();
-			std::shared_ptr<SceneNode> node = Load(*cb, filepath);
-			cb->Submit(*device->getQueue(family, 0));
-			if (device->waitForFences(**cb->GetCompletionFence(), true, std::numeric_limits<uint64_t>::max()) != vk::Result::eSuccess)
-				node = nullptr;
-			return std::make_pair(node, cb);
-		})) );
+	// extra alignment bytes, since the buffer's address is only aligned to its memory requirements
+	if (!mBlasScratch || mBlasScratch.SizeBytes() < scratchSize + alignment)
+		mBlasScratch = std::make_shared<Buffer>(
+			commandBuffer.mDevice,
+			"BLAS scratchData",
+			scratchSize + alignment,
+			vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eStorageBuffer);
+	commandBuffer.HoldResource(mBlasScratch);
+	const vk::DeviceAddress scratchAddress = AlignUp(mBlasScratch.GetDeviceAddress());
+
+	// read back the previous timestamps. new ones are only written once those have been read, so the pool is never reset while in use.
+	// a timestamp is written after each batch, so that build times can be reported per mesh
+	ReadBlasBuildTime(commandBuffer.mDevice);
+	const bool timestamps = commandBuffer.mDevice.GetLimits().timestampComputeAndGraphics;
+	const bool writeTimestamps = timestamps && !mBlasBuildStats.mTimestampsPending;
+	const uint32_t timestampCount = (uint32_t)batches.size() + 1;
+	if (writeTimestamps && mBlasBuildStats.mTimestampCount < timestampCount) {
+		mBlasBuildStats.mTimestamps = std::make_shared<vk::raii::QueryPool>(*commandBuffer.mDevice, vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp, timestampCount));
+		mBlasBuildStats.mTimestampCount = timestampCount;
 	}
-	mToLoad.clear();
 
-	if (!mUpdateOnce) {
-		if (commandBuffer.mDevice.GetAccelerationStructureFeatures().accelerationStructure)
-			commandBuffer.HoldResource(mRenderData.mShaderParameters.GetBuffer<std::byte>("mAccelerationStructureBuffer"));
-		return;
+	commandBuffer.FlushBarriers();
+	if (writeTimestamps) {
+		commandBuffer->resetQueryPool(**mBlasBuildStats.mTimestamps, 0, timestampCount);
+		commandBuffer->writeTimestamp(vk::PipelineStageFlagBits::eAllCommands, **mBlasBuildStats.mTimestamps, 0);
+		mBlasBuildStats.mTimedBuilds.clear();
 	}
 
-	// Update scene data based on node graph
-	// always update once after load so that motion transforms are valid
+	size_t triangleCount = 0;
+	std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> infos;
+	std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> ranges;
+	for (uint32_t batch = 0; batch < batches.size(); batch++) {
+		const auto[begin, end] = batches[batch];
+		// the scratch memory may still be in use by the previous batch, or by builds from a previous frame
+		commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+			vk::MemoryBarrier(vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+				vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eAccelerationStructureWriteKHR), {}, {});
+
+		infos.clear();
+		ranges.clear();
+		vk::DeviceSize offset = 0;
+		for (size_t i = begin; i < end; i++) {
+			const PendingBlasBuild& build = builds[i];
+			vk::AccelerationStructureBuildGeometryInfoKHR& info = infos.emplace_back(vk::AccelerationStructureTypeKHR::eBottomLevel, flags, vk::BuildAccelerationStructureModeKHR::eBuild);
+			info.setGeometries(build.mGeometry);
+			info.dstAccelerationStructure = build.mAccelerationStructure;
+			info.scratchData = scratchAddress + offset;
+			ranges.emplace_back(&build.mRange);
+			offset += AlignUp(build.mScratchSize);
+			if (build.mGeometry.geometryType == vk::GeometryTypeKHR::eTriangles)
+				triangleCount += build.mRange.primitiveCount;
+			if (writeTimestamps)
+				mBlasBuildStats.mTimedBuilds.emplace_back(build.mName, build.mRange.primitiveCount, batch);
+		}
+		commandBuffer->buildAccelerationStructuresKHR(infos, ranges);
+		if (writeTimestamps)
+			commandBuffer->writeTimestamp(vk::PipelineStageFlagBits::eAllCommands, **mBlasBuildStats.mTimestamps, batch + 1);
+	}
 
-	mUpdateOnce = loaded;
+	if (writeTimestamps) {
+		mBlasBuildStats.mTimestampsPending = true;
+		mBlasBuildStats.mTimedTriangleCount = triangleCount;
+	}
 
-	UpdateRenderData(commandBuffer);
+	mBlasBuildStats.mCount = (uint32_t)builds.size();
+	mBlasBuildStats.mBatchCount = (uint32_t)batches.size();
+	mBlasBuildStats.mTriangleCount = triangleCount;
+}
+
+void Scene::ReadBlasBuildTime(Device& device) {
+	if (!mBlasBuildStats.mTimestampsPending) return;
+	const uint32_t batchCount = mBlasBuildStats.mTimedBuilds.empty() ? 0 : std::get<2>(mBlasBuildStats.mTimedBuilds.back()) + 1;
+	const auto[result, values] = mBlasBuildStats.mTimestamps->getResults<uint64_t>(0, batchCount + 1, (batchCount + 1)*sizeof(uint64_t), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+	if (result != vk::Result::eSuccess) return;
+	const float period = device.GetLimits().timestampPeriod / 1e6f;
+	mBlasBuildStats.mTime = (values[batchCount] - values[0]) * period;
+	mBlasBuildStats.mTimestampsPending = false;
+
+	// builds in a batch run concurrently, so each batch's time is split between its meshes by primitive count
+	std::vector<uint64_t> batchPrimitives(batchCount);
+	for (const auto&[name, primitiveCount, batch] : mBlasBuildStats.mTimedBuilds)
+		batchPrimitives[batch] += primitiveCount;
+	mBlasBuildStats.mMeshTimes.clear();
+	for (const auto&[name, primitiveCount, batch] : mBlasBuildStats.mTimedBuilds) {
+		const float batchTime = (values[batch + 1] - values[batch]) * period;
+		mBlasBuildStats.mMeshTimes.emplace_back(name, batchPrimitives[batch] > 0 ? batchTime * primitiveCount / batchPrimitives[batch] : 0.f);
+	}
+	std::ranges::sort(mBlasBuildStats.mMeshTimes, std::greater<>{}, &std::pair<std::string, float>::second);
+
+	if (mBlasBuildStats.mTime > 0) {
+		std::cout << "Built BLASs over " << mBlasBuildStats.mTimedTriangleCount << " triangles in " << mBlasBuildStats.mTime << "ms (" << mBlasBuildStats.mTimedTriangleCount / (mBlasBuildStats.mTime * 1e3f) << " Mtri/s)" << std::endl;
+		for (size_t i = 0; i < std::min<size_t>(mBlasBuildStats.mMeshTimes.size(), 8); i++)
+			std::cout << "\t" << mBlasBuildStats.mMeshTimes[i].first << ": " << mBlasBuildStats.mMeshTimes[i].second << "ms" << std::endl;
+	}
+}
+
+uint32_t Scene::AddImage(const Image::View& image, const bool twoChannel) {
+	if (!image) return ~(uint32_t)0;
+	std::unordered_map<Image::View, uint32_t>& images = twoChannel ? mRenderData.mImage2s : mRenderData.mImage4s;
+	if (auto it = images.find(image); it != images.end())
+		return it->second;
+	const uint32_t c = (uint32_t)images.size();
+	mRenderData.mShaderParameters.SetImage(twoChannel ? "mImage2s" : "mImage4s", c, image, vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead);
+	images.emplace(image, c);
+	return c;
+}
+
+uint32_t Scene::AddMaterial(const std::shared_ptr<Material>& material) {
+	// append unique materials to materials list
+	RenderData& rd = mRenderData;
+	if (auto it = rd.mMaterialMap.find(material.get()); it != rd.mMaterialMap.end() && rd.mMaterialSources[it->second].lock() == material)
+		return it->second;
+	const uint32_t index = (uint32_t)rd.mMaterials.size();
+	rd.mMaterials.emplace_back(MakeGpuMaterial(*material,
+		[&](const Image::View& img) { return AddImage(img, true); },
+		[&](const Image::View& img) { return AddImage(img, false); }));
+	rd.mMaterialSources.emplace_back(material);
+	rd.mMaterialMap[material.get()] = index;
+	return index;
+}
+
+uint32_t Scene::AddVertexBuffer(const std::shared_ptr<Buffer>& buffer) {
+	if (!buffer)
+		return 0xFFFF;
+	// the shader parameters hold the buffer, so its address is never reused while it is in the map
+	if (auto it = mRenderData.mVertexBuffers.find(buffer.get()); it != mRenderData.mVertexBuffers.end())
+		return it->second;
+	const uint32_t index = (uint32_t)mRenderData.mVertexBuffers.size();
+	mRenderData.mShaderParameters.SetBuffer("mVertexBuffers", index, buffer);
+	mRenderData.mVertexBuffers.emplace(buffer.get(), index);
+	return index;
+}
+
+uint32_t Scene::AddMeshVertexInfo(const std::shared_ptr<Mesh>& mesh) {
+	// vertex records are shared by every renderer and instance drawing the same mesh
+	RenderData& rd = mRenderData;
+	if (auto it = rd.mVertexInfoMap.find(mesh.get()); it != rd.mVertexInfoMap.end() && rd.mVertexInfoSources[it->second].lock() == mesh)
+		return it->second;
+
+	auto [positions, positionsDesc] = mesh->GetVertices().at(Mesh::VertexAttributeType::ePosition)[0];
+	Buffer::View<std::byte> normals, texcoords;
+	Mesh::VertexAttributeDescription normalsDesc = {}, texcoordsDesc = {};
+	if (auto attrib = mesh->GetVertices().find(Mesh::VertexAttributeType::eNormal))
+		tie(normals, normalsDesc) = *attrib;
+	if (auto attrib = mesh->GetVertices().find(Mesh::VertexAttributeType::eTexcoord))
+		tie(texcoords, texcoordsDesc) = *attrib;
+
+	const uint32_t index = (uint32_t)rd.mMeshVertexInfos.size();
+	rd.mMeshVertexInfos.emplace_back(
+		AddVertexBuffer(mesh->GetIndices().GetBuffer()), (uint32_t)mesh->GetIndices().Offset(), (uint32_t)mesh->GetIndices().Stride(),
+		AddVertexBuffer(positions.GetBuffer()), (uint32_t)positions.Offset() + positionsDesc.mOffset, positionsDesc.mStride,
+		positionsDesc.mFormat == vk::Format::eR16G16B16A16Snorm ? VertexAttributeFormat::eQuantized : VertexAttributeFormat::eFloat,
+		AddVertexBuffer(normals.GetBuffer())  , (uint32_t)normals.Offset()   + normalsDesc.mOffset  , normalsDesc.mStride,
+		normalsDesc.mFormat == vk::Format::eR16G16Snorm ? VertexAttributeFormat::eQuantized : VertexAttributeFormat::eFloat,
+		AddVertexBuffer(texcoords.GetBuffer()), (uint32_t)texcoords.Offset() + texcoordsDesc.mOffset, texcoordsDesc.mStride,
+		texcoordsDesc.mFormat == vk::Format::eR16G16Sfloat ? VertexAttributeFormat::eQuantized : VertexAttributeFormat::eFloat);
+	rd.mVertexInfoSources.emplace_back(mesh);
+	rd.mVertexInfoMap[mesh.get()] = index;
+	return index;
+}
+
+const Scene::AccelerationStructureData& Scene::GetMeshBlas(CommandBuffer& commandBuffer, const Mesh& mesh, const bool opaque, const std::string& name, PendingBlases& pending) {
+	auto [positions, positionsDesc] = mesh.GetVertices().at(Mesh::VertexAttributeType::ePosition)[0];
+	const uint32_t vertexCount = (uint32_t)((positions.SizeBytes() - positionsDesc.mOffset) / positionsDesc.mStride);
+	const uint32_t primitiveCount = mesh.GetIndices().size() / (mesh.GetIndices().Stride() * 3);
+
+	// meshes with the same contents share a BLAS whichever load or buffer they came from
+	const size_t key = mesh.GetContentHash() != 0 ?
+		HashArgs(mesh.GetContentHash(), positionsDesc.mOffset, positionsDesc.mStride, positionsDesc.mFormat, vertexCount, primitiveCount, mesh.GetIndexType(), opaque) :
+		HashArgs(positions.GetBuffer(), positions.Offset(), positions.SizeBytes(), positionsDesc, opaque);
+	if (auto it = mMeshAccelerationStructures.find(key); it != mMeshAccelerationStructures.end())
+		return it->second;
+
+	vk::AccelerationStructureGeometryTrianglesDataKHR triangles;
+	triangles.vertexFormat = positionsDesc.mFormat;
+	triangles.vertexData = positions.GetDeviceAddress();
+	triangles.vertexStride = positionsDesc.mStride;
+	triangles.maxVertex = vertexCount;
+	triangles.indexType = mesh.GetIndexType();
+	triangles.indexData = mesh.GetIndices().GetDeviceAddress();
+	vk::AccelerationStructureGeometryKHR triangleGeometry(vk::GeometryTypeKHR::eTriangles, triangles, opaque ? vk::GeometryFlagBitsKHR::eOpaque : vk::GeometryFlagBitsKHR{});
+	vk::AccelerationStructureBuildRangeInfoKHR range(primitiveCount);
+
+	auto [as, asbuf, scratchSize] = CreateAccelerationStructure(commandBuffer, name + "/BLAS", vk::AccelerationStructureTypeKHR::eBottomLevel, triangleGeometry, range, GetBlasFlags());
+	pending.mBuilds.emplace_back(triangleGeometry, range, **as, scratchSize, name);
+	if (mCompactBlas) {
+		pending.mCompactionBatch.mKeys.emplace_back(false, key);
+		pending.mCompactionBatch.mAccelerationStructures.emplace_back(as);
+	}
+
+	pending.mBarriers.emplace_back(
+		vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+		**asbuf.GetBuffer(), asbuf.Offset(), asbuf.SizeBytes());
+
+	return mMeshAccelerationStructures.emplace(key, std::make_pair(as, asbuf)).first->second;
+}
+
+const Scene::AccelerationStructureData& Scene::GetAabbBlas(CommandBuffer& commandBuffer, const float3 mn, const float3 mx, const bool opaque, PendingBlases& pending) {
+	const size_t key = HashArgs(mn[0], mn[1], mn[2], mx[0], mx[1], mx[2], opaque);
+	if (auto it = mAABBs.find(key); it != mAABBs.end())
+		return it->second;
+
+	Buffer::View<vk::AabbPositionsKHR> aabb = std::make_shared<Buffer>(
+		commandBuffer.mDevice,
+		"aabb data",
+		sizeof(vk::AabbPositionsKHR),
+		vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+		VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+	aabb[0].minX = mn[0];
+	aabb[0].minY = mn[1];
+	aabb[0].minZ = mn[2];
+	aabb[0].maxX = mx[0];
+	aabb[0].maxY = mx[1];
+	aabb[0].maxZ = mx[2];
+	vk::AccelerationStructureGeometryAabbsDataKHR aabbs(aabb.GetDeviceAddress(), sizeof(vk::AabbPositionsKHR));
+	vk::AccelerationStructureGeometryKHR aabbGeometry(vk::GeometryTypeKHR::eAabbs, aabbs, opaque ? vk::GeometryFlagBitsKHR::eOpaque : vk::GeometryFlagBitsKHR{});
+	vk::AccelerationStructureBuildRangeInfoKHR range(1);
+	commandBuffer.HoldResource(aabb);
+
+	auto [as, asbuf, scratchSize] = CreateAccelerationStructure(commandBuffer, "aabb BLAS", vk::AccelerationStructureTypeKHR::eBottomLevel, aabbGeometry, range, GetBlasFlags());
+	pending.mBuilds.emplace_back(aabbGeometry, range, **as, scratchSize, "aabb");
+	if (mCompactBlas) {
+		pending.mCompactionBatch.mKeys.emplace_back(true, key);
+		pending.mCompactionBatch.mAccelerationStructures.emplace_back(as);
+	}
+
+	pending.mBarriers.emplace_back(
+		vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+		**asbuf.GetBuffer(), asbuf.Offset(), asbuf.SizeBytes());
+
+	return mAABBs.emplace(key, std::make_pair(as, asbuf)).first->second;
+}
+
+void Scene::BuildPendingBlases(CommandBuffer& commandBuffer, PendingBlases& pending) {
+	if (!pending.mBuilds.empty())
+		BuildBlases(commandBuffer, pending.mBuilds, GetBlasFlags());
+
+	commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::DependencyFlagBits::eByRegion, {}, pending.mBarriers, {});
+
+	// query compacted sizes now, and compact once the results are available in a later frame
+	CompactionBatch& compactionBatch = pending.mCompactionBatch;
+	if (!compactionBatch.mKeys.empty()) {
+		const uint32_t count = (uint32_t)compactionBatch.mKeys.size();
+		compactionBatch.mQueryPool = std::make_shared<vk::raii::QueryPool>(*commandBuffer.mDevice, vk::QueryPoolCreateInfo({}, vk::QueryType::eAccelerationStructureCompactedSizeKHR, count));
+		std::vector<vk::AccelerationStructureKHR> handles(count);
+		for (uint32_t i = 0; i < count; i++)
+			handles[i] = **compactionBatch.mAccelerationStructures[i];
+		commandBuffer->resetQueryPool(**compactionBatch.mQueryPool, 0, count);
+		commandBuffer->writeAccelerationStructuresPropertiesKHR(handles, vk::QueryType::eAccelerationStructureCompactedSizeKHR, **compactionBatch.mQueryPool, 0);
+		mCompactionBatches.emplace_back(std::move(compactionBatch));
+	}
 }
 
 void Scene::UpdateRenderData(CommandBuffer& commandBuffer) {
@@ -574,246 +1407,194 @@ void Scene::UpdateRenderData(CommandBuffer& commandBuffer) {
 
 	// Construct resources used by renderers (mesh/material data buffers, image arrays, etc.)
 
-	std::vector<InstanceBase> instanceDatas;
-	std::vector<float4x4> instanceTransforms;
-	std::vector<float4x4> instanceInverseTransforms;
-	std::vector<float4x4> instanceMotionTransforms;
+	std::vector<InstanceBase>& instanceDatas = mRenderData.mInstances;
 	std::vector<VolumeInfo> volumeInfos;
-	std::vector<uint32_t> lightInstanceMap; // light index -> instance index
-	std::vector<uint32_t> instanceLightMap; // instance index -> light index
+	std::vector<uint32_t>& lightInstanceMap = mRenderData.mLightInstanceMap; // light index -> instance index
+	std::vector<uint32_t>& instanceLightMap = mRenderData.mInstanceLightMap; // instance index -> light index
+	std::vector<float> lightPowers; // light index -> emitted power, for light selection
+	std::vector<uint32_t> lightTriangleTableOffsets; // light index -> offset of its triangle alias table in triangleAliasTables, or INVALID_TABLE_OFFSET
+	std::vector<AliasTableEntry> triangleAliasTables;
+	std::vector<LightBvhPrimitive> lightBvhPrimitives;
+	std::vector<uint32_t> lightBvhPrimitiveOffsets; // light index -> first light BVH primitive
 	std::vector<uint32_t> instanceIndexMap; // current frame instance index -> previous frame instance index
 
-	std::vector<MeshVertexInfo> meshVertexInfos;
-	std::unordered_map<Buffer*, uint32_t> vertexBufferMap;
-	uint32_t numVertexBuffers = 0;
-
-	std::unordered_map<Image::View, uint32_t> image2s;
-	std::unordered_map<Image::View, uint32_t> image4s;
-	std::vector<GpuMaterial> materials;
-	std::unordered_map<const void*, uint32_t> materialMap;
-
 	const bool useAccelerationStructure = commandBuffer.mDevice.GetAccelerationStructureFeatures().accelerationStructure;
-	std::vector<vk::AccelerationStructureInstanceKHR> instancesAS;
-	std::vector<vk::BufferMemoryBarrier> blasBarriers;
+	std::vector<vk::AccelerationStructureInstanceKHR>& instancesAS = mRenderData.mAccelerationStructureInstances;
+	PendingBlases pendingBlases;
 
 	float3 aabbMin = float3( std::numeric_limits<float>::infinity());
 	float3 aabbMax = float3(-std::numeric_limits<float>::infinity());
 
-	auto AddImage2 = [&](const Image::View& img) {
-		if (!img) return ~(uint32_t)0;
-		if (auto it = image2s.find(img); it != image2s.end())
-			return it->second;
-		else {
-			uint32_t c = image2s.size();
-			mRenderData.mShaderParameters.SetImage("mImage2s", c, img, vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead);
-			image2s.emplace(img, c);
-			return c;
-		}
-	};
-	auto AddImage4 = [&](const Image::View& img) {
-		if (!img) return ~(uint32_t)0;
-		if (auto it = image4s.find(img); it != image4s.end())
-			return it->second;
-		else {
-			uint32_t c = image4s.size();
-			mRenderData.mShaderParameters.SetImage("mImage4s", c, img, vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead);
-			image4s.emplace(img, c);
-			return c;
-		}
-	};
-	auto AddMaterial = [&](const Material& material) {
-		// append unique materials to materials list
-		auto materialMap_it = materialMap.find(&material);
-		if (materialMap_it != materialMap.end())
-			return materialMap_it->second;
-		materialMap_it = materialMap.emplace(&material, (uint32_t)materials.size()).first;
-
-		GpuMaterial m;
-		m.mParameters = material.mMaterial;
-		m.SetBaseColorImage(AddImage4(material.mBaseColor));
-		m.SetEmissionImage(AddImage4(material.mEmission));
-		m.SetPackedParamsImage(AddImage4(material.mPackedParams));
-		if (material.mBumpMap) {
-			if (GetChannelCount(material.mBumpMap.GetImage()->GetFormat()) == 2) {
-				m.SetBumpImage(AddImage2(material.mBumpMap));
-				m.SetIsBumpTwoChannel(true);
-			} else {
-				m.SetBumpImage(AddImage4(material.mBumpMap));
-				m.SetIsBumpTwoChannel(false);
-			}
-		} else
-			m.SetBumpImage(~(uint32_t)0);
-		materials.emplace_back(m);
-
-		return materialMap_it->second;
-	};
-
-	auto AddVertexBuffer = [&](const std::shared_ptr<Buffer>& buf) -> uint32_t {
-		if (!buf)
-			return 0xFFFF;
-
-		if (auto it = vertexBufferMap.find(buf.get()); it != vertexBufferMap.end())
-			return it->second;
-
-		mRenderData.mShaderParameters.SetBuffer( "mVertexBuffers", numVertexBuffers, buf);
-		vertexBufferMap.emplace(buf.get(), numVertexBuffers);
-		return numVertexBuffers++;
-	};
-
-	auto AddInstance = [&](SceneNode& node, const void* primPtr, const auto& instance, const float4x4& transform, const bool isLight) {
+	// Returns the instance index, and the instance's world transform and bounds
+	auto AddInstance = [&](SceneNode& node, const RenderData::InstanceRecord& record, const auto& instance, const float lightPower = 0, const uint32_t triangleTableOffset = INVALID_TABLE_OFFSET) {
 		const uint32_t instanceIndex = (uint32_t)instanceDatas.size();
 		instanceDatas.emplace_back(std::bit_cast<InstanceBase>(instance));
 		mRenderData.mInstanceNodes.emplace_back(node.GetPtr());
+		mRenderData.mInstanceRecords.emplace_back(record);
+
+		const auto[transform, instanceMin, instanceMax] = InstanceToWorld(record, NodeToWorld(node));
+		mRenderData.mInstanceBounds.emplace_back(instanceMin, instanceMax);
+		aabbMin = min(aabbMin, instanceMin);
+		aabbMax = max(aabbMax, instanceMax);
 
 		uint32_t& lightIndex = instanceLightMap.emplace_back(INVALID_INSTANCE);
-		if (isLight) {
+		if (record.mLight) {
 			lightIndex = (uint32_t)lightInstanceMap.size();
 			lightInstanceMap.emplace_back(instanceIndex);
+			lightPowers.emplace_back(lightPower);
+			lightTriangleTableOffsets.emplace_back(triangleTableOffset);
+			lightBvhPrimitiveOffsets.emplace_back((uint32_t)lightBvhPrimitives.size());
 		}
 
 		// transforms
 		uint32_t& prevInstanceIndex = instanceIndexMap.emplace_back(INVALID_INSTANCE);
 
 		float4x4 prevTransform = transform;
-		if (auto it = prevInstanceTransforms.find(primPtr); it != prevInstanceTransforms.end()) {
-			uint32_t idx;
+		if (auto it = prevInstanceTransforms.find(record.mKey); it != prevInstanceTransforms.end()) {
 			std::tie(prevTransform, prevInstanceIndex) = it->second;
 		}
-		mRenderData.mInstanceTransformMap.emplace(primPtr, std::make_pair(transform, instanceIndex));
+		mRenderData.mInstanceTransformMap.emplace(record.mKey, std::make_pair(transform, instanceIndex));
+		if (prevTransform != transform)
+			mRenderData.mMovingInstances.emplace_back(instanceIndex);
 
 		const float4x4 invTransform = inverse(transform);
-		instanceTransforms.emplace_back(transform);
-		instanceInverseTransforms.emplace_back(invTransform);
-		instanceMotionTransforms.emplace_back(prevTransform * invTransform);
-		return instanceIndex;
+		mRenderData.mInstanceTransforms.emplace_back(transform);
+		mRenderData.mInstanceInverseTransforms.emplace_back(invTransform);
+		mRenderData.mInstanceMotionTransforms.emplace_back(prevTransform * invTransform);
+		return std::make_tuple(instanceIndex, transform, instanceMin, instanceMax);
 	};
 
 	auto IsZero = [](const float3 v) { return !(v.r > 0 || v.g > 0 || v.b > 0); };
 
-	auto GetAabbBlas = [&](const float3 mn, const float3 mx, const bool opaque) {
-		const size_t key = HashArgs(mn[0], mn[1], mn[2], mx[0], mx[1], mx[2], opaque);
-		auto aabb_it = mAABBs.find(key);
-		if (aabb_it != mAABBs.end())
-			return aabb_it->second;
-
-		Buffer::View<vk::AabbPositionsKHR> aabb = std::make_shared<Buffer>(
-			commandBuffer.mDevice,
-			"aabb data",
-			sizeof(vk::AabbPositionsKHR),
-			vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
-			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-			VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-		aabb[0].minX = mn[0];
-		aabb[0].minY = mn[1];
-		aabb[0].minZ = mn[2];
-		aabb[0].maxX = mx[0];
-		aabb[0].maxY = mx[1];
-		aabb[0].maxZ = mx[2];
-		vk::AccelerationStructureGeometryAabbsDataKHR aabbs(aabb.GetDeviceAddress(), sizeof(vk::AabbPositionsKHR));
-		vk::AccelerationStructureGeometryKHR aabbGeometry(vk::GeometryTypeKHR::eAabbs, aabbs, opaque ? vk::GeometryFlagBitsKHR::eOpaque : vk::GeometryFlagBitsKHR{});
-		vk::AccelerationStructureBuildRangeInfoKHR range(1);
-		commandBuffer.HoldResource(aabb);
-
-		auto [as, asbuf] = BuildAccelerationStructure(commandBuffer, "aabb BLAS", vk::AccelerationStructureTypeKHR::eBottomLevel, aabbGeometry, range);
-
-		blasBarriers.emplace_back(
-			vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR,
-			VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-			**asbuf.GetBuffer(), asbuf.Offset(), asbuf.SizeBytes());
-
-		return mAABBs.emplace(key, std::make_pair(as, asbuf)).first->second;
-	};
-
 	{ // mesh instances
 		ProfilerScope s("Process mesh instances", &commandBuffer);
-		mRootNode->ForEachDescendant<MeshRenderer>([&](SceneNode& primNode, const std::shared_ptr<MeshRenderer>& prim) {
-			if (!primNode.Enabled() || !prim->mMesh || !prim->mMaterial) return;
 
-			if (prim->mMesh->GetTopology() != vk::PrimitiveTopology::eTriangleList ||
-				(prim->mMesh->GetIndexType() != vk::IndexType::eUint32 && prim->mMesh->GetIndexType() != vk::IndexType::eUint16) ||
-				!prim->mMesh->GetVertices().find(Mesh::VertexAttributeType::ePosition)) {
+		// Adds an instance of mesh for each of localTransforms (relative to primNode), or a single instance at primNode if localTransforms is empty.
+		// All instances share one BLAS and vertex record, and differ only by transform
+		auto AddMeshInstances = [&](SceneNode& primNode, const std::shared_ptr<const void>& renderer, const std::shared_ptr<Mesh>& meshPtr, const std::shared_ptr<Material>& materialPtr, const std::span<const float4x4> localTransforms) {
+			const Mesh& mesh = *meshPtr;
+			const Material& material = *materialPtr;
+			if (!IsSupportedMesh(mesh)) {
 				std::cout << "Skipping unsupported mesh in node " << primNode.GetName() << std::endl;
 				return;
 			}
 
-			auto [positions, positionsDesc] = prim->mMesh->GetVertices().at(Mesh::VertexAttributeType::ePosition)[0];
-
-			const uint32_t vertexCount = (uint32_t)((positions.SizeBytes() - positionsDesc.mOffset) / positionsDesc.mStride);
-			const uint32_t primitiveCount = prim->mMesh->GetIndices().size() / (prim->mMesh->GetIndices().Stride() * 3);
+			const uint32_t primitiveCount = mesh.GetIndices().size() / (mesh.GetIndices().Stride() * 3);
 
-			// get/build BLAS
 			vk::DeviceAddress accelerationStructureAddress;
-			if (useAccelerationStructure) {
-				const size_t key = HashArgs(positions.GetBuffer(), positions.Offset(), positions.SizeBytes(), positionsDesc, prim->mMaterial->mMaterial.AlphaCutoff() == 0);
-				auto it = mMeshAccelerationStructures.find(key);
-				if (it == mMeshAccelerationStructures.end()) {
-					ProfilerScope ps("Build acceleration structure", &commandBuffer);
-
-					vk::AccelerationStructureGeometryTrianglesDataKHR triangles;
-					triangles.vertexFormat = positionsDesc.mFormat;
-					triangles.vertexData = positions.GetDeviceAddress();
-					triangles.vertexStride = positionsDesc.mStride;
-					triangles.maxVertex = vertexCount;
-					triangles.indexType = prim->mMesh->GetIndexType();
-					triangles.indexData = prim->mMesh->GetIndices().GetDeviceAddress();
-					vk::AccelerationStructureGeometryKHR triangleGeometry(vk::GeometryTypeKHR::eTriangles, triangles, prim->mMaterial->mMaterial.AlphaCutoff() == 0 ? vk::GeometryFlagBitsKHR::eOpaque : vk::GeometryFlagBitsKHR{});
-					vk::AccelerationStructureBuildRangeInfoKHR range(primitiveCount);
-
-					auto [as, asbuf] = BuildAccelerationStructure(commandBuffer, primNode.GetName() + "/BLAS", vk::AccelerationStructureTypeKHR::eBottomLevel, triangleGeometry, range);
-
-					blasBarriers.emplace_back(
-						vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR,
-						VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-						**asbuf.GetBuffer(), asbuf.Offset(), asbuf.SizeBytes());
-
-					it = mMeshAccelerationStructures.emplace(key, std::make_pair(as, asbuf)).first;
+			if (useAccelerationStructure)
+				accelerationStructureAddress = commandBuffer.mDevice->getAccelerationStructureAddressKHR(**GetMeshBlas(commandBuffer, mesh, material.mMaterial.AlphaCutoff() == 0, primNode.GetName(), pendingBlases).first);
+
+			const uint32_t vertexInfoIndex = AddMeshVertexInfo(meshPtr);
+			const uint32_t materialIndex = AddMaterial(materialPtr);
+			const float4x4 nodeToWorld = NodeToWorld(primNode);
+			const bool instanced = !localTransforms.empty();
+
+			const bool isLight = !IsZero(material.mMaterial.Emission());
+			float lightPower = 0;
+			uint32_t triangleTableOffset = INVALID_TABLE_OFFSET;
+			std::vector<LightBvhPrimitive> bvhPrimitives;
+			if (isLight) {
+				// power = luminance * world-space area * average texel emission.
+				// triangles are sampled from a per-renderer alias table with the same weights. meshes loaded without triangles
+				// are sampled uniformly, and fall back to half the surface area of their bounds.
+				// instances share the table, and their light BVH primitives cover the whole instance
+				const LuminanceMap* luminanceMap = material.mEmission ? material.mEmissionLuminance.get() : nullptr;
+				const std::shared_ptr<const Mesh::Triangles>& triangles = mesh.GetTriangles();
+				float emittedArea = 0;
+				if (triangles && triangles->mPositions.size() == (size_t)primitiveCount*3) {
+					const bool textured = luminanceMap && !triangles->mTexcoords.empty();
+					// keep every triangle reachable, in case the coarse luminance map misses small bright texels
+					const float minLuminance = textured ? luminanceMap->mMean / 100 : 0;
+					const bool triangleBvhPrimitives = mUseLightBvh && !instanced;
+					std::vector<float> weights(primitiveCount);
+					if (triangleBvhPrimitives) bvhPrimitives.resize(primitiveCount);
+					for (uint32_t i = 0; i < primitiveCount; i++) {
+						const float3 v0 = TransformPoint(nodeToWorld, triangles->mPositions[3*i]);
+						const float3 v1 = TransformPoint(nodeToWorld, triangles->mPositions[3*i+1]);
+						const float3 v2 = TransformPoint(nodeToWorld, triangles->mPositions[3*i+2]);
+						const float3 n = cross(v1 - v0, v2 - v0);
+						const float nlen = length(n);
+						weights[i] = nlen / 2;
+						if (textured)
+							weights[i] *= std::max(luminanceMap->Average(triangles->mTexcoords[3*i], triangles->mTexcoords[3*i+1], triangles->mTexcoords[3*i+2]), minLuminance);
+						if (triangleBvhPrimitives) {
+							LightBvhPrimitive& p = bvhPrimitives[i];
+							p.mMin = min(min(v0, v1), v2);
+							p.mMax = max(max(v0, v1), v2);
+							if (nlen > 0) {
+								p.mAxis = n / nlen;
+								p.mCosThetaO = 1;
+							}
+							p.mPower = Luminance(material.mMaterial.Emission()) * weights[i];
+							p.mPrimitiveIndex = i;
+						}
+					}
+					triangleTableOffset = (uint32_t)triangleAliasTables.size();
+					triangleAliasTables.resize(triangleAliasTables.size() + primitiveCount);
+					emittedArea = (float)BuildAliasTable(weights, std::span(triangleAliasTables).subspan(triangleTableOffset));
+				} else {
+					const vk::AabbPositionsKHR& aabb = mesh.GetVertices().mAabb;
+					const float3 extent = abs((float3x3)nodeToWorld * float3(aabb.maxX - aabb.minX, aabb.maxY - aabb.minY, aabb.maxZ - aabb.minZ));
+					emittedArea = extent.x*extent.y + extent.y*extent.z + extent.z*extent.x;
+					if (luminanceMap) emittedArea *= luminanceMap->mMean;
 				}
-
-				accelerationStructureAddress = commandBuffer.mDevice->getAccelerationStructureAddressKHR(**it->second.first);
+				lightPower = Luminance(material.mMaterial.Emission()) * emittedArea;
 			}
 
-			// assign vertex buffers
-			Buffer::View<std::byte> normals, texcoords;
-			Mesh::VertexAttributeDescription normalsDesc = {}, texcoordsDesc = {};
-			if (auto attrib = prim->mMesh->GetVertices().find(Mesh::VertexAttributeType::eNormal))
-				tie(normals, normalsDesc) = *attrib;
-			if (auto attrib = prim->mMesh->GetVertices().find(Mesh::VertexAttributeType::eTexcoord))
-				tie(texcoords, texcoordsDesc) = *attrib;
-
-			const uint32_t vertexInfoIndex = (uint32_t)meshVertexInfos.size();
-
-			meshVertexInfos.emplace_back(
-				AddVertexBuffer(prim->mMesh->GetIndices().GetBuffer()), (uint32_t)prim->mMesh->GetIndices().Offset(), (uint32_t)prim->mMesh->GetIndices().Stride(),
-				AddVertexBuffer(positions.GetBuffer()), (uint32_t)positions.Offset() + positionsDesc.mOffset, positionsDesc.mStride,
-				AddVertexBuffer(normals.GetBuffer())  , (uint32_t)normals.Offset()   + normalsDesc.mOffset  , normalsDesc.mStride,
-				AddVertexBuffer(texcoords.GetBuffer()), (uint32_t)texcoords.Offset() + texcoordsDesc.mOffset, texcoordsDesc.mStride);
-
-			const uint32_t materialIndex = AddMaterial(*prim->mMaterial);
-			const float4x4 transform = NodeToWorld(primNode);
-			const uint32_t triCount = prim->mMesh->GetIndices().SizeBytes() / (prim->mMesh->GetIndices().Stride() * 3);
-
-			const uint32_t instanceIdx = AddInstance(primNode, prim.get(), MeshInstance(materialIndex, vertexInfoIndex, primitiveCount), transform, !IsZero(prim->mMaterial->mMaterial.Emission()));
+			const uint32_t instanceCount = instanced ? (uint32_t)localTransforms.size() : 1;
+			const vk::AabbPositionsKHR& aabb = mesh.GetVertices().mAabb;
+			for (uint32_t i = 0; i < instanceCount; i++) {
+				// area scales with the instance's scale squared (exactly for uniform scales)
+				const float instanceLightPower = instanced ? lightPower * std::pow(std::abs(glm::determinant((float3x3)localTransforms[i])), 2.f/3) : lightPower;
+
+				const RenderData::InstanceRecord record = {
+					// instanced renderers key motion vectors by the address of each instance's transform
+					.mKey = instanced ? (const void*)&localTransforms[i] : renderer.get(),
+					.mLocalTransform = instanced ? localTransforms[i] : glm::identity<float4x4>(),
+					// quantized positions are dequantized by the instance transform, so that BLAS builds and shading see the same geometry
+					.mPositionTransform = mesh.GetVertices().mPositionTransform,
+					.mMin = float3(aabb.minX, aabb.minY, aabb.minZ),
+					.mMax = float3(aabb.maxX, aabb.maxY, aabb.maxZ),
+					.mTranslationOnly = false,
+					.mLight = isLight,
+					.mRenderer = renderer };
+				const auto[instanceIdx, transform, instanceMin, instanceMax] = AddInstance(primNode, record, MeshInstance(materialIndex, vertexInfoIndex, primitiveCount), instanceLightPower, triangleTableOffset);
+
+				if (useAccelerationStructure) {
+					vk::AccelerationStructureInstanceKHR& instance = instancesAS.emplace_back();
+					float3x4 t = (float3x4)transpose(transform);
+					instance.transform = std::bit_cast<vk::TransformMatrixKHR>(t);
+					instance.instanceCustomIndex = instanceIdx;
+					instance.mask = BVH_FLAG_TRIANGLES;
+					instance.accelerationStructureReference = accelerationStructureAddress;
+				}
 
-			if (useAccelerationStructure) {
-				vk::AccelerationStructureInstanceKHR& instance = instancesAS.emplace_back();
-				float3x4 t = (float3x4)transpose(transform);
-				instance.transform = std::bit_cast<vk::TransformMatrixKHR>(t);
-				instance.instanceCustomIndex = instanceIdx;
-				instance.mask = BVH_FLAG_TRIANGLES;
-				instance.accelerationStructureReference = accelerationStructureAddress;
+				if (isLight && mUseLightBvh) {
+					if (bvhPrimitives.empty()) {
+						// triangles are unknown or instanced, the whole instance is one primitive emitting in all directions
+						LightBvhPrimitive& p = lightBvhPrimitives.emplace_back();
+						p.mMin = instanceMin;
+						p.mMax = instanceMax;
+						p.mPower = instanceLightPower;
+						p.mLightIndex = instanceLightMap[instanceIdx];
+					} else {
+						for (LightBvhPrimitive& p : bvhPrimitives) {
+							p.mLightIndex = instanceLightMap[instanceIdx];
+							lightBvhPrimitives.emplace_back(p);
+						}
+					}
+				}
 			}
+		};
 
-			const vk::AabbPositionsKHR& aabb = prim->mMesh->GetVertices().mAabb;
-			for (uint32_t i = 0; i < 8; i++) {
-				const int3 idx(i % 2, (i % 4) / 2, i / 4);
-				float3 corner(
-					idx[0] == 0 ? aabb.minX : aabb.maxX,
-					idx[1] == 0 ? aabb.minY : aabb.maxY,
-					idx[2] == 0 ? aabb.minZ : aabb.maxZ);
-				corner = TransformPoint(transform, corner);
-				aabbMin = min(aabbMin, corner);
-				aabbMax = max(aabbMax, corner);
-			}
+		mRootNode->ForEachDescendant<MeshRenderer>([&](SceneNode& primNode, const std::shared_ptr<MeshRenderer>& prim) {
+			if (!primNode.Enabled() || !prim->mMesh || !prim->mMaterial) return;
+			AddMeshInstances(primNode, prim, prim->mMesh, prim->mMaterial, {});
+		});
+		mRootNode->ForEachDescendant<InstancedMeshRenderer>([&](SceneNode& primNode, const std::shared_ptr<InstancedMeshRenderer>& prim) {
+			if (!primNode.Enabled() || !prim->mMesh || !prim->mMaterial || prim->mTransforms.empty()) return;
+			AddMeshInstances(primNode, prim, prim->mMesh, prim->mMaterial, prim->mTransforms);
 		});
 	}
 
@@ -827,12 +1608,23 @@ void Scene::UpdateRenderData(CommandBuffer& commandBuffer) {
 
 			vk::DeviceAddress accelerationStructureAddress;
 			if (useAccelerationStructure) {
-				const auto& [as, asbuf] = GetAabbBlas(-float3(radius), float3(radius), prim->mMaterial->mMaterial.AlphaCutoff() == 0);
+				const auto& [as, asbuf] = GetAabbBlas(commandBuffer, -float3(radius), float3(radius), prim->mMaterial->mMaterial.AlphaCutoff() == 0, pendingBlases);
 				accelerationStructureAddress = commandBuffer.mDevice->getAccelerationStructureAddressKHR(**as);
 			}
 
-			const uint32_t materialIndex = AddMaterial(*prim->mMaterial);
-			const uint32_t instanceIdx = AddInstance(primNode, prim.get(), SphereInstance(materialIndex, radius), transform, !IsZero(prim->mMaterial->mMaterial.Emission()));
+			const uint32_t materialIndex = AddMaterial(prim->mMaterial);
+			const float3 emission = prim->mMaterial->mMaterial.Emission();
+			const float lightPower = Luminance(emission) * 4 * float(M_PI) * radius*radius;
+			const RenderData::InstanceRecord record = {
+				.mKey = prim.get(),
+				.mLocalTransform = glm::identity<float4x4>(),
+				.mPositionTransform = glm::identity<float4x4>(),
+				.mMin = -float3(radius),
+				.mMax = float3(radius),
+				.mTranslationOnly = true,
+				.mLight = !IsZero(emission),
+				.mRenderer = prim };
+			const uint32_t instanceIdx = std::get<0>(AddInstance(primNode, record, SphereInstance(materialIndex, radius), lightPower));
 
 			if (useAccelerationStructure) {
 				vk::AccelerationStructureInstanceKHR& instance = instancesAS.emplace_back();
@@ -844,8 +1636,14 @@ void Scene::UpdateRenderData(CommandBuffer& commandBuffer) {
 			}
 
 			const float3 center = TransformPoint(transform, float3(0));
-			aabbMin = min(aabbMin, center - float3(radius));
-			aabbMax = max(aabbMax, center + float3(radius));
+
+			if (!IsZero(emission) && mUseLightBvh) {
+				LightBvhPrimitive& p = lightBvhPrimitives.emplace_back();
+				p.mMin = center - float3(radius);
+				p.mMax = center + float3(radius);
+				p.mPower = lightPower;
+				p.mLightIndex = instanceLightMap[instanceIdx];
+			}
 		});
 	}
 	/*
@@ -901,66 +1699,458 @@ void Scene::UpdateRenderData(CommandBuffer& commandBuffer) {
 		mRenderData.mShaderParameters.SetConstant("mBackgroundColor", float3(0));
 		mRenderData.mShaderParameters.SetConstant("mBackgroundImageIndex", ~uint32_t(0));
 		mRenderData.mShaderParameters.SetConstant("mBackgroundSampleProbability", 0.f);
+		Buffer::View<AliasTableEntry> aliasTable;
+		uint2 aliasTableExtent = uint2(0);
 		mRootNode->ForEachDescendant<EnvironmentMap>([&](SceneNode& node, const std::shared_ptr<EnvironmentMap> environment) {
 			if (!node.Enabled() || IsZero(environment->mColor)) return true;
+			mRenderData.mEnvironment = environment;
 			mRenderData.mShaderParameters.SetConstant("mBackgroundColor", environment->mColor);
-			mRenderData.mShaderParameters.SetConstant("mBackgroundImageIndex", AddImage4(environment->mImage));
+			mRenderData.mShaderParameters.SetConstant("mBackgroundImageIndex", AddImage(environment->mImage, false));
 			mRenderData.mShaderParameters.SetConstant("mBackgroundSampleProbability", lightInstanceMap.empty() ? 1.0f : 0.5f);
+			if (environment->mImage && environment->mAliasTable) {
+				aliasTable = environment->mAliasTable;
+				aliasTableExtent = environment->mAliasTableExtent;
+			}
 			return false;
 		});
+		// images without a table are sampled uniformly
+		if (!aliasTable)
+			aliasTable = commandBuffer.Upload<AliasTableEntry>({}, "mBackgroundAliasTable", vk::BufferUsageFlagBits::eStorageBuffer);
+		mRenderData.mShaderParameters.SetBuffer("mBackgroundAliasTable", aliasTable);
+		mRenderData.mShaderParameters.SetConstant("mBackgroundAliasTableExtent", aliasTableExtent);
 	}
 
-	// Build TLAS
+	// Build BLASs and TLAS
 	if (useAccelerationStructure) {
-		ProfilerScope s("Build TLAS", &commandBuffer);
-		commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::DependencyFlagBits::eByRegion, {}, blasBarriers, {});
-
-		vk::AccelerationStructureGeometryKHR geom{ vk::GeometryTypeKHR::eInstances, vk::AccelerationStructureGeometryInstancesDataKHR() };
-		vk::AccelerationStructureBuildRangeInfoKHR range{ (uint32_t)instancesAS.size() };
-		if (!instancesAS.empty()) {
-			std::shared_ptr<Buffer> tmp = std::make_shared<Buffer>(commandBuffer.mDevice, "TLAS instance buffer",
-				sizeof(vk::AccelerationStructureInstanceKHR) * instancesAS.size(),
-				vk::BufferUsageFlagBits::eTransferSrc,
-				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-				VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-
-			std::shared_ptr<Buffer> buf = std::make_shared<Buffer>(commandBuffer.mDevice, "TLAS instance buffer",
-				tmp->size() + 16, // extra 16 bytes for alignment
-				vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eShaderDeviceAddress);
-
-			const size_t address = (size_t)buf->GetDeviceAddress();
-			const size_t offset = (-address & 15); // aligned = unaligned + (-unaligned & (alignment - 1))
-
-			geom.geometry.instances.data = address + offset;
-			memcpy(tmp->data(), instancesAS.data(), instancesAS.size()*sizeof(vk::AccelerationStructureInstanceKHR));
-			commandBuffer.Copy(tmp, Buffer::View<std::byte>(buf, offset, tmp->size()));
-			commandBuffer.HoldResource(tmp);
-			commandBuffer.HoldResource(buf);
-
-		}
+		BuildPendingBlases(commandBuffer, pendingBlases);
+		BuildTlas(commandBuffer);
+	}
 
-		const auto&[ as, asbuf ] = BuildAccelerationStructure(commandBuffer, "TLAS", vk::AccelerationStructureTypeKHR::eTopLevel, geom, range);
-		mRenderData.mShaderParameters.SetAccelerationStructure("mAccelerationStructure", as);
-		mRenderData.mShaderParameters.SetBuffer("mAccelerationStructureBuffer", asbuf);
+	std::vector<LightBvhNode> lightBvhNodes;
+	std::vector<uint32_t> lightBvhLeaves; // light BVH primitive -> leaf node
+	std::vector<uint2> lightBvhPrimitiveIndices; // light BVH primitive -> (light index, primitive index)
+	if (mUseLightBvh) {
+		ProfilerScope s("Build light BVH", &commandBuffer);
+		const auto t0 = std::chrono::high_resolution_clock::now();
+		BuildLightBvh(lightBvhPrimitives, lightBvhNodes, lightBvhLeaves);
+		lightBvhPrimitiveIndices.resize(lightBvhPrimitives.size());
+		for (size_t i = 0; i < lightBvhPrimitives.size(); i++)
+			lightBvhPrimitiveIndices[i] = uint2(lightBvhPrimitives[i].mLightIndex, lightBvhPrimitives[i].mPrimitiveIndex);
+		mLightBvhStats.mBuildTime = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(std::chrono::high_resolution_clock::now() - t0).count();
+		mLightBvhStats.mPrimitiveCount = (uint32_t)lightBvhPrimitives.size();
+		mLightBvhStats.mNodeCount = (uint32_t)lightBvhNodes.size();
+		mLightBvhStats.mBytes =
+			lightBvhNodes.size() * sizeof(LightBvhNode) +
+			lightBvhLeaves.size() * sizeof(uint32_t) +
+			lightBvhPrimitiveIndices.size() * sizeof(uint2) +
+			lightBvhPrimitiveOffsets.size() * sizeof(uint32_t);
 	}
 
 	{ // upload data
 		ProfilerScope s("Upload scene data buffers");
 		mRenderData.mShaderParameters.SetBuffer("mInstances",                 commandBuffer.Upload<InstanceBase>  (instanceDatas,             "mInstances", vk::BufferUsageFlagBits::eStorageBuffer));
-		mRenderData.mShaderParameters.SetBuffer("mInstanceTransforms",        commandBuffer.Upload<float4x4>      (instanceTransforms,        "mInstanceTransforms", vk::BufferUsageFlagBits::eStorageBuffer));
-		mRenderData.mShaderParameters.SetBuffer("mInstanceInverseTransforms", commandBuffer.Upload<float4x4>      (instanceInverseTransforms, "mInstanceInverseTransforms", vk::BufferUsageFlagBits::eStorageBuffer));
-		mRenderData.mShaderParameters.SetBuffer("mInstanceMotionTransforms",  commandBuffer.Upload<float4x4>      (instanceMotionTransforms,  "mInstanceMotionTransforms", vk::BufferUsageFlagBits::eStorageBuffer));
+		mRenderData.mShaderParameters.SetBuffer("mInstanceTransforms",        commandBuffer.Upload<float4x4>      (mRenderData.mInstanceTransforms,        "mInstanceTransforms", vk::BufferUsageFlagBits::eStorageBuffer));
+		mRenderData.mShaderParameters.SetBuffer("mInstanceInverseTransforms", commandBuffer.Upload<float4x4>      (mRenderData.mInstanceInverseTransforms, "mInstanceInverseTransforms", vk::BufferUsageFlagBits::eStorageBuffer));
+		mRenderData.mShaderParameters.SetBuffer("mInstanceMotionTransforms",  commandBuffer.Upload<float4x4>      (mRenderData.mInstanceMotionTransforms,  "mInstanceMotionTransforms", vk::BufferUsageFlagBits::eStorageBuffer));
 		mRenderData.mShaderParameters.SetBuffer("mLightInstanceMap",          commandBuffer.Upload<uint32_t>      (lightInstanceMap,          "mLightInstanceMap", vk::BufferUsageFlagBits::eStorageBuffer));
 		mRenderData.mShaderParameters.SetBuffer("mInstanceLightMap",          commandBuffer.Upload<uint32_t>      (instanceLightMap,          "mInstanceLightMap", vk::BufferUsageFlagBits::eStorageBuffer));
-		mRenderData.mShaderParameters.SetBuffer("mMeshVertexInfo",            commandBuffer.Upload<MeshVertexInfo>(meshVertexInfos,           "mMeshVertexInfo", vk::BufferUsageFlagBits::eStorageBuffer));
+
+		// select lights and their triangles proportional to emitted power, or uniformly to compare against
+		std::vector<AliasTableEntry> lightAliasTable(lightPowers.size());
+		if (!mPowerLightSelection) {
+			std::ranges::fill(lightPowers, 1.f);
+			std::ranges::fill(lightTriangleTableOffsets, INVALID_TABLE_OFFSET);
+		}
+		BuildAliasTable(lightPowers, lightAliasTable);
+		mRenderData.mShaderParameters.SetBuffer("mLightAliasTable",           commandBuffer.Upload<AliasTableEntry>(lightAliasTable,          "mLightAliasTable", vk::BufferUsageFlagBits::eStorageBuffer));
+		mRenderData.mShaderParameters.SetBuffer("mLightTriangleTableOffsets", commandBuffer.Upload<uint32_t>      (lightTriangleTableOffsets, "mLightTriangleTableOffsets", vk::BufferUsageFlagBits::eStorageBuffer));
+		mRenderData.mShaderParameters.SetBuffer("mTriangleAliasTables",       commandBuffer.Upload<AliasTableEntry>(triangleAliasTables,      "mTriangleAliasTables", vk::BufferUsageFlagBits::eStorageBuffer));
+		mRenderData.mShaderParameters.SetBuffer("mLightBvhNodes",             commandBuffer.Upload<LightBvhNode>  (lightBvhNodes,             "mLightBvhNodes", vk::BufferUsageFlagBits::eStorageBuffer));
+		mRenderData.mShaderParameters.SetBuffer("mLightBvhPrimitives",        commandBuffer.Upload<uint2>         (lightBvhPrimitiveIndices,  "mLightBvhPrimitives", vk::BufferUsageFlagBits::eStorageBuffer));
+		mRenderData.mShaderParameters.SetBuffer("mLightBvhLeaves",            commandBuffer.Upload<uint32_t>      (lightBvhLeaves,            "mLightBvhLeaves", vk::BufferUsageFlagBits::eStorageBuffer));
+		mRenderData.mShaderParameters.SetBuffer("mLightBvhPrimitiveOffsets",  commandBuffer.Upload<uint32_t>      (lightBvhPrimitiveOffsets,  "mLightBvhPrimitiveOffsets", vk::BufferUsageFlagBits::eStorageBuffer));
+		mRenderData.mShaderParameters.SetBuffer("mMeshVertexInfo",            commandBuffer.Upload<MeshVertexInfo>(mRenderData.mMeshVertexInfos, "mMeshVertexInfo", vk::BufferUsageFlagBits::eStorageBuffer));
 		mRenderData.mShaderParameters.SetBuffer("mInstanceVolumeInfo",        commandBuffer.Upload<VolumeInfo>    (volumeInfos,               "mInstanceVolumeInfo", vk::BufferUsageFlagBits::eStorageBuffer));
-		mRenderData.mShaderParameters.SetBuffer("mMaterials",                 commandBuffer.Upload<GpuMaterial>   (materials,                 "mMaterials", vk::BufferUsageFlagBits::eStorageBuffer));
+		mRenderData.mShaderParameters.SetBuffer("mMaterials",                 commandBuffer.Upload<GpuMaterial>   (mRenderData.mMaterials,     "mMaterials", vk::BufferUsageFlagBits::eStorageBuffer));
 		mRenderData.mInstanceIndexMap = commandBuffer.Upload<uint32_t>(instanceIndexMap, "mInstanceIndexMap", vk::BufferUsageFlagBits::eStorageBuffer);
+		mRenderData.mIdentityInstanceIndexMap = std::ranges::equal(instanceIndexMap, std::views::iota(0u, (uint32_t)instanceIndexMap.size()));
 	}
 	mRenderData.mShaderParameters.SetConstant("mSceneMin", aabbMin);
 	mRenderData.mShaderParameters.SetConstant("mSceneMax", aabbMax);
 	mRenderData.mShaderParameters.SetConstant("mInstanceCount", (uint32_t)instanceDatas.size());
 	mRenderData.mShaderParameters.SetConstant("mLightCount", (uint32_t)lightInstanceMap.size());
+	mRenderData.mShaderParameters.SetConstant("mLightBvhNodeCount", (uint32_t)lightBvhNodes.size());
+	mRenderData.mShaderParameters.SetConstant("mSolidAngleLightSampling", (uint32_t)mSolidAngleLightSampling);
 }
 
-}
\ No newline at end of file
+bool Scene::PatchRenderData(CommandBuffer& commandBuffer, const bool transforms, const bool materials, const bool instances) {
+	RenderData& rd = mRenderData;
+	if (!rd.mInstanceIndexMap) return false;
+
+	const uint32_t prevInstanceCount = (uint32_t)rd.mInstanceRecords.size();
+	auto IsZero = [](const float3 v) { return !(v.r > 0 || v.g > 0 || v.b > 0); };
+
+	// find changes first, so that falling back to UpdateRenderData still sees the previous transforms
+
+	// Instances of added or enabled renderers, and removed or disabled ones.
+	// Lights and the environment are not patched, since the light tables and light BVH are built over all of them
+	struct NewInstance {
+		std::shared_ptr<SceneNode> mNode;
+		std::shared_ptr<const void> mRenderer;
+		const void* mKey;
+		std::shared_ptr<Mesh> mMesh; // null for spheres
+		std::shared_ptr<Material> mMaterial;
+		float4x4 mLocalTransform;
+		float mRadius;
+	};
+	std::vector<NewInstance> addedInstances;
+	std::vector<bool> removed(prevInstanceCount, false);
+	uint32_t removedCount = 0;
+	if (instances) {
+		std::shared_ptr<const EnvironmentMap> environment;
+		mRootNode->ForEachDescendant<EnvironmentMap>([&](SceneNode& node, const std::shared_ptr<EnvironmentMap> e) {
+			if (!node.Enabled() || IsZero(e->mColor)) return true;
+			environment = e;
+			return false;
+		});
+		// compared by owner, so that a destroyed environment map does not look like no environment map
+		const std::weak_ptr<const EnvironmentMap> weakEnvironment = environment;
+		if (weakEnvironment.owner_before(rd.mEnvironment) || rd.mEnvironment.owner_before(weakEnvironment)) return false;
+
+		std::vector<NewInstance> current;
+		mRootNode->ForEachDescendant<MeshRenderer>([&](SceneNode& node, const std::shared_ptr<MeshRenderer>& prim) {
+			if (!node.Enabled() || !prim->mMesh || !prim->mMaterial || !IsSupportedMesh(*prim->mMesh)) return;
+			current.emplace_back(node.GetPtr(), prim, prim.get(), prim->mMesh, prim->mMaterial, glm::identity<float4x4>(), 0.f);
+		});
+		mRootNode->ForEachDescendant<InstancedMeshRenderer>([&](SceneNode& node, const std::shared_ptr<InstancedMeshRenderer>& prim) {
+			if (!node.Enabled() || !prim->mMesh || !prim->mMaterial || !IsSupportedMesh(*prim->mMesh)) return;
+			for (const float4x4& t : prim->mTransforms)
+				current.emplace_back(node.GetPtr(), prim, &t, prim->mMesh, prim->mMaterial, t, 0.f);
+		});
+		mRootNode->ForEachDescendant<SphereRenderer>([&](SceneNode& node, const std::shared_ptr<SphereRenderer>& prim) {
+			if (!node.Enabled() || !prim->mMaterial) return;
+			current.emplace_back(node.GetPtr(), prim, prim.get(), nullptr, prim->mMaterial, glm::identity<float4x4>(), prim->mRadius);
+		});
+
+		// an instance is kept if its renderer is alive, still on the same node, and has the same key
+		std::unordered_map<const void*, uint32_t> currentMap;
+		for (uint32_t i = 0; i < current.size(); i++)
+			currentMap.emplace(current[i].mKey, i);
+		std::vector<bool> kept(current.size(), false);
+		for (uint32_t i = 0; i < prevInstanceCount; i++) {
+			const RenderData::InstanceRecord& r = rd.mInstanceRecords[i];
+			const std::shared_ptr<const void> renderer = r.mRenderer.lock();
+			if (auto it = currentMap.find(r.mKey); renderer && it != currentMap.end() && current[it->second].mRenderer == renderer && current[it->second].mNode == rd.mInstanceNodes[i].lock()) {
+				kept[it->second] = true;
+				continue;
+			}
+			if (r.mLight) return false;
+			removed[i] = true;
+			removedCount++;
+		}
+		for (uint32_t i = 0; i < current.size(); i++) {
+			if (kept[i]) continue;
+			if (!IsZero(current[i].mMaterial->mMaterial.Emission())) return false;
+			addedInstances.emplace_back(std::move(current[i]));
+		}
+	}
+
+	struct InstancePatch {
+		uint32_t mInstance;
+		float4x4 mTransform;
+		float3 mMin, mMax;
+	};
+	std::vector<InstancePatch> instancePatches;
+	if (transforms) {
+		for (uint32_t i = 0; i < prevInstanceCount; i++) {
+			if (removed[i]) continue;
+			const std::shared_ptr<SceneNode> node = rd.mInstanceNodes[i].lock();
+			if (!node) return false;
+			const auto[transform, mn, mx] = InstanceToWorld(rd.mInstanceRecords[i], NodeToWorld(*node));
+			if (transform == rd.mInstanceTransforms[i]) continue;
+			// light powers, triangle tables and the light BVH are built in world space
+			if (rd.mInstanceRecords[i].mLight) return false;
+			instancePatches.emplace_back(i, transform, mn, mx);
+		}
+	}
+
+	std::vector<std::pair<uint32_t, GpuMaterial>> materialPatches;
+	if (materials) {
+		bool missingImage = false;
+		auto FindImage = [&](const std::unordered_map<Image::View, uint32_t>& images) {
+			return [&missingImage, images = &images](const Image::View& img) {
+				if (!img) return ~(uint32_t)0;
+				if (auto it = images->find(img); it != images->end())
+					return it->second;
+				missingImage = true;
+				return ~(uint32_t)0;
+			};
+		};
+		for (uint32_t i = 0; i < rd.mMaterials.size(); i++) {
+			// no instance uses a destroyed material
+			const std::shared_ptr<const Material> source = rd.mMaterialSources[i].lock();
+			if (!source) continue;
+			const GpuMaterial m = MakeGpuMaterial(*source, FindImage(rd.mImage2s), FindImage(rd.mImage4s));
+			if (missingImage) return false;
+			const GpuMaterial& prev = rd.mMaterials[i];
+			if (memcmp(&m, &prev, sizeof(GpuMaterial)) == 0) continue;
+			// emission changes which instances are lights and their powers, alpha cutoff changes whether BLASs are opaque
+			if (m.mParameters.Emission() != prev.mParameters.Emission() || (m.mParameters.AlphaCutoff() == 0) != (prev.mParameters.AlphaCutoff() == 0))
+				return false;
+			materialPatches.emplace_back(i, m);
+		}
+	}
+
+	mLastUpdate = std::chrono::high_resolution_clock::now();
+
+	size_t uploadBytes = 0;
+	std::vector<uint32_t> transformInstances; // instances whose transform changed
+	std::vector<uint32_t> motionInstances; // instances whose motion transform changed
+
+	if (transforms) {
+		// instances that moved last update need their motion transform reset, even if they did not move again
+		motionInstances = std::move(rd.mMovingInstances);
+		rd.mMovingInstances.clear();
+		for (const InstancePatch& p : instancePatches) {
+			const uint32_t i = p.mInstance;
+			const float4x4 invTransform = inverse(p.mTransform);
+			rd.mInstanceMotionTransforms[i] = rd.mInstanceTransforms[i] * invTransform;
+			rd.mInstanceTransforms[i] = p.mTransform;
+			rd.mInstanceInverseTransforms[i] = invTransform;
+			rd.mInstanceBounds[i] = { p.mMin, p.mMax };
+			rd.mInstanceTransformMap[rd.mInstanceRecords[i].mKey] = std::make_pair(p.mTransform, i);
+			if (!rd.mAccelerationStructureInstances.empty()) {
+				float3x4 t = (float3x4)transpose(p.mTransform);
+				rd.mAccelerationStructureInstances[i].transform = std::bit_cast<vk::TransformMatrixKHR>(t);
+			}
+			rd.mMovingInstances.emplace_back(i);
+		}
+		// both lists are in instance order
+		for (const uint32_t i : motionInstances)
+			if (!std::ranges::binary_search(rd.mMovingInstances, i))
+				rd.mInstanceMotionTransforms[i] = glm::identity<float4x4>();
+		motionInstances.insert(motionInstances.end(), rd.mMovingInstances.begin(), rd.mMovingInstances.end());
+		transformInstances = rd.mMovingInstances;
+	}
+
+	const bool useAccelerationStructure = commandBuffer.mDevice.GetAccelerationStructureFeatures().accelerationStructure;
+	const bool restructured = !addedInstances.empty() || removedCount > 0;
+	const uint32_t prevMaterialCount = (uint32_t)rd.mMaterials.size();
+	const uint32_t prevVertexInfoCount = (uint32_t)rd.mMeshVertexInfos.size();
+	std::vector<uint32_t> filledInstances; // slots that hold a different instance than before
+	std::vector<uint32_t> sources; // instance index -> previous instance index, or INVALID_INSTANCE for added instances
+	std::vector<uint32_t> changedLights;
+	PendingBlases pendingBlases;
+	if (restructured) {
+		const uint32_t instanceCount = prevInstanceCount - removedCount + (uint32_t)addedInstances.size();
+
+		// Removed slots are filled with added instances, then with kept instances moved down from the end, and the rest are appended.
+		// Everything else keeps its index, so only the filled slots need uploading
+		std::vector<uint32_t> tail; // kept instances at or past instanceCount
+		for (uint32_t i = instanceCount; i < prevInstanceCount; i++)
+			if (!removed[i]) tail.emplace_back(i);
+		sources.resize(instanceCount);
+		std::vector<uint32_t> addedSlots;
+		for (uint32_t i = 0; i < instanceCount; i++) {
+			if (i < prevInstanceCount && !removed[i])
+				sources[i] = i;
+			else if (addedSlots.size() < addedInstances.size()) {
+				sources[i] = INVALID_INSTANCE;
+				addedSlots.emplace_back(i);
+			} else {
+				sources[i] = tail.back();
+				tail.pop_back();
+			}
+			if (sources[i] != i)
+				filledInstances.emplace_back(i);
+		}
+
+		for (uint32_t i = 0; i < prevInstanceCount; i++)
+			if (removed[i])
+				rd.mInstanceTransformMap.erase(rd.mInstanceRecords[i].mKey);
+
+		const size_t size = std::max(instanceCount, prevInstanceCount);
+		rd.mInstanceRecords.resize(size);
+		rd.mInstanceNodes.resize(size);
+		rd.mInstances.resize(size);
+		rd.mInstanceTransforms.resize(size);
+		rd.mInstanceInverseTransforms.resize(size);
+		rd.mInstanceMotionTransforms.resize(size);
+		rd.mInstanceBounds.resize(size);
+		rd.mInstanceLightMap.resize(size);
+		if (useAccelerationStructure) rd.mAccelerationStructureInstances.resize(size);
+
+		// moved instances. sources are past instanceCount, so they are never overwritten before they are read
+		std::vector<uint32_t> newIndices(prevInstanceCount, INVALID_INSTANCE);
+		for (uint32_t i = 0; i < instanceCount; i++) {
+			const uint32_t src = sources[i];
+			if (src == INVALID_INSTANCE) continue;
+			newIndices[src] = i;
+			if (src == i) continue;
+			rd.mInstanceRecords[i]            = std::move(rd.mInstanceRecords[src]);
+			rd.mInstanceNodes[i]              = std::move(rd.mInstanceNodes[src]);
+			rd.mInstances[i]                  = rd.mInstances[src];
+			rd.mInstanceTransforms[i]         = rd.mInstanceTransforms[src];
+			rd.mInstanceInverseTransforms[i]  = rd.mInstanceInverseTransforms[src];
+			rd.mInstanceMotionTransforms[i]   = rd.mInstanceMotionTransforms[src];
+			rd.mInstanceBounds[i]             = rd.mInstanceBounds[src];
+			rd.mInstanceLightMap[i]           = rd.mInstanceLightMap[src];
+			rd.mInstanceTransformMap[rd.mInstanceRecords[i].mKey].second = i;
+			if (const uint32_t light = rd.mInstanceLightMap[i]; light != INVALID_INSTANCE) {
+				rd.mLightInstanceMap[light] = i;
+				changedLights.emplace_back(light);
+			}
+			if (useAccelerationStructure) {
+				rd.mAccelerationStructureInstances[i] = rd.mAccelerationStructureInstances[src];
+				rd.mAccelerationStructureInstances[i].instanceCustomIndex = i;
+			}
+		}
+
+		// added instances, see AddMeshInstances and the sphere instances in UpdateRenderData
+		for (size_t a = 0; a < addedInstances.size(); a++) {
+			const uint32_t i = addedSlots[a];
+			const NewInstance& n = addedInstances[a];
+			const bool opaque = n.mMaterial->mMaterial.AlphaCutoff() == 0;
+			const uint32_t materialIndex = AddMaterial(n.mMaterial);
+			RenderData::InstanceRecord record;
+			vk::DeviceAddress accelerationStructureAddress = 0;
+			if (n.mMesh) {
+				const Mesh& mesh = *n.mMesh;
+				const vk::AabbPositionsKHR& aabb = mesh.GetVertices().mAabb;
+				const uint32_t primitiveCount = mesh.GetIndices().size() / (mesh.GetIndices().Stride() * 3);
+				record = {
+					.mKey = n.mKey,
+					.mLocalTransform = n.mLocalTransform,
+					.mPositionTransform = mesh.GetVertices().mPositionTransform,
+					.mMin = float3(aabb.minX, aabb.minY, aabb.minZ),
+					.mMax = float3(aabb.maxX, aabb.maxY, aabb.maxZ),
+					.mTranslationOnly = false,
+					.mLight = false,
+					.mRenderer = n.mRenderer };
+				rd.mInstances[i] = std::bit_cast<InstanceBase>(MeshInstance(materialIndex, AddMeshVertexInfo(n.mMesh), primitiveCount));
+				if (useAccelerationStructure)
+					accelerationStructureAddress = commandBuffer.mDevice->getAccelerationStructureAddressKHR(**GetMeshBlas(commandBuffer, mesh, opaque, n.mNode->GetName(), pendingBlases).first);
+			} else {
+				record = {
+					.mKey = n.mKey,
+					.mLocalTransform = glm::identity<float4x4>(),
+					.mPositionTransform = glm::identity<float4x4>(),
+					.mMin = -float3(n.mRadius),
+					.mMax = float3(n.mRadius),
+					.mTranslationOnly = true,
+					.mLight = false,
+					.mRenderer = n.mRenderer };
+				rd.mInstances[i] = std::bit_cast<InstanceBase>(SphereInstance(materialIndex, n.mRadius));
+				if (useAccelerationStructure)
+					accelerationStructureAddress = commandBuffer.mDevice->getAccelerationStructureAddressKHR(**GetAabbBlas(commandBuffer, -float3(n.mRadius), float3(n.mRadius), opaque, pendingBlases).first);
+			}
+
+			const auto[transform, mn, mx] = InstanceToWorld(record, NodeToWorld(*n.mNode));
+			rd.mInstanceRecords[i] = record;
+			rd.mInstanceNodes[i] = n.mNode;
+			rd.mInstanceTransforms[i] = transform;
+			rd.mInstanceInverseTransforms[i] = inverse(transform);
+			rd.mInstanceMotionTransforms[i] = glm::identity<float4x4>();
+			rd.mInstanceBounds[i] = { mn, mx };
+			rd.mInstanceLightMap[i] = INVALID_INSTANCE;
+			rd.mInstanceTransformMap[n.mKey] = std::make_pair(transform, i);
+			if (useAccelerationStructure) {
+				vk::AccelerationStructureInstanceKHR& instance = rd.mAccelerationStructureInstances[i];
+				instance = vk::AccelerationStructureInstanceKHR();
+				float3x4 t = (float3x4)transpose(transform);
+				instance.transform = std::bit_cast<vk::TransformMatrixKHR>(t);
+				instance.instanceCustomIndex = i;
+				instance.mask = n.mMesh ? BVH_FLAG_TRIANGLES : BVH_FLAG_SPHERES;
+				instance.accelerationStructureReference = accelerationStructureAddress;
+			}
+		}
+
+		rd.mInstanceRecords.resize(instanceCount);
+		rd.mInstanceNodes.resize(instanceCount);
+		rd.mInstances.resize(instanceCount);
+		rd.mInstanceTransforms.resize(instanceCount);
+		rd.mInstanceInverseTransforms.resize(instanceCount);
+		rd.mInstanceMotionTransforms.resize(instanceCount);
+		rd.mInstanceBounds.resize(instanceCount);
+		rd.mInstanceLightMap.resize(instanceCount);
+		if (useAccelerationStructure) rd.mAccelerationStructureInstances.resize(instanceCount);
+
+		auto Remap = [&](std::vector<uint32_t>& indices) {
+			std::vector<uint32_t> remapped;
+			for (const uint32_t i : indices)
+				if (i < newIndices.size() && newIndices[i] != INVALID_INSTANCE)
+					remapped.emplace_back(newIndices[i]);
+			std::ranges::sort(remapped);
+			indices = std::move(remapped);
+		};
+		Remap(rd.mMovingInstances);
+		Remap(transformInstances);
+		Remap(motionInstances);
+		transformInstances.insert(transformInstances.end(), filledInstances.begin(), filledInstances.end());
+		motionInstances.insert(motionInstances.end(), filledInstances.begin(), filledInstances.end());
+
+		rd.mShaderParameters.SetConstant("mInstanceCount", instanceCount);
+	}
+
+	{ // upload instance data. buffers grow when instances are appended
+		const std::vector<uint2> filledRanges = ToRanges(filledInstances);
+		uploadBytes += PatchOrGrowBuffer(commandBuffer, rd.mShaderParameters, "mInstances",                 rd.mInstances,                 filledRanges);
+		uploadBytes += PatchOrGrowBuffer(commandBuffer, rd.mShaderParameters, "mInstanceLightMap",          rd.mInstanceLightMap,          filledRanges);
+		uploadBytes += PatchOrGrowBuffer(commandBuffer, rd.mShaderParameters, "mInstanceTransforms",        rd.mInstanceTransforms,        ToRanges(transformInstances));
+		uploadBytes += PatchOrGrowBuffer(commandBuffer, rd.mShaderParameters, "mInstanceInverseTransforms", rd.mInstanceInverseTransforms, ToRanges(transformInstances));
+		uploadBytes += PatchOrGrowBuffer(commandBuffer, rd.mShaderParameters, "mInstanceMotionTransforms",  rd.mInstanceMotionTransforms,  ToRanges(motionInstances));
+		uploadBytes += PatchBuffer(commandBuffer, rd.mShaderParameters.GetBuffer<uint32_t>("mLightInstanceMap"), rd.mLightInstanceMap, ToRanges(changedLights));
+	}
+
+	if (restructured) {
+		rd.mInstanceIndexMap = commandBuffer.Upload<uint32_t>(sources, "mInstanceIndexMap", vk::BufferUsageFlagBits::eStorageBuffer);
+		rd.mIdentityInstanceIndexMap = std::ranges::equal(sources, std::views::iota(0u, (uint32_t)sources.size()));
+		uploadBytes += sources.size() * sizeof(uint32_t);
+	} else if (transforms && !rd.mIdentityInstanceIndexMap) {
+		// instance indices did not change
+		std::vector<uint32_t> instanceIndexMap(rd.mInstanceRecords.size());
+		std::iota(instanceIndexMap.begin(), instanceIndexMap.end(), 0u);
+		rd.mInstanceIndexMap = commandBuffer.Upload<uint32_t>(instanceIndexMap, "mInstanceIndexMap", vk::BufferUsageFlagBits::eStorageBuffer);
+		rd.mIdentityInstanceIndexMap = true;
+		uploadBytes += instanceIndexMap.size() * sizeof(uint32_t);
+	}
+
+	if (!instancePatches.empty() || restructured) {
+		float3 aabbMin = float3( std::numeric_limits<float>::infinity());
+		float3 aabbMax = float3(-std::numeric_limits<float>::infinity());
+		for (const auto&[mn, mx] : rd.mInstanceBounds) {
+			aabbMin = min(aabbMin, mn);
+			aabbMax = max(aabbMax, mx);
+		}
+		rd.mShaderParameters.SetConstant("mSceneMin", aabbMin);
+		rd.mShaderParameters.SetConstant("mSceneMax", aabbMax);
+
+		if (useAccelerationStructure) {
+			if (!pendingBlases.mBuilds.empty())
+				BuildPendingBlases(commandBuffer, pendingBlases);
+			BuildTlas(commandBuffer);
+		}
+	}
+
+	// materials and vertex records of added instances are appended
+	std::vector<uint32_t> materialIndices;
+	for (const auto&[i, m] : materialPatches) {
+		rd.mMaterials[i] = m;
+		materialIndices.emplace_back(i);
+	}
+	for (uint32_t i = prevMaterialCount; i < rd.mMaterials.size(); i++)
+		materialIndices.emplace_back(i);
+	if (!materialIndices.empty())
+		uploadBytes += PatchOrGrowBuffer(commandBuffer, rd.mShaderParameters, "mMaterials", rd.mMaterials, ToRanges(materialIndices));
+	if (rd.mMeshVertexInfos.size() > prevVertexInfoCount)
+		uploadBytes += PatchOrGrowBuffer(commandBuffer, rd.mShaderParameters, "mMeshVertexInfo", rd.mMeshVertexInfos, { uint2(prevVertexInfoCount, (uint32_t)rd.mMeshVertexInfos.size()) });
+
+	mUpdateStats.mPatchedInstances = (uint32_t)instancePatches.size();
+	mUpdateStats.mPatchedMaterials = (uint32_t)materialPatches.size();
+	mUpdateStats.mAddedInstances = (uint32_t)addedInstances.size();
+	mUpdateStats.mRemovedInstances = removedCount;
+	mUpdateStats.mUploadBytes = uploadBytes;
+	return true;
+}
+
+}
@@ -6,9 +6,27 @@
 #include <Core/PipelineCache.hpp>
 #include "SceneNode.hpp"
 #include "Mesh.hpp"
+#include "AssetCache.hpp"
+#include "LoadQueue.hpp"
 
 namespace ptvk {
 
+// Host copy of an emission image's luminance, box filtered into a small mip chain,
+// so that emissive triangles can be weighted by the average emission over their texcoords
+struct LuminanceMap {
+	static constexpr uint32_t gMaxExtent = 256;
+
+	std::vector<std::vector<float>> mLevels;
+	std::vector<uint2> mExtents;
+	float mMean = 0;
+
+	// Returns null if luminance is empty
+	static std::shared_ptr<const LuminanceMap> Create(const std::span<const float> luminance, const uint2 extent);
+
+	// Approximate average over a triangle in uv space, with repeat addressing
+	float Average(const float2 uv0, const float2 uv1, const float2 uv2) const;
+};
+
 struct Material {
     PackedMaterialParameters mMaterial;
 	Image::View mBaseColor;
@@ -16,6 +34,7 @@ struct Material {
 	Image::View mEmission;
 	Image::View mBumpMap;
 	Buffer::View<uint> mMinAlpha;
+	std::shared_ptr<const LuminanceMap> mEmissionLuminance; // null if mEmission is null, or its format could not be read on the host
 };
 
 struct MeshRenderer {
@@ -25,6 +44,15 @@ struct MeshRenderer {
 	void OnInspectorGui(SceneNode& node);
 };
 
+// Draws mMesh once per transform (relative to the node), sharing one BLAS and vertex record between instances (e.g. EXT_mesh_gpu_instancing)
+struct InstancedMeshRenderer {
+	std::shared_ptr<Material> mMaterial;
+	std::shared_ptr<Mesh> mMesh;
+	std::vector<float4x4> mTransforms;
+
+	void OnInspectorGui(SceneNode& node);
+};
+
 struct SphereRenderer {
 	std::shared_ptr<Material> mMaterial;
 	float mRadius;
@@ -45,6 +73,9 @@ struct VolumeRenderer {
 struct EnvironmentMap {
 	float3 mColor;
 	Image::View mImage;
+	// importance sampling table for mImage, see BuildEnvironmentAliasTable (AliasTable.hpp)
+	Buffer::View<AliasTableEntry> mAliasTable;
+	uint2 mAliasTableExtent = uint2(0);
 
     void OnInspectorGui(SceneNode &node);
 };
@@ -70,11 +101,67 @@ public:
 		// see SceneConstants struct in Scene.slang
 		ShaderParameterBlock mShaderParameters;
 
+		// Everything below is kept so that transform, material and instance add/remove changes can patch the buffers above in place, see Scene::PatchRenderData
+
+		struct InstanceRecord {
+			const void* mKey; // key in mInstanceTransformMap
+			float4x4 mLocalTransform; // instance relative to its node
+			float4x4 mPositionTransform; // vertex dequantization, applied after mLocalTransform
+			float3 mMin, mMax; // bounds, relative to mLocalTransform
+			bool mTranslationOnly; // spheres ignore the rotation and scale of their node
+			bool mLight;
+			std::weak_ptr<const void> mRenderer; // expires when the renderer is destroyed, even if a new one reuses its address (mKey)
+		};
+		std::vector<InstanceRecord> mInstanceRecords;
+		std::vector<InstanceBase> mInstances;
+		std::vector<float4x4> mInstanceTransforms;
+		std::vector<float4x4> mInstanceInverseTransforms;
+		std::vector<float4x4> mInstanceMotionTransforms;
+		std::vector<std::pair<float3, float3>> mInstanceBounds; // world space
+		std::vector<vk::AccelerationStructureInstanceKHR> mAccelerationStructureInstances;
+		std::vector<uint32_t> mMovingInstances; // instances whose motion transform is not the identity
+		bool mIdentityInstanceIndexMap = false;
+		std::vector<uint32_t> mLightInstanceMap; // light index -> instance index
+		std::vector<uint32_t> mInstanceLightMap; // instance index -> light index
+		std::weak_ptr<const EnvironmentMap> mEnvironment; // the environment map drawn as the background, if any
+
+		// sources are weak so that entries of removed renderers can't be mistaken for new ones at the same address
+		std::vector<std::weak_ptr<const Material>> mMaterialSources;
+		std::unordered_map<const Material*, uint32_t> mMaterialMap;
+		std::vector<GpuMaterial> mMaterials;
+		std::unordered_map<Image::View, uint32_t> mImage2s;
+		std::unordered_map<Image::View, uint32_t> mImage4s;
+		std::vector<std::weak_ptr<const Mesh>> mVertexInfoSources;
+		std::unordered_map<const Mesh*, uint32_t> mVertexInfoMap;
+		std::vector<MeshVertexInfo> mMeshVertexInfos;
+		std::unordered_map<const Buffer*, uint32_t> mVertexBuffers;
+
 		inline void Reset() {
 			mInstanceTransformMap.clear();
 			mInstanceNodes.clear();
 			mInstanceIndexMap = {};
 			mShaderParameters.clear();
+			mInstanceRecords.clear();
+			mInstances.clear();
+			mInstanceTransforms.clear();
+			mInstanceInverseTransforms.clear();
+			mInstanceMotionTransforms.clear();
+			mInstanceBounds.clear();
+			mAccelerationStructureInstances.clear();
+			mMovingInstances.clear();
+			mIdentityInstanceIndexMap = false;
+			mLightInstanceMap.clear();
+			mInstanceLightMap.clear();
+			mEnvironment.reset();
+			mMaterialSources.clear();
+			mMaterialMap.clear();
+			mMaterials.clear();
+			mImage2s.clear();
+			mImage4s.clear();
+			mVertexInfoSources.clear();
+			mVertexInfoMap.clear();
+			mMeshVertexInfos.clear();
+			mVertexBuffers.clear();
 		}
 	};
 
@@ -93,7 +180,7 @@ public:
 
 	std::shared_ptr<SceneNode> LoadEnvironmentMap(CommandBuffer& commandBuffer, const std::filesystem::path& filename);
 	std::shared_ptr<SceneNode> LoadGltf          (CommandBuffer& commandBuffer, const std::filesystem::path& filename);
-	//std::shared_ptr<SceneNode> LoadMitsuba       (CommandBuffer& commandBuffer, const std::filesystem::path& filename);
+	std::shared_ptr<SceneNode> LoadMitsuba       (CommandBuffer& commandBuffer, const std::filesystem::path& filename);
 	//std::shared_ptr<SceneNode> LoadVol           (CommandBuffer& commandBuffer, const std::filesystem::path& filename);
 	//std::shared_ptr<SceneNode> LoadNvdb          (CommandBuffer& commandBuffer, const std::filesystem::path& filename);
 #ifdef ENABLE_ASSIMP
@@ -108,6 +195,7 @@ public:
 			"All Files", "*",
 			"Environment Maps (.exr .hdr)", "*.exr *.hdr",
 			"glTF Scenes (.gltf .glb)", "*.gltf *.glb",
+			"Mitsuba Scenes (.xml)", "*.xml",
 			//"Mitsuba Volumes (.vol)" , "*.vol",
 			//"NVDB Volume (.nvdb)" , "*.nvdb",
 			#ifdef ENABLE_ASSIMP
@@ -128,7 +216,7 @@ public:
 		else if (ext == ".exr") return LoadEnvironmentMap(commandBuffer, filename);
 		else if (ext == ".gltf") return LoadGltf(commandBuffer, filename);
 		else if (ext == ".glb")  return LoadGltf(commandBuffer, filename);
-		//else if (ext == ".xml") return LoadMitsuba(commandBuffer, filename);
+		else if (ext == ".xml")  return LoadMitsuba(commandBuffer, filename);
 		//else if (ext == ".vol") return LoadVol(commandBuffer, filename);
 		//else if (ext == ".nvdb") return LoadNvdb(commandBuffer, filename);
 		//#ifdef ENABLE_OPENVDB
@@ -142,7 +230,8 @@ public:
 		#endif
 	}
 
-	inline void LoadAsync(const std::filesystem::path& filename) { mToLoad.emplace_back(filename.string()); }
+	// Queues filename to be loaded on a worker thread. Higher priorities load first
+	inline void LoadAsync(const std::filesystem::path& filename, const int priority = 0) { mToLoad.emplace_back(filename, priority); }
 
 	#pragma endregion
 	#pragma region Material conversion
@@ -168,19 +257,154 @@ private:
 	// cache mesh BLASs
 	std::unordered_map<size_t, AccelerationStructureData> mMeshAccelerationStructures;
 
+	// BLASs built with eAllowCompaction, waiting for their compacted sizes. see CompactAccelerationStructures
+	struct CompactionBatch {
+		std::shared_ptr<vk::raii::QueryPool> mQueryPool;
+		std::vector<std::pair<bool /* aabb */, size_t /* key in mAABBs or mMeshAccelerationStructures */>> mKeys;
+		std::vector<std::shared_ptr<vk::raii::AccelerationStructureKHR>> mAccelerationStructures;
+	};
+	std::vector<CompactionBatch> mCompactionBatches;
+	bool mCompactBlas = true;
+	struct {
+		uint32_t mCount = 0;
+		size_t mOriginalBytes = 0;
+		size_t mCompactedBytes = 0;
+	} mCompactionStats;
+
+	// BLASs created in UpdateRenderData or PatchRenderData but not yet built. see BuildBlases
+	struct PendingBlasBuild {
+		vk::AccelerationStructureGeometryKHR mGeometry;
+		vk::AccelerationStructureBuildRangeInfoKHR mRange;
+		vk::AccelerationStructureKHR mAccelerationStructure;
+		vk::DeviceSize mScratchSize;
+		std::string mName; // mesh name, for the per-mesh build time report
+	};
+	struct PendingBlases {
+		std::vector<PendingBlasBuild> mBuilds; // built together before the TLAS
+		std::vector<vk::BufferMemoryBarrier> mBarriers;
+		CompactionBatch mCompactionBatch;
+	};
+	// scratch memory for BLAS builds, sub-allocated by each build in a batch and reused by later batches
+	Buffer::View<std::byte> mBlasScratch;
+	vk::DeviceSize mMaxBlasBatchScratch = 128 << 20;
+	struct {
+		uint32_t mCount = 0;
+		uint32_t mBatchCount = 0;
+		size_t mTriangleCount = 0;
+
+		// GPU time of the last timed build, with a timestamp between each batch
+		std::shared_ptr<vk::raii::QueryPool> mTimestamps;
+		uint32_t mTimestampCount = 0;
+		bool mTimestampsPending = false;
+		size_t mTimedTriangleCount = 0;
+		float mTime = 0; // ms
+
+		// builds in the last timed build, as (name, primitive count, batch index)
+		std::vector<std::tuple<std::string, uint32_t, uint32_t>> mTimedBuilds;
+		// per mesh build time of the last timed build, slowest first. A batch's time is split between its meshes by primitive count
+		std::vector<std::pair<std::string, float /* ms */>> mMeshTimes;
+	} mBlasBuildStats;
+
 	RenderData mRenderData;
 
-	bool DrawNodeGui(SceneNode& node, bool& changed);
+	AssetCache mAssetCache;
+	bool mOptimizeMeshes = false;
+	bool mQuantizeVertices = false;
+	bool mCompressTextures = false;
+	bool mPowerLightSelection = true; // false selects lights and emissive triangles uniformly
+	bool mUseLightBvh = true; // select direct lights from a light BVH over emissive triangles, see LightBvh.hpp
+	bool mSolidAngleLightSampling = true; // sample points on direct lights by solid angle instead of area
+
+	struct {
+		uint32_t mPrimitiveCount = 0;
+		uint32_t mNodeCount = 0;
+		size_t mBytes = 0;
+		float mBuildTime = 0; // ms
+	} mLightBvhStats;
+
+	// changes since the last update. anything that is not a transform, material or instance add/remove change rebuilds all render data
+	struct {
+		bool mTransforms = false;
+		bool mMaterials = false;
+		bool mInstances = false; // renderers added, removed, enabled or disabled
+		bool mStructure = false;
+	} mDirty;
+	bool mIncrementalUpdates = true;
+
+	struct {
+		const char* mType = "none";
+		float mTime = 0; // ms
+		uint32_t mPatchedInstances = 0;
+		uint32_t mPatchedMaterials = 0;
+		uint32_t mAddedInstances = 0;
+		uint32_t mRemovedInstances = 0;
+		size_t mUploadBytes = 0;
+	} mUpdateStats;
+
+	// The TLAS is kept so that transform-only changes can refit it in place, see BuildTlas
+	struct {
+		std::shared_ptr<vk::raii::AccelerationStructureKHR> mAccelerationStructure;
+		Buffer::View<std::byte> mBuffer;
+		Buffer::View<std::byte> mUpdateScratch;
+		std::vector<uint64_t> mBlasReferences; // per instance, at the last build
+		std::vector<std::pair<float3, float3>> mBounds; // per instance, at the last build
+		uint32_t mRefitCount = 0; // since the last build
+		const char* mRebuildReason = "";
+
+		// GPU time of the last build and refit
+		std::shared_ptr<vk::raii::QueryPool> mTimestamps;
+		bool mTimestampsPending = false;
+		bool mTimestampsRefit = false;
+		float mBuildTime = 0; // ms
+		float mRefitTime = 0; // ms
+	} mTlas;
+	bool mRefitTlas = true;
+	uint32_t mMaxTlasRefits = 64;
+	float mMaxTlasBoundsGrowth = 1.5f; // rebuild once instances sweep this much more surface area than they covered at the last build
+
+	bool DrawNodeGui(SceneNode& node, bool& changed, bool& instancesChanged);
 	void UpdateRenderData(CommandBuffer& commandBuffer);
+	// Patches transforms and materials of the existing instances, and adds and removes instances.
+	// Returns false if the changes need a full UpdateRenderData (e.g. a light moved, or was added or removed)
+	bool PatchRenderData(CommandBuffer& commandBuffer, const bool transforms, const bool materials, const bool instances);
+
+	// Add* return the index of a resource in the render data, adding it to the shader parameters if it is new
+	uint32_t AddImage(const Image::View& image, const bool twoChannel);
+	uint32_t AddMaterial(const std::shared_ptr<Material>& material);
+	uint32_t AddVertexBuffer(const std::shared_ptr<Buffer>& buffer);
+	uint32_t AddMeshVertexInfo(const std::shared_ptr<Mesh>& mesh);
+	// Return cached BLASs, or create them and record their builds in pending
+	const AccelerationStructureData& GetMeshBlas(CommandBuffer& commandBuffer, const Mesh& mesh, const bool opaque, const std::string& name, PendingBlases& pending);
+	const AccelerationStructureData& GetAabbBlas(CommandBuffer& commandBuffer, const float3 mn, const float3 mx, const bool opaque, PendingBlases& pending);
+	// Builds the pending BLASs, and queries the compacted sizes of those built for compaction
+	void BuildPendingBlases(CommandBuffer& commandBuffer, PendingBlases& pending);
+	inline vk::BuildAccelerationStructureFlagsKHR GetBlasFlags() const {
+		return mCompactBlas ?
+			vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction :
+			vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+	}
+	void BuildTlas(CommandBuffer& commandBuffer);
+	// Records builds in as few buildAccelerationStructuresKHR calls as mMaxBlasBatchScratch allows, with scratch sub-allocated from mBlasScratch
+	void BuildBlases(CommandBuffer& commandBuffer, const std::vector<PendingBlasBuild>& builds, const vk::BuildAccelerationStructureFlagsKHR flags);
+	// Reads back the timestamps written by BuildBlases, if they are available. Never waits on the GPU
+	void ReadBlasBuildTime(Device& device);
+	// Copies BLASs whose compacted sizes are available into right-sized buffers, and rebuilds the TLAS to reference them. Never waits on the GPU
+	void CompactAccelerationStructures(CommandBuffer& commandBuffer);
 
 	ComputePipelineCache mComputeMinAlphaPipeline;
 	ComputePipelineCache mConvertMetallicRoughnessPipeline;
 
-	std::vector<std::string> mToLoad;
-	std::vector< std::future<std::pair<std::shared_ptr<SceneNode>, std::shared_ptr<CommandBuffer>>> > mLoading;
+	bool DrawLoadQueueGui();
+
+	// files queued before the load queue exists (it needs a device)
+	std::vector<std::pair<std::filesystem::path, int /* priority */>> mToLoad;
+	uint32_t mLoadThreads = 2;
 
 	bool mUpdateOnce = false;
 	std::chrono::high_resolution_clock::time_point mLastUpdate;
+
+	// declared last so that workers are joined before the state they load into is destroyed
+	std::unique_ptr<LoadQueue> mLoadQueue;
 };
 
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifdef ENABLE_ASSIMP
 
 #include <Scene/Scene.hpp>
+#include <Core/ThreadPool.hpp>
+#include <Scene/MeshProcessing.hpp>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -52,25 +54,92 @@ std::shared_ptr<SceneNode> Scene::LoadAssimp(CommandBuffer& commandBuffer, const
 	if (scene->HasLights())
 		std::cout << "Warning: punctual lights are unsupported" << std::endl;
 
+	// relative to the scene file. the working directory is shared by every loading thread, so it is never changed
+	auto ResolvePath = [&](std::filesystem::path path) {
+		if (path.is_relative())
+			path = filename.parent_path() / path;
+		return path;
+	};
+
+	// decode every referenced image and generate its mip chain on a worker pool up front. GetImage then records the copies in material order
+
+	std::vector<std::tuple<std::filesystem::path, bool /* srgb */, MipChainOptions>> imagesToDecode;
+	std::unordered_map<std::string, size_t> imageIndices;
+	std::vector<PixelData> decodedImages;
+	std::vector<std::vector<std::vector<std::byte>>> mipChains;
+	const auto decodeStart = std::chrono::high_resolution_clock::now();
+	size_t encodedBytes = 0;
+	size_t decodedBytes = 0;
+	if (scene->HasMaterials()) {
+		const auto AddImage = [&](const aiMaterial* m, const aiTextureType type, const bool srgb, const MipChainOptions& options = {}) {
+			if (m->GetTextureCount(type) == 0) return false;
+			aiString aiPath;
+			m->GetTexture(type, 0, &aiPath);
+			const std::filesystem::path path = ResolvePath(aiPath.C_Str());
+			if (imageIndices.emplace(path.string(), imagesToDecode.size()).second)
+				imagesToDecode.emplace_back(path, srgb, options);
+			return true;
+		};
+		for (int i = 0; i < scene->mNumMaterials; i++) {
+			const aiMaterial* m = scene->mMaterials[i];
+			AddImage(m, aiTextureType_DIFFUSE, true, MipChainOptions{ .mAlphaCutoff = 0.5f });
+			AddImage(m, aiTextureType_SPECULAR, false);
+			AddImage(m, aiTextureType_EMISSIVE, true);
+			if (!AddImage(m, aiTextureType_NORMALS, false, MipChainOptions{ .mNormalMap = true }))
+				AddImage(m, aiTextureType_HEIGHT, false);
+		}
+
+		ReportLoadProgress(LoadJob::Stage::eDecode);
+		LoadJob* const loadJob = gCurrentLoadJob;
+
+		ThreadPool pool(std::min<uint32_t>(std::thread::hardware_concurrency(), (uint32_t)imagesToDecode.size()));
+		std::vector<std::future<PixelData>> jobs;
+		mipChains.resize(imagesToDecode.size());
+		for (size_t i = 0; i < imagesToDecode.size(); i++) {
+			const auto&[path, srgb, options] = imagesToDecode[i];
+			encodedBytes += std::filesystem::exists(path) ? std::filesystem::file_size(path) : 0;
+			jobs.emplace_back(pool.Enqueue([&, i, path, srgb, options]() -> PixelData {
+				if (loadJob && loadJob->mCancelRequested) return {};
+				PixelData data = LoadImageFile(commandBuffer.mDevice, path, srgb);
+				const auto&[pixels, format, extent] = data;
+				mipChains[i] = GenerateMipChain(std::span(reinterpret_cast<const std::byte*>(pixels->data()), pixels->size()), format, extent, options);
+				return data;
+			}));
+		}
+		decodedImages.resize(jobs.size());
+		for (size_t i = 0; i < jobs.size(); i++) {
+			decodedImages[i] = jobs[i].get();
+			ReportLoadProgress(LoadJob::Stage::eDecode, (i+1) / (float)jobs.size());
+			decodedBytes += std::get<std::shared_ptr<Buffer>>(decodedImages[i])->size();
+		}
+	}
+	const float decodeTime = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(std::chrono::high_resolution_clock::now() - decodeStart).count();
+
 	std::unordered_map<std::string, Image::View> imageCache;
 	auto GetImage = [&](std::filesystem::path path, const bool srgb) -> Image::View {
-		if (path.is_relative()) {
-			std::filesystem::path cur = std::filesystem::current_path();
-			std::filesystem::current_path(filename.parent_path());
-			path = std::filesystem::absolute(path);
-			std::filesystem::current_path(cur);
-		}
+		path = ResolvePath(path);
 		auto it = imageCache.find(path.string());
 		if (it != imageCache.end()) return it->second;
 
 		ImageInfo md = {};
 		std::shared_ptr<Buffer> pixels;
-		std::tie(pixels, md.mFormat, md.mExtent) = LoadImageFile(commandBuffer.mDevice, path, srgb);
+		std::vector<std::vector<std::byte>> levels;
+		if (auto decoded = imageIndices.find(path.string()); decoded != imageIndices.end()) {
+			std::tie(pixels, md.mFormat, md.mExtent) = decodedImages[decoded->second];
+			levels = std::move(mipChains[decoded->second]);
+		} else
+			std::tie(pixels, md.mFormat, md.mExtent) = LoadImageFile(commandBuffer.mDevice, path, srgb);
 		md.mUsage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
-		const std::shared_ptr<Image> img = std::make_shared<Image>(commandBuffer.mDevice, path.filename().string(), md);
-
-		commandBuffer.Copy(pixels, img);
-		commandBuffer.HoldResource(pixels);
+		if (!levels.empty())
+			md.mLevels = (uint32_t)levels.size();
+		std::shared_ptr<Image> img;
+		if (!levels.empty())
+			img = commandBuffer.UploadShared(levels, md, path.filename().string());
+		else {
+			img = std::make_shared<Image>(commandBuffer.mDevice, path.filename().string(), md);
+			commandBuffer.Copy(pixels, img);
+			commandBuffer.HoldResource(pixels);
+		}
 
 		imageCache.emplace(path.string(), img);
 		return img;
@@ -94,6 +163,7 @@ std::shared_ptr<SceneNode> Scene::LoadAssimp(CommandBuffer& commandBuffer, const
 		const std::shared_ptr<SceneNode> materialsNode = root->AddChild("materials");
 		for (int i = 0; i < scene->mNumMaterials; i++) {
 			std::cout << "\rLoading materials " << (i+1) << "/" << scene->mNumMaterials << "     ";
+			ReportLoadProgress(LoadJob::Stage::eUpload, i / (float)scene->mNumMaterials);
 
 			aiMaterial* m = scene->mMaterials[i];
 			Material& material = *materials.emplace_back(materialsNode->AddChild(m->GetName().C_Str())->MakeComponent<Material>());
@@ -132,6 +202,16 @@ std::shared_ptr<SceneNode> Scene::LoadAssimp(CommandBuffer& commandBuffer, const
 			else
 				material = CreateDiffuseSpecularMaterial(commandBuffer, diffuse, specular, emission);
 
+			if (emission.second) {
+				aiString aiPath;
+				m->GetTexture(aiTextureType_EMISSIVE, 0, &aiPath);
+				if (auto decoded = imageIndices.find(ResolvePath(aiPath.C_Str()).string()); decoded != imageIndices.end()) {
+					const auto&[pixels, format, extent] = decodedImages[decoded->second];
+					if (pixels)
+						material.mEmissionLuminance = LuminanceMap::Create(ComputeLuminance(std::span(reinterpret_cast<const std::byte*>(pixels->data()), pixels->size()), format, extent), uint2(extent.width, extent.height));
+				}
+			}
+
 			if (m->GetTextureCount(aiTextureType_NORMALS) > 0) {
 				aiString aiPath;
 				m->GetTexture(aiTextureType_NORMALS, 0, &aiPath);
@@ -151,6 +231,7 @@ std::shared_ptr<SceneNode> Scene::LoadAssimp(CommandBuffer& commandBuffer, const
 
 	if (scene->HasMeshes()) {
 		std::cout << "Loading mesh data...";
+		ReportLoadProgress(LoadJob::Stage::eUpload);
 
 		size_t vertexDataSize = 0;
 		size_t indexDataSize = 0;
@@ -216,14 +297,74 @@ std::shared_ptr<SceneNode> Scene::LoadAssimp(CommandBuffer& commandBuffer, const
 		for (auto& w : work)
 			w.wait();
 
+		// meshes are shared with other loads individually (see AssetRegistry). Those another load already uploaded are reused,
+		// and the streams of the rest are moved together before uploading
+		std::vector<std::shared_ptr<Mesh>> sharedMeshes(scene->mNumMeshes);
+		std::vector<size_t> meshKeys(scene->mNumMeshes);
+		size_t vertexEnd = 0, indexEnd = 0, reusedMeshes = 0;
+		for (uint i = 0; i < scene->mNumMeshes; i++) {
+			const aiMesh* m = scene->mMeshes[i];
+			if (!(m->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) || (m->mPrimitiveTypes & ~aiPrimitiveType_TRIANGLE) != 0)
+				continue;
+
+			const size_t vertexSize = m->mNumVertices * (m->GetNumUVChannels() > 0 ? 8 : 6);
+			const size_t indexSize  = m->mNumFaces*3;
+			meshKeys[i] = HashArgs(
+				m->GetNumUVChannels() > 0,
+				AssetRegistry::HashContents(std::as_bytes(std::span(vertices).subspan(positionsOffsets[i], vertexSize))),
+				AssetRegistry::HashContents(std::as_bytes(std::span(indices).subspan(indicesOffsets[i], indexSize))));
+			if ((sharedMeshes[i] = commandBuffer.FindSharedMesh(meshKeys[i]))) {
+				reusedMeshes++;
+				continue;
+			}
+
+			const size_t vertexShift = positionsOffsets[i] - vertexEnd;
+			std::memmove(vertices.data() + vertexEnd, vertices.data() + positionsOffsets[i], vertexSize*sizeof(float));
+			positionsOffsets[i] -= vertexShift;
+			normalsOffsets[i]   -= vertexShift;
+			if (m->GetNumUVChannels() > 0)
+				uvsOffsets[i]   -= vertexShift;
+			vertexEnd += vertexSize;
+
+			std::memmove(indices.data() + indexEnd, indices.data() + indicesOffsets[i], indexSize*sizeof(uint));
+			indicesOffsets[i] = indexEnd;
+			indexEnd += indexSize;
+		}
+		vertices.resize(vertexEnd);
+		indices.resize(indexEnd);
+		if (reusedMeshes > 0)
+			std::cout << "Reused " << reusedMeshes << "/" << scene->mNumMeshes << " meshes from other loads" << std::endl;
+
 		vk::BufferUsageFlags bufferUsage = vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eStorageBuffer;
 		if (commandBuffer.mDevice.GetAccelerationStructureFeatures().accelerationStructure) {
 			bufferUsage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
 			bufferUsage |= vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
 		}
 
-		auto vertexBuffer = commandBuffer.Upload<float>(vertices, filename.stem().string() + "/Vertices", bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-		auto indexBuffer  = commandBuffer.Upload<uint> (indices , filename.stem().string() + "/Indices" , bufferUsage|vk::BufferUsageFlagBits::eIndexBuffer);
+		std::shared_ptr<Buffer> vertexBuffer, indexBuffer;
+		HostBufferData hostBuffers;
+		if (!vertices.empty()) {
+			vertexBuffer = commandBuffer.Upload<float>(vertices, filename.stem().string() + "/Vertices", bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
+			indexBuffer  = commandBuffer.Upload<uint> (indices , filename.stem().string() + "/Indices" , bufferUsage|vk::BufferUsageFlagBits::eIndexBuffer);
+			hostBuffers.emplace(vertexBuffer.get(), HostBufferRange{ 0, std::as_bytes(std::span(vertices)) });
+			hostBuffers.emplace(indexBuffer.get(),  HostBufferRange{ 0, std::as_bytes(std::span(indices)) });
+		}
+
+		// triangles of a reused mesh, read from the source rather than its buffers
+		const auto GetTriangles = [](const aiMesh* m) {
+			auto triangles = std::make_shared<Mesh::Triangles>();
+			triangles->mPositions.resize(m->mNumFaces*3);
+			if (m->GetNumUVChannels() > 0)
+				triangles->mTexcoords.resize(m->mNumFaces*3);
+			for (uint fi = 0; fi < m->mNumFaces; fi++)
+				for (uint j = 0; j < 3; j++) {
+					const uint vi = m->mFaces[fi].mIndices[j];
+					triangles->mPositions[3*fi + j] = float3((float)m->mVertices[vi].x, (float)m->mVertices[vi].y, (float)m->mVertices[vi].z);
+					if (m->GetNumUVChannels() > 0)
+						triangles->mTexcoords[3*fi + j] = float2((float)m->mTextureCoords[0][vi].x, (float)m->mTextureCoords[0][vi].y);
+				}
+			return triangles;
+		};
 
 		// construct meshes
 
@@ -236,6 +377,27 @@ std::shared_ptr<SceneNode> Scene::LoadAssimp(CommandBuffer& commandBuffer, const
 			if (!(m->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) || (m->mPrimitiveTypes & ~aiPrimitiveType_TRIANGLE) != 0)
 				continue;
 
+			const std::shared_ptr<SceneNode>& meshNode = meshesNode->AddChild(m->mName.C_Str());
+			bool emissive = false;
+			if (m->mMaterialIndex < materials.size() && materials[m->mMaterialIndex]) {
+				const float3 emission = materials[m->mMaterialIndex]->mMaterial.Emission();
+				emissive = emission.r > 0 || emission.g > 0 || emission.b > 0;
+			}
+
+			if (const std::shared_ptr<Mesh>& shared = sharedMeshes[i]) {
+				// other loads may be using the shared mesh, so emissive meshes get a copy holding the triangles rather than modifying it
+				if (emissive && !shared->GetTriangles()) {
+					const std::shared_ptr<Mesh> copy = std::make_shared<Mesh>(*shared);
+					copy->SetTriangles(GetTriangles(m));
+					meshNode->AddComponent(copy);
+					meshes.emplace_back(copy);
+				} else {
+					meshNode->AddComponent(shared);
+					meshes.emplace_back(shared);
+				}
+				continue;
+			}
+
 			Mesh::Vertices meshVertices;
 
 			meshVertices[Mesh::VertexAttributeType::ePosition].emplace_back(
@@ -259,11 +421,16 @@ std::shared_ptr<SceneNode> Scene::LoadAssimp(CommandBuffer& commandBuffer, const
 			meshVertices.mAabb.maxY = (float)m->mAABB.mMax.y;
 			meshVertices.mAabb.maxZ = (float)m->mAABB.mMax.z;
 
-			const std::shared_ptr<SceneNode>& meshNode = meshesNode->AddChild(m->mName.C_Str());
 			meshes.emplace_back( meshNode->MakeComponent<Mesh>(
 				meshVertices,
 				Buffer::View<uint32_t>(indexBuffer, indicesOffsets[i]*sizeof(uint32_t), m->mNumFaces*3),
 				vk::PrimitiveTopology::eTriangleList) );
+			meshes.back()->SetContentHash(meshKeys[i]);
+			commandBuffer.ShareMesh(meshKeys[i], meshes.back(), (m->mNumVertices * (m->GetNumUVChannels() > 0 ? 8 : 6) + m->mNumFaces*3) * sizeof(float));
+
+			// emissive meshes keep their triangles, for light sampling
+			if (emissive)
+				meshes.back()->SetTriangles(ReadTriangles(*meshes.back(), hostBuffers));
 		}
 		std::cout << std::endl;
 	}
@@ -295,6 +462,13 @@ std::shared_ptr<SceneNode> Scene::LoadAssimp(CommandBuffer& commandBuffer, const
 	}
 
 	std::cout << "Loaded " << filename << std::endl;
+	if (!decodedImages.empty()) {
+		const auto[encodedSize, encodedUnit] = FormatBytes(encodedBytes);
+		const auto[decodedSize, decodedUnit] = FormatBytes(decodedBytes);
+		const float seconds = std::max(decodeTime, 1e-3f) / 1000;
+		std::cout << "\tDecoded " << decodedImages.size() << " images (" << encodedSize << " " << encodedUnit << " -> " << decodedSize << " " << decodedUnit << ") in " << decodeTime << "ms: "
+			<< decodedImages.size() / seconds << " images/s, " << (encodedBytes / (1024.f*1024.f)) / seconds << " MB/s" << std::endl;
+	}
 	return root;
 }
 
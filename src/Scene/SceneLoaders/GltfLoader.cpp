@@ -1,4 +1,10 @@
 #include <Scene/Scene.hpp>
+#include <Core/ThreadPool.hpp>
+#include <Core/BlockCompression.hpp>
+#include <Core/MappedFile.hpp>
+#include <Scene/MeshProcessing.hpp>
+
+#include <numeric>
 
 #define TINYGLTF_USE_CPP14
 #define TINYGLTF_NO_STB_IMAGE_WRITE
@@ -59,43 +65,140 @@ Material Scene::CreateMetallicRoughnessMaterial(CommandBuffer& commandBuffer, co
 std::shared_ptr<SceneNode> Scene::LoadGltf(CommandBuffer& commandBuffer, const std::filesystem::path& filename) {
 	std::cout << "Loading " << filename << std::endl;
 
-	tinygltf::Model model;
-	tinygltf::TinyGLTF loader;
-	std::string err, warn;
-	if (
-		(filename.extension() == ".glb" && !loader.LoadBinaryFromFile(&model, &err, &warn, filename.string())) ||
-		(filename.extension() == ".gltf" && !loader.LoadASCIIFromFile(&model, &err, &warn, filename.string())) )
-		throw std::runtime_error(filename.string() + ": " + err);
-	if (!warn.empty()) std::cerr << filename.string() << ": " << warn << std::endl;
+	using clock = std::chrono::high_resolution_clock;
+	const auto loadStart = clock::now();
+	auto t0 = loadStart;
+	const auto Lap = [&]() {
+		const auto t1 = clock::now();
+		const float ms = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(t1 - t0).count();
+		t0 = t1;
+		return ms;
+	};
 
 	Device& device = commandBuffer.mDevice;
 
-	std::cout << "Loading buffers..." << std::endl;
-
 	vk::BufferUsageFlags bufferUsage = vk::BufferUsageFlagBits::eVertexBuffer|vk::BufferUsageFlagBits::eIndexBuffer|vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eTransferSrc;
 	if (commandBuffer.mDevice.GetAccelerationStructureFeatures().accelerationStructure) {
 		bufferUsage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
 		bufferUsage |= vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
 	}
-	std::vector<std::shared_ptr<Buffer>> buffers(model.buffers.size());
-	std::ranges::transform(model.buffers, buffers.begin(), [&](const tinygltf::Buffer& buffer) {
-		return commandBuffer.Upload<uint8_t>(buffer.data, buffer.name, bufferUsage);
-	});
 
-	std::cout << "Loading materials..." << std::endl;
-	std::vector<Image::View> images(model.images.size());
-	auto GetImage = [&](const uint32_t textureIndex, const bool srgb) -> Image::View {
-		if (textureIndex >= model.textures.size()) return {};
-		const uint32_t index = model.textures[textureIndex].source;
-		if (index >= images.size()) return {};
-		if (images[index]) return images[index];
+	// loader options which change the data written to the asset cache
+	const size_t loaderOptions = HashArgs(mOptimizeMeshes, mQuantizeVertices, mCompressTextures && commandBuffer.mDevice.GetFeatures().textureCompressionBC);
+	AssetCache::Key cacheKey;
+	AssetCache::Writer cacheWriter;
+	if (mAssetCache.Enabled()) {
+		cacheKey = mAssetCache.ComputeKey(filename, loaderOptions);
+		try {
+			if (const std::shared_ptr<SceneNode> root = mAssetCache.Read(commandBuffer, filename, cacheKey, bufferUsage)) {
+				std::cout << "Loaded " << filename << " in " << std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(clock::now() - loadStart).count() << "ms (warm)" << std::endl;
+				return root;
+			}
+		} catch (std::exception& e) {
+			std::cerr << "Failed to read asset cache for " << filename << ": " << e.what() << std::endl;
+		}
+		Lap();
+	}
 
-		const tinygltf::Image& image = model.images[index];
+	tinygltf::Model model;
+	tinygltf::TinyGLTF loader;
 
-		ImageInfo md = {};
-		if (srgb) {
+	// only store the encoded images while parsing, they are decoded in parallel afterwards
+	std::vector<std::vector<unsigned char>> encodedImages;
+	loader.SetImageLoader([](tinygltf::Image* image, const int imageIndex, std::string* err, std::string* warn, int reqWidth, int reqHeight, const unsigned char* bytes, int size, void* userData) {
+		auto& encoded = *reinterpret_cast<std::vector<std::vector<unsigned char>>*>(userData);
+		if (encoded.size() <= imageIndex) encoded.resize(imageIndex + 1);
+		encoded[imageIndex].assign(bytes, bytes + size);
+		return true;
+	}, &encodedImages);
+
+	// .glb files are memory mapped, and only their JSON chunk goes through tinygltf.
+	// The BIN chunk is never copied into a tinygltf::Buffer: meshes read it from the mapping,
+	// and it is streamed to the GPU in batches, so host memory stays bounded regardless of the file size.
+	std::unique_ptr<MappedFile> glbFile;
+	std::span<const std::byte> glbBin;
+	int glbBuffer = -1;
+	std::unordered_map<uint32_t, std::span<const std::byte>> glbImages;
+
+	std::string err, warn;
+	if (filename.extension() == ".glb") {
+		glbFile = std::make_unique<MappedFile>(filename);
+		const std::span<const std::byte> bytes = glbFile->Data();
+		const auto ReadUint32 = [&](const size_t offset) {
+			if (offset + sizeof(uint32_t) > bytes.size())
+				throw std::runtime_error(filename.string() + ": unexpected end of file");
+			uint32_t v;
+			std::memcpy(&v, bytes.data() + offset, sizeof(uint32_t));
+			return v;
+		};
+		if (ReadUint32(0) != 0x46546C67 /* glTF */ || ReadUint32(4) != 2)
+			throw std::runtime_error(filename.string() + ": not a glTF 2.0 binary file");
+		const size_t jsonLength = ReadUint32(12);
+		if (ReadUint32(16) != 0x4E4F534A /* JSON */ || 20 + jsonLength > bytes.size())
+			throw std::runtime_error(filename.string() + ": invalid JSON chunk");
+		const size_t binChunk = 20 + ((jsonLength + 3) & ~size_t(3));
+		if (binChunk + 8 <= bytes.size() && ReadUint32(binChunk + 4) == 0x004E4942 /* BIN */)
+			glbBin = bytes.subspan(binChunk + 8, std::min<size_t>(ReadUint32(binChunk), bytes.size() - binChunk - 8));
+
+		nlohmann::json json = nlohmann::json::parse(reinterpret_cast<const char*>(bytes.data()) + 20, reinterpret_cast<const char*>(bytes.data()) + 20 + jsonLength);
+
+		// point the BIN chunk's buffer, and images stored in it, at a one byte placeholder so that tinygltf does not copy them
+		const std::string placeholder = "data:application/octet-stream;base64,AA==";
+		size_t glbBufferLength = 0;
+		if (json.contains("buffers"))
+			for (size_t i = 0; i < json["buffers"].size(); i++) {
+				nlohmann::json& buffer = json["buffers"][i];
+				if (buffer.contains("uri")) continue;
+				glbBuffer = (int)i;
+				glbBufferLength = buffer.value("byteLength", size_t(0));
+				buffer["uri"] = placeholder;
+				buffer["byteLength"] = 1;
+			}
+		if (glbBuffer >= 0 && glbBufferLength > glbBin.size())
+			throw std::runtime_error(filename.string() + ": BIN chunk is smaller than its buffer");
+		glbBin = glbBin.first(glbBufferLength);
+
+		if (glbBuffer >= 0 && json.contains("images"))
+			for (size_t i = 0; i < json["images"].size(); i++) {
+				nlohmann::json& image = json["images"][i];
+				if (!image.contains("bufferView")) continue;
+				const nlohmann::json& bufferView = json["bufferViews"].at(image["bufferView"].get<size_t>());
+				if (bufferView.value("buffer", -1) != glbBuffer) continue;
+				const size_t offset = bufferView.value("byteOffset", size_t(0));
+				const size_t length = bufferView.value("byteLength", size_t(0));
+				if (offset + length > glbBin.size())
+					throw std::runtime_error(filename.string() + ": image " + std::to_string(i) + " is out of bounds");
+				glbImages.emplace((uint32_t)i, glbBin.subspan(offset, length));
+				image.erase("bufferView");
+				image.erase("mimeType");
+				image["uri"] = placeholder;
+			}
+
+		const std::string jsonString = json.dump();
+		if (!loader.LoadASCIIFromString(&model, &err, &warn, jsonString.c_str(), (unsigned int)jsonString.size(), filename.parent_path().string()))
+			throw std::runtime_error(filename.string() + ": " + err);
+	} else if (!loader.LoadASCIIFromFile(&model, &err, &warn, filename.string()))
+		throw std::runtime_error(filename.string() + ": " + err);
+	if (!warn.empty()) std::cerr << filename.string() << ": " << warn << std::endl;
+	const float parseTime = Lap();
+
+	const auto GetBufferData = [&](const int index) {
+		return index == glbBuffer ? glbBin.data() : reinterpret_cast<const std::byte*>(model.buffers[index].data.data());
+	};
+
+	// encoded bytes of each image, either copied by the image loader callback or in the mapped BIN chunk
+	std::vector<std::span<const std::byte>> encodedImageData(model.images.size());
+	for (uint32_t i = 0; i < model.images.size(); i++) {
+		if (const auto it = glbImages.find(i); it != glbImages.end())
+			encodedImageData[i] = it->second;
+		else if (i < encodedImages.size())
+			encodedImageData[i] = std::as_bytes(std::span(encodedImages[i]));
+	}
+
+	const auto GetImageFormat = [](const tinygltf::Image& image, const bool srgb) {
+		if (srgb && image.pixel_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
 			static const std::array<vk::Format,4> formatMap { vk::Format::eR8Srgb, vk::Format::eR8G8Srgb, vk::Format::eR8G8B8Srgb, vk::Format::eR8G8B8A8Srgb };
-			md.mFormat = formatMap.at(image.component - 1);
+			return formatMap.at(image.component - 1);
 		} else {
 			static const std::unordered_map<int, std::array<vk::Format,4>> formatMap {
 				{ TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE,  { vk::Format::eR8Unorm, vk::Format::eR8G8Unorm, vk::Format::eR8G8B8Unorm, vk::Format::eR8G8B8A8Unorm } },
@@ -107,22 +210,148 @@ std::shared_ptr<SceneNode> Scene::LoadGltf(CommandBuffer& commandBuffer, const s
 				{ TINYGLTF_COMPONENT_TYPE_FLOAT,          { vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat } },
 				{ TINYGLTF_COMPONENT_TYPE_DOUBLE,         { vk::Format::eR64Sfloat, vk::Format::eR64G64Sfloat, vk::Format::eR64G64B64Sfloat, vk::Format::eR64G64B64A64Sfloat } }
 			};
-			md.mFormat = formatMap.at(image.pixel_type).at(image.component - 1);
+			return formatMap.at(image.pixel_type).at(image.component - 1);
+		}
+	};
+
+	std::cout << "Decoding images..." << std::endl;
+
+	// base color and emission textures are srgb. the first use of an image determines its format, same as in GetImage below
+	std::vector<std::optional<bool>> imageSrgb(model.images.size());
+	std::vector<MipChainOptions> mipOptions(model.images.size());
+	std::vector<bool> emissionImages(model.images.size(), false);
+	const auto MarkImage = [&](const uint32_t textureIndex, const bool srgb, const MipChainOptions& options = {}) {
+		if (textureIndex >= model.textures.size()) return;
+		const uint32_t index = model.textures[textureIndex].source;
+		if (index < imageSrgb.size() && !imageSrgb[index]) {
+			imageSrgb[index] = srgb;
+			mipOptions[index] = options;
 		}
+	};
+	for (const tinygltf::Material& material : model.materials) {
+		MarkImage(material.emissiveTexture.index, true);
+		if (material.emissiveTexture.index >= 0 && material.emissiveTexture.index < model.textures.size() && model.textures[material.emissiveTexture.index].source >= 0 && model.textures[material.emissiveTexture.index].source < model.images.size())
+			emissionImages[model.textures[material.emissiveTexture.index].source] = true;
+		// materials are alpha tested against AlphaCutoff (see CreateMetallicRoughnessMaterial)
+		MarkImage(material.pbrMetallicRoughness.baseColorTexture.index, true, MipChainOptions{ .mAlphaCutoff = 0.5f });
+		MarkImage(material.pbrMetallicRoughness.metallicRoughnessTexture.index, false);
+		MarkImage(material.normalTexture.index, false, MipChainOptions{ .mNormalMap = true });
+	}
+
+	// decode referenced images and generate their mip chains (and block compress them) on a worker pool
+	std::vector<std::vector<std::vector<std::byte>>> mipChains(model.images.size());
+	std::vector<vk::Format> compressedFormats(model.images.size(), vk::Format::eUndefined);
+	std::vector<std::shared_ptr<const LuminanceMap>> luminanceMaps(model.images.size());
+	size_t encodedBytes = 0;
+	size_t decodedBytes = 0;
+	uint32_t decodedImages = 0;
+	std::atomic<size_t> uncompressedBytes = 0;
+	std::atomic<size_t> compressedBytes = 0;
+	std::atomic<uint32_t> compressedImages = 0;
+	std::atomic<uint32_t> compressedCacheHits = 0;
+	{
+		std::vector<uint32_t> toDecode;
+		for (uint32_t i = 0; i < model.images.size(); i++)
+			if (imageSrgb[i] && !encodedImageData[i].empty())
+				toDecode.emplace_back(i);
+
+		ReportLoadProgress(LoadJob::Stage::eDecode);
+		LoadJob* const loadJob = gCurrentLoadJob;
+
+		ThreadPool pool(std::min<uint32_t>(std::thread::hardware_concurrency(), (uint32_t)toDecode.size()));
+		std::vector<std::future<void>> jobs;
+		for (const uint32_t i : toDecode) {
+			encodedBytes += encodedImageData[i].size();
+			jobs.emplace_back(pool.Enqueue([&, i]() {
+				// skip queued images once the load is cancelled, the pool still drains its queue
+				if (loadJob && loadJob->mCancelRequested) return;
+				tinygltf::Image& image = model.images[i];
+				std::string imageErr, imageWarn;
+				if (!tinygltf::LoadImageData(&image, i, &imageErr, &imageWarn, 0, 0, reinterpret_cast<const unsigned char*>(encodedImageData[i].data()), (int)encodedImageData[i].size(), nullptr))
+					throw std::runtime_error(filename.string() + ": " + imageErr);
+				if (i < encodedImages.size())
+					encodedImages[i] = {};
+
+				const vk::Format format = GetImageFormat(image, *imageSrgb[i]);
+				const vk::Extent3D extent(image.width, image.height, 1);
+				mipChains[i] = GenerateMipChain(std::as_bytes(std::span(image.image)), format, extent, mipOptions[i]);
+				if (emissionImages[i])
+					luminanceMaps[i] = LuminanceMap::Create(ComputeLuminance(std::as_bytes(std::span(image.image)), format, extent), uint2(extent.width, extent.height));
+
+				if (!mCompressTextures || mipChains[i].empty()) return;
+				const vk::Format compressedFormat = GetBlockCompressedFormat(format, mipOptions[i].mNormalMap);
+				if (compressedFormat == vk::Format::eUndefined || !device.SupportsBlockCompressedFormat(compressedFormat)) return;
+
+				// encoding is slow, so compressed mip chains are cached by the source pixels
+				const size_t textureKey = AssetCache::ComputeTextureKey(mipChains[i][0], format, extent, compressedFormat);
+				std::vector<std::vector<std::byte>> levels = mAssetCache.ReadTexture(textureKey);
+				if (levels.size() == mipChains[i].size())
+					compressedCacheHits++;
+				else {
+					levels = EncodeBlockCompressed(mipChains[i], format, extent, compressedFormat);
+					mAssetCache.WriteTexture(textureKey, levels);
+				}
+				for (const auto& level : mipChains[i]) uncompressedBytes += level.size();
+				for (const auto& level : levels) compressedBytes += level.size();
+				compressedImages++;
+				mipChains[i] = std::move(levels);
+				compressedFormats[i] = compressedFormat;
+			}));
+		}
+		for (size_t j = 0; j < jobs.size(); j++) {
+			jobs[j].get();
+			ReportLoadProgress(LoadJob::Stage::eDecode, (j+1) / (float)jobs.size());
+		}
+
+		for (const uint32_t i : toDecode)
+			decodedBytes += model.images[i].image.size();
+		decodedImages = (uint32_t)toDecode.size();
+	}
+	const float decodeTime = Lap();
 
+	std::cout << "Loading materials..." << std::endl;
+	ReportLoadProgress(LoadJob::Stage::eUpload);
+	std::vector<Image::View> images(model.images.size());
+	auto GetImage = [&](const uint32_t textureIndex, const bool srgb) -> Image::View {
+		if (textureIndex >= model.textures.size()) return {};
+		const uint32_t index = model.textures[textureIndex].source;
+		if (index >= images.size()) return {};
+		if (images[index]) return images[index];
+
+		const tinygltf::Image& image = model.images[index];
+		if (image.image.empty()) return {};
+
+		ImageInfo md = {};
+		md.mFormat = compressedFormats[index] != vk::Format::eUndefined ? compressedFormats[index] : GetImageFormat(image, srgb);
 		md.mExtent = vk::Extent3D(image.width, image.height, 1);
-		md.mLevels = GetMaxMipLevels(md.mExtent);
-		const std::shared_ptr<Image> img = std::make_shared<Image>(device, image.name, md);
 
-		Buffer::View<unsigned char> pixels = std::make_shared<Buffer>(device, image.name+"/Staging", image.image.size(), vk::BufferUsageFlagBits::eTransferSrc,
-			vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent,
-			VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-		std::ranges::uninitialized_copy(image.image, pixels);
+		// mip chains were generated (and possibly block compressed) on the CPU while decoding
+		std::vector<std::vector<std::byte>> levels = std::move(mipChains[index]);
 
-		commandBuffer.Copy(pixels, img);
-		commandBuffer.GenerateMipMaps(img);
+		// formats GenerateMipChain does not support are mipmapped with blits, which need a graphics queue
+		md.mLevels = levels.empty() && !commandBuffer.SupportsBlit() ? 1 : GetMaxMipLevels(md.mExtent);
+		std::shared_ptr<Image> img;
+		if (!levels.empty()) {
+			img = commandBuffer.UploadShared(levels, md, image.name);
+			if (mAssetCache.Enabled())
+				cacheWriter.AddImage(img, std::move(levels));
+		} else {
+			img = std::make_shared<Image>(device, image.name, md);
+			Buffer::View<unsigned char> pixels = std::make_shared<Buffer>(device, image.name+"/Staging", image.image.size(), vk::BufferUsageFlagBits::eTransferSrc,
+				vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent,
+				VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+			std::ranges::uninitialized_copy(image.image, pixels);
+
+			commandBuffer.Copy(pixels, img);
+			if (md.mLevels > 1)
+				commandBuffer.GenerateMipMaps(img);
+			commandBuffer.HoldResource(pixels);
+
+			// formats GenerateMipChain does not support. cache only the base level, mips are regenerated on load
+			if (mAssetCache.Enabled())
+				cacheWriter.AddImage(img, { std::vector<std::byte>(std::as_bytes(std::span(image.image)).begin(), std::as_bytes(std::span(image.image)).end()) });
+		}
 
-		commandBuffer.HoldResource(pixels);
 		commandBuffer.HoldResource(img);
 
 		images[index] = img;
@@ -145,6 +374,8 @@ std::shared_ptr<SceneNode> Scene::LoadGltf(CommandBuffer& commandBuffer, const s
 			GetImage(material.pbrMetallicRoughness.metallicRoughnessTexture.index, false) };
 
 		Material m = CreateMetallicRoughnessMaterial(commandBuffer, baseColor, metallicRoughness, emission);
+		if (emission.second)
+			m.mEmissionLuminance = luminanceMaps[model.textures[material.emissiveTexture.index].source];
 		m.mBumpMap = GetImage(material.normalTexture.index, false);
 		m.mMaterial.BumpScale(1);
 		if (material.extensions.contains("KHR_materials_ior"))
@@ -167,143 +398,447 @@ std::shared_ptr<SceneNode> Scene::LoadGltf(CommandBuffer& commandBuffer, const s
 
 		return std::make_shared<Material>(m);
 	});
+	const float materialTime = Lap();
+
+	const auto GetAttributeFormat = [](const tinygltf::Accessor& accessor) {
+		static const std::unordered_map<int, std::unordered_map<int, vk::Format>> formatMap {
+			{ TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, {
+				{ TINYGLTF_TYPE_SCALAR, vk::Format::eR8Uint },
+				{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR8G8Uint },
+				{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR8G8B8Uint },
+				{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR8G8B8A8Uint },
+			} },
+			{ TINYGLTF_COMPONENT_TYPE_BYTE, {
+				{ TINYGLTF_TYPE_SCALAR, vk::Format::eR8Sint },
+				{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR8G8Sint },
+				{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR8G8B8Sint },
+				{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR8G8B8A8Sint },
+			} },
+			{ TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, {
+				{ TINYGLTF_TYPE_SCALAR, vk::Format::eR16Uint },
+				{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR16G16Uint },
+				{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR16G16B16Uint },
+				{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR16G16B16A16Uint },
+			} },
+			{ TINYGLTF_COMPONENT_TYPE_SHORT, {
+				{ TINYGLTF_TYPE_SCALAR, vk::Format::eR16Sint },
+				{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR16G16Sint },
+				{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR16G16B16Sint },
+				{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR16G16B16A16Sint },
+			} },
+			{ TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT, {
+				{ TINYGLTF_TYPE_SCALAR, vk::Format::eR32Uint },
+				{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR32G32Uint },
+				{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR32G32B32Uint },
+				{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR32G32B32A32Uint },
+			} },
+			{ TINYGLTF_COMPONENT_TYPE_INT, {
+				{ TINYGLTF_TYPE_SCALAR, vk::Format::eR32Sint },
+				{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR32G32Sint },
+				{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR32G32B32Sint },
+				{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR32G32B32A32Sint },
+			} },
+			{ TINYGLTF_COMPONENT_TYPE_FLOAT, {
+				{ TINYGLTF_TYPE_SCALAR, vk::Format::eR32Sfloat },
+				{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR32G32Sfloat },
+				{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR32G32B32Sfloat },
+				{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR32G32B32A32Sfloat },
+			} },
+			{ TINYGLTF_COMPONENT_TYPE_DOUBLE, {
+				{ TINYGLTF_TYPE_SCALAR, vk::Format::eR64Sfloat },
+				{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR64G64Sfloat },
+				{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR64G64B64Sfloat },
+				{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR64G64B64A64Sfloat },
+			} }
+		};
+		return formatMap.at(accessor.componentType).at(accessor.type);
+	};
 
+	const auto ParseAttributeName = [](const std::string& attribName) {
+		// parse typename & typeindex
+		uint32_t typeIndex = 0;
+		std::string typeName;
+		typeName.resize(attribName.size());
+		std::ranges::transform(attribName, typeName.begin(), [&](char c) { return tolower(c); });
+		size_t c = typeName.find_first_of("0123456789");
+		if (c != std::string::npos) {
+			typeIndex = stoi(typeName.substr(c));
+			typeName = typeName.substr(0, c);
+		}
+		if (typeName.back() == '_') typeName.pop_back();
+		static const std::unordered_map<std::string, Mesh::VertexAttributeType> semanticMap {
+			{ "position", 	Mesh::VertexAttributeType::ePosition },
+			{ "normal", 	Mesh::VertexAttributeType::eNormal },
+			{ "tangent", 	Mesh::VertexAttributeType::eTangent },
+			{ "bitangent", 	Mesh::VertexAttributeType::eBinormal },
+			{ "texcoord", 	Mesh::VertexAttributeType::eTexcoord },
+			{ "color", 		Mesh::VertexAttributeType::eColor },
+			{ "psize", 		Mesh::VertexAttributeType::ePointSize },
+			{ "pointsize", 	Mesh::VertexAttributeType::ePointSize },
+			{ "joints",     Mesh::VertexAttributeType::eBlendIndex },
+			{ "weights",    Mesh::VertexAttributeType::eBlendWeight }
+		};
+		return std::make_pair(semanticMap.at(typeName), typeIndex);
+	};
+
+	// copies a triangle list primitive into tightly packed streams, for MeshProcessing
+	const auto ReadMeshData = [&](const tinygltf::Primitive& prim) {
+		MeshData mesh;
+		const auto ReadAccessor = [&](const tinygltf::Accessor& accessor, std::vector<std::byte>& dst) {
+			const uint32_t elementSize = tinygltf::GetComponentSizeInBytes(accessor.componentType) * tinygltf::GetNumComponentsInType(accessor.type);
+			const tinygltf::BufferView& bv = model.bufferViews[accessor.bufferView];
+			const uint32_t stride = accessor.ByteStride(bv);
+			const std::byte* src = GetBufferData(bv.buffer) + bv.byteOffset + accessor.byteOffset;
+			dst.resize(accessor.count * elementSize);
+			for (size_t v = 0; v < accessor.count; v++)
+				std::memcpy(dst.data() + v*elementSize, src + v*stride, elementSize);
+			return elementSize;
+		};
+
+		for (const auto&[attribName, attribIndex] : prim.attributes) {
+			const tinygltf::Accessor& accessor = model.accessors[attribIndex];
+			const auto[attributeType, typeIndex] = ParseAttributeName(attribName);
+			MeshData::Attribute& a = attributeType == Mesh::VertexAttributeType::ePosition ?
+				*mesh.mAttributes.emplace(mesh.mAttributes.begin()) :
+				mesh.mAttributes.emplace_back();
+			a.mType = attributeType;
+			a.mTypeIndex = typeIndex;
+			a.mFormat = GetAttributeFormat(accessor);
+			a.mElementSize = ReadAccessor(accessor, a.mData);
+			if (attributeType == Mesh::VertexAttributeType::ePosition)
+				mesh.mVertexCount = (uint32_t)accessor.count;
+		}
+
+		if (prim.indices < 0) {
+			mesh.mIndices.resize(mesh.mVertexCount);
+			std::iota(mesh.mIndices.begin(), mesh.mIndices.end(), 0);
+		} else {
+			const tinygltf::Accessor& accessor = model.accessors[prim.indices];
+			std::vector<std::byte> data;
+			const uint32_t indexSize = ReadAccessor(accessor, data);
+			mesh.mIndices.resize(accessor.count);
+			for (size_t i = 0; i < accessor.count; i++) {
+				switch (indexSize) {
+					case sizeof(uint8_t):  mesh.mIndices[i] = reinterpret_cast<const uint8_t*>(data.data())[i]; break;
+					case sizeof(uint16_t): mesh.mIndices[i] = reinterpret_cast<const uint16_t*>(data.data())[i]; break;
+					default:               mesh.mIndices[i] = reinterpret_cast<const uint32_t*>(data.data())[i]; break;
+				}
+			}
+		}
+		return mesh;
+	};
+
+	// byte range of an accessor in its buffer, as the meshes below view it
+	const auto GetAccessorRange = [&](const tinygltf::Accessor& accessor, const size_t stride) {
+		const tinygltf::BufferView& bv = model.bufferViews[accessor.bufferView];
+		const size_t bufferSize = bv.buffer == glbBuffer ? glbBin.size() : model.buffers[bv.buffer].data.size();
+		const size_t offset = std::min(bv.byteOffset + accessor.byteOffset, bufferSize);
+		return std::span(GetBufferData(bv.buffer) + offset, std::min(stride*accessor.count, bufferSize - offset));
+	};
+	const auto GetTopology = [](const tinygltf::Primitive& prim) {
+		switch (prim.mode) {
+			case TINYGLTF_MODE_POINTS: 			return vk::PrimitiveTopology::ePointList;
+			case TINYGLTF_MODE_LINE: 			return vk::PrimitiveTopology::eLineList;
+			case TINYGLTF_MODE_LINE_LOOP: 		return vk::PrimitiveTopology::eLineStrip;
+			case TINYGLTF_MODE_LINE_STRIP: 		return vk::PrimitiveTopology::eLineStrip;
+			case TINYGLTF_MODE_TRIANGLE_STRIP: 	return vk::PrimitiveTopology::eTriangleStrip;
+			case TINYGLTF_MODE_TRIANGLE_FAN: 	return vk::PrimitiveTopology::eTriangleFan;
+			default: 							return vk::PrimitiveTopology::eTriangleList;
+		}
+	};
+	const auto GetIndexStride = [&](const tinygltf::Primitive& prim) {
+		return (size_t)tinygltf::GetComponentSizeInBytes(model.accessors[prim.indices].componentType);
+	};
+
+	// content key of a primitive which views its source buffers (see Mesh::GetContentHash): the bytes of every view and their layout
+	const auto HashPrimitive = [&](const tinygltf::Primitive& prim, const vk::PrimitiveTopology topology) {
+		const tinygltf::Accessor& indicesAccessor = model.accessors[prim.indices];
+		const size_t indexStride = GetIndexStride(prim);
+		size_t hash = HashArgs(topology, indexStride, AssetRegistry::HashContents(GetAccessorRange(indicesAccessor, indexStride)));
+		for (const auto&[attribName, attribIndex] : prim.attributes) {
+			const tinygltf::Accessor& accessor = model.accessors[attribIndex];
+			const size_t stride = accessor.ByteStride(model.bufferViews[accessor.bufferView]);
+			hash = HashCombine(hash, HashArgs(attribName, GetAttributeFormat(accessor), stride, AssetRegistry::HashContents(GetAccessorRange(accessor, stride))));
+		}
+		return hash;
+	};
+	const auto ForEachBuffer = [&](const tinygltf::Primitive& prim, auto fn) {
+		fn(model.bufferViews[model.accessors[prim.indices].bufferView].buffer);
+		for (const auto&[attribName, attribIndex] : prim.attributes)
+			fn(model.bufferViews[model.accessors[attribIndex].bufferView].buffer);
+	};
+
+	// Primitives are shared with other loads individually (see AssetRegistry). Those another load already uploaded are reused,
+	// and the rest either view their source buffers or, when processed or when other primitives in the same buffer were reused, are packed into a new buffer.
+	// Source buffers are only uploaded if a primitive views them.
 	std::cout << "Loading meshes...";
 	std::vector<std::vector<std::shared_ptr<Mesh>>> meshes(model.meshes.size());
+	std::vector<std::vector<size_t>> meshKeys(model.meshes.size());
+	std::unordered_set<const Mesh*> sharedMeshes;
+	std::vector<std::tuple<uint32_t, uint32_t, bool /* process */>> toPack; // (mesh, primitive, process)
+	std::vector<std::pair<uint32_t, uint32_t>> toView; // (mesh, primitive)
+	std::vector<bool> bufferReused(model.buffers.size(), false);
+	std::vector<bool> bufferViewed(model.buffers.size(), false);
+	size_t primitiveCount = 0, reusedPrimitives = 0;
 	for (uint32_t i = 0; i < model.meshes.size(); i++) {
 		std::cout << "\rLoading meshes " << (i+1) << "/" << model.meshes.size() << "     ";
+		ReportLoadProgress(LoadJob::Stage::eUpload, i / (float)model.meshes.size());
 		meshes[i].resize(model.meshes[i].primitives.size());
+		meshKeys[i].resize(model.meshes[i].primitives.size());
 		for (uint32_t j = 0; j < model.meshes[i].primitives.size(); j++) {
 			const tinygltf::Primitive& prim = model.meshes[i].primitives[j];
-			const auto& indicesAccessor = model.accessors[prim.indices];
-			const auto& indexBufferView = model.bufferViews[indicesAccessor.bufferView];
-			const size_t indexStride = tinygltf::GetComponentSizeInBytes(indicesAccessor.componentType);
-			const Buffer::StrideView indexBuffer = Buffer::StrideView(buffers[indexBufferView.buffer], indexStride, indexBufferView.byteOffset + indicesAccessor.byteOffset, indicesAccessor.count * indexStride);
-
-			Mesh::Vertices vertexData;
-
-			vk::PrimitiveTopology topology;
-			switch (prim.mode) {
-				case TINYGLTF_MODE_POINTS: 			topology = vk::PrimitiveTopology::ePointList; break;
-				case TINYGLTF_MODE_LINE: 			topology = vk::PrimitiveTopology::eLineList; break;
-				case TINYGLTF_MODE_LINE_LOOP: 		topology = vk::PrimitiveTopology::eLineStrip; break;
-				case TINYGLTF_MODE_LINE_STRIP: 		topology = vk::PrimitiveTopology::eLineStrip; break;
-				case TINYGLTF_MODE_TRIANGLES: 		topology = vk::PrimitiveTopology::eTriangleList; break;
-				case TINYGLTF_MODE_TRIANGLE_STRIP: 	topology = vk::PrimitiveTopology::eTriangleStrip; break;
-				case TINYGLTF_MODE_TRIANGLE_FAN: 	topology = vk::PrimitiveTopology::eTriangleFan; break;
-			}
+			primitiveCount++;
 
-			for (const auto&[attribName,attribIndex] : prim.attributes) {
-				const tinygltf::Accessor& accessor = model.accessors[attribIndex];
+			const vk::PrimitiveTopology topology = GetTopology(prim);
 
-				static const std::unordered_map<int, std::unordered_map<int, vk::Format>> formatMap {
-					{ TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, {
-						{ TINYGLTF_TYPE_SCALAR, vk::Format::eR8Uint },
-						{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR8G8Uint },
-						{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR8G8B8Uint },
-						{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR8G8B8A8Uint },
-					} },
-					{ TINYGLTF_COMPONENT_TYPE_BYTE, {
-						{ TINYGLTF_TYPE_SCALAR, vk::Format::eR8Sint },
-						{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR8G8Sint },
-						{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR8G8B8Sint },
-						{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR8G8B8A8Sint },
-					} },
-					{ TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, {
-						{ TINYGLTF_TYPE_SCALAR, vk::Format::eR16Uint },
-						{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR16G16Uint },
-						{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR16G16B16Uint },
-						{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR16G16B16A16Uint },
-					} },
-					{ TINYGLTF_COMPONENT_TYPE_SHORT, {
-						{ TINYGLTF_TYPE_SCALAR, vk::Format::eR16Sint },
-						{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR16G16Sint },
-						{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR16G16B16Sint },
-						{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR16G16B16A16Sint },
-					} },
-					{ TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT, {
-						{ TINYGLTF_TYPE_SCALAR, vk::Format::eR32Uint },
-						{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR32G32Uint },
-						{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR32G32B32Uint },
-						{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR32G32B32A32Uint },
-					} },
-					{ TINYGLTF_COMPONENT_TYPE_INT, {
-						{ TINYGLTF_TYPE_SCALAR, vk::Format::eR32Sint },
-						{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR32G32Sint },
-						{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR32G32B32Sint },
-						{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR32G32B32A32Sint },
-					} },
-					{ TINYGLTF_COMPONENT_TYPE_FLOAT, {
-						{ TINYGLTF_TYPE_SCALAR, vk::Format::eR32Sfloat },
-						{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR32G32Sfloat },
-						{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR32G32B32Sfloat },
-						{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR32G32B32A32Sfloat },
-					} },
-					{ TINYGLTF_COMPONENT_TYPE_DOUBLE, {
-						{ TINYGLTF_TYPE_SCALAR, vk::Format::eR64Sfloat },
-						{ TINYGLTF_TYPE_VEC2, 	vk::Format::eR64G64Sfloat },
-						{ TINYGLTF_TYPE_VEC3, 	vk::Format::eR64G64B64Sfloat },
-						{ TINYGLTF_TYPE_VEC4, 	vk::Format::eR64G64B64A64Sfloat },
-					} }
-				};
-				vk::Format attributeFormat = formatMap.at(accessor.componentType).at(accessor.type);
-
-				Mesh::VertexAttributeType attributeType;
-				uint32_t typeIndex = 0;
-				// parse typename & typeindex
-				{
-					std::string typeName;
-					typeName.resize(attribName.size());
-					std::ranges::transform(attribName, typeName.begin(), [&](char c) { return tolower(c); });
-					size_t c = typeName.find_first_of("0123456789");
-					if (c != std::string::npos) {
-						typeIndex = stoi(typeName.substr(c));
-						typeName = typeName.substr(0, c);
-					}
-					if (typeName.back() == '_') typeName.pop_back();
-					static const std::unordered_map<std::string, Mesh::VertexAttributeType> semanticMap {
-						{ "position", 	Mesh::VertexAttributeType::ePosition },
-						{ "normal", 	Mesh::VertexAttributeType::eNormal },
-						{ "tangent", 	Mesh::VertexAttributeType::eTangent },
-						{ "bitangent", 	Mesh::VertexAttributeType::eBinormal },
-						{ "texcoord", 	Mesh::VertexAttributeType::eTexcoord },
-						{ "color", 		Mesh::VertexAttributeType::eColor },
-						{ "psize", 		Mesh::VertexAttributeType::ePointSize },
-						{ "pointsize", 	Mesh::VertexAttributeType::ePointSize },
-						{ "joints",     Mesh::VertexAttributeType::eBlendIndex },
-						{ "weights",    Mesh::VertexAttributeType::eBlendWeight }
-					};
-					attributeType = semanticMap.at(typeName);
+			if ((mOptimizeMeshes || mQuantizeVertices) && topology == vk::PrimitiveTopology::eTriangleList) {
+				if (const auto it = prim.attributes.find("POSITION"); it != prim.attributes.end() && GetAttributeFormat(model.accessors[it->second]) == vk::Format::eR32G32B32Sfloat) {
+					toPack.emplace_back(i, j, true);
+					continue;
 				}
+			}
 
-				auto& attribs = vertexData[attributeType];
-				if (attribs.size() <= typeIndex) attribs.resize(typeIndex+1);
-				const tinygltf::BufferView& bv = model.bufferViews[accessor.bufferView];
-				const uint32_t stride = accessor.ByteStride(bv);
-				attribs[typeIndex] = {
-					Buffer::View<std::byte>(buffers[bv.buffer], bv.byteOffset + accessor.byteOffset, stride*accessor.count),
-					Mesh::VertexAttributeDescription(stride, attributeFormat, 0, vk::VertexInputRate::eVertex) };
-
-				if (attributeType == Mesh::VertexAttributeType::ePosition) {
-					vertexData.mAabb.minX = (float)accessor.minValues[0];
-					vertexData.mAabb.minY = (float)accessor.minValues[1];
-					vertexData.mAabb.minZ = (float)accessor.minValues[2];
-					vertexData.mAabb.maxX = (float)accessor.maxValues[0];
-					vertexData.mAabb.maxY = (float)accessor.maxValues[1];
-					vertexData.mAabb.maxZ = (float)accessor.maxValues[2];
-				}
+			// non-indexed primitives have no index view to share, so they are packed with generated indices
+			if (prim.indices < 0 && topology == vk::PrimitiveTopology::eTriangleList && prim.attributes.contains("POSITION")) {
+				toPack.emplace_back(i, j, false);
+				continue;
 			}
 
-			meshes[i][j] = std::make_shared<Mesh>(vertexData, indexBuffer, topology);
+			meshKeys[i][j] = HashPrimitive(prim, topology);
+			if (const std::shared_ptr<Mesh> shared = commandBuffer.FindSharedMesh(meshKeys[i][j])) {
+				meshes[i][j] = shared;
+				sharedMeshes.emplace(shared.get());
+				ForEachBuffer(prim, [&](const int b) { bufferReused[b] = true; });
+				reusedPrimitives++;
+				continue;
+			}
+			toView.emplace_back(i, j);
 		}
 	}
 	std::cout << std::endl;
 
+	// upload the rest of a partly reused buffer's triangle lists on their own, rather than the whole buffer again
+	std::erase_if(toView, [&](const std::pair<uint32_t, uint32_t>& p) {
+		const tinygltf::Primitive& prim = model.meshes[p.first].primitives[p.second];
+		bool reused = false;
+		ForEachBuffer(prim, [&](const int b) { reused |= bufferReused[b]; });
+		if (reused && GetTopology(prim) == vk::PrimitiveTopology::eTriangleList && prim.attributes.contains("POSITION")) {
+			toPack.emplace_back(p.first, p.second, false);
+			return true;
+		}
+		ForEachBuffer(prim, [&](const int b) { bufferViewed[b] = true; });
+		return false;
+	});
+
+	std::cout << "Loading buffers..." << std::endl;
+	std::vector<std::shared_ptr<Buffer>> buffers(model.buffers.size());
+	HostBufferData hostBuffers; // read back by ReadEmissiveTriangles and the asset cache
+	for (size_t i = 0; i < model.buffers.size(); i++) {
+		if (!bufferViewed[i]) continue;
+		const tinygltf::Buffer& buffer = model.buffers[i];
+		const std::span<const std::byte> data = (int)i == glbBuffer ? glbBin : std::as_bytes(std::span(buffer.data));
+		if ((int)i == glbBuffer && !data.empty()) {
+			// the same BIN chunk may already be resident from another load (e.g. the same file loaded twice)
+			const size_t key = CommandBuffer::GetBufferKey(data, bufferUsage);
+			if (const std::shared_ptr<Buffer> shared = commandBuffer.FindSharedBuffer(key)) {
+				buffers[i] = shared;
+				glbFile->Discard(data);
+			} else {
+				buffers[i] = std::make_shared<Buffer>(device, buffer.name, data.size(), bufferUsage|vk::BufferUsageFlagBits::eTransferDst);
+				commandBuffer.HoldResource(buffers[i]);
+				commandBuffer.UploadBatched(data, buffers[i], [&]() { device.GetUploadQueue().SubmitAndWait(commandBuffer); }, [&](const std::span<const std::byte> batch) {
+					glbFile->Discard(batch);
+				});
+				commandBuffer.ShareBuffer(key, buffers[i], data.size());
+			}
+		} else
+			buffers[i] = commandBuffer.UploadShared<std::byte>(vk::ArrayProxy<const std::byte>((uint32_t)data.size(), data.data()), buffer.name, bufferUsage);
+		hostBuffers.emplace(buffers[i].get(), HostBufferRange{ 0, data });
+		ReportLoadProgress(LoadJob::Stage::eUpload, (i+1) / (float)model.buffers.size());
+	}
+	const float bufferTime = Lap();
+
+	for (const auto&[i, j] : toView) {
+		const tinygltf::Primitive& prim = model.meshes[i].primitives[j];
+
+		const vk::PrimitiveTopology topology = GetTopology(prim);
+
+		const auto& indicesAccessor = model.accessors[prim.indices];
+		const auto& indexBufferView = model.bufferViews[indicesAccessor.bufferView];
+		const size_t indexStride = GetIndexStride(prim);
+		const Buffer::StrideView indexBuffer = Buffer::StrideView(buffers[indexBufferView.buffer], indexStride, indexBufferView.byteOffset + indicesAccessor.byteOffset, indicesAccessor.count * indexStride);
+		size_t meshBytes = indexBuffer.SizeBytes();
+
+		Mesh::Vertices vertexData;
+
+		for (const auto&[attribName,attribIndex] : prim.attributes) {
+			const tinygltf::Accessor& accessor = model.accessors[attribIndex];
+			const vk::Format attributeFormat = GetAttributeFormat(accessor);
+			const auto[attributeType, typeIndex] = ParseAttributeName(attribName);
+
+			auto& attribs = vertexData[attributeType];
+			if (attribs.size() <= typeIndex) attribs.resize(typeIndex+1);
+			const tinygltf::BufferView& bv = model.bufferViews[accessor.bufferView];
+			const uint32_t stride = accessor.ByteStride(bv);
+			attribs[typeIndex] = {
+				Buffer::View<std::byte>(buffers[bv.buffer], bv.byteOffset + accessor.byteOffset, stride*accessor.count),
+				Mesh::VertexAttributeDescription(stride, attributeFormat, 0, vk::VertexInputRate::eVertex) };
+			meshBytes += stride*accessor.count;
+
+			if (attributeType == Mesh::VertexAttributeType::ePosition) {
+				vertexData.mAabb.minX = (float)accessor.minValues[0];
+				vertexData.mAabb.minY = (float)accessor.minValues[1];
+				vertexData.mAabb.minZ = (float)accessor.minValues[2];
+				vertexData.mAabb.maxX = (float)accessor.maxValues[0];
+				vertexData.mAabb.maxY = (float)accessor.maxValues[1];
+				vertexData.mAabb.maxZ = (float)accessor.maxValues[2];
+			}
+		}
+
+		meshes[i][j] = std::make_shared<Mesh>(vertexData, indexBuffer, topology);
+		meshes[i][j]->SetContentHash(meshKeys[i][j]);
+		commandBuffer.ShareMesh(meshKeys[i][j], meshes[i][j], meshBytes);
+	}
+
+	// host copies of reused primitives, which view another load's buffers
+	for (uint32_t i = 0; i < model.meshes.size(); i++)
+		for (uint32_t j = 0; j < model.meshes[i].primitives.size(); j++) {
+			if (!meshes[i][j] || !sharedMeshes.contains(meshes[i][j].get())) continue;
+			const tinygltf::Primitive& prim = model.meshes[i].primitives[j];
+			const Mesh& shared = *meshes[i][j];
+			hostBuffers.emplace(shared.GetIndices().GetBuffer().get(), HostBufferRange{ shared.GetIndices().Offset(), GetAccessorRange(model.accessors[prim.indices], GetIndexStride(prim)) });
+			for (const auto&[attribName, attribIndex] : prim.attributes) {
+				const tinygltf::Accessor& accessor = model.accessors[attribIndex];
+				const auto[attributeType, typeIndex] = ParseAttributeName(attribName);
+				if (const auto attrib = shared.GetVertices().find(attributeType, typeIndex))
+					hostBuffers.emplace(attrib->first.GetBuffer().get(), HostBufferRange{ attrib->first.Offset(), GetAccessorRange(accessor, accessor.ByteStride(model.bufferViews[accessor.bufferView])) });
+			}
+		}
+
+	// weld, reorder and quantize triangle meshes if enabled, then pack them into a single buffer
+	std::vector<std::byte> packedMeshData;
+	if (!toPack.empty()) {
+		const size_t processCount = std::ranges::count_if(toPack, [](const auto& p) { return std::get<2>(p); });
+		if (processCount > 0)
+			std::cout << "Processing " << processCount << " meshes..." << std::endl;
+
+		std::vector<MeshData> meshData(toPack.size());
+		std::vector<vk::AabbPositionsKHR> aabbs(toPack.size());
+		std::vector<size_t> originalSizes(toPack.size());
+		std::vector<uint32_t> originalVertexCounts(toPack.size());
+		{
+			ReportLoadProgress(LoadJob::Stage::eDecode);
+			LoadJob* const loadJob = gCurrentLoadJob;
+
+			ThreadPool pool(std::min<uint32_t>(std::thread::hardware_concurrency(), (uint32_t)toPack.size()));
+			std::vector<std::future<void>> jobs;
+			for (size_t k = 0; k < toPack.size(); k++) {
+				jobs.emplace_back(pool.Enqueue([&, k]() {
+					if (loadJob && loadJob->mCancelRequested) return;
+					const auto[i, j, process] = toPack[k];
+					const tinygltf::Primitive& prim = model.meshes[i].primitives[j];
+					MeshData& mesh = meshData[k];
+					mesh = ReadMeshData(prim);
+					originalVertexCounts[k] = mesh.mVertexCount;
+					originalSizes[k] = mesh.mVertexCount * mesh.VertexSize() + mesh.mIndices.size() * (prim.indices < 0 ? 0 : tinygltf::GetComponentSizeInBytes(model.accessors[prim.indices].componentType));
+					if (process && mOptimizeMeshes) {
+						WeldVertices(mesh);
+						OptimizeLocality(mesh);
+					}
+					if (process && mQuantizeVertices)
+						QuantizeVertices(mesh);
+
+					const tinygltf::Accessor& positionAccessor = model.accessors[prim.attributes.at("POSITION")];
+					aabbs[k] = vk::AabbPositionsKHR(
+						(float)positionAccessor.minValues[0], (float)positionAccessor.minValues[1], (float)positionAccessor.minValues[2],
+						(float)positionAccessor.maxValues[0], (float)positionAccessor.maxValues[1], (float)positionAccessor.maxValues[2]);
+				}));
+			}
+			for (size_t j = 0; j < jobs.size(); j++) {
+				jobs[j].get();
+				ReportLoadProgress(LoadJob::Stage::eDecode, (j+1) / (float)jobs.size());
+			}
+		}
+		ReportLoadProgress(LoadJob::Stage::eUpload);
+
+		const size_t sharedBefore = sharedMeshes.size();
+		const std::vector<std::shared_ptr<Mesh>> packed = UploadMeshes(commandBuffer, meshData, aabbs, filename.stem().string() + "/Meshes", bufferUsage, packedMeshData, hostBuffers, sharedMeshes);
+		reusedPrimitives += sharedMeshes.size() - sharedBefore;
+
+		size_t totalOriginal = 0, totalOptimized = 0;
+		for (size_t k = 0; k < toPack.size(); k++) {
+			const auto[i, j, process] = toPack[k];
+			meshes[i][j] = packed[k];
+			if (!process) continue;
+
+			const MeshData& mesh = meshData[k];
+			totalOriginal += originalSizes[k];
+			totalOptimized += mesh.SizeBytes();
+			const auto[before, beforeUnit] = FormatBytes(originalSizes[k]);
+			const auto[after, afterUnit] = FormatBytes(mesh.SizeBytes());
+			std::cout << "\t" << model.meshes[i].name << "[" << j << "]: "
+				<< originalVertexCounts[k] << " -> " << mesh.mVertexCount << " vertices, "
+				<< mesh.mIndices.size()/3 << " triangles, "
+				<< (mesh.IndexType() == vk::IndexType::eUint16 ? "uint16" : "uint32") << " indices, "
+				<< before << " " << beforeUnit << " -> " << after << " " << afterUnit << std::endl;
+		}
+		if (processCount > 0) {
+			const auto[saved, savedUnit] = FormatBytes(totalOriginal - std::min(totalOriginal, totalOptimized));
+			std::cout << "Processed " << processCount << " meshes, saved " << saved << " " << savedUnit << std::endl;
+		}
+	}
+	if (reusedPrimitives > 0)
+		std::cout << "Reused " << reusedPrimitives << "/" << primitiveCount << " primitives from other loads" << std::endl;
+	const float meshTime = Lap();
+
+	// reads a float accessor, or a normalized integer one (allowed for EXT_mesh_gpu_instancing rotations)
+	const auto ReadAccessor = [&](const int index) {
+		std::vector<float4> values;
+		if (index < 0 || index >= model.accessors.size()) return values;
+		const tinygltf::Accessor& accessor = model.accessors[index];
+		if (accessor.bufferView < 0 || accessor.sparse.isSparse)
+			throw std::runtime_error(filename.string() + ": unsupported instance attribute accessor " + std::to_string(index));
+		const tinygltf::BufferView& bv = model.bufferViews[accessor.bufferView];
+		const std::byte* src = GetBufferData(bv.buffer) + bv.byteOffset + accessor.byteOffset;
+		const size_t stride = accessor.ByteStride(bv);
+		const int components = std::min(tinygltf::GetNumComponentsInType(accessor.type), 4);
+		values.resize(accessor.count, float4(0));
+		for (size_t i = 0; i < accessor.count; i++) {
+			const std::byte* p = src + i*stride;
+			for (int c = 0; c < components; c++) {
+				switch (accessor.componentType) {
+				case TINYGLTF_COMPONENT_TYPE_FLOAT: values[i][c] = reinterpret_cast<const float*>(p)[c]; break;
+				case TINYGLTF_COMPONENT_TYPE_BYTE:  values[i][c] = std::max(reinterpret_cast<const int8_t*>(p)[c] / 127.f, -1.f); break;
+				case TINYGLTF_COMPONENT_TYPE_SHORT: values[i][c] = std::max(reinterpret_cast<const int16_t*>(p)[c] / 32767.f, -1.f); break;
+				default: throw std::runtime_error(filename.string() + ": unsupported instance attribute component type " + std::to_string(accessor.componentType));
+				}
+			}
+		}
+		return values;
+	};
+
+	// EXT_mesh_gpu_instancing: per-instance TRS, applied before the node's transform
+	const auto ReadInstanceTransforms = [&](const tinygltf::Value& attributes) {
+		const auto GetAccessor = [&](const char* name) { return attributes.Has(name) ? attributes.Get(name).GetNumberAsInt() : -1; };
+		const std::vector<float4> translations = ReadAccessor(GetAccessor("TRANSLATION"));
+		const std::vector<float4> rotations    = ReadAccessor(GetAccessor("ROTATION"));
+		const std::vector<float4> scales       = ReadAccessor(GetAccessor("SCALE"));
+		std::vector<float4x4> transforms(std::max({ translations.size(), rotations.size(), scales.size() }), glm::identity<float4x4>());
+		for (size_t i = 0; i < transforms.size(); i++) {
+			if (i < translations.size()) transforms[i] = glm::translate(float3(translations[i]));
+			if (i < rotations.size())    transforms[i] = transforms[i] * glm::mat4_cast(glm::quat(rotations[i].w, rotations[i].x, rotations[i].y, rotations[i].z));
+			if (i < scales.size())       transforms[i] = transforms[i] * glm::scale(float3(scales[i]));
+		}
+		return transforms;
+	};
+	size_t instancedRendererCount = 0, instanceCount = 0;
+
 	std::cout << "Loading primitives...";
 	const std::shared_ptr<SceneNode> rootNode = SceneNode::Create(filename.stem().string());
 	std::vector<std::shared_ptr<SceneNode>> nodes(model.nodes.size());
 	for (size_t n = 0; n < model.nodes.size(); n++) {
 		std::cout << "\rLoading primitives " << (n+1) << "/" << model.nodes.size() << "     ";
+		ReportLoadProgress(LoadJob::Stage::eUpload, n / (float)model.nodes.size());
 
 		const auto& node = model.nodes[n];
 		const std::shared_ptr<SceneNode> dst = rootNode->AddChild(node.name);
@@ -320,12 +855,23 @@ std::shared_ptr<SceneNode> Scene::LoadGltf(CommandBuffer& commandBuffer, const s
 		} else if (!node.matrix.empty())
 			dst->MakeComponent<float4x4>((float4x4)*reinterpret_cast<const glm::mat<4,4,double>*>(node.matrix.data()));
 
-		// make node for MeshRenderer
+		// make node for MeshRenderer, or InstancedMeshRenderer for EXT_mesh_gpu_instancing nodes
+
+		std::vector<float4x4> instanceTransforms;
+		if (const auto it = node.extensions.find("EXT_mesh_gpu_instancing"); it != node.extensions.end() && it->second.Has("attributes"))
+			instanceTransforms = ReadInstanceTransforms(it->second.Get("attributes"));
 
 		if (node.mesh < model.meshes.size())
 			for (uint32_t i = 0; i < model.meshes[node.mesh].primitives.size(); i++) {
 				const auto& prim = model.meshes[node.mesh].primitives[i];
-				dst->AddChild(model.meshes[node.mesh].name)->MakeComponent<MeshRenderer>(materials[prim.material], meshes[node.mesh][i]);
+				const std::shared_ptr<SceneNode> child = dst->AddChild(model.meshes[node.mesh].name);
+				if (instanceTransforms.empty())
+					child->MakeComponent<MeshRenderer>(materials[prim.material], meshes[node.mesh][i]);
+				else {
+					child->MakeComponent<InstancedMeshRenderer>(materials[prim.material], meshes[node.mesh][i], instanceTransforms);
+					instancedRendererCount++;
+					instanceCount += instanceTransforms.size();
+				}
 			}
 
 		auto light_it = node.extensions.find("KHR_lights_punctual");
@@ -343,12 +889,41 @@ std::shared_ptr<SceneNode> Scene::LoadGltf(CommandBuffer& commandBuffer, const s
 		}
 	}
 	std::cout << std::endl;
+	if (instancedRendererCount > 0)
+		std::cout << "Loaded " << instanceCount << " instances in " << instancedRendererCount << " instanced renderers" << std::endl;
 
 	for (size_t i = 0; i < model.nodes.size(); i++)
 		for (int c : model.nodes[i].children)
 			nodes[i]->AddChild(nodes[c]);
-
-	std::cout << "Loaded " << filename << std::endl;
+	ReadEmissiveTriangles(*rootNode, hostBuffers, sharedMeshes);
+	const float nodeTime = Lap();
+
+	if (mAssetCache.Enabled()) {
+		try {
+			cacheWriter.AddBuffers(hostBuffers);
+			cacheWriter.Write(mAssetCache, filename, cacheKey, *rootNode);
+		} catch (std::exception& e) {
+			std::cerr << "Failed to write asset cache for " << filename << ": " << e.what() << std::endl;
+		}
+	}
+	const float cacheTime = Lap();
+
+	std::cout << "Loaded " << filename << " in " << std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(clock::now() - loadStart).count() << "ms (cold)" << std::endl;
+	std::cout << "\tParse: " << parseTime << "ms, buffers: " << bufferTime << "ms, image decode: " << decodeTime << "ms, materials: " << materialTime << "ms, meshes: " << meshTime << "ms, nodes: " << nodeTime << "ms, cache write: " << cacheTime << "ms" << std::endl;
+	if (decodedImages > 0) {
+		const auto[encodedSize, encodedUnit] = FormatBytes(encodedBytes);
+		const auto[decodedSize, decodedUnit] = FormatBytes(decodedBytes);
+		const float seconds = std::max(decodeTime, 1e-3f) / 1000;
+		std::cout << "\tDecoded " << decodedImages << " images (" << encodedSize << " " << encodedUnit << " -> " << decodedSize << " " << decodedUnit << ") in " << decodeTime << "ms: "
+			<< decodedImages / seconds << " images/s, " << (encodedBytes / (1024.f*1024.f)) / seconds << " MB/s" << std::endl;
+	}
+	if (compressedImages > 0) {
+		const auto[uncompressedSize, uncompressedUnit] = FormatBytes(uncompressedBytes);
+		const auto[compressedSize, compressedUnit] = FormatBytes(compressedBytes);
+		const auto[savedSize, savedUnit] = FormatBytes(uncompressedBytes - compressedBytes);
+		std::cout << "\tBlock compressed " << compressedImages << " images (" << compressedCacheHits << " from cache): "
+			<< uncompressedSize << " " << uncompressedUnit << " -> " << compressedSize << " " << compressedUnit << ", saved " << savedSize << " " << savedUnit << std::endl;
+	}
 
 	return rootNode;
 }
@@ -1,4 +1,7 @@
 #include <Scene/Scene.hpp>
+#include <Core/ThreadPool.hpp>
+#include <Scene/MeshProcessing.hpp>
+#include <Common/Math.h>
 
 #include <miniz.h>
 #include <pugixml.hpp>
@@ -9,1012 +12,827 @@ namespace ptvk {
 #define MTS_FILEFORMAT_VERSION_V3 0x0003
 #define MTS_FILEFORMAT_VERSION_V4 0x0004
 
-#define ZSTREAM_BUFSIZE 32768
+#pragma region Serialized meshes
 
-#if 0
-class z_iftream {
-public:
-	inline z_iftream(std::fstream& fs) : fs(fs) {
-		std::streampos pos = fs.tellg();
-		fs.seekg(0, fs.end);
-		fsize = (size_t)fs.tellg();
-		fs.seekg(pos, fs.beg);
-
-		int windowBits = 15;
-		m_inflateStream.zalloc = Z_NULL;
-		m_inflateStream.zfree = Z_NULL;
-		m_inflateStream.opaque = Z_NULL;
-		m_inflateStream.avail_in = 0;
-		m_inflateStream.next_in = Z_NULL;
-
-		int retval = inflateInit2(&m_inflateStream, windowBits);
-		if (retval != Z_OK) {
-			throw runtime_error("Could not initialize ZLIB");
-		}
-	}
-	inline virtual ~z_iftream() {
-		inflateEnd(&m_inflateStream);
-	}
-
-	inline void read(void* ptr, size_t size) {
-		uint8_t* targetPtr = (uint8_t*)ptr;
-		while (size > 0) {
-			if (m_inflateStream.avail_in == 0) {
-				size_t remaining = fsize - fs.tellg();
-				m_inflateStream.next_in = m_inflateBuffer;
-				m_inflateStream.avail_in = (uint32_t)min(remaining, sizeof(m_inflateBuffer));
-				if (m_inflateStream.avail_in == 0) {
-					throw runtime_error("Read less data than expected");
-				}
-
-				fs.read((char*)m_inflateBuffer, m_inflateStream.avail_in);
-			}
-
-			m_inflateStream.avail_out = (uint32_t)size;
-			m_inflateStream.next_out = targetPtr;
-
-			int retval = inflate(&m_inflateStream, Z_NO_FLUSH);
-			switch (retval) {
-			case Z_STREAM_ERROR: {
-				throw runtime_error("inflate(): stream error!");
-			}
-			case Z_NEED_DICT: {
-				throw runtime_error("inflate(): need dictionary!");
-			}
-			case Z_DATA_ERROR: {
-				throw runtime_error("inflate(): data error!");
-			}
-			case Z_MEM_ERROR: {
-				throw runtime_error("inflate(): memory error!");
-			}
-			};
-
-			size_t outputSize = size - (size_t)m_inflateStream.avail_out;
-			targetPtr += outputSize;
-			size -= outputSize;
+// Shape table of a .serialized file. Each shape is a 4 byte header (magic, version) followed by a zlib stream.
+// The table is read once per file, so that shapes can be inflated independently.
+struct SerializedFile {
+	uint16_t mVersion = 0;
+	std::vector<std::pair<uint64_t /* offset */, uint64_t /* size */>> mShapes;
+};
 
-			if (size > 0 && retval == Z_STREAM_END) {
-				throw runtime_error("inflate(): attempting to read past the end of the stream!");
-			}
-		}
-	}
+inline SerializedFile ReadSerializedTable(const std::filesystem::path& filename) {
+	std::ifstream fs(filename, std::ios::binary);
+	if (!fs) throw std::runtime_error("Failed to open " + filename.string());
+	fs.seekg(0, fs.end);
+	const uint64_t fileSize = fs.tellg();
+
+	SerializedFile file;
+	// format magic number, ignore it
+	fs.seekg(sizeof(uint16_t), fs.beg);
+	fs.read((char*)&file.mVersion, sizeof(uint16_t));
+	if (file.mVersion != MTS_FILEFORMAT_VERSION_V3 && file.mVersion != MTS_FILEFORMAT_VERSION_V4)
+		throw std::runtime_error("Unsupported serialized mesh version " + std::to_string(file.mVersion) + " in " + filename.string());
+
+	// the shape count is at the end of the file, preceded by the offset of each shape
+	uint32_t count = 0;
+	fs.seekg(fileSize - sizeof(uint32_t), fs.beg);
+	fs.read((char*)&count, sizeof(uint32_t));
+	const uint64_t entrySize = file.mVersion == MTS_FILEFORMAT_VERSION_V4 ? sizeof(uint64_t) : sizeof(uint32_t);
+	if (count == 0 || count * entrySize + sizeof(uint32_t) > fileSize)
+		throw std::runtime_error("Invalid shape table in " + filename.string());
+	const uint64_t tableStart = fileSize - sizeof(uint32_t) - count * entrySize;
+
+	std::vector<uint64_t> offsets(count, 0);
+	fs.seekg(tableStart, fs.beg);
+	for (uint64_t& offset : offsets)
+		fs.read((char*)&offset, entrySize);
+
+	file.mShapes.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		const uint64_t begin = offsets[i] + 2*sizeof(uint16_t); // skip the header
+		const uint64_t end = i + 1 < count ? offsets[i + 1] : tableStart;
+		if (end < begin || end > tableStart)
+			throw std::runtime_error("Invalid shape table in " + filename.string());
+		file.mShapes[i] = { begin, end - begin };
+	}
+	return file;
+}
 
-private:
-	std::fstream& fs;
-	size_t fsize;
-	z_stream m_inflateStream;
-	uint8_t m_inflateBuffer[ZSTREAM_BUFSIZE];
-};
+// Inflates one shape of a .serialized file. Safe to call from multiple threads.
+inline MeshData LoadSerialized(const std::filesystem::path& filename, const SerializedFile& file, const uint32_t shapeIndex) {
+	if (shapeIndex >= file.mShapes.size())
+		throw std::runtime_error("Shape index " + std::to_string(shapeIndex) + " out of range in " + filename.string());
+	const auto[offset, size] = file.mShapes[shapeIndex];
 
-Mesh LoadSerialized(CommandBuffer& commandBuffer, const std::filesystem::path& filename, int shape_index) {
-	std::fstream fs(filename.c_str(), std::fstream::in | std::fstream::binary);
-	// Format magic number, ignore it
-	fs.ignore(sizeof(short));
-	// Version number
-	short version = 0;
-	fs.read((char*)&version, sizeof(short));
-	if (shape_index > 0) {
-		// Go to the end of the file to see how many components are there
-		fs.seekg(-sizeof(uint32_t), fs.end);
-		uint32_t count = 0;
-		fs.read((char*)&count, sizeof(uint32_t));
-		size_t offset = 0;
-		if (version == MTS_FILEFORMAT_VERSION_V4) {
-			fs.seekg(-sizeof(uint64_t) * (count - shape_index) - sizeof(uint32_t), fs.end);
-			fs.read((char*)&offset, sizeof(size_t));
-		} else {  // V3
-			fs.seekg(-sizeof(uint32_t) * (count - shape_index + 1), fs.end);
-			uint32_t upos = 0;
-			fs.read((char*)&upos, sizeof(unsigned int));
-			offset = upos;
-		}
+	std::vector<uint8_t> compressed(size);
+	{
+		std::ifstream fs(filename, std::ios::binary);
 		fs.seekg(offset, fs.beg);
-		// Skip the header
-		fs.ignore(sizeof(short) * 2);
-	}
-	z_iftream zs(fs);
+		fs.read((char*)compressed.data(), size);
+		if (!fs) throw std::runtime_error("Failed to read shape " + std::to_string(shapeIndex) + " from " + filename.string());
+	}
+
+	size_t inflatedSize = 0;
+	const std::unique_ptr<void, decltype(&mz_free)> inflated(tinfl_decompress_mem_to_heap(compressed.data(), compressed.size(), &inflatedSize, TINFL_FLAG_PARSE_ZLIB_HEADER), &mz_free);
+	if (!inflated) throw std::runtime_error("Failed to inflate shape " + std::to_string(shapeIndex) + " from " + filename.string());
+	compressed.clear();
+	compressed.shrink_to_fit();
+
+	const uint8_t* src = reinterpret_cast<const uint8_t*>(inflated.get());
+	size_t cursor = 0;
+	const auto Read = [&](void* dst, const size_t n) {
+		if (cursor + n > inflatedSize)
+			throw std::runtime_error("Shape " + std::to_string(shapeIndex) + " in " + filename.string() + " is truncated");
+		std::memcpy(dst, src + cursor, n);
+		cursor += n;
+	};
 
 	enum ETriMeshFlags {
-		EHasNormals = 0x0001,
-		EHasTexcoords = 0x0002,
-		EHasTangents = 0x0004,  // unused
-		EHasColors = 0x0008,
-		EFaceNormals = 0x0010,
+		EHasNormals      = 0x0001,
+		EHasTexcoords    = 0x0002,
+		EHasTangents     = 0x0004, // unused
+		EHasColors       = 0x0008,
+		EFaceNormals     = 0x0010,
 		ESinglePrecision = 0x1000,
 		EDoublePrecision = 0x2000
 	};
 
-	uint32_t flags;
-	zs.read((char*)&flags, sizeof(uint32_t));
-	std::string name;
-	if (version == MTS_FILEFORMAT_VERSION_V4) {
-		char c;
-		while (true) {
-			zs.read((char*)&c, sizeof(char));
-			if (c == '\0')
-				break;
-			name.push_back(c);
-		}
-	}
-	size_t vertex_count = 0;
-	zs.read((char*)&vertex_count, sizeof(size_t));
-	size_t triangle_count = 0;
-	zs.read((char*)&triangle_count, sizeof(size_t));
-
-	bool file_double_precision = flags & EDoublePrecision;
-	// bool face_normals = flags & EFaceNormals;
-
-	vk::BufferUsageFlags bufferUsage = vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer;
-	if (commandBuffer.mDevice.GetAccelerationStructureFeatures().accelerationStructure) {
-		bufferUsage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
-		bufferUsage |= vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
-	}
+	uint32_t flags = 0;
+	Read(&flags, sizeof(uint32_t));
+	if (file.mVersion == MTS_FILEFORMAT_VERSION_V4) {
+		// shape name, ignore it
+		char c = 1;
+		while (c != '\0') Read(&c, sizeof(char));
+	}
+	uint64_t vertexCount = 0;
+	uint64_t triangleCount = 0;
+	Read(&vertexCount, sizeof(uint64_t));
+	Read(&triangleCount, sizeof(uint64_t));
+	if (vertexCount > std::numeric_limits<uint32_t>::max())
+		throw std::runtime_error("Shape " + std::to_string(shapeIndex) + " in " + filename.string() + " has too many vertices");
+
+	const bool doublePrecision = flags & EDoublePrecision;
+	const size_t scalarSize = doublePrecision ? sizeof(double) : sizeof(float);
+
+	MeshData mesh;
+	mesh.mVertexCount = (uint32_t)vertexCount;
+
+	const auto ReadAttribute = [&](const Mesh::VertexAttributeType type, const uint32_t components) {
+		MeshData::Attribute& a = mesh.mAttributes.emplace_back(MeshData::Attribute{
+			type, 0,
+			components == 3 ? vk::Format::eR32G32B32Sfloat : vk::Format::eR32G32Sfloat,
+			components * (uint32_t)sizeof(float) });
+		a.mData.resize(vertexCount * a.mElementSize);
+		float* dst = reinterpret_cast<float*>(a.mData.data());
+		if (doublePrecision) {
+			for (size_t i = 0; i < vertexCount * components; i++) {
+				double v;
+				Read(&v, sizeof(double));
+				dst[i] = (float)v;
+			}
+		} else
+			Read(dst, a.mData.size());
+	};
 
-	Mesh::Vertices attributes;
+	// positions are first, so that BLAS builds read one tight float3 stream
+	ReadAttribute(Mesh::VertexAttributeType::ePosition, 3);
+	if (flags & EHasNormals)   ReadAttribute(Mesh::VertexAttributeType::eNormal, 3);
+	if (flags & EHasTexcoords) ReadAttribute(Mesh::VertexAttributeType::eTexcoord, 2);
+	// vertex colors are unused
+	if (flags & EHasColors) cursor += vertexCount * 3 * scalarSize;
 
-	auto UploadData(const auto& data) {
-		Buffer::View<float3> tmp = std::make_shared<Buffer>(commandBuffer.mDevice, "tmp positions", sizeof(float3) * vertex_count, vk::BufferUsageFlagBits::eTransferSrc,
-			vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent,
-			VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-		Buffer::View<float3> normals = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " normals", tmp.SizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-	}
+	mesh.mIndices.resize(triangleCount * 3);
+	Read(mesh.mIndices.data(), mesh.mIndices.size() * sizeof(uint32_t));
+	return mesh;
+}
 
-	{
-		float3 vmin = float3::( std::numeric_limits<float>::infinity());
-		float3 vmax = float3::(-std::numeric_limits<float>::infinity());
-		if (file_double_precision) {
-			for (uint32_t i = 0; i < vertex_count; i++) {
-				double3 tmp;
-				zs.read(&tmp.x, sizeof(double) * 3);
-				positions_tmp[i] = (float3)tmp;
-				vmin = min(vmin, positions_tmp[i]);
-				vmax = max(vmax, positions_tmp[i]);
-			}
-		} else {
-			for (uint32_t i = 0; i < vertex_count; i++) {
-				zs.read(&positions_tmp[i].x, sizeof(float) * 3);
-				vmin = min(vmin, positions_tmp[i]);
-				vmax = max(vmax, positions_tmp[i]);
-			}
-		}
-		attributes.mAabb = vk::AabbPositionsKHR(vmin[0], vmin[1], vmin[2], vmax[0], vmax[1], vmax[2]);
-		Buffer::View<float3> positions = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " positions", positions_tmp.SizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-		commandBuffer.Copy(positions_tmp, positions);
-		attributes[Mesh::VertexAttributeType::ePosition].emplace_back(positions, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
-	}
+inline MeshData CreateMeshData(const std::vector<float3>& vertices, const std::vector<float3>& normals, const std::vector<float2>& uvs, const std::vector<uint32_t>& indices) {
+	MeshData mesh;
+	mesh.mVertexCount = (uint32_t)vertices.size();
+	mesh.mIndices = indices;
+	const auto AddAttribute = [&](const Mesh::VertexAttributeType type, const vk::Format format, const auto& data) {
+		MeshData::Attribute& a = mesh.mAttributes.emplace_back(MeshData::Attribute{ type, 0, format, (uint32_t)sizeof(data[0]) });
+		a.mData.resize(data.size() * sizeof(data[0]));
+		std::memcpy(a.mData.data(), data.data(), a.mData.size());
+	};
+	AddAttribute(Mesh::VertexAttributeType::ePosition, vk::Format::eR32G32B32Sfloat, vertices);
+	AddAttribute(Mesh::VertexAttributeType::eNormal, vk::Format::eR32G32B32Sfloat, normals);
+	AddAttribute(Mesh::VertexAttributeType::eTexcoord, vk::Format::eR32G32Sfloat, uvs);
+	return mesh;
+}
 
-	if (flags & EHasNormals) {
-		Buffer::View<float3> normals_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp normals", sizeof(float3) * vertex_count, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-		if (file_double_precision) {
-			for (uint32_t i = 0; i < vertex_count; i++) {
-				double3 tmp;
-				zs.read(tmp.data(), sizeof(double) * 3);
-				normals_tmp[i] = tmp.cast<float>();
-			}
-		} else {
-			for (uint32_t i = 0; i < vertex_count; i++)
-				zs.read(normals_tmp[i].data(), sizeof(float) * 3);
-		}
-		Buffer::copy(commandBuffer, normals_tmp, normals);
-		attributes[Mesh::VertexAttributeType::eNormal].emplace_back(normals, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
-	}
+inline MeshData CreateRectangle() {
+	return CreateMeshData(
+		{ float3(-1,-1,0), float3(-1,1,0), float3(1,-1,0), float3(1,1,0) },
+		{ float3(0,0,1), float3(0,0,1), float3(0,0,1), float3(0,0,1) },
+		{ float2(0,0), float2(0,1), float2(1,0), float2(1,1) },
+		{ 0, 1, 2, 1, 3, 2 });
+}
 
-	if (flags & EHasTexcoords) {
-		Buffer::View<float2> uvs_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp uvs", sizeof(float2) * vertex_count, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-		if (file_double_precision) {
-			for (uint32_t i = 0; i < vertex_count; i++) {
-				double2 tmp;
-				zs.read(tmp.data(), sizeof(double) * 2);
-				uvs_tmp[i] = tmp.cast<float>();
-			}
-		} else {
-			for (uint32_t i = 0; i < vertex_count; i++)
-				zs.read(uvs_tmp[i].data(), sizeof(float) * 2);
+inline MeshData CreateCube() {
+	std::vector<float3> vertices(24);
+	std::vector<float3> normals(24);
+	std::vector<float2> uvs(24);
+	std::vector<uint32_t> indices(36);
+	for (uint32_t face = 0; face < 6; face++) {
+		const uint32_t i = face*4;
+		const uint32_t axis = face/2;
+		const float s = face%2 == 0 ? 1 : -1;
+
+		float3 n = float3(0);
+		n[axis] = s;
+		for (uint32_t j = 0; j < 4; j++) {
+			float3 v = n;
+			v[(axis + 1) % 3] = (j & 1) ? s : -s;
+			v[(axis + 2) % 3] = (j & 2) ? s : -s;
+			vertices[i+j] = v;
+			normals[i+j] = n;
+			uvs[i+j] = float2(j & 1, j >> 1);
 		}
-		Buffer::View<float2> uvs = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " uvs", uvs_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-		Buffer::copy(commandBuffer, uvs_tmp, uvs);
-		attributes[Mesh::VertexAttributeType::eTexcoord].emplace_back(uvs, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float2), vk::Format::eR32G32Sfloat, 0, vk::VertexInputRate::eVertex });
-	}
 
-	if (flags & EHasColors) {
-		Buffer::View<float3> colors_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp colors", sizeof(float3) * vertex_count, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-		if (file_double_precision) {
-			for (uint32_t i = 0; i < vertex_count; i++) {
-				double3 tmp;
-				zs.read(tmp.data(), sizeof(double) * 3);
-				colors_tmp[i] = tmp.cast<float>();
-			}
-		} else {
-			for (uint32_t i = 0; i < vertex_count; i++)
-				zs.read(colors_tmp[i].data(), sizeof(float) * 3);
-		}
-		Buffer::View<float2> colors = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " colors", colors_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-		Buffer::copy(commandBuffer, colors_tmp, colors);
-		attributes[Mesh::VertexAttributeType::eColor].emplace_back(colors, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
+		indices[face*6 + 0] = i + 0;
+		indices[face*6 + 1] = i + 1;
+		indices[face*6 + 2] = i + 2;
+		indices[face*6 + 3] = i + 1;
+		indices[face*6 + 4] = i + 3;
+		indices[face*6 + 5] = i + 2;
 	}
+	return CreateMeshData(vertices, normals, uvs, indices);
+}
 
-	Buffer::View<uint32_t> indices_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp inds", 3 * triangle_count * sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-	zs.read(indices_tmp.data(), sizeof(uint32_t) * 3 * triangle_count);
+#pragma endregion
 
-	Buffer::View<uint32_t> indexBuffer = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " indices", indices_tmp.sizeBytes(), bufferUsage | vk::BufferUsageFlagBits::eIndexBuffer);
-	Buffer::copy(commandBuffer, indices_tmp, indexBuffer);
+#pragma region Parsing helpers
 
-	return Mesh(attributes, indexBuffer, vk::PrimitiveTopology::eTriangleList);
+inline std::vector<std::string> SplitString(const std::string& str, const std::regex& delim_regex) {
+	std::sregex_token_iterator first{ str.begin(), str.end(), delim_regex, -1 }, last;
+	std::vector<std::string> list;
+	for (; first != last; first++)
+		if (first->length() > 0)
+			list.emplace_back(*first);
+	return list;
 }
 
-
-std::vector<std::string> split_string(const string& str, const regex& delim_regex) {
-	sregex_token_iterator first{ begin(str), end(str), delim_regex, -1 }, last;
-	return vector<string>{ first, last };
+inline float3 ParseVector3(const std::string& value) {
+	const std::vector<std::string> list = SplitString(value, std::regex("(,| )+"));
+	if (list.size() == 1)
+		return float3(std::stof(list[0]));
+	else if (list.size() == 3)
+		return float3(std::stof(list[0]), std::stof(list[1]), std::stof(list[2]));
+	throw std::runtime_error("Failed to parse vector: " + value);
 }
 
-float3 parse_vector3(const string& value) {
-	vector<string> list = split_string(value, regex("(,| )+"));
-	float3 v;
-	if (list.size() == 1) {
-		v[0] = stof(list[0]);
-		v[1] = stof(list[0]);
-		v[2] = stof(list[0]);
-	} else if (list.size() == 3) {
-		v[0] = stof(list[0]);
-		v[1] = stof(list[1]);
-		v[2] = stof(list[2]);
-	} else {
-		throw runtime_error("parse_vector3 failed");
-	}
-	return v;
-}
-
-float3 parse_srgb(const string& value) {
-	float3 srgb;
-	if (value.size() == 7 && value[0] == '#') {
-		char* end_ptr = NULL;
-		// parse hex code (#abcdef)
-		int encoded = strtol(value.c_str() + 1, &end_ptr, 16);
-		if (*end_ptr != '\0') {
-			throw runtime_error("Invalid sRGB value: " + value);
-		}
-		srgb[0] = ((encoded & 0xFF0000) >> 16) / 255.0f;
-		srgb[1] = ((encoded & 0x00FF00) >> 8) / 255.0f;
-		srgb[2] = (encoded & 0x0000FF) / 255.0f;
-	} else {
-		throw runtime_error("Unsupported sRGB format: " + value);
-	}
-	return srgb;
+inline float3 ParseSrgb(const std::string& value) {
+	if (value.size() != 7 || value[0] != '#')
+		throw std::runtime_error("Unsupported sRGB format: " + value);
+	// parse hex code (#abcdef)
+	char* end_ptr = nullptr;
+	const long encoded = std::strtol(value.c_str() + 1, &end_ptr, 16);
+	if (*end_ptr != '\0')
+		throw std::runtime_error("Invalid sRGB value: " + value);
+	return float3(
+		((encoded & 0xFF0000) >> 16) / 255.0f,
+		((encoded & 0x00FF00) >> 8) / 255.0f,
+		 (encoded & 0x0000FF) / 255.0f);
 }
 
-std::vector<std::pair<float, float>> parse_spectrum(const string& value) {
-	vector<string> list = split_string(value, regex("(,| )+"));
-	vector<pair<float, float>> s;
-	if (list.size() == 1 && list[0].find(":") == string::npos) {
-		// a single uniform value for all wavelength
-		s.push_back(make_pair(float(-1), stof(list[0])));
+inline std::vector<std::pair<float, float>> ParseSpectrum(const std::string& value) {
+	const std::vector<std::string> list = SplitString(value, std::regex("(,| )+"));
+	std::vector<std::pair<float, float>> s;
+	if (list.size() == 1 && list[0].find(":") == std::string::npos) {
+		// a single uniform value for all wavelengths
+		s.emplace_back(-1.f, std::stof(list[0]));
 	} else {
-		for (auto val_str : list) {
-			vector<string> pair = split_string(val_str, regex(":"));
-			if (pair.size() < 2) {
-				throw runtime_error("parse_spectrum failed");
-			}
-			s.push_back(make_pair(float(stof(pair[0])), float(stof(pair[1]))));
+		for (const std::string& val_str : list) {
+			const std::vector<std::string> pair = SplitString(val_str, std::regex(":"));
+			if (pair.size() < 2) throw std::runtime_error("Failed to parse spectrum: " + value);
+			s.emplace_back(std::stof(pair[0]), std::stof(pair[1]));
 		}
 	}
 	return s;
 }
 
-float4x4 parse_matrix4x4(const string& value) {
-	vector<string> list = split_string(value, regex("(,| )+"));
+inline float4x4 ParseMatrix4x4(const std::string& value) {
+	const std::vector<std::string> list = SplitString(value, std::regex("(,| )+"));
 	if (list.size() != 16)
-		throw runtime_error("parse_matrix4x4 failed");
-
-	Eigen::Matrix4f m;
-	int k = 0;
+		throw std::runtime_error("Failed to parse matrix: " + value);
+	// row major in the file
+	float4x4 m;
 	for (int i = 0; i < 4; i++)
 		for (int j = 0; j < 4; j++)
-			m(i, j) = stof(list[k++]);
+			m[j][i] = std::stof(list[i*4 + j]);
 	return m;
 }
 
-float4x4 parse_transform(pugi::xml_node node) {
-	TransformData t;
-	for (auto child : node.children()) {
-		string name = child.name();
-		for (char& c : name) c = tolower(c);
+inline float ParseFloatAttribute(const pugi::xml_node node, const char* name, const float defaultValue) {
+	const pugi::xml_attribute a = node.attribute(name);
+	return a.empty() ? defaultValue : std::stof(a.value());
+}
+
+// Each child element is applied after the ones before it
+inline float4x4 ParseTransform(const pugi::xml_node node) {
+	float4x4 t = float4x4(1);
+	for (const pugi::xml_node child : node.children()) {
+		std::string name = child.name();
+		for (char& c : name) c = std::tolower(c);
 
 		if (name == "scale") {
-			float x = 1;
-			float y = 1;
-			float z = 1;
-			if (!child.attribute("x").empty())
-				x = stof(child.attribute("x").value());
-			if (!child.attribute("y").empty())
-				y = stof(child.attribute("y").value());
-			if (!child.attribute("z").empty())
-				z = stof(child.attribute("z").value());
-			if (!child.attribute("value").empty())
-				x = y = z = stof(child.attribute("value").value());
-			t = tmul(TransformData(float3::Zero(), quatf::identity(), float3(x, y, z)), t);
+			const float v = ParseFloatAttribute(child, "value", 1);
+			t = glm::scale(float3(
+				ParseFloatAttribute(child, "x", v),
+				ParseFloatAttribute(child, "y", v),
+				ParseFloatAttribute(child, "z", v))) * t;
 		} else if (name == "translate") {
-			float x = 0;
-			float y = 0;
-			float z = 0;
-			if (!child.attribute("x").empty())
-				x = stof(child.attribute("x").value());
-			if (!child.attribute("y").empty())
-				y = stof(child.attribute("y").value());
-			if (!child.attribute("z").empty())
-				z = stof(child.attribute("z").value());
-			t = tmul(TransformData(float3(x, y, z), quatf::identity(), float3::Ones()), t);
+			t = glm::translate(float3(
+				ParseFloatAttribute(child, "x", 0),
+				ParseFloatAttribute(child, "y", 0),
+				ParseFloatAttribute(child, "z", 0))) * t;
 		} else if (name == "rotate") {
-			float x = 0;
-			float y = 0;
-			float z = 0;
-			float angle = 0;
-			if (!child.attribute("x").empty())
-				x = stof(child.attribute("x").value());
-			if (!child.attribute("y").empty())
-				y = stof(child.attribute("y").value());
-			if (!child.attribute("z").empty())
-				z = stof(child.attribute("z").value());
-			if (!child.attribute("angle").empty())
-				angle = radians(stof(child.attribute("angle").value()));
-			t = tmul(TransformData(float3::Zero(), quatf::angleAxis(angle, float3(x, y, z)), float3::Ones()), t);
+			const float3 axis = float3(
+				ParseFloatAttribute(child, "x", 0),
+				ParseFloatAttribute(child, "y", 0),
+				ParseFloatAttribute(child, "z", 0));
+			t = glm::rotate(glm::radians(ParseFloatAttribute(child, "angle", 0)), glm::normalize(axis)) * t;
 		} else if (name == "lookat") {
-			const float3 pos    = parse_vector3(child.attribute("origin").value());
-			const float3 target = parse_vector3(child.attribute("target").value());
-			float3 up = parse_vector3(child.attribute("up").value());
-
-			const float3 fwd = (target - pos).matrix().normalized();
-			up = (up - dot(up, fwd) * fwd).matrix().normalized();
-			const float3 r = normalize(cross(up, fwd));
-			t = tmul(TransformData(pos, quatf(r, up, fwd), float3::Ones()), t);
+			const float3 pos    = ParseVector3(child.attribute("origin").value());
+			const float3 target = ParseVector3(child.attribute("target").value());
+			float3 up = ParseVector3(child.attribute("up").value());
+
+			const float3 fwd = glm::normalize(target - pos);
+			up = glm::normalize(up - glm::dot(up, fwd) * fwd);
+			const float3 r = glm::normalize(glm::cross(up, fwd));
+			t = float4x4(float4(r, 0), float4(up, 0), float4(fwd, 0), float4(pos, 1)) * t;
 		} else if (name == "matrix") {
-			t = tmul(TransformData(parse_matrix4x4(string(child.attribute("value").value())).block<3,4>(0,0)), t);
+			t = ParseMatrix4x4(child.attribute("value").value()) * t;
 		}
 	}
 	return t;
 }
 
-float3 XYZintegral_coeff(const float wavelength) {
+inline float3 XyzIntegralCoeff(const float wavelength) {
 	// To support spectral data, we need to convert spectral measurements (how much energy at each wavelength) to
 	// RGB. To do this, we first convert the spectral data to CIE XYZ, by
 	// integrating over the XYZ response curve. Here we use an analytical response
 	// curve proposed by Wyman et al.: https://jcgt.org/published/0002/02/01/
-	float3 rgb;
+	float3 xyz;
 	{
 		const float t1 = (wavelength - 442.0f) * ((wavelength < 442.0f) ? 0.0624f : 0.0374f);
 		const float t2 = (wavelength - 599.8f) * ((wavelength < 599.8f) ? 0.0264f : 0.0323f);
 		const float t3 = (wavelength - 501.1f) * ((wavelength < 501.1f) ? 0.0490f : 0.0382f);
-		rgb[0] = 0.362f * exp(-0.5f * t1 * t1) + 1.056f * exp(-0.5f * t2 * t2) - 0.065f * exp(-0.5f * t3 * t3);
+		xyz[0] = 0.362f * std::exp(-0.5f * t1 * t1) + 1.056f * std::exp(-0.5f * t2 * t2) - 0.065f * std::exp(-0.5f * t3 * t3);
 	}
 	{
-		const float t1 = (wavelength - 568.8) * ((wavelength < 568.8) ? 0.0213 : 0.0247f);
-		const float t2 = (wavelength - 530.9) * ((wavelength < 530.9) ? 0.0613 : 0.0322f);
-		rgb[1] = 0.821f * exp(-0.5f * t1 * t1) + 0.286f * exp(-0.5f * t2 * t2);
+		const float t1 = (wavelength - 568.8f) * ((wavelength < 568.8f) ? 0.0213f : 0.0247f);
+		const float t2 = (wavelength - 530.9f) * ((wavelength < 530.9f) ? 0.0613f : 0.0322f);
+		xyz[1] = 0.821f * std::exp(-0.5f * t1 * t1) + 0.286f * std::exp(-0.5f * t2 * t2);
 	}
 	{
-		const float t1 = (wavelength - 437.0) * ((wavelength < 437.0) ? 0.0845 : 0.0278f);
-		const float t2 = (wavelength - 459.0) * ((wavelength < 459.0) ? 0.0385 : 0.0725f);
-		rgb[2] = 1.217f * exp(-0.5f * t1 * t1) +0.681f * exp(-0.5f * t2 * t2);
+		const float t1 = (wavelength - 437.0f) * ((wavelength < 437.0f) ? 0.0845f : 0.0278f);
+		const float t2 = (wavelength - 459.0f) * ((wavelength < 459.0f) ? 0.0385f : 0.0725f);
+		xyz[2] = 1.217f * std::exp(-0.5f * t1 * t1) + 0.681f * std::exp(-0.5f * t2 * t2);
 	}
-	return rgb;
+	return xyz;
 }
 
-float3 integrate_XYZ(const std::vector<std::pair<float, float>>& data) {
+inline float3 IntegrateXyz(const std::vector<std::pair<float, float>>& data) {
 	static const float CIE_Y_integral = 106.856895f;
 	static const float wavelength_beg = 400;
 	static const float wavelength_end = 700;
-	if (data.size() == 0) {
-		return float3::Zero();
-	}
-	float3 ret = float3::Zero();
+	if (data.size() == 0)
+		return float3(0);
+	float3 ret = float3(0);
 	int data_pos = 0;
 	// integrate from wavelength 400 nm to 700 nm, increment by 1nm at a time
 	// linearly interpolate from the data
-	for (float wavelength = wavelength_beg; wavelength <= wavelength_end; wavelength += float(1)) {
+	for (float wavelength = wavelength_beg; wavelength <= wavelength_end; wavelength += 1.f) {
 		// assume the spectrum data is sorted by wavelength
 		// move data_pos such that wavelength is between two data or at one end
-		while(data_pos < (int)data.size() - 1 && !((data[data_pos].first <= wavelength && data[data_pos + 1].first > wavelength) || data[0].first > wavelength)) {
+		while (data_pos < (int)data.size() - 1 && !((data[data_pos].first <= wavelength && data[data_pos + 1].first > wavelength) || data[0].first > wavelength))
 			data_pos += 1;
-		}
 		float measurement = 0;
 		if (data_pos < (int)data.size() - 1 && data[0].first <= wavelength) {
 			const float curr_data = data[data_pos].second;
-			const float next_data = data[std::min(data_pos + 1, (int)data.size() - 1)].second;
+			const float next_data = data[data_pos + 1].second;
 			const float curr_wave = data[data_pos].first;
-			const float next_wave = data[std::min(data_pos + 1, (int)data.size() - 1)].first;
+			const float next_wave = data[data_pos + 1].first;
 			// linearly interpolate
 			measurement = curr_data * (next_wave - wavelength) / (next_wave - curr_wave) +
-										next_data * (wavelength - curr_wave) / (next_wave - curr_wave);
+			              next_data * (wavelength - curr_wave) / (next_wave - curr_wave);
 		} else {
 			// assign the endpoint
 			measurement = data[data_pos].second;
 		}
-		const float3 coeff = XYZintegral_coeff(wavelength);
-		ret += coeff * measurement;
+		ret += XyzIntegralCoeff(wavelength) * measurement;
 	}
-	const float wavelength_span = wavelength_end - wavelength_beg;
-	ret *= (wavelength_span / (CIE_Y_integral * (wavelength_end - wavelength_beg)));
-	return ret;
+	return ret / CIE_Y_integral;
 }
 
-float3 parse_color(pugi::xml_node node) {
-	string type = node.name();
+inline float3 ParseColor(const pugi::xml_node node) {
+	const std::string type = node.name();
 	if (type == "spectrum") {
-		vector<pair<float, float>> spec = parse_spectrum(node.attribute("value").value());
-		if (spec.size() > 1) {
-			return xyzToRgb(integrate_XYZ(spec));
-		} else if (spec.size() == 1) {
-			return float3::Ones();
-		} else {
-			return float3::Zero();
-		}
-	} else if (type == "rgb") {
-		return parse_vector3(node.attribute("value").value());
-	} else if (type == "srgb") {
-		float3 srgb = parse_srgb(node.attribute("value").value());
-		return srgbToRgb(srgb);
-	} else if (type == "float") {
-		return float3::Constant(stof(node.attribute("value").value()));
-	} else {
-		throw runtime_error("Unsupported color type: " + type);
-		return float3::Zero();
+		const std::vector<std::pair<float, float>> spec = ParseSpectrum(node.attribute("value").value());
+		if (spec.size() > 1)
+			return XyzToRgb(IntegrateXyz(spec));
+		else if (spec.size() == 1)
+			return float3(spec[0].second);
+		else
+			return float3(0);
+	} else if (type == "rgb")
+		return ParseVector3(node.attribute("value").value());
+	else if (type == "srgb")
+		return SrgbToRgb(ParseSrgb(node.attribute("value").value()));
+	else if (type == "float")
+		return float3(std::stof(node.attribute("value").value()));
+	throw std::runtime_error("Unsupported color type: " + type);
+}
+
+// Like ParseColor, but a single spectrum value is relative to the white point of emitters
+inline float3 ParseRadiance(const pugi::xml_node node) {
+	if (std::string(node.name()) == "spectrum") {
+		const std::vector<std::pair<float, float>> spec = ParseSpectrum(node.attribute("value").value());
+		// For a light source, the white point is XYZ(0.9505, 1.0, 1.0888) instead of XYZ(1, 1, 1).
+		// We need to handle this special case when we don't have the full spectrum data.
+		if (spec.size() == 1)
+			return XyzToRgb(float3(0.9505f, 1.0f, 1.0888f) * spec[0].second);
 	}
+	return ParseColor(node);
 }
 
+#pragma endregion
 
-Mesh create_mesh(CommandBuffer& commandBuffer, const vector<float3>& vertices, const vector<float3>& normals, const vector<float2>& uvs, const vector<uint32_t>& indices) {
-	vk::BufferUsageFlags bufferUsage = vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer;
-	if (commandBuffer.mDevice.accelerationStructureFeatures().accelerationStructure) {
-		bufferUsage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
-		bufferUsage |= vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
-	}
+class MitsubaParser {
+public:
+	// Meshes are created after the whole file is parsed, so that they can be inflated in parallel
+	struct PendingMesh {
+		std::string mType;
+		std::filesystem::path mFilename;
+		uint32_t mShapeIndex = 0;
+	};
 
-	// create staging buffers
-	Buffer::View<float3> positions_tmp = make_shared<Buffer>(commandBuffer.mDevice, "positions_tmp", vertices.size() * sizeof(float3), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-	Buffer::View<float3> normals_tmp   = make_shared<Buffer>(commandBuffer.mDevice, "normals_tmp", normals.size() * sizeof(float3)   , vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-	Buffer::View<float2> texcoords_tmp = make_shared<Buffer>(commandBuffer.mDevice, "texcoords_tmp", uvs.size() * sizeof(float2)     , vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-	Buffer::View<uint32_t> indices_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp indices", indices.size() * sizeof(uint32_t) , vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-
-	// compute aabb
-	float3 vmin = float3::Constant(numeric_limits<float>::infinity());
-	float3 vmax = float3::Constant(-numeric_limits<float>::infinity());
-	for (const float3& p : vertices) {
-		vmin = min(vmin, p);
-		vmax = min(vmax, p);
-	}
+	Scene& mScene;
+	CommandBuffer& mCommandBuffer;
+	std::filesystem::path mDirectory;
 
-	// copy vertex data to staging buffers
-	memcpy(positions_tmp.data(), vertices.data(), positions_tmp.sizeBytes());
-	memcpy(normals_tmp.data(), vertices.data(), normals_tmp.sizeBytes());
-	memcpy(texcoords_tmp.data(), vertices.data(), texcoords_tmp.sizeBytes());
-	memcpy(indices_tmp.data(), indices.data(), indices_tmp.sizeBytes());
-
-	// copy vertex data to gpu buffers
-	Buffer::View<float3> positions_buf = make_shared<Buffer>(commandBuffer.mDevice, "positions", positions_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-	Buffer::View<float3> normals_buf   = make_shared<Buffer>(commandBuffer.mDevice, "normals"  , normals_tmp.sizeBytes()  , bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-	Buffer::View<float2> texcoords_buf = make_shared<Buffer>(commandBuffer.mDevice, "texcoords", texcoords_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-	Buffer::View<uint32_t> indices_buf = make_shared<Buffer>(commandBuffer.mDevice, "indices"  , indices_tmp.sizeBytes()  , bufferUsage|vk::BufferUsageFlagBits::eIndexBuffer);
-	Buffer::copy(commandBuffer, positions_tmp, positions_buf);
-	Buffer::copy(commandBuffer, normals_tmp, normals_buf);
-	Buffer::copy(commandBuffer, texcoords_tmp, texcoords_buf);
-	Buffer::copy(commandBuffer, indices_tmp, indices_buf);
-
-	// construct mesh object
-	Mesh::Vertices vertexArray;
-	vertexArray[Mesh::VertexAttributeType::ePosition].emplace_back(positions_buf, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
-	vertexArray[Mesh::VertexAttributeType::eNormal].emplace_back(normals_buf, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
-	vertexArray[Mesh::VertexAttributeType::eTexcoord].emplace_back(texcoords_buf, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float2), vk::Format::eR32G32Sfloat, 0, vk::VertexInputRate::eVertex });
-	vertexArray.mAabb = vk::AabbPositionsKHR(vmin[0], vmin[1], vmin[2], vmax[0], vmax[1], vmax[2]);
-	return Mesh(vertexArray, indices_buf, vk::PrimitiveTopology::eTriangleList);
-}
+	std::unordered_map<std::string /* id */, std::shared_ptr<Material>> mMaterials;
+	std::unordered_map<std::string /* id */, Image::View> mTextures;
+	std::unordered_map<std::string /* path */, Image::View> mImageFiles;
+	std::unordered_map<std::string /* path */, std::vector<std::shared_ptr<Mesh>>> mObjMeshes;
+	std::unordered_map<std::string /* path */, SerializedFile> mSerializedFiles;
 
-// parse "texture" node
-Image::View parse_texture(CommandBuffer& commandBuffer, pugi::xml_node node) {
-	const string type = node.attribute("type").value();
-
-	filesystem::path filename;
-	float3 color0 = float3::Constant(0.4f);
-	float3 color1 = float3::Constant(0.2f);
-	float uscale = 1;
-	float vscale = 1;
-	float uoffset = 0;
-	float voffset = 0;
-
-	for (auto child : node.children()) {
-		string name = child.attribute("name").value();
-		if (name == "filename") {
-			filename = child.attribute("value").value();
-		} else if (name == "color0") {
-			color0 = parse_color(child);
-		} else if (name == "color1") {
-			color1 = parse_color(child);
-		} else if (name == "uvscale") {
-			uscale = vscale = stof(child.attribute("value").value());
-		} else if (name == "uscale") {
-			uscale = stof(child.attribute("value").value());
-		} else if (name == "vscale") {
-			vscale = stof(child.attribute("value").value());
-		} else if (name == "uoffset") {
-			uoffset = stof(child.attribute("value").value());
-		} else if (name == "voffset") {
-			voffset = stof(child.attribute("value").value());
-		}
+	std::vector<PendingMesh> mPendingMeshes;
+	std::unordered_map<std::string, size_t> mPendingMeshIndices;
+	std::vector<std::pair<std::shared_ptr<MeshRenderer>, size_t>> mPendingRenderers;
+
+	std::shared_ptr<Material> mDefaultMaterial;
+
+	inline MitsubaParser(Scene& scene, CommandBuffer& commandBuffer, const std::filesystem::path& filename)
+		: mScene(scene), mCommandBuffer(commandBuffer), mDirectory(filename.parent_path()) {}
+
+	inline std::filesystem::path ResolvePath(const std::filesystem::path& path) const {
+		return path.is_relative() ? mDirectory / path : path;
 	}
 
-	if (type == "bitmap") {
-		Image::Metadata metadata;
-		const Image::PixelData pixels = Image::loadFile(commandBuffer.mDevice, filename, 0, 4);
-		metadata.mExtent = get<vk::Extent3D>(pixels);
-		metadata.mFormat = get<vk::Format>(pixels);
-		metadata.mUsage = vk::ImageUsageFlagBits::eTransferDst|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eStorage;
-		auto img = make_shared<Image>(commandBuffer.mDevice, filename.stem().string(), metadata);
-		commandBuffer.trackResource(img);
-		img->upload(commandBuffer, pixels);
-		img->generateMipMaps(commandBuffer);
-		return img;
-	} else if (type == "checkerboard") {
-		Image::Metadata metadata;
-		metadata.mExtent = vk::Extent3D(512, 512, 1);
-		metadata.mFormat = vk::Format::eR8G8B8A8Unorm;
-		metadata.mUsage = vk::ImageUsageFlagBits::eTransferDst|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eStorage;
-
-		Buffer::View<byte> buf = make_shared<Buffer>(commandBuffer.mDevice, "checkerboard pixels", metadata.mExtent.width*metadata.mExtent.height*4, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-
-		for (uint32_t y = 0; y < metadata.mExtent.height; y++)
-			for (uint32_t x = 0; x < metadata.mExtent.width; x++) {
-				const float u = uoffset + uscale * (x + 0.5f) / (float)metadata.mExtent.width;
-				const float v = voffset + vscale * (y + 0.5f) / (float)metadata.mExtent.height;
-				const float3 c = fmodf(fmodf(floorf(u/2), 2.f) + fmodf(floorf(v/2), 2.f), 2.f) < 1 ? color0 : color1;
-				const size_t addr = 4*(y*metadata.mExtent.width + x);
-				buf[addr+0] = (byte)(c[0] * 0xFF);
-				buf[addr+1] = (byte)(c[1] * 0xFF);
-				buf[addr+2] = (byte)(c[2] * 0xFF);
-				buf[addr+3] = (byte)(0xFF);
-			}
+	inline Image::View UploadImage(const std::string& name, const std::span<const std::byte> pixels, const vk::Format format, const vk::Extent3D& extent, const std::shared_ptr<Buffer>& pixelBuffer = {}) {
+		const std::vector<std::vector<std::byte>> levels = GenerateMipChain(pixels, format, extent);
+
+		ImageInfo md = {};
+		md.mFormat = format;
+		md.mExtent = extent;
+		md.mUsage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+		if (!levels.empty()) {
+			md.mLevels = (uint32_t)levels.size();
+			return mCommandBuffer.UploadShared(levels, md, name);
+		}
 
-		auto img = make_shared<Image>(commandBuffer.mDevice, "checkerboard", metadata);
-		commandBuffer.trackResource(img);
-		img->upload(commandBuffer, Image::PixelData { buf.buffer(), metadata.mFormat, metadata.mExtent });
-		img->generateMipMaps(commandBuffer);
+		const std::shared_ptr<Image> img = std::make_shared<Image>(mCommandBuffer.mDevice, name, md);
+		if (pixelBuffer) {
+			mCommandBuffer.Copy(pixelBuffer, img);
+			mCommandBuffer.HoldResource(pixelBuffer);
+		} else
+			throw std::runtime_error("Cannot upload " + name + ": unsupported format " + vk::to_string(format));
 		return img;
 	}
-	throw runtime_error("Unsupported texture type: " + type + " for " + node.attribute("name").value());
-}
 
-ImageValue<3> parse_spectrum_texture(CommandBuffer& commandBuffer, pugi::xml_node node, unordered_map<string /* name id */, Image::View>& texture_map) {
-	const string type = node.name();
+	// parse "texture" node
+	inline Image::View ParseTexture(const pugi::xml_node node) {
+		const std::string type = node.attribute("type").value();
+
+		std::filesystem::path filename;
+		float3 color0 = float3(0.4f);
+		float3 color1 = float3(0.2f);
+		float uscale = 1;
+		float vscale = 1;
+		float uoffset = 0;
+		float voffset = 0;
+
+		for (const pugi::xml_node child : node.children()) {
+			const std::string name = child.attribute("name").value();
+			if      (name == "filename") filename = ResolvePath(child.attribute("value").value());
+			else if (name == "color0")   color0 = ParseColor(child);
+			else if (name == "color1")   color1 = ParseColor(child);
+			else if (name == "uvscale")  uscale = vscale = std::stof(child.attribute("value").value());
+			else if (name == "uscale")   uscale = std::stof(child.attribute("value").value());
+			else if (name == "vscale")   vscale = std::stof(child.attribute("value").value());
+			else if (name == "uoffset")  uoffset = std::stof(child.attribute("value").value());
+			else if (name == "voffset")  voffset = std::stof(child.attribute("value").value());
+		}
 
-	if (type == "spectrum") {
-		vector<pair<float, float>> spec =
-			parse_spectrum(node.attribute("value").value());
-		if (spec.size() > 1) {
-			float3 xyz = integrate_XYZ(spec);
-			return ImageValue<3>{xyzToRgb(xyz), {}};
-		} else if (spec.size() == 1) {
-			return ImageValue<3>{float3::Ones(), {}};
-		} else {
-			return ImageValue<3>{float3::Zero(), {}};
+		if (type == "bitmap") {
+			if (auto it = mImageFiles.find(filename.string()); it != mImageFiles.end())
+				return it->second;
+			const auto[pixels, format, extent] = LoadImageFile(mCommandBuffer.mDevice, filename);
+			const Image::View img = UploadImage(filename.filename().string(), std::span(reinterpret_cast<const std::byte*>(pixels->data()), pixels->size()), format, extent, pixels);
+			mImageFiles.emplace(filename.string(), img);
+			return img;
+		} else if (type == "checkerboard") {
+			const vk::Extent3D extent(512, 512, 1);
+			std::vector<std::byte> pixels(extent.width * extent.height * 4);
+			for (uint32_t y = 0; y < extent.height; y++)
+				for (uint32_t x = 0; x < extent.width; x++) {
+					const float u = uoffset + uscale * (x + 0.5f) / (float)extent.width;
+					const float v = voffset + vscale * (y + 0.5f) / (float)extent.height;
+					const float3 c = ((int)std::floor(2*u) + (int)std::floor(2*v)) % 2 == 0 ? color0 : color1;
+					const size_t addr = 4*(y*extent.width + x);
+					for (uint32_t i = 0; i < 3; i++)
+						pixels[addr + i] = (std::byte)(std::clamp(c[i], 0.f, 1.f) * 0xFF);
+					pixels[addr + 3] = (std::byte)0xFF;
+				}
+			return UploadImage("checkerboard", pixels, vk::Format::eR8G8B8A8Unorm, extent);
 		}
-	} else if (type == "rgb") {
-		return ImageValue<3>{parse_vector3(node.attribute("value").value()), {}};
-	} else if (type == "srgb") {
-		float3 srgb = parse_srgb(node.attribute("value").value());
-		return ImageValue<3>{srgbToRgb(srgb), {}};
-	} else if (type == "ref") {
-		// referencing a texture
-		string ref_id = node.attribute("id").value();
-		auto t_it = texture_map.find(ref_id);
-		if (t_it == texture_map.end()) {
-			throw runtime_error("Texture not found: " + ref_id);
+		throw std::runtime_error("Unsupported texture type: " + type + " for " + node.attribute("name").value());
+	}
+
+	inline Image::View ParseTextureReference(const pugi::xml_node node) {
+		if (std::string(node.name()) == "ref") {
+			const std::string id = node.attribute("id").value();
+			auto it = mTextures.find(id);
+			if (it == mTextures.end()) throw std::runtime_error("Texture not found: " + id);
+			return it->second;
 		}
-		return ImageValue<3>{float3::Ones(), t_it->second};
-	} else if (type == "texture") {
-		Image::View t = parse_texture(commandBuffer, node);
+		const Image::View t = ParseTexture(node);
 		if (!node.attribute("id").empty()) {
-			string id = node.attribute("id").value();
-			if (texture_map.find(id) != texture_map.end()) throw runtime_error("Duplicate texture ID: " + id);
-			texture_map.emplace(id, t);
+			const std::string id = node.attribute("id").value();
+			if (mTextures.find(id) != mTextures.end()) throw std::runtime_error("Duplicate texture ID: " + id);
+			mTextures.emplace(id, t);
 		}
-		return ImageValue<3>{float3::Ones(), t};
+		return t;
 	}
 
-	throw runtime_error("Unsupported spectrum texture type: " + type);
-}
+	inline Scene::ImageValue3 ParseSpectrumTexture(const pugi::xml_node node) {
+		const std::string type = node.name();
+		if (type == "ref" || type == "texture")
+			return { float3(1), ParseTextureReference(node) };
+		return { ParseColor(node), {} };
+	}
 
-ImageValue<1> parse_float_texture(CommandBuffer& commandBuffer, pugi::xml_node node, unordered_map<string /* name id */, Image::View>& texture_map) {
-	const string type = node.name();
-
-	if (type == "ref") {
-		// referencing a texture
-		string ref_id = node.attribute("id").value();
-		auto t_it = texture_map.find(ref_id);
-		if (t_it == texture_map.end()) throw runtime_error("Texture not found: " + ref_id);
-		return { float1::Ones(), t_it->second };
-	} else if (type == "float") {
-		return { float1::Constant(stof(node.attribute("value").value())), {} };
-	} else if (type == "texture") {
-		Image::View t = parse_texture(commandBuffer, node);
-		if (!node.attribute("id").empty()) {
-			string id = node.attribute("id").value();
-			if (texture_map.find(id) != texture_map.end()) throw runtime_error("Duplicate texture ID: " + id);
-			texture_map.emplace(id, t);
+	// Mitsuba's alpha is the squared roughness. Textured alpha is unsupported, so only constants are converted.
+	inline float ParseRoughness(const pugi::xml_node node, const float defaultRoughness) {
+		const std::string type = node.name();
+		const std::string name = node.attribute("name").value();
+		if (type == "float") {
+			const float v = std::stof(node.attribute("value").value());
+			return name == "alpha" ? std::sqrt(v) : v;
 		}
-		return { float1::Ones(), t };
+		std::cout << "Warning: textured " << name << " is unsupported, using a constant roughness of " << defaultRoughness << std::endl;
+		return defaultRoughness;
 	}
 
-	throw runtime_error("Unsupported float texture type: " + type);
-}
-
-std::shared_ptr<Material> parse_bsdf(Scene& scene, Node& dst, CommandBuffer& commandBuffer, pugi::xml_node node, unordered_map<string /* name id */, shared_ptr<Material>>& material_map, unordered_map<string /* name id */, Image::View>& texture_map) {
-	string type = node.attribute("type").value();
+	inline std::shared_ptr<Material> ParseBsdf(pugi::xml_node node) {
+		std::string type = node.attribute("type").value();
 
-	unordered_set<string> ids;
-	if (!node.attribute("id").empty()) ids.emplace(node.attribute("id").value());
-	while (type == "twosided" || type == "bumpmap" || type == "mask") {
-		if (node.child("bsdf").empty()) throw runtime_error(type + " has no child BSDF");
-		node = node.child("bsdf");
-		type = node.attribute("type").value();
+		std::unordered_set<std::string> ids;
 		if (!node.attribute("id").empty()) ids.emplace(node.attribute("id").value());
-	}
-
-	string name = !ids.empty() ? *ids.begin() : (type + " BSDF");
-
-	if (type == "diffuse") {
-		ImageValue<3> diffuse { float3::Constant(0.5f) };
-		for (auto child : node.children()) {
-			string name = child.attribute("name").value();
-			if (name == "reflectance")
-				diffuse = parse_spectrum_texture(commandBuffer, child, texture_map);
+		while (type == "twosided" || type == "bumpmap" || type == "mask") {
+			if (node.child("bsdf").empty()) throw std::runtime_error(type + " has no child BSDF");
+			node = node.child("bsdf");
+			type = node.attribute("type").value();
+			if (!node.attribute("id").empty()) ids.emplace(node.attribute("id").value());
 		}
-		auto m = dst.addChild(name)->makeComponent<Material>();
-		m->mMaterialData.setBaseColor(diffuse.mValue);
-		m->mImages[0] = diffuse.mImage;
-		m->mMaterialData.setMetallic(0);
-		m->mMaterialData.setEta(1.5f);
-		for (const string& id : ids)
-			if (!id.empty()) material_map[id] = m;
-		return m;
-	} else if (type == "roughplastic" || type == "plastic" || type == "conductor" || type == "roughconductor") {
-		ImageValue<3> diffuse  { float3::Ones(), {} };
-		ImageValue<3> specular { float3::Zero(), {} };
-		ImageValue<1> roughness { float1::Constant((type == "plastic" || type == "conductor") ? 0 : 0.1f), {} };
-
-		float intIOR = 1.49;
-		float extIOR = 1.000277;
-		float eta = intIOR / extIOR;
-		for (auto child : node.children()) {
-			string name = child.attribute("name").value();
-			if (name == "diffuseReflectance") {
-				diffuse = parse_spectrum_texture(commandBuffer, child, texture_map);
-			} else if (name == "specularReflectance") {
-				specular = parse_spectrum_texture(commandBuffer, child, texture_map);
-			} else if (name == "alpha") {
-				// Alpha requires special treatment since we need to convert
-				// the values to roughness
-				string type = child.name();
-				if (type == "ref") {
-					// referencing a texture
-					string ref_id = child.attribute("id").value();
-					auto t_it = texture_map.find(ref_id);
-					if (t_it == texture_map.end()) throw runtime_error("Texture not found: " + ref_id);
-					roughness = scene.alphaToRoughness(commandBuffer, { float1::Ones(), t_it->second });
-				} else if (type == "float") {
-					float alpha = stof(child.attribute("value").value());
-					roughness.mValue = sqrt(alpha);
-				} else
-					throw runtime_error("Unsupported float texture type: " + type);
-			} else if (name == "roughness") {
-				roughness = parse_float_texture(commandBuffer, child, texture_map);
-			} else if (name == "intIOR") {
-				intIOR = stof(child.attribute("value").value());
-				eta = intIOR / extIOR;
-			} else if (name == "extIOR") {
-				extIOR = stof(child.attribute("value").value());
-				eta = intIOR / extIOR;
+
+		Material m;
+		if (type == "roughplastic" || type == "plastic" || type == "roughconductor" || type == "conductor" || type == "roughdielectric" || type == "dielectric" || type == "thindielectric") {
+			const bool conductor = type == "roughconductor" || type == "conductor";
+			const bool dielectric = type == "roughdielectric" || type == "dielectric" || type == "thindielectric";
+
+			Scene::ImageValue3 baseColor = { float3(conductor || dielectric ? 1 : 0.5f), {} };
+			float roughness = type.starts_with("rough") ? std::sqrt(0.1f) : 0.f;
+			float intIOR = dielectric ? 1.5046f : 1.49f;
+			float extIOR = 1.000277f;
+			for (const pugi::xml_node child : node.children()) {
+				const std::string name = child.attribute("name").value();
+				if      (name == "diffuseReflectance" && !conductor && !dielectric)  baseColor = ParseSpectrumTexture(child);
+				else if (name == "specularReflectance" && conductor)                baseColor = ParseSpectrumTexture(child);
+				else if (name == "specularTransmittance" && dielectric)             baseColor = ParseSpectrumTexture(child);
+				else if (name == "alpha" || name == "roughness") roughness = ParseRoughness(child, roughness);
+				else if (name == "intIOR") intIOR = std::stof(child.attribute("value").value());
+				else if (name == "extIOR") extIOR = std::stof(child.attribute("value").value());
 			}
+			m = mScene.CreateMetallicRoughnessMaterial(mCommandBuffer, baseColor, { float4(0, roughness, conductor ? 1 : 0, 0), {} }, { float3(0), {} });
+			m.mMaterial.Eta(intIOR / extIOR);
+			if (dielectric)
+				m.mMaterial.Transmission(1);
+		} else {
+			if (type != "diffuse" && !type.empty())
+				std::cout << "Warning: unsupported BSDF type \"" << type << "\", using a diffuse BSDF instead" << std::endl;
+			Scene::ImageValue3 diffuse = { float3(0.5f), {} };
+			for (const pugi::xml_node child : node.children())
+				if (std::string(child.attribute("name").value()) == "reflectance")
+					diffuse = ParseSpectrumTexture(child);
+			m = mScene.CreateMetallicRoughnessMaterial(mCommandBuffer, diffuse, { float4(0, 1, 0, 0), {} }, { float3(0), {} });
+			m.mMaterial.Specular(0);
 		}
-		auto m = dst.addChild(name)->makeComponent<Material>(scene.makeDiffuseSpecularMaterial(commandBuffer, diffuse, specular, roughness, { float3::Zero(), {} }, eta, { float3::Zero(), {} }));
-		for (const string& id : ids)
-			if (!id.empty()) material_map[id] = m;
-		return m;
-	} else if (type == "roughdielectric" || type == "dielectric" || type == "thindielectric") {
-		ImageValue<3> diffuse       { float3::Zero(), {} };
-		ImageValue<3> specular      { float3::Zero(), {} };
-		ImageValue<3> transmittance { float3::Ones(), {} };
-		ImageValue<1> roughness     { float1::Constant((type == "dielectric") ? 0 : 0.1f), {} };
-		float intIOR = 1.5046;
-		float extIOR = 1.000277;
-		float eta = intIOR / extIOR;
-		for (auto child : node.children()) {
-			string name = child.attribute("name").value();
-			if (name == "specularReflectance") {
-				specular = parse_spectrum_texture(commandBuffer, child, texture_map);
-			} else if (name == "specularTransmittance") {
-				transmittance = parse_spectrum_texture(commandBuffer, child, texture_map);
-			} else if (name == "alpha") {
-				string type = child.name();
-				if (type == "ref") {
-					// referencing a texture
-					string ref_id = child.attribute("id").value();
-					auto t_it = texture_map.find(ref_id);
-					if (t_it == texture_map.end()) throw runtime_error("Texture not found: " + ref_id);
-					roughness.mImage = scene.alphaToRoughness(commandBuffer, { float1::Ones(), t_it->second }).mImage;
-				} else if (type == "float") {
-					roughness.mValue = sqrt(stof(child.attribute("value").value()));
-				} else
-					throw runtime_error("Unsupported float texture type: " + type);
-			} else if (name == "roughness") {
-				roughness = parse_float_texture(commandBuffer, child, texture_map);
-			} else if (name == "intIOR") {
-				intIOR = stof(child.attribute("value").value());
-				eta = intIOR / extIOR;
-			} else if (name == "extIOR") {
-				extIOR = stof(child.attribute("value").value());
-				eta = intIOR / extIOR;
+
+		const std::shared_ptr<Material> material = std::make_shared<Material>(m);
+		for (const std::string& id : ids)
+			mMaterials[id] = material;
+		return material;
+	}
+
+	inline void ParseShape(SceneNode& dst, const pugi::xml_node node) {
+		std::shared_ptr<Material> material;
+		std::optional<float3> emission;
+		std::filesystem::path filename;
+		uint32_t shapeIndex = 0;
+
+		for (const pugi::xml_node child : node.children()) {
+			const std::string name = child.name();
+			const std::string name_attrib = child.attribute("name").value();
+			if (name == "ref") {
+				const pugi::xml_attribute id = child.attribute("id");
+				if (id.empty()) throw std::runtime_error("Material reference id not specified.");
+				auto it = mMaterials.find(id.value());
+				if (it == mMaterials.end()) throw std::runtime_error("Material reference " + std::string(id.value()) + " not found.");
+				if (!material)
+					material = it->second;
+			} else if (name == "bsdf") {
+				material = ParseBsdf(child);
+			} else if (name == "emitter") {
+				emission = float3(1);
+				for (const pugi::xml_node grand_child : child.children())
+					if (std::string(grand_child.attribute("name").value()) == "radiance")
+						emission = ParseRadiance(grand_child);
+			} else if (name == "string" && name_attrib == "filename") {
+				filename = ResolvePath(child.attribute("value").value());
+			} else if (name == "transform" && name_attrib == "toWorld") {
+				dst.MakeComponent<float4x4>(ParseTransform(child));
+			} else if (name == "integer" && name_attrib == "shapeIndex") {
+				shapeIndex = std::stoi(child.attribute("value").value());
 			}
 		}
-		auto m = dst.addChild(name)->makeComponent<Material>(scene.makeDiffuseSpecularMaterial(commandBuffer, diffuse, specular, roughness, transmittance, eta, { float3::Zero(), {} }));
-		for (const string& id : ids)
-			if (!id.empty()) material_map[id] = m;
-		return m;
-	}
-
-	string idstr;
-	for (const string& id : ids)
-		idstr += id + " ";
 
-	cerr << "Unsupported BSDF type: \"" + type + "\" with IDs " + idstr << endl;
-	throw runtime_error("Unsupported BSDF type: \"" + type + "\" with IDs " + idstr);
-}
+		if (emission) {
+			// copy, as the BSDF may be shared with shapes that do not emit
+			if (material)
+				material = std::make_shared<Material>(*material);
+			else
+				material = std::make_shared<Material>(mScene.CreateMetallicRoughnessMaterial(mCommandBuffer, { float3(0), {} }, { float4(0, 1, 0, 0), {} }, { float3(0), {} }));
+			material->mMaterial.Emission(*emission);
+		}
+		if (!material) {
+			if (!mDefaultMaterial)
+				mDefaultMaterial = ParseBsdf(pugi::xml_node());
+			material = mDefaultMaterial;
+		}
 
-void parse_shape(Scene& scene, CommandBuffer& commandBuffer, Node& dst, pugi::xml_node node, unordered_map<string, shared_ptr<Material>>& material_map, unordered_map<string, Image::View>& texture_map, unordered_map<string, shared_ptr<Mesh>>& obj_map, unordered_map<pair<string,uint32_t>, shared_ptr<Mesh>>& serialized_map) {
-	shared_ptr<Material> material;
-	string filename;
-	int shape_index = -1;
-
-	// parse children first, to load material
-
-	for (auto child : node.children()) {
-		const string name = child.name();
-		if (name == "ref") {
-			const string name_value = child.attribute("name").value();
-			pugi::xml_attribute id = child.attribute("id");
-			if (id.empty()) throw runtime_error("Material reference id not specified.");
-			auto it = material_map.find(id.value());
-			if (it == material_map.end()) throw runtime_error("Material reference " + string(id.value()) + " not found.");
-			if (!material)
-				material = it->second;
-		} else if (name == "bsdf") {
-			// store previously-parsed emission
-			optional<float3> emission;
-			if (material) emission = material->mMaterialData.getEmission();
-			// parse material
-			material = parse_bsdf(scene, dst, commandBuffer, child, material_map, texture_map);
-			// override emission with previously parsed emission
-			if (emission) material->mMaterialData.setEmission(*emission);
-		} else if (name == "emitter") {
-			// make emission material
-			float3 radiance = float3::Ones();
-			for (auto grand_child : child.children()) {
-				string name = grand_child.attribute("name").value();
-				if (name == "radiance") {
-					string rad_type = grand_child.name();
-					if (rad_type == "spectrum") {
-						vector<pair<float, float>> spec = parse_spectrum(grand_child.attribute("value").value());
-						if (spec.size() == 1) {
-							// For a light source, the white point is
-							// XYZ(0.9505, 1.0, 1.0888) instead
-							// or XYZ(1, 1, 1). We need to handle this special case when
-							// we don't have the full spectrum data.
-							const float3 xyz = float3(0.9505f, 1.0f, 1.0888f);
-							radiance = xyzToRgb(xyz * spec[0].second);
-						} else {
-							const float3 xyz = integrate_XYZ(spec);
-							radiance = xyzToRgb(xyz);
-						}
-					} else if (rad_type == "rgb") {
-						radiance = parse_vector3(grand_child.attribute("value").value());
-					} else if (rad_type == "srgb") {
-						const string value = grand_child.attribute("value").value();
-						const float3 srgb = parse_srgb(value);
-						radiance = srgbToRgb(srgb);
-					}
-				}
+		const std::string type = node.attribute("type").value();
+		if (type == "serialized" || type == "rectangle" || type == "cube") {
+			std::string key = type;
+			if (type == "serialized") {
+				key = filename.string() + ":" + std::to_string(shapeIndex);
+				if (!mSerializedFiles.contains(filename.string()))
+					mSerializedFiles.emplace(filename.string(), ReadSerializedTable(filename));
+			}
+			auto[it, inserted] = mPendingMeshIndices.emplace(key, mPendingMeshes.size());
+			if (inserted)
+				mPendingMeshes.emplace_back(type, filename, shapeIndex);
+			mPendingRenderers.emplace_back(dst.MakeComponent<MeshRenderer>(material, nullptr), it->second);
+		} else if (type == "obj") {
+			#ifdef ENABLE_ASSIMP
+			auto it = mObjMeshes.find(filename.string());
+			if (it == mObjMeshes.end()) {
+				std::vector<std::shared_ptr<Mesh>> meshes;
+				mScene.LoadAssimp(mCommandBuffer, filename)->ForEachDescendant<MeshRenderer>([&](SceneNode&, const std::shared_ptr<MeshRenderer> r) {
+					meshes.emplace_back(r->mMesh);
+				});
+				it = mObjMeshes.emplace(filename.string(), std::move(meshes)).first;
+			}
+			for (const std::shared_ptr<Mesh>& mesh : it->second)
+				dst.AddChild(filename.stem().string())->MakeComponent<MeshRenderer>(material, mesh);
+			#else
+			throw std::runtime_error("Cannot load " + filename.string() + ": obj shapes require ENABLE_ASSIMP");
+			#endif
+		} else if (type == "sphere") {
+			std::optional<float3> center;
+			float radius = 1;
+			for (const pugi::xml_node child : node.children()) {
+				const std::string name = child.attribute("name").value();
+				if (name == "center")
+					center = float3(
+						ParseFloatAttribute(child, "x", 0),
+						ParseFloatAttribute(child, "y", 0),
+						ParseFloatAttribute(child, "z", 0));
+				else if (name == "radius")
+					radius = std::stof(child.attribute("value").value());
 			}
-			if (material) {
-				material->mMaterialData.setEmission(radiance);
-			} else {
-				material = dst.makeComponent<Material>();
-				material->mMaterialData.setBaseColor(float3::Zero());
-				material->mMaterialData.setEmission(radiance);
+			if (center) {
+				if (const std::shared_ptr<float4x4> t = dst.GetComponent<float4x4>())
+					dst.SetTransform(*t * glm::translate(*center));
+				else
+					dst.SetTransform(glm::translate(*center));
 			}
+			dst.MakeComponent<SphereRenderer>(material, radius);
+		} else
+			throw std::runtime_error("Unsupported shape: " + type);
+	}
+
+	inline void ParseEmitter(SceneNode& root, const pugi::xml_node node) {
+		const std::string type = node.attribute("type").value();
+		std::optional<float4x4> transform;
+		std::filesystem::path filename;
+		float scale = 1;
+		float3 radiance = float3(1);
+		for (const pugi::xml_node child : node.children()) {
+			const std::string name = child.attribute("name").value();
+			if      (name == "filename") filename = ResolvePath(child.attribute("value").value());
+			else if (name == "toWorld")  transform = ParseTransform(child);
+			else if (name == "scale")    scale = std::stof(child.attribute("value").value());
+			else if (name == "radiance") radiance = ParseRadiance(child);
 		}
 
-		const string name_attrib = child.attribute("name").value();
-		if (name == "string" && name_attrib == "filename") {
-			filename = child.attribute("value").value();
-		} else if (name == "transform" && name_attrib == "toWorld") {
-			dst.makeComponent<TransformData>(parse_transform(child));
-		} if (name == "integer" && name_attrib == "shapeIndex") {
-			shape_index = stoi(child.attribute("value").value());
+		if (type == "envmap") {
+			if (filename.empty()) throw std::runtime_error("Filename unspecified for envmap.");
+			const std::shared_ptr<SceneNode> envNode = mScene.LoadEnvironmentMap(mCommandBuffer, filename);
+			envNode->GetComponent<EnvironmentMap>()->mColor *= scale;
+			if (transform)
+				envNode->MakeComponent<float4x4>(*transform);
+			root.AddChild(envNode);
+		} else if (type == "constant")
+			root.AddChild("constant")->MakeComponent<EnvironmentMap>(radiance * scale, Image::View{});
+		else
+			std::cout << "Warning: unsupported emitter type \"" << type << "\"" << std::endl;
+	}
+
+	inline void ParseScene(SceneNode& root, const pugi::xml_node node) {
+		for (const pugi::xml_node child : node.children()) {
+			const std::string name = child.name();
+			if (name == "bsdf") {
+				ParseBsdf(child);
+			} else if (name == "shape") {
+				const pugi::xml_attribute id = child.attribute("id");
+				ParseShape(*root.AddChild(id.empty() ? "shape" : id.value()), child);
+			} else if (name == "texture") {
+				const std::string id = child.attribute("id").value();
+				if (mTextures.find(id) != mTextures.end()) throw std::runtime_error("Duplicate texture ID: " + id);
+				mTextures[id] = ParseTexture(child);
+			} else if (name == "emitter") {
+				ParseEmitter(root, child);
+			}
 		}
 	}
+};
 
-	string type = node.attribute("type").value();
-	if (type == "obj") {
-		shared_ptr<Mesh> m;
-		if (auto m_it = obj_map.find(filename); m_it != obj_map.end()) {
-			m = m_it->second;
-		} else {
-			m = dst.makeComponent<Mesh>(loadObj(commandBuffer, filename));
-			obj_map.emplace(filename, m);
-		}
-		dst.makeComponent<MeshPrimitive>(material, m);
-	} else if (type == "serialized") {
-		const auto key = make_pair(filename, shape_index);
-		shared_ptr<Mesh> m;
-		if (auto m_it = serialized_map.find(key); m_it != serialized_map.end()) {
-			m = m_it->second;
-		} else {
-			m = dst.makeComponent<Mesh>(loadSerialized(commandBuffer, filename, shape_index));
-			serialized_map.emplace(key, m);
-		}
-		dst.makeComponent<MeshPrimitive>(material, m);
-	} else if (type == "sphere") {
-		optional<float3> center;
-		float radius = 1;
-		for (auto child : node.children()) {
-			const string name = child.attribute("name").value();
-			if (name == "center") {
-				center = float3{
-						stof(child.attribute("x").value()),
-						stof(child.attribute("y").value()),
-						stof(child.attribute("z").value()) };
-			} else if (name == "radius") {
-				radius = stof(child.attribute("value").value());
-			}
-		}
-		if (center) {
-			if (auto ptr = dst.getComponent<TransformData>())
-				*ptr = tmul(*ptr, TransformData(*center, quatf::identity(), float3::Ones()));
-			else
-				dst.makeComponent<TransformData>(*center, quatf::identity(), float3::Ones());
-		}
-		dst.makeComponent<SpherePrimitive>(material, radius);
-	} else if (type == "rectangle") {
-		const vector<float3> vertices = { float3(-1,-1,0), float3(-1,1,0), float3(1,-1,0), float3(1,1,0) };
-		const vector<float3> normals = { float3(0,0,1), float3(0,0,1), float3(0,0,1), float3(0,0,1) };
-		const vector<float2> uvs = { float2(0,0), float2(0,1), float2(1,0), float2(1,1) };
-		const vector<uint32_t> indices = { 0, 1, 2, 1, 3, 2 };
-		dst.makeComponent<MeshPrimitive>(material, dst.makeComponent<Mesh>(create_mesh(commandBuffer, vertices, normals, uvs, indices)));
-	}/* else if (type == "cube") {
-		vector<float3> vertices(16);
-		vector<float3> normals(16);
-		vector<float2> uvs(16);
-		vector<uint32_t> indices(36);
-		for (uint32_t face = 0; face < 6; face++) {
-			const uint32_t i = face*4;
-			const int s = face%2 == 0 ? 1 : -1;
-
-			float3 n = float3::Zero();
-			n[face/2] = s;
-
-			float3 v0 = n;
-			float3 v1 = n;
-			float3 v2 = n;
-			float3 v3 = n;
-			v0[(face/2 + 1) % 3] = -s;
-			v0[(face/2 + 2) % 3] = -s;
-			v1[(face/2 + 1) % 3] = s;
-			v1[(face/2 + 2) % 3] = -s;
-			v2[(face/2 + 1) % 3] = -s;
-			v2[(face/2 + 2) % 3] = s;
-			v3[(face/2 + 1) % 3] = s;
-			v3[(face/2 + 2) % 3] = s;
-
-			vertices[i+0] = v0;
-			vertices[i+1] = v1;
-			vertices[i+2] = v2;
-			vertices[i+3] = v3;
-			normals[i+0] = n;
-			normals[i+1] = n;
-			normals[i+2] = n;
-			normals[i+3] = n;
-			uvs[i+0] = float2(0,0);
-			uvs[i+1] = float2(1,0);
-			uvs[i+2] = float2(0,1);
-			uvs[i+3] = float2(1,1);
-
-			indices[face*6 + 0] = i + 0;
-			indices[face*6 + 1] = i + 1;
-			indices[face*6 + 2] = i + 2;
-			indices[face*6 + 3] = i + 1;
-			indices[face*6 + 4] = i + 3;
-			indices[face*6 + 5] = i + 2;
-		}
-		dst.makeComponent<MeshPrimitive>(material, dst.makeComponent<Mesh>(create_mesh(commandBuffer, vertices, normals, uvs, indices)));
-	}*/
-	else throw runtime_error("Unsupported shape: " + type);
-}
+std::shared_ptr<SceneNode> Scene::LoadMitsuba(CommandBuffer& commandBuffer, const std::filesystem::path& filename) {
+	std::cout << "Loading " << filename << std::endl;
+
+	using clock = std::chrono::high_resolution_clock;
+	const auto loadStart = clock::now();
+	auto t0 = loadStart;
+	const auto Lap = [&]() {
+		const auto t1 = clock::now();
+		const float ms = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(t1 - t0).count();
+		t0 = t1;
+		return ms;
+	};
 
-std::shared_ptr<SceneNode> parse_scene(Scene& scene, CommandBuffer& commandBuffer, pugi::xml_node node) {
-	unordered_map<string /* name id */, shared_ptr<Material>> material_map;
-	unordered_map<string /* name id */, Image::View> texture_map;
-	unordered_map<string /* filename */, shared_ptr<Mesh>> obj_map;
-	unordered_map<pair<string /* filename */, uint32_t /* shape index */>, shared_ptr<Mesh>> serialized_map;
-
-	int envmap_light_id = -1;
-
-	const shared_ptr<Node> root = Node::create(node.name());
-
-	for (auto child : node.children()) {
-		string name = child.name();
-		if (name == "bsdf") {
-			parse_bsdf(scene, *root, commandBuffer, child, material_map, texture_map);
-		} else if (name == "shape") {
-			parse_shape(scene, commandBuffer, *root->addChild("shape"), child, material_map, texture_map, obj_map, serialized_map);
-		} else if (name == "texture") {
-			string id = child.attribute("id").value();
-			if (texture_map.find(id) != texture_map.end()) throw runtime_error("Duplicate texture ID: " + id);
-			texture_map[id] = parse_texture(commandBuffer, child);
-		} else if (name == "emitter") {
-			string type = child.attribute("type").value();
-			if (type == "envmap") {
-				optional<TransformData> transform;
-				string filename;
-				float scale = 1;
-				for (auto grand_child : child.children()) {
-					string name = grand_child.attribute("name").value();
-					if (name == "filename") {
-						filename = grand_child.attribute("value").value();
-					} else if (name == "toWorld") {
-						transform = parse_transform(grand_child);
-					} else if (name == "scale") {
-						scale = stof(grand_child.attribute("value").value());
-					}
+	pugi::xml_document doc;
+	if (const pugi::xml_parse_result result = doc.load_file(filename.c_str()); !result)
+		throw std::runtime_error("Failed to parse " + filename.string() + ": " + result.description() + " at offset " + std::to_string(result.offset));
+
+	const std::shared_ptr<SceneNode> root = SceneNode::Create(filename.stem().string());
+	MitsubaParser parser(*this, commandBuffer, filename);
+	parser.ParseScene(*root, doc.child("scene"));
+	const float parseTime = Lap();
+
+	// inflate serialized shapes and build the rest on a worker pool, then pack every mesh another load has not uploaded into a single buffer
+
+	const std::vector<MitsubaParser::PendingMesh>& pending = parser.mPendingMeshes;
+	std::vector<MeshData> meshData(pending.size());
+	std::vector<vk::AabbPositionsKHR> aabbs(pending.size());
+	if (!pending.empty()) {
+		ReportLoadProgress(LoadJob::Stage::eDecode);
+		LoadJob* const loadJob = gCurrentLoadJob;
+
+		ThreadPool pool(std::min<uint32_t>(std::thread::hardware_concurrency(), (uint32_t)pending.size()));
+		std::vector<std::future<void>> jobs;
+		for (size_t k = 0; k < pending.size(); k++) {
+			jobs.emplace_back(pool.Enqueue([&, k]() {
+				if (loadJob && loadJob->mCancelRequested) return;
+				const MitsubaParser::PendingMesh& p = pending[k];
+				MeshData& mesh = meshData[k];
+				if (p.mType == "serialized")
+					mesh = LoadSerialized(p.mFilename, parser.mSerializedFiles.at(p.mFilename.string()), p.mShapeIndex);
+				else if (p.mType == "rectangle")
+					mesh = CreateRectangle();
+				else
+					mesh = CreateCube();
+
+				const float3* positions = reinterpret_cast<const float3*>(mesh.Find(Mesh::VertexAttributeType::ePosition)->mData.data());
+				float3 mn = float3( std::numeric_limits<float>::infinity());
+				float3 mx = float3(-std::numeric_limits<float>::infinity());
+				for (uint32_t v = 0; v < mesh.mVertexCount; v++) {
+					mn = min(mn, positions[v]);
+					mx = max(mx, positions[v]);
 				}
-				if (filename.size() > 0) {
-					const shared_ptr<Node> envNode = scene.load(commandBuffer, filename);
-					envNode->getComponent<EnvironmentMap>()->mValue *= scale;
-					if (transform)
-						envNode->makeComponent<TransformData>(*transform);
-					root->addChild(envNode);
-				} else {
-					throw runtime_error("Filename unspecified for envmap.");
+				aabbs[k] = vk::AabbPositionsKHR(mn.x, mn.y, mn.z, mx.x, mx.y, mx.z);
+
+				if (mOptimizeMeshes) {
+					WeldVertices(mesh);
+					OptimizeLocality(mesh);
 				}
-			} else {
-				throw runtime_error("Unsupported emitter type:" + type);
-			}
+				if (mQuantizeVertices)
+					QuantizeVertices(mesh);
+			}));
+		}
+		for (size_t j = 0; j < jobs.size(); j++) {
+			jobs[j].get();
+			ReportLoadProgress(LoadJob::Stage::eDecode, (j+1) / (float)jobs.size());
 		}
 	}
+	const float decodeTime = Lap();
+	ReportLoadProgress(LoadJob::Stage::eUpload);
+
+	std::vector<std::byte> packedMeshData;
+	std::vector<std::shared_ptr<Mesh>> meshes(pending.size());
+	size_t triangleCount = 0;
+	if (!pending.empty()) {
+		vk::BufferUsageFlags bufferUsage = vk::BufferUsageFlagBits::eVertexBuffer|vk::BufferUsageFlagBits::eIndexBuffer|vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eTransferSrc;
+		if (commandBuffer.mDevice.GetAccelerationStructureFeatures().accelerationStructure) {
+			bufferUsage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
+			bufferUsage |= vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
+		}
 
-	return root;
-}
+		HostBufferData hostBuffers;
+		std::unordered_set<const Mesh*> sharedMeshes;
+		meshes = UploadMeshes(commandBuffer, meshData, aabbs, filename.stem().string() + "/Meshes", bufferUsage, packedMeshData, hostBuffers, sharedMeshes);
+		for (const MeshData& mesh : meshData)
+			triangleCount += mesh.mIndices.size() / 3;
+		if (!sharedMeshes.empty())
+			std::cout << "Reused " << sharedMeshes.size() << "/" << meshes.size() << " meshes from other loads" << std::endl;
 
-std::shared_ptr<ScebneNode> Scene::LoadMitsuba(CommandBuffer& commandBuffer, const std::filesystem::path& filename) {
-	ProfilerScope ps("Scene::loadMitsuba", &commandBuffer);
+		for (const auto&[renderer, k] : parser.mPendingRenderers)
+			renderer->mMesh = meshes[k];
 
-	pugi::xml_document doc;
-	pugi::xml_parse_result result = doc.load_file(filename.c_str());
-	if (!result) {
-		cerr << "Error description: " << result.description() << endl;
-		cerr << "Error offset: " << result.offset << endl;
-		throw runtime_error("Parse error");
+		ReadEmissiveTriangles(*root, hostBuffers, sharedMeshes);
 	}
-	// back up the current working directory and switch to the parent folder of the file
-	filesystem::path old_path = filesystem::current_path();
-	filesystem::current_path(filename.parent_path());
+	const float uploadTime = Lap();
 
-	auto root = parse_scene(*this, commandBuffer, doc.child("scene"));
-
-	// switch back to the old current working directory
-	filesystem::current_path(old_path);
-
-	cout << "Loaded " << filename << endl;
+	const auto[meshSize, meshUnit] = FormatBytes(packedMeshData.size());
+	std::cout << "Loaded " << filename << " in " << std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(clock::now() - loadStart).count() << "ms" << std::endl;
+	std::cout << "\tParse: " << parseTime << "ms, mesh decode: " << decodeTime << "ms, mesh upload: " << uploadTime << "ms" << std::endl;
+	std::cout << "\t" << meshes.size() << " meshes, " << triangleCount << " triangles, " << meshSize << " " << meshUnit << std::endl;
 
 	return root;
 }
 
-#endif
-
-}
\ No newline at end of file
+}
@@ -17,8 +17,40 @@ private:
 	std::weak_ptr<SceneNode> mParent;
 	std::unordered_set<std::shared_ptr<SceneNode>> mChildren;
 
+	// cached node-to-world transform and its inverse, recomputed lazily by GetWorldTransform.
+	// if a node is dirty, all of its descendants are dirty too
+	mutable float4x4 mWorldTransform = glm::identity<float4x4>();
+	mutable float4x4 mWorldInverse = glm::identity<float4x4>();
+	mutable bool mWorldTransformDirty = true;
+
 	SceneNode(const std::string& name) : mName(name), mEnabled(true) {}
 
+	inline void UpdateWorldTransform() const {
+		// find the topmost dirty ancestor, then recompute downwards from its (clean) parent
+		std::vector<const SceneNode*> dirty;
+		std::shared_ptr<const SceneNode> p;
+		for (const SceneNode* n = this; n && n->mWorldTransformDirty; n = p.get()) {
+			dirty.emplace_back(n);
+			p = n->GetParent();
+		}
+		float4x4 parentTransform = p ? p->mWorldTransform : glm::identity<float4x4>();
+		float4x4 parentInverse   = p ? p->mWorldInverse   : glm::identity<float4x4>();
+		for (auto it = dirty.rbegin(); it != dirty.rend(); it++) {
+			const SceneNode& n = **it;
+			if (const auto c = n.mComponents.find(typeid(float4x4)); c != n.mComponents.end()) {
+				const float4x4& local = *static_pointer_cast<float4x4>(c->second);
+				n.mWorldTransform = parentTransform * local;
+				n.mWorldInverse = inverse(local) * parentInverse;
+			} else {
+				n.mWorldTransform = parentTransform;
+				n.mWorldInverse = parentInverse;
+			}
+			n.mWorldTransformDirty = false;
+			parentTransform = n.mWorldTransform;
+			parentInverse = n.mWorldInverse;
+		}
+	}
+
 public:
 	[[nodiscard]] inline static std::shared_ptr<SceneNode> Create(const std::string& name) {
 		return std::shared_ptr<SceneNode>(new SceneNode(name));
@@ -53,6 +85,7 @@ public:
 		c->RemoveParent();
 		c->mParent = GetPtr();
 		mChildren.emplace(c);
+		c->MarkTransformDirty();
 	}
 	inline std::shared_ptr<SceneNode> AddChild(const std::string& name) {
 		const std::shared_ptr<SceneNode> c = Create(name);
@@ -63,6 +96,7 @@ public:
 		if (auto it = mChildren.find(c); it != mChildren.end()) {
 			mChildren.erase(it);
 			c->mParent.reset();
+			c->MarkTransformDirty();
 		}
 	}
 	inline void RemoveParent() {
@@ -71,6 +105,41 @@ public:
 		}
 	}
 
+	// Transforms. The local transform is the float4x4 component (identity if there is none)
+
+	// Invalidates the cached world transforms of this node and its descendants.
+	// Must be called after modifying the float4x4 component in place
+	inline void MarkTransformDirty() {
+		if (mWorldTransformDirty) return;
+		std::stack<SceneNode*> todo;
+		todo.push(this);
+		while (!todo.empty()) {
+			SceneNode* n = todo.top();
+			todo.pop();
+			n->mWorldTransformDirty = true;
+			for (const std::shared_ptr<SceneNode>& c : n->mChildren)
+				if (!c->mWorldTransformDirty)
+					todo.push(c.get());
+		}
+	}
+
+	inline void SetTransform(const float4x4& transform) {
+		if (const std::shared_ptr<float4x4> t = GetComponent<float4x4>())
+			*t = transform;
+		else
+			AddComponent(std::make_shared<float4x4>(transform));
+		MarkTransformDirty();
+	}
+
+	inline const float4x4& GetWorldTransform() const {
+		if (mWorldTransformDirty) UpdateWorldTransform();
+		return mWorldTransform;
+	}
+	inline const float4x4& GetWorldInverse() const {
+		if (mWorldTransformDirty) UpdateWorldTransform();
+		return mWorldInverse;
+	}
+
 	// Components
 
 	inline bool HasComponent(const std::type_index type) const { return mComponents.find(type) != mComponents.end(); }
@@ -94,6 +163,7 @@ public:
 
 	inline void AddComponent(const std::type_index type, const std::shared_ptr<void>& v) {
 		mComponents.emplace(type, v);
+		if (type == typeid(float4x4)) MarkTransformDirty();
 	}
 	template<typename T>
 	inline void AddComponent(const std::shared_ptr<T>& v) {
@@ -106,10 +176,12 @@ public:
 		if (it != mComponents.end()) {
 			it->second.reset();
 			mComponents.erase(it);
+			if (typeid(T) == typeid(float4x4)) MarkTransformDirty();
 		}
 	}
 	inline void RemoveComponent(const std::type_index type) {
-		mComponents.erase(type);
+		if (mComponents.erase(type) && type == typeid(float4x4))
+			MarkTransformDirty();
 	}
 
 	template<typename T, typename...Types>
@@ -240,17 +312,6 @@ public:
 	}
 };
 
-inline float4x4 NodeToWorld(const SceneNode& node) {
-	float4x4 transform = glm::identity<float4x4>();
-	if (auto m = node.GetComponent<float4x4>())
-		transform = *m;
-	std::shared_ptr<SceneNode> p = node.GetParent();
-	while (p) {
-		if (auto m = p->GetComponent<float4x4>())
-			transform = (*m) * transform;
-		p = p->GetParent();
-	}
-	return transform;
-}
+inline const float4x4& NodeToWorld(const SceneNode& node) { return node.GetWorldTransform(); }
 
 }
\ No newline at end of file
@@ -0,0 +1,100 @@
+// Checks BuildAliasTable against a brute-force histogram of samples drawn the way SampleAliasTable (Sampling.slang) draws them
+
+#include <Scene/AliasTable.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+using namespace ptvk;
+
+static int gFailures = 0;
+
+static void Check(const bool condition, const std::string& what) {
+	if (condition) return;
+	std::cerr << "FAILED: " << what << std::endl;
+	gFailures++;
+}
+
+// CPU version of SampleAliasTable
+static uint32_t SampleAliasTable(const std::span<const AliasTableEntry> table, float rnd, float& pdf) {
+	const uint32_t n = (uint32_t)table.size();
+	const float x = rnd * n;
+	const uint32_t i = std::min((uint32_t)x, n - 1);
+	rnd = std::clamp(x - i, 0.f, 1.f);
+	const AliasTableEntry& e = table[i];
+	if (rnd < e.mThreshold) {
+		pdf = e.mPdf;
+		return i;
+	} else {
+		pdf = e.mAliasPdf;
+		return e.mAlias;
+	}
+}
+
+static void TestWeights(const std::string& name, const std::vector<float>& weights) {
+	const size_t n = weights.size();
+	std::vector<AliasTableEntry> table(n);
+	BuildAliasTable(weights, table);
+
+	double sum = 0;
+	for (const float w : weights) sum += std::max(w, 0.f);
+
+	// pdfs match the normalized weights
+	for (size_t i = 0; i < n; i++) {
+		const double expected = sum > 0 ? std::max(weights[i], 0.f) / sum : 1.0 / n;
+		Check(std::abs(table[i].mPdf - expected) < 1e-6, name + ": mPdf[" + std::to_string(i) + "] = " + std::to_string(table[i].mPdf) + ", expected " + std::to_string(expected));
+		Check(table[i].mAliasPdf == table[table[i].mAlias].mPdf, name + ": mAliasPdf[" + std::to_string(i) + "] does not match the alias' pdf");
+	}
+
+	// histogram of samples against the pdfs
+	const size_t sampleCount = 1 << 22;
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	std::vector<size_t> histogram(n, 0);
+	for (size_t s = 0; s < sampleCount; s++) {
+		float pdf;
+		const uint32_t i = SampleAliasTable(table, uniform(rng), pdf);
+		if (i >= n) {
+			Check(false, name + ": sampled bin " + std::to_string(i) + " out of range");
+			continue;
+		}
+		if (pdf != table[i].mPdf) {
+			Check(false, name + ": sampled pdf " + std::to_string(pdf) + " for bin " + std::to_string(i) + ", expected " + std::to_string(table[i].mPdf));
+			return;
+		}
+		histogram[i]++;
+	}
+	for (size_t i = 0; i < n; i++) {
+		const double p = table[i].mPdf;
+		const double frequency = histogram[i] / (double)sampleCount;
+		if (p == 0) {
+			Check(histogram[i] == 0, name + ": zero-weight bin " + std::to_string(i) + " was sampled " + std::to_string(histogram[i]) + " times");
+			continue;
+		}
+		// 5 standard deviations of the binomial frequency
+		const double tolerance = 5 * std::sqrt(p * (1 - p) / sampleCount) + 1e-6;
+		Check(std::abs(frequency - p) < tolerance, name + ": bin " + std::to_string(i) + " sampled with frequency " + std::to_string(frequency) + ", pdf " + std::to_string(p));
+	}
+}
+
+int main() {
+	TestWeights("fixed", { 1, 0, 3, 0.5f, 7, 0, 2, 0.25f, 10, 0.01f });
+	TestWeights("negative", { 2, -1, 1, 0, -5, 4 });
+	TestWeights("all zero", { 0, 0, 0, 0 });
+	TestWeights("single", { 3 });
+
+	// a skewed table, with a few large bins among many small and empty ones
+	std::vector<float> skewed(1000);
+	for (size_t i = 0; i < skewed.size(); i++)
+		skewed[i] = (i % 7 == 0) ? 0 : (i % 97 == 0) ? 1000.f : (float)(i % 13) / 13;
+	TestWeights("skewed", skewed);
+
+	if (gFailures > 0) {
+		std::cerr << gFailures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All alias table checks passed" << std::endl;
+	return 0;
+}
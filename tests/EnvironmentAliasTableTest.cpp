@@ -0,0 +1,144 @@
+// Checks BuildEnvironmentAliasTable against brute-force bin weights and a histogram of samples drawn the way SampleBackgroundUV (Scene.slang) draws them
+
+#include <Scene/AliasTable.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+using namespace ptvk;
+
+static int gFailures = 0;
+
+static void Check(const bool condition, const std::string& what) {
+	if (condition) return;
+	std::cerr << "FAILED: " << what << std::endl;
+	gFailures++;
+}
+
+// CPU version of SampleAliasTable over table[offset, offset + n)
+static uint32_t SampleAliasTable(const std::span<const AliasTableEntry> table, const uint32_t offset, const uint32_t n, float rnd, float& pdf) {
+	const float x = rnd * n;
+	const uint32_t i = std::min((uint32_t)x, n - 1);
+	rnd = std::clamp(x - i, 0.f, 1.f);
+	const AliasTableEntry& e = table[offset + i];
+	if (rnd < e.mThreshold) {
+		pdf = e.mPdf;
+		return i;
+	} else {
+		pdf = e.mAliasPdf;
+		return e.mAlias;
+	}
+}
+
+// Expected joint probability of each table texel: luminance times sin(theta) at the image texel center,
+// integrated over the uv range each table texel covers
+static std::vector<double> ExpectedPdfs(const std::vector<float>& luminance, const uint2 extent, const uint2 tableExtent) {
+	std::vector<double> expected((size_t)tableExtent.x*tableExtent.y, 0);
+	double sum = 0;
+	for (uint32_t ty = 0; ty < tableExtent.y; ty++)
+	for (uint32_t tx = 0; tx < tableExtent.x; tx++) {
+		const double u0 = tx / (double)tableExtent.x, u1 = (tx + 1) / (double)tableExtent.x;
+		const double v0 = ty / (double)tableExtent.y, v1 = (ty + 1) / (double)tableExtent.y;
+		double w = 0;
+		for (uint32_t y = 0; y < extent.y; y++)
+		for (uint32_t x = 0; x < extent.x; x++) {
+			const double ou = std::max(0.0, std::min(u1, (x + 1) / (double)extent.x) - std::max(u0, x / (double)extent.x));
+			const double ov = std::max(0.0, std::min(v1, (y + 1) / (double)extent.y) - std::max(v0, y / (double)extent.y));
+			w += std::max(luminance[(size_t)y*extent.x + x], 0.f) * std::sin(M_PI * (y + 0.5) / extent.y) * ou * ov;
+		}
+		expected[(size_t)ty*tableExtent.x + tx] = w;
+		sum += w;
+	}
+	for (double& p : expected) p /= sum;
+	return expected;
+}
+
+static void TestImage(const std::string& name, const std::vector<float>& luminance, const uint2 extent, const uint32_t maxWidth, const uint2 expectedTableExtent) {
+	uint2 tableExtent;
+	const std::vector<AliasTableEntry> table = BuildEnvironmentAliasTable(luminance, extent, tableExtent, maxWidth);
+	Check(tableExtent == expectedTableExtent, name + ": table extent " + std::to_string(tableExtent.x) + "x" + std::to_string(tableExtent.y));
+	if (table.size() != tableExtent.y + (size_t)tableExtent.x*tableExtent.y) {
+		Check(false, name + ": table has " + std::to_string(table.size()) + " entries");
+		return;
+	}
+	const std::span<const AliasTableEntry> joint = std::span(table).subspan(tableExtent.y);
+
+	// joint pdfs match the luminance and solid angle each table texel covers, and sum to the row's marginal pdf
+	const std::vector<double> expected = ExpectedPdfs(luminance, extent, tableExtent);
+	for (uint32_t y = 0; y < tableExtent.y; y++) {
+		double rowSum = 0;
+		for (uint32_t x = 0; x < tableExtent.x; x++) {
+			const size_t i = (size_t)y*tableExtent.x + x;
+			rowSum += joint[i].mPdf;
+			Check(std::abs(joint[i].mPdf - expected[i]) < 1e-5, name + ": joint pdf (" + std::to_string(x) + ", " + std::to_string(y) + ") = " + std::to_string(joint[i].mPdf) + ", expected " + std::to_string(expected[i]));
+		}
+		Check(std::abs(rowSum - table[y].mPdf) < 1e-5, name + ": row " + std::to_string(y) + " joint pdfs sum to " + std::to_string(rowSum) + ", marginal pdf " + std::to_string(table[y].mPdf));
+	}
+
+	// histogram of samples against the joint pdfs
+	const size_t sampleCount = 1 << 22;
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	std::vector<size_t> histogram(joint.size(), 0);
+	for (size_t s = 0; s < sampleCount; s++) {
+		float rowPdf, pdf;
+		const uint32_t y = SampleAliasTable(table, 0, tableExtent.y, uniform(rng), rowPdf);
+		const uint32_t x = SampleAliasTable(table, tableExtent.y + y*tableExtent.x, tableExtent.x, uniform(rng), pdf);
+		const size_t i = (size_t)y*tableExtent.x + x;
+		if (pdf != joint[i].mPdf) {
+			Check(false, name + ": sampled pdf " + std::to_string(pdf) + " for texel " + std::to_string(i) + ", expected " + std::to_string(joint[i].mPdf));
+			return;
+		}
+		histogram[i]++;
+	}
+	for (size_t i = 0; i < joint.size(); i++) {
+		const double p = joint[i].mPdf;
+		const double frequency = histogram[i] / (double)sampleCount;
+		if (p == 0) {
+			Check(histogram[i] == 0, name + ": zero-weight texel " + std::to_string(i) + " was sampled " + std::to_string(histogram[i]) + " times");
+			continue;
+		}
+		// 5 standard deviations of the binomial frequency
+		const double tolerance = 5 * std::sqrt(p * (1 - p) / sampleCount) + 1e-6;
+		Check(std::abs(frequency - p) < tolerance, name + ": texel " + std::to_string(i) + " sampled with frequency " + std::to_string(frequency) + ", pdf " + std::to_string(p));
+	}
+}
+
+int main() {
+	// constant luminance: only the solid angle weighting remains
+	TestImage("constant", std::vector<float>(16*8, 1.f), uint2(16, 8), 2048, uint2(16, 8));
+
+	std::mt19937 rng(5678);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	std::vector<float> random(10*7);
+	for (float& l : random) l = uniform(rng) < 0.2f ? 0 : std::pow(uniform(rng), 4.f) * 100;
+	TestImage("random", random, uint2(10, 7), 2048, uint2(10, 7));
+
+	// 10 texels into 4 table texels: each covers 2.5 image texels, so the image texels at 2 and 7 are split
+	TestImage("downsampled", random, uint2(10, 7), 4, uint2(4, 3));
+
+	// a single bright texel that straddles two table texels
+	std::vector<float> spot(10*7, 0.f);
+	spot[3*10 + 7] = 1000;
+	TestImage("straddling spot", spot, uint2(10, 7), 4, uint2(4, 3));
+
+	std::vector<float> nonFinite = random;
+	nonFinite[5] = NAN;
+	nonFinite[17] = INFINITY;
+	nonFinite[23] = -3;
+	std::vector<float> cleaned = nonFinite;
+	for (float& l : cleaned) if (!std::isfinite(l)) l = 0;
+	uint2 a, b;
+	const std::vector<AliasTableEntry> t0 = BuildEnvironmentAliasTable(nonFinite, uint2(10, 7), a, 4);
+	const std::vector<AliasTableEntry> t1 = BuildEnvironmentAliasTable(cleaned, uint2(10, 7), b, 4);
+	Check(a == b && std::ranges::equal(t0, t1, {}, &AliasTableEntry::mPdf, &AliasTableEntry::mPdf), "non-finite and negative luminance is ignored");
+
+	if (gFailures > 0) {
+		std::cerr << gFailures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All environment alias table checks passed" << std::endl;
+	return 0;
+}